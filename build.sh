@@ -14,5 +14,6 @@ make
 
 #Move fn5 to main level
 mv fn5 ..
+mv fn5-dump ..
 cd ..
 
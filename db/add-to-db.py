@@ -1,6 +1,7 @@
 '''Parse `comparisons.txt` and enter into db
 '''
 import argparse
+from distances import read_distances
 from model import *
 
 def add_dist_to_session(session, dist, seen):
@@ -21,18 +22,15 @@ def add_dist_to_session(session, dist, seen):
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser()
-    parser.add_argument("--comparisons", required=True, help="Path to the comparisons file")
+    parser.add_argument("--comparisons", required=True, help="Path to the comparisons file. Either text or binary format")
     options = parser.parse_args()
 
     conn, engine = get_engine()
     session = create_session(engine)
 
-    with open(options.comparisons) as f:
-        comparisons = [line.strip().split(" ") for line in f if line.strip() != ""]
     dists = []
-    for g1, g2, d in comparisons:
+    for g1, g2, d in read_distances(options.comparisons):
         #Note that a sample with `guid1 guid1 -1` is an orphan
-        d = int(d)
         if d <= 20:
             #Add all below cutoff
             dists.append(Distances(g1, g2, d))
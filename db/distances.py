@@ -0,0 +1,174 @@
+'''Read FN5 distance outputs, in either the text or binary formats
+
+Binary outputs (`--output_format binary` or `binary_delta`) are a series of blocks.
+See `src/include/output.hpp` for the full format.
+
+Can also be run directly to convert a binary output to text:
+    python distances.py <path>
+'''
+import gzip
+import struct
+import sys
+
+BLOCK_HEADER = struct.Struct("<cIQ")
+RECORD = struct.Struct("<IIH")
+
+def _open(path: str):
+    '''Open a file, transparently decompressing gzip
+
+    Args:
+        path (str): Path to the file
+
+    Returns:
+        file: Binary file object
+    '''
+    with open(path, "rb") as f:
+        magic = f.read(2)
+    if magic == b"\x1f\x8b":
+        return gzip.open(path, "rb")
+    return open(path, "rb")
+
+def is_binary(path: str) -> bool:
+    '''Check if a distance output is in the binary format
+
+    Args:
+        path (str): Path to the output
+
+    Returns:
+        bool: True if the output is binary
+    '''
+    with _open(path) as f:
+        header = f.read(BLOCK_HEADER.size + 4)
+    return len(header) == BLOCK_HEADER.size + 4 and header[0:1] == b"F" and header[BLOCK_HEADER.size:] == b"FN5D"
+
+def _read_varint(data: bytes, pos: int):
+    '''Read an unsigned LEB128 varint
+
+    Args:
+        data (bytes): Data to read from
+        pos (int): Position to start at
+
+    Returns:
+        tuple[int, int]: The value, and the position after it
+    '''
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        if byte < 0x80:
+            return value, pos
+        shift += 7
+
+def read_blocks(path: str):
+    '''Read a binary distance output block by block
+
+    Args:
+        path (str): Path to the output
+
+    Yields:
+        tuple[list[str], list[tuple[int, int, int]]]: UUIDs by ID at this point in the file, and this block's (id1, id2, dist) records
+    '''
+    names = []
+    with _open(path) as f:
+        while True:
+            header = f.read(BLOCK_HEADER.size)
+            if len(header) == 0:
+                return
+            if len(header) != BLOCK_HEADER.size:
+                raise ValueError(f"Truncated distance file: {path}")
+            block_type, count, size = BLOCK_HEADER.unpack(header)
+            payload = f.read(size)
+            if len(payload) != size:
+                raise ValueError(f"Truncated distance file: {path}")
+
+            if block_type == b"F":
+                if payload[:4] != b"FN5D":
+                    raise ValueError(f"Not an FN5 distance file: {path}")
+                #Each run has its own IDs
+                names = []
+            elif block_type == b"I":
+                (first_id,) = struct.unpack_from("<I", payload, 0)
+                pos = 4
+                if len(names) < first_id + count:
+                    names.extend([None] * (first_id + count - len(names)))
+                for i in range(count):
+                    (length,) = struct.unpack_from("<H", payload, pos)
+                    names[first_id + i] = payload[pos + 2:pos + 2 + length].decode()
+                    pos += 2 + length
+            elif block_type == b"R":
+                yield names, list(RECORD.iter_unpack(payload))
+            elif block_type == b"D":
+                records = []
+                pos = 0
+                id1 = 0
+                id2 = 0
+                for _ in range(count):
+                    id1_delta, pos = _read_varint(payload, pos)
+                    if id1_delta == 0:
+                        delta, pos = _read_varint(payload, pos)
+                        id2 += delta
+                    else:
+                        id1 += id1_delta
+                        id2, pos = _read_varint(payload, pos)
+                    dist, pos = _read_varint(payload, pos)
+                    records.append((id1, id2, dist))
+                yield names, records
+            else:
+                raise ValueError(f"Unknown block in distance file: {path}")
+
+def read_distances(path: str):
+    '''Read a distance output, in either text or binary formats
+
+    Args:
+        path (str): Path to the output
+
+    Yields:
+        tuple[str, str, int]: (guid1, guid2, dist)
+    '''
+    if is_binary(path):
+        for names, records in read_blocks(path):
+            for id1, id2, dist in records:
+                yield names[id1], names[id2], dist
+    else:
+        with _open(path) as f:
+            for line in f:
+                line = line.decode().strip()
+                if line == "":
+                    continue
+                g1, g2, d = line.split(" ")
+                yield g1, g2, int(d)
+
+def read_numpy(path: str):
+    '''Read a binary distance output into numpy arrays. Requires numpy.
+    As IDs are per run, this doesn't support outputs from several runs concatenated together
+
+    Args:
+        path (str): Path to the output
+
+    Returns:
+        tuple[list[str], np.ndarray, np.ndarray, np.ndarray]: UUIDs by ID, then id1, id2 and dist arrays
+    '''
+    import numpy as np
+    id1 = []
+    id2 = []
+    dist = []
+    names = []
+    for names, records in read_blocks(path):
+        if len(records) == 0:
+            continue
+        block = np.array(records, dtype=np.uint32)
+        id1.append(block[:, 0])
+        id2.append(block[:, 1])
+        dist.append(block[:, 2].astype(np.uint16))
+    if len(id1) == 0:
+        return names, np.zeros(0, np.uint32), np.zeros(0, np.uint32), np.zeros(0, np.uint16)
+    return names, np.concatenate(id1), np.concatenate(id2), np.concatenate(dist)
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: python distances.py <distance file>")
+        sys.exit(1)
+    for g1, g2, d in read_distances(sys.argv[1]):
+        print(g1, g2, d)
@@ -0,0 +1,159 @@
+#include "include/aggregate.hpp"
+#include "include/duplicates.hpp"
+
+/**
+* @brief Summaries of pairwise matrices, reduced per thread rather than written out
+*/
+
+using namespace std;
+
+Aggregates::Aggregates(size_t samples){
+    degree.assign(samples, 0);
+    nearest.assign(samples, max_distance);
+}
+
+void Aggregates::add(uint32_t i, uint32_t j, int dist, uint64_t weight_i, uint64_t weight_j){
+    if((size_t) dist >= histogram.size()){
+        //Grown as needed, as the cutoff may be arbitrarily high
+        histogram.resize(dist + 1, 0);
+    }
+    histogram.at(dist) += weight_i * weight_j;
+    degree.at(i) += weight_j;
+    degree.at(j) += weight_i;
+    nearest.at(i) = min(nearest.at(i), dist);
+    nearest.at(j) = min(nearest.at(j), dist);
+}
+
+void Aggregates::merge(const Aggregates &other){
+    if(other.histogram.size() > histogram.size()){
+        histogram.resize(other.histogram.size(), 0);
+    }
+    for(size_t d=0;d<other.histogram.size();d++){
+        histogram.at(d) += other.histogram.at(d);
+    }
+    for(size_t i=0;i<degree.size();i++){
+        degree.at(i) += other.degree.at(i);
+        nearest.at(i) = min(nearest.at(i), other.nearest.at(i));
+    }
+}
+
+/**
+* @brief Reduce tiles taken from a shared counter until there are none left. To be used by a thread
+*/
+void aggregate_tiles_thread(const vector<Sample*>* samples, const vector<uint64_t>* weights, const vector<Tile>* tiles, atomic<size_t>* next, int cutoff, Aggregates* counts){
+    for(size_t t=(*next)++;t<tiles->size();t=(*next)++){
+        const Tile &tile = tiles->at(t);
+        for(uint32_t i=tile.row_start;i<tile.row_end;i++){
+            Sample* s1 = samples->at(i);
+            for(uint32_t j=max(tile.col_start, i + 1);j<tile.col_end;j++){
+                Sample* s2 = samples->at(j);
+                if(s1->id == s2->id){
+                    continue;
+                }
+                int dist = s1->dist(s2, cutoff);
+                if(dist > cutoff){
+                    continue;
+                }
+                counts->add(i, j, dist, weights->at(i), weights->at(j));
+            }
+        }
+    }
+}
+
+Aggregates aggregate_loaded(int cutoff, const vector<Sample*> &samples){
+    //Exact duplicates only need comparing once, then count for every member
+    DuplicateClasses classes(samples);
+    classes.report();
+    const vector<Sample*> &representatives = classes.representatives;
+    vector<uint64_t> weights;
+    for(Sample* s: representatives){
+        auto members = classes.duplicates.find(s->id);
+        weights.push_back(members == classes.duplicates.end() ? 1 : members->second.size());
+    }
+
+    vector<Tile> tiles = make_tiles(representatives, (uint64_t) thread_count * 4);
+    if(debug){
+        uint64_t comparisons = 0;
+        for(const Tile &tile: tiles){
+            comparisons += tile.pairs();
+        }
+        cout << "Comparing " << representatives.size() << " of " << samples.size() << " for a total of " << comparisons << " comparisons" << endl;
+    }
+    //Each thread has its own counts, so nothing is shared until they're merged
+    vector<Aggregates> counts(thread_count, Aggregates(representatives.size()));
+    atomic<size_t> next = 0;
+    vector<thread> threads;
+    for(int i=1;i<thread_count;i++){
+        threads.push_back(thread(aggregate_tiles_thread, &representatives, &weights, &tiles, &next, cutoff, &counts.at(i)));
+    }
+    aggregate_tiles_thread(&representatives, &weights, &tiles, &next, cutoff, &counts.at(0));
+    for(thread &t: threads){
+        t.join();
+    }
+    for(int i=1;i<thread_count;i++){
+        counts.at(0).merge(counts.at(i));
+    }
+    Aggregates &merged = counts.at(0);
+
+    //Members of a class are at distance 0 from each other
+    unordered_map<uint32_t, uint32_t> position;
+    for(uint32_t i=0;i<representatives.size();i++){
+        position[representatives.at(i)->id] = i;
+        if(weights.at(i) > 1){
+            if(merged.histogram.size() == 0){
+                merged.histogram.resize(1, 0);
+            }
+            merged.histogram.at(0) += weights.at(i) * (weights.at(i) - 1) / 2;
+            merged.degree.at(i) += weights.at(i) - 1;
+            merged.nearest.at(i) = 0;
+            for(const uint32_t &member: classes.duplicates.at(representatives.at(i)->id)){
+                position[member] = i;
+            }
+        }
+    }
+    if(representatives.size() == samples.size()){
+        return merged;
+    }
+    //Every member has its representative's counts
+    Aggregates all(samples.size());
+    all.histogram = merged.histogram;
+    for(size_t i=0;i<samples.size();i++){
+        uint32_t representative = position.at(samples.at(i)->id);
+        all.degree.at(i) = merged.degree.at(representative);
+        all.nearest.at(i) = merged.nearest.at(representative);
+    }
+    return all;
+}
+
+void compute_aggregate(string mode, int cutoff, vector<Sample*> samples){
+    if(mode != "histogram" && mode != "degree" && mode != "nearest"){
+        throw invalid_argument("Invalid aggregate. Should be one of histogram, degree or nearest: " + mode);
+    }
+    Aggregates counts = aggregate_loaded(cutoff, samples);
+    stringstream out;
+    if(mode == "histogram"){
+        out << "distance\tpairs\n";
+        for(size_t d=0;d<counts.histogram.size();d++){
+            if(counts.histogram.at(d) > 0){
+                out << d << "\t" << counts.histogram.at(d) << "\n";
+            }
+        }
+    }
+    else{
+        out << "uuid\t" << (mode == "degree" ? "neighbours" : "nearest") << "\n";
+        for(size_t i=0;i<samples.size();i++){
+            out << samples.at(i)->uuid << "\t";
+            if(mode == "degree"){
+                out << counts.degree.at(i);
+            }
+            else if(counts.nearest.at(i) == max_distance){
+                out << "-";
+            }
+            else{
+                out << counts.nearest.at(i);
+            }
+            out << "\n";
+        }
+    }
+    cout << out.str();
+}
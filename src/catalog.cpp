@@ -0,0 +1,787 @@
+#include "include/catalog.hpp"
+#include <sstream>
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* @brief Definition of the save catalog. A manifest of every sample in a saves dir, maintained by `save`
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+const string catalog_filename = "catalog.tsv";
+
+const string versions_dirname = "versions";
+
+const string readers_dirname = "readers";
+
+const string runs_filename = "runs.tsv";
+
+/**
+* @brief First line of a catalog file, followed by a tab and the file's base generation
+*/
+const string catalog_header = "#fn5 catalog v1";
+
+/**
+* @brief Name of the lock file within a saves dir
+*/
+const string catalog_lock_filename = "catalog.lock";
+
+/**
+* @brief Holds a lock on a saves dir's catalog for its lifetime. Appends share it, and rewrites (which replace the
+            file, so would lose anything appended to the old one) hold it exclusively
+*/
+class CatalogFileLock{
+    public:
+        int fd;
+
+        CatalogFileLock(string dir, int operation){
+            string path = dir + "/" + catalog_lock_filename;
+            fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if(fd < 0 || flock(fd, operation) != 0){
+                string error = strerror(errno);
+                if(fd >= 0){
+                    close(fd);
+                }
+                throw invalid_argument("Error locking catalog: " + path + ": " + error);
+            }
+        }
+
+        ~CatalogFileLock(){
+            close(fd);
+        }
+};
+
+/**
+* @brief Catalogs which have already been read, keyed by saves dir
+*/
+map<string, Catalog> catalog_cache;
+
+/**
+* @brief Guards `catalog_cache` and appends to catalog files
+*/
+mutex catalog_lock;
+
+/**
+* @brief Strip the trailing / from a dir so it can be used as a consistent key
+*/
+string normalise_dir(string dir){
+    while(dir.size() > 1 && dir[dir.size()-1] == '/'){
+        dir.pop_back();
+    }
+    if(dir == ""){
+        dir = ".";
+    }
+    return dir;
+}
+
+/**
+* @brief Size of a file in bytes, or UINT64_MAX if it doesn't exist
+*/
+uint64_t file_size_or_missing(string path){
+    error_code err;
+    uint64_t size = fs::file_size(path, err);
+    if(err){
+        return UINT64_MAX;
+    }
+    return size;
+}
+
+/**
+* @brief Inode of a file, or 0 if it doesn't exist
+*/
+uint64_t file_inode(string path){
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0){
+        return 0;
+    }
+    return info.st_ino;
+}
+
+/**
+* @brief Format a catalog entry as a single line of the catalog file
+*
+* @param carried Whether to write the entry's generation, rather than leave it to the line's position
+*/
+string format_entry(const CatalogEntry &entry, bool carried=false){
+    string line = to_string(entry.seq) + "\t" + entry.uuid + "\t" + entry.file + "\t" + to_string(entry.offset) + "\t" + to_string(entry.size);
+    for(int i=0;i<5;i++){
+        line += '\t';
+        line += to_string(entry.counts[i]);
+    }
+    if(carried){
+        line += '\t';
+        line += to_string(entry.end);
+    }
+    return line + "\n";
+}
+
+/**
+* @brief Start of a tombstone line
+*/
+const string tombstone_prefix = "removed\t";
+
+/**
+* @brief Parse a single line of a catalog file. `entry.end` is only set if the line carries its generation, otherwise 0
+*
+* @returns true if the line was a valid entry
+*/
+bool parse_entry(const string &line, CatalogEntry &entry){
+    if(line == "" || line[0] == '#'){
+        return false;
+    }
+    vector<string> fields;
+    string acc;
+    for(const char &ch: line){
+        if(ch == '\t'){
+            fields.push_back(acc);
+            acc = "";
+        }
+        else{
+            acc += ch;
+        }
+    }
+    fields.push_back(acc);
+    if(fields.size() != 10 && fields.size() != 11){
+        return false;
+    }
+    try{
+        entry.seq = stoul(fields.at(0));
+        entry.uuid = fields.at(1);
+        entry.file = fields.at(2);
+        entry.offset = stoull(fields.at(3));
+        entry.size = stoull(fields.at(4));
+        for(int i=0;i<5;i++){
+            entry.counts[i] = stoul(fields.at(5+i));
+        }
+        entry.end = fields.size() == 11 ? stoull(fields.at(10)) : 0;
+    }
+    catch (logic_error &err){
+        //Truncated line (i.e a writer died mid-append), so ignore it
+        return false;
+    }
+    return true;
+}
+
+/**
+* @brief Read a catalog file in one go. Later lines for a UUID replace earlier ones
+*/
+Catalog read_catalog_file(string dir){
+    Catalog catalog;
+    catalog.dir = dir;
+    string path = dir + "/" + catalog_filename;
+    //Before reading, so a rebuild in between is noticed next time
+    catalog.inode = file_inode(path);
+
+    fstream in(path, fstream::in | fstream::binary);
+    if(!in.good()){
+        throw invalid_argument("Invalid catalog: " + path);
+    }
+    stringstream buffer;
+    buffer << in.rdbuf();
+    in.close();
+    string contents = buffer.str();
+    catalog.file_size = contents.size();
+
+    size_t start = 0;
+    while(start < contents.size()){
+        size_t end = contents.find('\n', start);
+        if(end == string::npos){
+            //No trailing newline, so this is a partial append. Ignore it
+            break;
+        }
+        CatalogEntry entry;
+        string line = contents.substr(start, end - start);
+        if(start == 0 && line.starts_with(catalog_header + "\t")){
+            //Catalogs from before rebuilds kept generations start at 0
+            try{
+                catalog.base = stoull(line.substr(catalog_header.size() + 1));
+            }
+            catch(logic_error &err){
+                throw invalid_argument("Invalid catalog header: " + path);
+            }
+        }
+        else if(line.starts_with(tombstone_prefix)){
+            string uuid = line.substr(tombstone_prefix.size());
+            auto previous = catalog.entries.find(uuid);
+            if(previous != catalog.entries.end()){
+                //Visible until the tombstone
+                catalog.superseded[previous->second.file] = {previous->second.end, catalog.base + end + 1};
+                catalog.removed[uuid] = previous->second.file;
+                catalog.entries.erase(previous);
+            }
+            else if(!catalog.removed.contains(uuid)){
+                catalog.removed[uuid] = "";
+            }
+        }
+        else if(parse_entry(line, entry)){
+            if(entry.end == 0){
+                entry.end = catalog.base + end + 1;
+            }
+            auto previous = catalog.entries.find(entry.uuid);
+            if(previous != catalog.entries.end() && previous->second.file != entry.file){
+                catalog.superseded[previous->second.file] = {previous->second.end, entry.end};
+            }
+            catalog.entries[entry.uuid] = entry;
+            catalog.removed.erase(entry.uuid);
+            catalog.next_seq = max(catalog.next_seq, entry.seq + 1);
+        }
+        start = end + 1;
+    }
+    return catalog;
+}
+
+/**
+* @brief Get the counts of each nucleotide from a save file without reading the positions
+*/
+void read_save_counts(string path, uint32_t counts[5]){
+    fstream in(path, fstream::binary | fstream::in);
+    if(!in.good()){
+        throw invalid_argument("Invalid save path: " + path);
+    }
+    for(int i=0;i<5;i++){
+        int nc_size = 0;
+        in.read((char *) &nc_size, 4);
+        if(!in.good() || nc_size < 0){
+            throw invalid_argument("Malformed save file: " + path);
+        }
+        counts[i] = nc_size;
+        in.seekg((streamoff) nc_size * 4, fstream::cur);
+    }
+    in.close();
+}
+
+/**
+* @brief Version number of a save file. 0 for a first save, or `<v>` for `versions/<v>/<uuid>.fn5`
+*/
+uint64_t version_of(const string &file){
+    if(!file.starts_with(versions_dirname + "/")){
+        return 0;
+    }
+    size_t start = versions_dirname.size() + 1;
+    try{
+        return stoull(file.substr(start, file.find('/', start) - start));
+    }
+    catch(logic_error &err){
+        return 0;
+    }
+}
+
+/**
+* @brief Largest generation covered by a run recorded in a saves dir, or 0 if there are none
+*/
+uint64_t latest_run(string dir){
+    fstream in(dir + "/" + runs_filename, fstream::in);
+    string line;
+    uint64_t latest = 0;
+    while(getline(in, line)){
+        stringstream fields(line);
+        uint64_t marker;
+        if(fields >> marker){
+            latest = max(latest, marker);
+        }
+    }
+    return latest;
+}
+
+/**
+* @brief Write a catalog file's contents to a temp file and move it into place, so readers never see a partial catalog
+*/
+void replace_catalog_file(string dir, const string &contents){
+    string tmp = dir + "/" + catalog_filename + ".tmp";
+    fstream out(tmp, fstream::out | fstream::binary | fstream::trunc);
+    if(!out.good()){
+        throw invalid_argument("Error writing catalog: " + tmp);
+    }
+    out << contents;
+    out.close();
+    if(!out.good()){
+        throw invalid_argument("Error writing catalog: " + tmp);
+    }
+    fs::rename(tmp, dir + "/" + catalog_filename);
+}
+
+/**
+* @brief Rebuild a catalog from a directory scan. `catalog_lock` must be held
+*/
+Catalog& rebuild_catalog_locked(string dir){
+    if(!fs::is_directory(dir)){
+        throw invalid_argument("Invalid saves dir: " + dir);
+    }
+    //Keep any sequence numbers and generations we already know about
+    Catalog previous;
+    if(file_size_or_missing(dir + "/" + catalog_filename) != UINT64_MAX){
+        previous = read_catalog_file(dir);
+    }
+
+    //Sort the directory listing so new sequence numbers are deterministic
+    vector<string> filenames;
+    for(const auto &item: fs::directory_iterator(dir)){
+        filenames.push_back(item.path().filename());
+    }
+    sort(filenames.begin(), filenames.end());
+    //Then any re-saved versions, which replace the first save
+    vector<string> versions;
+    if(fs::is_directory(dir + "/" + versions_dirname)){
+        for(const auto &version: fs::directory_iterator(dir + "/" + versions_dirname)){
+            if(!version.is_directory()){
+                continue;
+            }
+            for(const auto &item: fs::directory_iterator(version.path())){
+                versions.push_back(versions_dirname + "/" + version.path().filename().string() + "/" + item.path().filename().string());
+            }
+        }
+    }
+    sort(versions.begin(), versions.end());
+    filenames.insert(filenames.end(), versions.begin(), versions.end());
+
+    const vector<char> types = {'A', 'C', 'G', 'T', 'N'};
+    vector<CatalogEntry> found;
+    for(const string &filename: filenames){
+        CatalogEntry entry;
+        entry.offset = 0;
+        size_t dot = filename.find_last_of(".");
+        if(dot == string::npos || dot == 0){
+            continue;
+        }
+        string ext = filename.substr(dot+1);
+        entry.uuid = filename.substr(0, dot);
+        size_t slash = entry.uuid.find_last_of("/");
+        if(slash != string::npos){
+            //Re-saved version. Only `.fn5` saves are versioned
+            entry.uuid = entry.uuid.substr(slash+1);
+            if(ext != "fn5" && ext != "FN5"){
+                continue;
+            }
+        }
+        if(ext == "fn5" || ext == "FN5"){
+            entry.file = filename;
+            entry.size = fs::file_size(dir + "/" + filename);
+            read_save_counts(dir + "/" + filename, entry.counts);
+        }
+        else if(ext == "A"){
+            //Old style saves. These are converted to `.fn5` when first loaded
+            entry.file = entry.uuid;
+            entry.size = 0;
+            for(int i=0;i<5;i++){
+                uint64_t size = file_size_or_missing(dir + "/" + entry.uuid + "." + types.at(i));
+                if(size == UINT64_MAX){
+                    throw invalid_argument("Incomplete old style save: " + dir + "/" + entry.uuid);
+                }
+                entry.counts[i] = size / 4;
+                entry.size += size;
+            }
+        }
+        else{
+            continue;
+        }
+        found.push_back(entry);
+    }
+
+    Catalog catalog;
+    catalog.dir = dir;
+    catalog.next_seq = previous.next_seq;
+    //Past every generation of the old file, so anything not carried over is newer than any run or pin.
+    //Runs are checked too, in case the old file is gone
+    catalog.base = max(previous.generation(), latest_run(dir));
+    for(CatalogEntry &entry: found){
+        if(catalog.entries.contains(entry.uuid)){
+            //Both a legacy and `.fn5` save exist. Prefer the `.fn5`, and the latest version of that
+            const CatalogEntry &existing = catalog.entries.at(entry.uuid);
+            if(entry.file == entry.uuid || (existing.file != existing.uuid && version_of(existing.file) > version_of(entry.file))){
+                continue;
+            }
+            entry.seq = existing.seq;
+        }
+        else if(previous.removed.contains(entry.uuid)){
+            //Removed, but not collected yet
+            continue;
+        }
+        else if(previous.contains(entry.uuid)){
+            entry.seq = previous.entries.at(entry.uuid).seq;
+        }
+        else{
+            entry.seq = catalog.next_seq++;
+        }
+        catalog.entries[entry.uuid] = entry;
+    }
+
+    string contents = catalog_header + "\t" + to_string(catalog.base) + "\n";
+    for(const CatalogEntry &entry: catalog.ordered()){
+        auto known = previous.entries.find(entry.uuid);
+        if(known != previous.entries.end() && known->second.file == entry.file){
+            //Unchanged, so runs which covered it still do
+            CatalogEntry carried = entry;
+            carried.end = known->second.end;
+            contents += format_entry(carried, true);
+            catalog.entries.at(entry.uuid).end = carried.end;
+        }
+        else{
+            contents += format_entry(entry);
+            catalog.entries.at(entry.uuid).end = catalog.base + contents.size();
+        }
+    }
+    for(const auto &[uuid, file]: previous.removed){
+        //Kept, so the saves left behind aren't picked up again by a later rebuild
+        contents += tombstone_prefix + uuid + "\n";
+        catalog.removed[uuid] = "";
+    }
+    replace_catalog_file(dir, contents);
+    catalog.file_size = contents.size();
+    catalog.inode = file_inode(dir + "/" + catalog_filename);
+
+    catalog_cache[dir] = catalog;
+    return catalog_cache.at(dir);
+}
+
+/**
+* @brief Get the up to date catalog for a dir, reading or rebuilding as required. `catalog_lock` must be held
+*/
+Catalog& cached_catalog(string dir){
+    uint64_t size = file_size_or_missing(dir + "/" + catalog_filename);
+    if(size == UINT64_MAX){
+        //No catalog, so build from the directory contents
+        return rebuild_catalog_locked(dir);
+    }
+    auto cached = catalog_cache.find(dir);
+    if(cached != catalog_cache.end() && cached->second.file_size == size && cached->second.inode == file_inode(dir + "/" + catalog_filename)){
+        //Nothing has changed since we last read it. A rebuild replaces the file, so could leave it the same size
+        return cached->second;
+    }
+    catalog_cache[dir] = read_catalog_file(dir);
+    return catalog_cache.at(dir);
+}
+
+uint64_t Catalog::generation() const{
+    return base + file_size;
+}
+
+bool Catalog::contains(const string &uuid) const{
+    return entries.contains(uuid);
+}
+
+vector<CatalogEntry> Catalog::ordered() const{
+    vector<CatalogEntry> ordered;
+    ordered.reserve(entries.size());
+    for(const auto &[uuid, entry]: entries){
+        ordered.push_back(entry);
+    }
+    sort(ordered.begin(), ordered.end(), [](const CatalogEntry &a, const CatalogEntry &b){
+        return a.seq < b.seq;
+    });
+    return ordered;
+}
+
+vector<string> Catalog::paths() const{
+    vector<string> paths;
+    for(const CatalogEntry &entry: ordered()){
+        paths.push_back(dir + "/" + entry.file);
+    }
+    return paths;
+}
+
+Catalog load_catalog(string dir){
+    dir = normalise_dir(dir);
+    lock_guard<mutex> guard(catalog_lock);
+    return cached_catalog(dir);
+}
+
+void catalog_add(string dir, Sample* sample, string file, uint64_t offset, uint64_t size){
+    dir = normalise_dir(dir);
+    lock_guard<mutex> guard(catalog_lock);
+    CatalogFileLock appending(dir, LOCK_SH);
+    Catalog &catalog = cached_catalog(dir);
+
+    CatalogEntry entry;
+    if(catalog.contains(sample->uuid)){
+        //Re-saving an existing sample keeps its place in the load order
+        entry.seq = catalog.entries.at(sample->uuid).seq;
+    }
+    else{
+        entry.seq = catalog.next_seq++;
+    }
+    entry.uuid = sample->uuid;
+    entry.file = file;
+    entry.offset = offset;
+    entry.size = size;
+    entry.counts[0] = sample->A.size();
+    entry.counts[1] = sample->C.size();
+    entry.counts[2] = sample->G.size();
+    entry.counts[3] = sample->T.size();
+    entry.counts[4] = sample->N.size();
+
+    //Single write of a whole line, so concurrent appenders don't interleave. This is what publishes the save
+    string line = format_entry(entry);
+    fstream out(dir + "/" + catalog_filename, fstream::out | fstream::app | fstream::binary);
+    if(!out.good()){
+        throw invalid_argument("Error writing catalog: " + dir + "/" + catalog_filename);
+    }
+    out.write(line.c_str(), line.size());
+    out.close();
+
+    catalog.file_size += line.size();
+    entry.end = catalog.generation();
+    auto previous = catalog.entries.find(entry.uuid);
+    if(previous != catalog.entries.end() && previous->second.file != entry.file){
+        catalog.superseded[previous->second.file] = {previous->second.end, entry.end};
+    }
+    catalog.entries[entry.uuid] = entry;
+    catalog.removed.erase(entry.uuid);
+}
+
+bool catalog_remove(string dir, string uuid){
+    dir = normalise_dir(dir);
+    lock_guard<mutex> guard(catalog_lock);
+    CatalogFileLock appending(dir, LOCK_SH);
+    Catalog &catalog = cached_catalog(dir);
+    auto existing = catalog.entries.find(uuid);
+    if(existing == catalog.entries.end()){
+        return false;
+    }
+    //Single write of a whole line, like an add. This is what hides the sample
+    string line = tombstone_prefix + uuid + "\n";
+    fstream out(dir + "/" + catalog_filename, fstream::out | fstream::app | fstream::binary);
+    if(!out.good()){
+        throw invalid_argument("Error writing catalog: " + dir + "/" + catalog_filename);
+    }
+    out.write(line.c_str(), line.size());
+    out.close();
+
+    catalog.file_size += line.size();
+    catalog.superseded[existing->second.file] = {existing->second.end, catalog.generation()};
+    catalog.removed[uuid] = existing->second.file;
+    catalog.entries.erase(existing);
+    return true;
+}
+
+string catalog_save_path(string dir, string uuid){
+    Catalog catalog = load_catalog(dir);
+    auto removed = catalog.removed.find(uuid);
+    if(removed != catalog.removed.end() && removed->second != "" && removed->second != uuid){
+        //Saved again after being removed, so its old save may still be being read
+        return versions_dirname + "/" + to_string(version_of(removed->second) + 1) + "/" + uuid + ".fn5";
+    }
+    auto existing = catalog.entries.find(uuid);
+    if(existing == catalog.entries.end() || existing->second.file == uuid){
+        //First save (or converting a legacy save), so nothing can be reading it yet
+        return uuid + ".fn5";
+    }
+    //Never overwrite a save a reader may be using
+    return versions_dirname + "/" + to_string(version_of(existing->second.file) + 1) + "/" + uuid + ".fn5";
+}
+
+/**
+* @brief Used to give each pin in this process a unique name
+*/
+atomic<uint64_t> pin_count = 0;
+
+/**
+* @brief Write a pin's generation. Fixed width so a reader never sees a partial number
+*/
+void write_pin(int fd, uint64_t generation){
+    char text[21];
+    snprintf(text, sizeof(text), "%020lu", (unsigned long) generation);
+    if(pwrite(fd, text, 20, 0) != 20){
+        throw invalid_argument(string("Error writing snapshot pin: ") + strerror(errno));
+    }
+}
+
+Snapshot::Snapshot(string dir){
+    dir = normalise_dir(dir);
+    string readers = dir + "/" + readers_dirname;
+    string name = to_string(getpid()) + "." + to_string(pin_count++);
+    //Locked before it's visible, so it's never mistaken for a dead reader's pin.
+    //Pinned at generation 0 until the catalog is read, so nothing is collected in between
+    string tmp_path = readers + "/" + name + ".tmp";
+    error_code err;
+    fs::create_directories(readers, err);
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd >= 0){
+        if(flock(fd, LOCK_EX) == 0 && pwrite(fd, "00000000000000000000", 20, 0) == 20){
+            pin_path = readers + "/" + name + ".pin";
+            if(rename(tmp_path.c_str(), pin_path.c_str()) == 0){
+                pin_fd = fd;
+            }
+        }
+        if(pin_fd < 0){
+            unlink(tmp_path.c_str());
+            close(fd);
+        }
+    }
+    catalog = load_catalog(dir);
+    if(pin_fd >= 0){
+        write_pin(pin_fd, catalog.generation());
+    }
+}
+
+Snapshot::~Snapshot(){
+    if(pin_fd >= 0){
+        unlink(pin_path.c_str());
+        close(pin_fd);
+    }
+}
+
+/**
+* @brief Whether a replaced save is never collected: the first save of a sample which is still saved (so `<uuid>.fn5`
+            is always there), or an old style save
+*/
+bool always_kept(const Catalog &catalog, const string &file){
+    string uuid = fs::path(file).stem().string();
+    bool first_save = !file.starts_with(versions_dirname + "/");
+    return first_save && (catalog.entries.contains(uuid) || !file.ends_with(".fn5"));
+}
+
+uint64_t collect_garbage(string dir){
+    dir = normalise_dir(dir);
+    if(file_size_or_missing(dir + "/" + catalog_filename) == UINT64_MAX){
+        return 0;
+    }
+    //Read the catalog before the pins. Any reader pinned after this sees every replacement in it
+    Catalog catalog;
+    {
+        lock_guard<mutex> guard(catalog_lock);
+        catalog = read_catalog_file(dir);
+    }
+    vector<uint64_t> pinned;
+    string readers = dir + "/" + readers_dirname;
+    if(fs::is_directory(readers)){
+        for(const auto &item: fs::directory_iterator(readers)){
+            string path = item.path().string();
+            if(item.path().extension() != ".pin"){
+                continue;
+            }
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if(fd < 0){
+                continue;
+            }
+            if(flock(fd, LOCK_SH | LOCK_NB) == 0){
+                //Nothing holds it, so the reader has died
+                unlink(path.c_str());
+                close(fd);
+                continue;
+            }
+            char text[21] = {0};
+            //A pin which can't be read could be at any generation, so keeps everything
+            pinned.push_back(pread(fd, text, 20, 0) == 20 ? strtoull(text, nullptr, 10) : 0);
+            close(fd);
+        }
+    }
+
+    //Anything still current is kept regardless
+    unordered_set<string> current;
+    for(const auto &[uuid, entry]: catalog.entries){
+        current.insert(entry.file);
+    }
+    uint64_t removed = 0;
+    for(const auto &[file, visible]: catalog.superseded){
+        if(current.contains(file) || always_kept(catalog, file)){
+            continue;
+        }
+        bool seen = false;
+        for(uint64_t generation: pinned){
+            //Pins at 0 are still reading the catalog
+            if(generation == 0 || (generation >= visible.first && generation < visible.second)){
+                seen = true;
+                break;
+            }
+        }
+        if(seen){
+            continue;
+        }
+        error_code err;
+        if(fs::remove(dir + "/" + file, err)){
+            removed++;
+        }
+    }
+    return removed;
+}
+
+Catalog rebuild_catalog(string dir){
+    dir = normalise_dir(dir);
+    if(!fs::is_directory(dir)){
+        throw invalid_argument("Invalid saves dir: " + dir);
+    }
+    lock_guard<mutex> guard(catalog_lock);
+    CatalogFileLock rewriting(dir, LOCK_EX);
+    return rebuild_catalog_locked(dir);
+}
+
+uint64_t compact_catalog(string dir){
+    dir = normalise_dir(dir);
+    if(file_size_or_missing(dir + "/" + catalog_filename) == UINT64_MAX){
+        return 0;
+    }
+    lock_guard<mutex> guard(catalog_lock);
+    CatalogFileLock rewriting(dir, LOCK_EX);
+    Catalog catalog = read_catalog_file(dir);
+    fstream in(dir + "/" + catalog_filename, fstream::in | fstream::binary);
+    stringstream buffer;
+    buffer << in.rdbuf();
+    in.close();
+    string old_contents = buffer.str();
+
+    //The last line of each file and tombstone of each UUID, so old versions keep the generations they were replaced in.
+    //Tombstones are keyed by `removed\t<uuid>`, which can't be a file
+    vector<pair<bool, CatalogEntry>> lines;
+    unordered_map<string, size_t> last_line;
+    size_t start = 0;
+    while(start < old_contents.size()){
+        size_t end = old_contents.find('\n', start);
+        if(end == string::npos){
+            break;
+        }
+        string line = old_contents.substr(start, end - start);
+        CatalogEntry entry;
+        if(line.starts_with(tombstone_prefix)){
+            entry.uuid = line.substr(tombstone_prefix.size());
+            last_line[tombstone_prefix + entry.uuid] = lines.size();
+            lines.push_back({true, entry});
+        }
+        else if(parse_entry(line, entry)){
+            if(entry.end == 0){
+                entry.end = catalog.base + end + 1;
+            }
+            last_line[entry.file] = lines.size();
+            lines.push_back({false, entry});
+        }
+        start = end + 1;
+    }
+
+    //Past every generation of the old file, like a rebuild
+    string contents = catalog_header + "\t" + to_string(catalog.generation()) + "\n";
+    uint64_t dropped = 0;
+    for(size_t i=0;i<lines.size();i++){
+        const auto &[tombstone, entry] = lines.at(i);
+        bool keep;
+        if(tombstone){
+            //Only while something is left to keep out of a rebuild
+            auto removed = catalog.removed.find(entry.uuid);
+            keep = last_line.at(tombstone_prefix + entry.uuid) == i && removed != catalog.removed.end()
+                   && ((removed->second != "" && fs::exists(dir + "/" + removed->second)) || fs::exists(dir + "/" + entry.uuid + ".fn5"));
+            if(keep){
+                contents += tombstone_prefix + entry.uuid + "\n";
+            }
+        }
+        else{
+            //Current, or replaced but not collected yet, so a pinned reader may still use it
+            auto current = catalog.entries.find(entry.uuid);
+            bool collectable = catalog.superseded.contains(entry.file) && !always_kept(catalog, entry.file) && fs::exists(dir + "/" + entry.file);
+            keep = last_line.at(entry.file) == i && ((current != catalog.entries.end() && current->second.file == entry.file) || collectable);
+            if(keep){
+                contents += format_entry(entry, true);
+            }
+        }
+        if(!keep){
+            dropped++;
+        }
+    }
+    replace_catalog_file(dir, contents);
+    catalog_cache.erase(dir);
+    return dropped;
+}
@@ -0,0 +1,158 @@
+#include "include/checkpoint.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+* @brief Checkpoint journals, so tiled runs can be resumed
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+string resume_journal = "";
+
+int checkpoint_interval = 30;
+
+/**
+* @brief Append to a file and sync it
+*/
+void append_synced(string path, string text){
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0){
+        throw invalid_argument("Error opening journal: " + path + ": " + strerror(errno));
+    }
+    bool ok = write(fd, text.c_str(), text.size()) == (ssize_t) text.size() && fsync(fd) == 0;
+    close(fd);
+    if(!ok){
+        throw invalid_argument("Error writing journal: " + path + ": " + strerror(errno));
+    }
+}
+
+Journal::Journal(string path_, string job_){
+    path = path_;
+    job = job_;
+    if(!fs::exists(path)){
+        append_synced(path, "#fn5 checkpoint journal\njob\t" + job + "\n");
+        return;
+    }
+
+    fstream in(path, fstream::in);
+    stringstream contents;
+    contents << in.rdbuf();
+    string text = contents.str();
+    //Anything after the last newline was torn by a crash
+    text = text.substr(0, text.rfind('\n') == string::npos ? 0 : text.rfind('\n') + 1);
+    bool found_job = false;
+    stringstream lines(text);
+    string line;
+    while(getline(lines, line)){
+        if(line == "" || line[0] == '#'){
+            continue;
+        }
+        vector<string> parts;
+        stringstream fields(line);
+        string part;
+        while(getline(fields, part, '\t')){
+            parts.push_back(part);
+        }
+        if(parts.at(0) == "job" && parts.size() == 2 && !found_job){
+            if(parts.at(1) != job){
+                throw invalid_argument("Journal is for a different job: " + path + "\nJournal: " + parts.at(1) + "\nThis job: " + job);
+            }
+            found_job = true;
+        }
+        else if(parts.at(0) == "checkpoint" && (parts.size() == 2 || parts.size() == 3) && found_job){
+            try{
+                offset = stoull(parts.at(1));
+                if(parts.size() == 3){
+                    stringstream tiles(parts.at(2));
+                    while(getline(tiles, part, ',')){
+                        done.insert(stoull(part));
+                    }
+                }
+            }
+            catch(logic_error &err){
+                throw invalid_argument("Malformed journal: " + path);
+            }
+        }
+        else{
+            throw invalid_argument("Malformed journal: " + path);
+        }
+    }
+    if(!found_job){
+        throw invalid_argument("Malformed journal, no job: " + path);
+    }
+}
+
+vector<Tile> Journal::remaining(const vector<Tile> &tiles) const{
+    vector<Tile> left;
+    for(const Tile &tile: tiles){
+        if(!done.contains(tile.index)){
+            left.push_back(tile);
+        }
+    }
+    return left;
+}
+
+void Journal::resume(string output) const{
+    error_code err;
+    uint64_t size = fs::file_size(output, err);
+    if(err){
+        size = 0;
+        if(offset > 0){
+            throw invalid_argument("Output to resume is missing: " + output);
+        }
+    }
+    if(size < offset){
+        throw invalid_argument("Output to resume is shorter than its last checkpoint: " + output);
+    }
+    //Anything after the last checkpoint is from tiles which will be compared again
+    fstream(output, fstream::out | fstream::app).close();
+    fs::resize_file(output, offset);
+}
+
+void Journal::record(const vector<uint64_t> &tiles, uint64_t size){
+    string line = "checkpoint\t" + to_string(size) + "\t";
+    for(size_t i=0;i<tiles.size();i++){
+        if(i > 0){
+            line += ",";
+        }
+        line += to_string(tiles.at(i));
+    }
+    append_synced(path, line + "\n");
+    done.insert(tiles.begin(), tiles.end());
+    offset = size;
+}
+
+unique_ptr<ResultWriter> open_tiled_writer(string job, vector<Tile> &tiles, bool append){
+    if(output_cutoffs.size() > 0){
+        if(resume_journal != ""){
+            throw invalid_argument("--cutoffs can't be used with --resume");
+        }
+        return open_tiered_writer(append);
+    }
+    if(resume_journal == ""){
+        return open_writer("-");
+    }
+    bool started = fs::exists(resume_journal);
+    shared_ptr<Journal> journal = make_shared<Journal>(resume_journal, job + " output=" + output_file);
+    if(append && !started){
+        //Whatever is already in the output is kept, so is where the job starts from
+        error_code err;
+        uint64_t size = fs::file_size(output_file, err);
+        journal->record({}, err ? 0 : size);
+    }
+    tiles = journal->remaining(tiles);
+    if(debug){
+        cout << "Resuming from " << journal->done.size() << " tiles done, " << tiles.size() << " left" << endl;
+    }
+    journal->resume(output_file);
+    unique_ptr<ResultWriter> writer = open_writer(output_file);
+    //The writer holds a reference, so the journal outlives it
+    writer->checkpoint_every(checkpoint_interval * 1000, [journal](const vector<uint64_t> &done, uint64_t size){
+        journal->record(done, size);
+    });
+    return writer;
+}
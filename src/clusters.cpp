@@ -0,0 +1,344 @@
+#include "include/clusters.hpp"
+#include "include/comparisons.hpp"
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+/**
+* @brief Single linkage clusters, maintained as a log of the merges
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+const string clusters_filename = "clusters.log";
+
+int cluster_cutoff = 12;
+
+string cluster_merges_file = "";
+
+void UnionFind::grow(uint32_t id){
+    while(parent.size() <= id){
+        parent.push_back(parent.size());
+        size.push_back(1);
+    }
+}
+
+uint32_t UnionFind::find(uint32_t id){
+    grow(id);
+    while(parent[id] != id){
+        //Path halving
+        parent[id] = parent[parent[id]];
+        id = parent[id];
+    }
+    return id;
+}
+
+bool UnionFind::join(uint32_t id1, uint32_t id2){
+    uint32_t root1 = find(id1);
+    uint32_t root2 = find(id2);
+    if(root1 == root2){
+        return false;
+    }
+    //Smaller under larger, so paths stay short
+    if(size[root1] < size[root2]){
+        swap(root1, root2);
+    }
+    parent[root2] = root1;
+    size[root1] += size[root2];
+    return true;
+}
+
+/**
+* @brief Holds an exclusive lock on a clusters log for its lifetime
+*/
+class ClustersLockGuard{
+    public:
+        int fd;
+
+        ClustersLockGuard(int fd_){
+            fd = fd_;
+            if(flock(fd, LOCK_EX) != 0){
+                throw invalid_argument("Error locking clusters log");
+            }
+        }
+
+        ~ClustersLockGuard(){
+            flock(fd, LOCK_UN);
+        }
+};
+
+/**
+* @brief Replay complete lines of a clusters log from an offset
+*
+* @param path Path to the log
+* @param offset Byte offset to start at
+* @param forest Union-find to replay merges into
+* @param cutoff Set to the log's cutoff if its header is read
+* @param merges If given, the fields of each `merge` and `dirty` line are appended to it
+* @returns The offset after the last complete line
+*/
+uint64_t replay_clusters(string path, uint64_t offset, UnionFind &forest, int &cutoff, vector<vector<string>>* merges=nullptr){
+    error_code err;
+    uint64_t size = fs::file_size(path, err);
+    if(err || size <= offset){
+        return offset;
+    }
+    string data(size - offset, '\0');
+    fstream in(path, fstream::in | fstream::binary);
+    in.seekg(offset);
+    in.read(data.data(), data.size());
+    data.resize(in.gcount());
+    in.close();
+
+    size_t start = 0;
+    size_t end;
+    while((end = data.find('\n', start)) != string::npos){
+        stringstream line(data.substr(start, end - start));
+        start = end + 1;
+        vector<string> fields;
+        string field;
+        while(getline(line, field, '\t')){
+            fields.push_back(field);
+        }
+        if(fields.size() == 2 && fields.at(0) == "cutoff"){
+            cutoff = stoi(fields.at(1));
+        }
+        else if(fields.size() == 2 && fields.at(0) == "dirty"){
+            //Only changes how the clusters are read
+            if(merges != nullptr){
+                merges->push_back(fields);
+            }
+        }
+        else if(fields.size() == 4 && fields.at(0) == "merge"){
+            forest.join(intern_uuid(fields.at(1)), intern_uuid(fields.at(2)));
+            if(merges != nullptr){
+                merges->push_back(fields);
+            }
+        }
+        else{
+            throw invalid_argument("Malformed clusters log: " + path);
+        }
+    }
+    return offset + start;
+}
+
+Clusters::Clusters(string dir, int cutoff_){
+    path = dir + "/" + clusters_filename;
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if(fd < 0){
+        throw invalid_argument("Error opening clusters log: " + path);
+    }
+    ClustersLockGuard guard(fd);
+    error_code err;
+    if(fs::file_size(path, err) == 0){
+        if(cutoff_ < 0 || cutoff_ > max_distance){
+            throw invalid_argument("Invalid cluster cutoff: " + to_string(cutoff_));
+        }
+        string header = "cutoff\t" + to_string(cutoff_) + "\n";
+        if(write(fd, header.c_str(), header.size()) != (ssize_t) header.size()){
+            throw invalid_argument("Error writing clusters log: " + path);
+        }
+    }
+    cutoff = -1;
+    refresh();
+    if(cutoff < 0){
+        throw invalid_argument("Malformed clusters log: " + path);
+    }
+}
+
+Clusters::~Clusters(){
+    try{
+        close();
+    }
+    catch(const exception &e){
+        cerr << e.what() << endl;
+    }
+}
+
+void Clusters::refresh(){
+    error_code err;
+    if(fs::file_size(path, err) < replayed && !err){
+        //Rewritten by `compact_clusters`, so start again
+        forest = UnionFind();
+        replayed = 0;
+    }
+    replayed = replay_clusters(path, replayed, forest, cutoff);
+    uint64_t size = fs::file_size(path, err);
+    if(!err && size > replayed){
+        //Appends are whole lines under the lock, so anything after the last line was torn by a crash
+        if(ftruncate(fd, replayed) != 0){
+            throw invalid_argument("Error truncating clusters log: " + path);
+        }
+    }
+}
+
+void Clusters::append(const vector<Distance> &distances){
+    if(fd < 0){
+        throw invalid_argument("Clusters log is closed");
+    }
+    ClustersLockGuard guard(fd);
+    //Other processes may have merged clusters since
+    refresh();
+    string lines;
+    for(const Distance &elem: distances){
+        if(elem.dist > cutoff || !forest.join(elem.id1, elem.id2)){
+            continue;
+        }
+        string line = "merge\t" + uuid_of(elem.id1) + "\t" + uuid_of(elem.id2) + "\t" + to_string(elem.dist);
+        lines += line + "\n";
+        merges.push_back(line);
+    }
+    if(lines.size() == 0){
+        return;
+    }
+    //A single write, so other processes never see part of it
+    if(write(fd, lines.c_str(), lines.size()) != (ssize_t) lines.size()){
+        throw invalid_argument("Error writing clusters log: " + path);
+    }
+    replayed += lines.size();
+}
+
+void Clusters::dirty(const vector<uint32_t> &ids){
+    if(fd < 0){
+        throw invalid_argument("Clusters log is closed");
+    }
+    if(ids.size() == 0){
+        return;
+    }
+    ClustersLockGuard guard(fd);
+    refresh();
+    string lines;
+    for(const uint32_t &id: ids){
+        lines += "dirty\t" + uuid_of(id) + "\n";
+    }
+    if(write(fd, lines.c_str(), lines.size()) != (ssize_t) lines.size()){
+        throw invalid_argument("Error writing clusters log: " + path);
+    }
+    replayed += lines.size();
+}
+
+void Clusters::close(){
+    if(fd < 0){
+        return;
+    }
+    ::close(fd);
+    fd = -1;
+    if(debug){
+        cout << "Merged " << merges.size() << " clusters" << endl;
+    }
+    if(cluster_merges_file == ""){
+        return;
+    }
+    fstream out(cluster_merges_file, fstream::out | fstream::trunc);
+    for(const string &line: merges){
+        out << line << "\n";
+    }
+    out.close();
+    if(!out.good()){
+        throw invalid_argument("Error writing cluster merges: " + cluster_merges_file);
+    }
+}
+
+/**
+* @brief Replay a saves dir's clusters log without any removed samples. Merges in the clusters of removed or dirty
+            samples are left out, as they may only have been joined through them, and the clusters rebuilt from the
+            neighbour graph
+*
+* @param dir Saves dir
+* @param catalog The saves dir's catalog
+* @param forest Union-find to join the clusters in
+* @param cutoff Set to the log's cutoff
+* @returns `merge` lines spanning the clusters
+*/
+vector<string> live_clusters(string dir, const Catalog &catalog, UnionFind &forest, int &cutoff){
+    UnionFind logged;
+    vector<vector<string>> merges;
+    replay_clusters(dir + "/" + clusters_filename, 0, logged, cutoff, &merges);
+    unordered_set<uint32_t> affected;
+    for(const auto &[uuid, file]: catalog.removed){
+        affected.insert(logged.find(intern_uuid(uuid)));
+    }
+    for(const vector<string> &line: merges){
+        if(line.at(0) == "dirty"){
+            affected.insert(logged.find(intern_uuid(line.at(1))));
+        }
+    }
+
+    vector<string> lines;
+    auto join = [&forest, &lines](const string &uuid1, const string &uuid2, int dist){
+        if(forest.join(intern_uuid(uuid1), intern_uuid(uuid2))){
+            lines.push_back("merge\t" + uuid1 + "\t" + uuid2 + "\t" + to_string(dist));
+        }
+    };
+    for(const vector<string> &merge: merges){
+        if(merge.at(0) == "merge" && !affected.contains(logged.find(intern_uuid(merge.at(1))))){
+            join(merge.at(1), merge.at(2), stoi(merge.at(3)));
+        }
+    }
+    //Removed samples' edges are gone from the graph, and dirty samples' are up to date, so the graph's edges are
+    //all that's left to join their clusters
+    for(const CatalogEntry &entry: catalog.ordered()){
+        if(!affected.contains(logged.find(intern_uuid(entry.uuid)))){
+            continue;
+        }
+        for(const auto &[neighbour, dist]: graph_neighbours(dir, entry.uuid, cutoff)){
+            if(!catalog.removed.contains(neighbour)){
+                join(entry.uuid, neighbour, dist);
+            }
+        }
+    }
+    return lines;
+}
+
+vector<pair<string, string>> cluster_membership(string dir){
+    UnionFind forest;
+    int cutoff = -1;
+    //Nothing is written, so no lock is needed. A torn line is just not replayed
+    Catalog catalog = load_catalog(dir);
+    live_clusters(dir, catalog, forest, cutoff);
+    unordered_map<uint32_t, string> names;
+    vector<pair<string, string>> membership;
+    for(const CatalogEntry &entry: catalog.ordered()){
+        uint32_t root = forest.find(intern_uuid(entry.uuid));
+        auto found = names.find(root);
+        if(found == names.end()){
+            //First sample of the cluster
+            found = names.emplace(root, entry.uuid).first;
+        }
+        membership.push_back({entry.uuid, found->second});
+    }
+    return membership;
+}
+
+void compact_clusters(string dir){
+    string path = dir + "/" + clusters_filename;
+    if(!fs::exists(path)){
+        return;
+    }
+    int fd = open(path.c_str(), O_RDWR | O_APPEND);
+    if(fd < 0){
+        throw invalid_argument("Error opening clusters log: " + path);
+    }
+    {
+        ClustersLockGuard guard(fd);
+        UnionFind forest;
+        int cutoff = -1;
+        vector<string> merges = live_clusters(dir, load_catalog(dir), forest, cutoff);
+        if(cutoff < 0){
+            ::close(fd);
+            throw invalid_argument("Malformed clusters log: " + path);
+        }
+        string lines = "cutoff\t" + to_string(cutoff) + "\n";
+        for(const string &merge: merges){
+            lines += merge + "\n";
+        }
+        //Rewritten in place, so appenders holding the log see it shrink and replay it again
+        if(ftruncate(fd, 0) != 0 || write(fd, lines.c_str(), lines.size()) != (ssize_t) lines.size()){
+            ::close(fd);
+            throw invalid_argument("Error writing clusters log: " + path);
+        }
+    }
+    ::close(fd);
+}
@@ -1,5 +1,9 @@
 #include "include/comparisons.hpp"
+#include "include/shared.hpp"
+#include "include/checkpoint.hpp"
+#include "include/duplicates.hpp"
 #include <exception>
+#include <queue>
 
 namespace fs = std::filesystem;
 
@@ -17,44 +21,166 @@ string exclude_mask_path = "tb-exclude.txt";
 
 bool debug = false;
 
-unordered_set<string> find_saves(){
-    unordered_set<string> saves;
-    for (const auto &entry : fs::directory_iterator(save_dir)){
-        string p = entry.path();
-        //Check for .gitkeep or nothing (we want to ignore this)
-        if(p == save_dir+"/.gitkeep" || p == save_dir){
-            continue;
+string output_compression = "none";
+
+string output_format = "text";
+
+string sqlite_path = "";
+
+unique_ptr<ResultWriter> open_writer(string path){
+    if(sqlite_path != ""){
+        //Write into the database instead
+        return make_unique<ResultWriter>(sqlite_path, "none", "sqlite");
+    }
+    return make_unique<ResultWriter>(path, output_compression, output_format);
+}
+
+vector<int> output_cutoffs;
+
+string tier_path(string path, int cutoff){
+    fs::path tier = path;
+    tier.replace_extension("." + to_string(cutoff) + tier.extension().string());
+    return tier.string();
+}
+
+unique_ptr<ResultWriter> open_tiered_writer(bool append){
+    if(sqlite_path != ""){
+        throw invalid_argument("--cutoffs can't be used with --sqlite");
+    }
+    vector<int> cutoffs = output_cutoffs;
+    sort(cutoffs.begin(), cutoffs.end(), greater<int>());
+    auto open_tier = [append](int cutoff){
+        string path = tier_path(output_file, cutoff);
+        if(!append){
+            fstream output(path, fstream::out);
+            output.close();
         }
-        
-        if(p.at(p.size()-2) == '.'){
-            // 1 character file extension so likely old `.A` format
-            // Remove file extension in such cases to match old loading format
-            p.pop_back();
-            p.pop_back();
-        }
-        else {
-            // Not a 1 character file extension so check if `.fn5`
-            string ext = p.substr(p.find_last_of(".")+1);
-            if(ext != "fn5" && ext != "FN5"){
-                //  Not valid file extension for new saves so skip
-                continue;
-            }
+        return make_unique<ResultWriter>(path, output_compression, output_format);
+    };
+    //Everything is computed to the largest cutoff, so that tier gets every result and passes the rest on
+    unique_ptr<ResultWriter> writer = open_tier(cutoffs.front());
+    writer->limit(cutoffs.front());
+    for(size_t i=1;i<cutoffs.size();i++){
+        writer->tee(open_tier(cutoffs.at(i)), cutoffs.at(i));
+    }
+    return writer;
+}
+
+void report_tiers(ResultWriter* writer){
+    if(output_cutoffs.size() == 0){
+        return;
+    }
+    vector<pair<int, uint64_t>> counts = {{*max_element(output_cutoffs.begin(), output_cutoffs.end()), writer->written()}};
+    for(const auto &[cutoff, other]: writer->tees){
+        counts.push_back({cutoff, other->written()});
+    }
+    sort(counts.begin(), counts.end());
+    fs::path stats = output_file;
+    stats.replace_extension(".tiers.tsv");
+    fstream out(stats, fstream::out | fstream::trunc);
+    out << "cutoff\tresults\n";
+    for(const auto &[cutoff, count]: counts){
+        out << cutoff << "\t" << count << "\n";
+        if(debug){
+            cout << "Tier " << cutoff << ": " << count << " results" << endl;
         }
+    }
+    out.close();
+    if(!out.good()){
+        throw invalid_argument("Error writing tier stats: " + stats.string());
+    }
+}
 
-        //Only add if the path found is not empty
-        if(p.find_first_not_of(' ') != string::npos){
-            saves.insert(p);
+/**
+* @brief IDs of new samples which failed QC
+*/
+unordered_set<uint32_t> qc_failures;
+shared_mutex qc_failures_lock;
+
+void note_qc(const Sample* sample){
+    unique_lock<shared_mutex> guard(qc_failures_lock);
+    if(sample->qc_pass){
+        //Re-added with a sequence which passes
+        qc_failures.erase(sample->id);
+    }
+    else{
+        qc_failures.insert(sample->id);
+    }
+}
+
+vector<Distance> passing_qc(const vector<Distance> &distances){
+    shared_lock<shared_mutex> guard(qc_failures_lock);
+    if(qc_failures.size() == 0){
+        return distances;
+    }
+    vector<Distance> passing;
+    for(const Distance &d: distances){
+        if(!qc_failures.contains(d.id1) && !qc_failures.contains(d.id2)){
+            passing.push_back(d);
         }
     }
-    return saves;
+    return passing;
+}
+
+int graph_cutoff = 20;
+
+void cover(NeighbourGraph* graph, const vector<Sample*> &samples){
+    vector<uint32_t> ids;
+    for(const Sample* sample: samples){
+        //Ones which failed QC aren't saved
+        if(sample->qc_pass){
+            ids.push_back(sample->id);
+        }
+    }
+    graph->cover(ids);
+}
+
+shared_ptr<NeighbourGraph> attach_graph(string dir, ResultWriter* writer, int &cutoff){
+    if(graph_cutoff < 0){
+        return nullptr;
+    }
+    shared_ptr<NeighbourGraph> graph = make_shared<NeighbourGraph>(dir, graph_cutoff);
+    //The writer holds a reference, so the graph outlives it
+    writer->observe([graph](const vector<Distance> &distances){
+        //A sample which failed QC is never saved, so would be left as a dangling node
+        graph->append(passing_qc(distances));
+    });
+    if(graph->cutoff > cutoff){
+        //Compute as far as the graph needs, but only output as far as asked
+        writer->limit(cutoff);
+        cutoff = graph->cutoff;
+    }
+    return graph;
+}
+
+shared_ptr<Clusters> attach_clusters(string dir, ResultWriter* writer, int &cutoff){
+    if(cluster_cutoff < 0){
+        return nullptr;
+    }
+    shared_ptr<Clusters> clusters = make_shared<Clusters>(dir, cluster_cutoff);
+    //The writer holds a reference, so the clusters outlive it
+    writer->observe([clusters](const vector<Distance> &distances){
+        //A sample which failed QC is never saved, so mustn't join clusters
+        clusters->append(passing_qc(distances));
+    });
+    if(clusters->cutoff > cutoff){
+        //Compute as far as the clusters need, but only output as far as asked
+        writer->limit(cutoff);
+        cutoff = clusters->cutoff;
+    }
+    return clusters;
 }
 
 vector<Sample*> load_saves(){
-    unordered_set<string> saves = find_saves();
+    //Pinned so nothing is replaced from under us while loading
+    Snapshot snapshot(save_dir);
+    vector<string> saves = snapshot.catalog.paths();
 
     vector<Sample*> samples;
     for(const string &elem: saves){
         Sample *s = readSample(elem);
+        //Loaded samples are never saved again, so can be restricted in place
+        regions.restrict(s);
         samples.push_back(s);
     }
 
@@ -65,6 +191,7 @@ void load_save_thread(vector<string> filenames, vector<Sample*> *acc){
     vector<Sample*> samples;
     for(unsigned int i=0;i<filenames.size();i++){
         samples.push_back(readSample(filenames.at(i)));
+        regions.restrict(samples.back());
     }
 
     mutex_lock.lock();
@@ -75,31 +202,35 @@ void load_save_thread(vector<string> filenames, vector<Sample*> *acc){
 }
 
 vector<Sample*> load_saves_multithreaded(){
-    unordered_set<string> saves = find_saves();
-
-    vector<Sample*> acc;
-    vector<string> filenames;
-    for(const string &elem: saves){
-        filenames.push_back(elem);
-    }
+    Snapshot snapshot(save_dir);
+    return load_saves_multithreaded(snapshot.catalog.paths());
+}
 
+vector<Sample*> load_saves_multithreaded(vector<string> filenames){
+    //Each thread loads a contiguous chunk into its own accumulator so catalog order is kept
     int chunk_size = filenames.size() / thread_count;
+    vector<vector<Sample*>> accs(thread_count + 1);
     vector<thread> threads;
     for(int i=0;i<thread_count;i++){
         vector<string> these(filenames.begin() + i*chunk_size, filenames.begin() + i*chunk_size + chunk_size);
-        threads.push_back(thread(load_save_thread, these, &acc));
+        threads.push_back(thread(load_save_thread, these, &accs.at(i)));
     }
     //Catch ones missed at the end due to rounding (doing on main thread)
     vector<string> missed;
     for(unsigned int i=chunk_size*thread_count;i<filenames.size();i++){
         missed.push_back(filenames.at(i));
     }
-    load_save_thread(missed, &acc);
+    load_save_thread(missed, &accs.at(thread_count));
 
     for(unsigned int i=0;i<threads.size();i++){
         threads.at(i).join();
     }
 
+    vector<Sample*> acc;
+    acc.reserve(filenames.size());
+    for(const vector<Sample*> &these: accs){
+        acc.insert(acc.end(), these.begin(), these.end());
+    }
     return acc;
 }
 
@@ -176,33 +307,40 @@ vector<Sample*> bulk_load(string path, string reference, unordered_set<int> mask
     return samples;
 }
 
-void save_comparisons(vector<tuple<string, string, int>> comparisons){
-    //Save some comparisons to disk in a threadsafe manner
+void save_comparisons(const vector<Distance> &comparisons){
+    //Format outside of the lock, then save to disk with a single write
+    string text;
+    format_distances(comparisons, text);
     mutex_lock.lock();
         fstream output(output_file, fstream::app);
-        for(const tuple<string, string, int> &elem: comparisons){
-            output << get<0>(elem) << " " << get<1>(elem) << " " << get<2>(elem) << endl;
-        }
+        output.write(text.c_str(), text.size());
         output.close();
     mutex_lock.unlock();
 }
 
-void print_comparisons(vector<tuple<string, string, int>> comparisons){
-    //Save some comparisons to disk in a threadsafe manner
+void print_comparisons(const vector<Distance> &comparisons){
+    //Format outside of the lock, then print with a single write
+    string text;
+    format_distances(comparisons, text);
     mutex_lock.lock();
-        for(const tuple<string, string, int> &elem: comparisons){
-            cout << get<0>(elem) << " " << get<1>(elem) << " " << get<2>(elem) << endl;
-        }
+        cout.write(text.c_str(), text.size());
+        cout.flush();
     mutex_lock.unlock();
 }
 
-void do_comparisons_from_disk(vector<string> paths, Sample* sample, int cutoff){
+void do_comparisons_from_disk(vector<string> paths, Sample* sample, int cutoff, ResultWriter* writer){
     //To be used by Thread to do comparisons in parallel
     //Used by `add_sample` for multithreading adding a single sample
-    vector<tuple<string, string, int>> distances;
+    unique_ptr<ResultWriter> own_writer;
+    if(writer == nullptr){
+        //Not sharing a writer, so append to the output file
+        own_writer = open_writer(output_file);
+        writer = own_writer.get();
+    }
+    vector<Distance> distances;
     for(unsigned int i=0;i<paths.size();i++){
         Sample *s2 = readSample(paths.at(i));
-        if(sample->uuid == s2->uuid){
+        if(sample->id == s2->id){
             //These are the same sample so skip...
             continue;
         }
@@ -211,63 +349,144 @@ void do_comparisons_from_disk(vector<string> paths, Sample* sample, int cutoff){
             //Further than cutoff so ignore
             continue;
         }
-        distances.push_back(make_tuple(sample->uuid, s2->uuid, dist));
-
-        if(distances.size() == 1000){
-            //We have a fair few comparisons now, so save
-            save_comparisons(distances);
-            //Clear for continuing
-            distances = {};
+        distances.push_back(make_distance(sample, s2, dist));
 
+        if(distances.size() == result_buffer_size){
+            //We have a fair few comparisons now, so hand them to the writer
+            writer->push(distances);
         }
     }
     //And save the last few (if existing)
-    save_comparisons(distances);
+    writer->push(distances);
+}
+
+/**
+* @brief Compare a sample against a range of a shared collection. To be used by a thread
+*
+* @param collection Attached collection
+* @param start Index of the first sample to compare against
+* @param end Index after the last sample to compare against
+* @param sample Pre-loaded sample
+* @param cutoff SNP cutoff
+* @param writer Writer to hand results to
+*/
+void do_comparisons_shared(const SharedCollection* collection, size_t start, size_t end, Sample* sample, int cutoff, ResultWriter* writer){
+    vector<Distance> distances;
+    for(size_t i=start;i<end;i++){
+        const SampleView &s2 = collection->samples.at(i);
+        if(sample->id == s2.id){
+            //These are the same sample so skip...
+            continue;
+        }
+        int dist = sample->dist(s2, cutoff);
+        if(dist > cutoff){
+            continue;
+        }
+        distances.push_back(make_distance(sample->id, s2.id, dist));
+        if(distances.size() == result_buffer_size){
+            writer->push(distances);
+        }
+    }
+    writer->push(distances);
 }
 
 void add_sample(string path, string reference, unordered_set<int> mask, int cutoff){
     //Parse a new sample
     //Compare it to every saved sample, then save it too
     Sample *s = new Sample(path, reference, mask);
+    note_qc(s);
+
+    if(shared_collection){
+        //Compare straight from the node's shared copy rather than reading every save
+        unique_ptr<SharedCollection> collection = make_unique<SharedCollection>(save_dir);
+        unique_ptr<ResultWriter> writer = open_writer(output_file);
+        shared_ptr<NeighbourGraph> graph = attach_graph(save_dir, writer.get(), cutoff);
+        shared_ptr<Clusters> clusters = attach_clusters(save_dir, writer.get(), cutoff);
+        if(graph != nullptr && load_catalog(save_dir).contains(s->uuid)){
+            readd(save_dir, {s}, clusters.get());
+        }
+        size_t count = collection->samples.size();
+        vector<thread> threads;
+        for(int i=0;i<thread_count;i++){
+            threads.push_back(thread(do_comparisons_shared, collection.get(), count * i / thread_count, count * (i+1) / thread_count, s, cutoff, writer.get()));
+        }
+        for(thread &t: threads){
+            t.join();
+        }
+        writer->close();
+        if(graph != nullptr){
+            cover(graph.get(), {s});
+            graph->close();
+        }
+        if(clusters != nullptr){
+            clusters->close();
+        }
+        //Detach before saving, so a process attaching later doesn't wait on this one
+        collection.reset();
+        save(save_dir+"/", s);
+        return;
+    }
 
-    //Find all saves
-    unordered_set<string> saves_ = find_saves();
-    //Load them and perform comparisons
+    //Find all saves, skipping this sample's own save if it has been added before
+    Snapshot snapshot(save_dir);
+    const Catalog &catalog = snapshot.catalog;
     vector<string> saves;
-    for(const string &elem: saves_){
-        saves.push_back(elem);
+    for(const CatalogEntry &entry: catalog.ordered()){
+        if(entry.uuid != s->uuid){
+            saves.push_back(catalog.dir + "/" + entry.file);
+        }
     }
 
     //Do comparisons with multithreading
+    unique_ptr<ResultWriter> writer = open_writer(output_file);
+    shared_ptr<NeighbourGraph> graph = attach_graph(save_dir, writer.get(), cutoff);
+    shared_ptr<Clusters> clusters = attach_clusters(save_dir, writer.get(), cutoff);
+    if(graph != nullptr && catalog.contains(s->uuid)){
+        readd(save_dir, {s}, clusters.get());
+    }
     int chunk_size = saves.size() / thread_count;
     vector<thread> threads;
     for(int i=0;i<thread_count;i++){
         vector<string> these(saves.begin() + i*chunk_size, saves.begin() + i*chunk_size + chunk_size);
-        threads.push_back(thread(do_comparisons_from_disk, these, s, cutoff));
+        threads.push_back(thread(do_comparisons_from_disk, these, s, cutoff, writer.get()));
     }
     //Catch ones missed at the end due to rounding (doing on main thread)
     vector<string> remaining;
     for(unsigned int i=chunk_size*thread_count;i<saves.size();i++){
         remaining.push_back(saves.at(i));
     }
-    do_comparisons_from_disk(remaining, s, cutoff);
+    do_comparisons_from_disk(remaining, s, cutoff, writer.get());
 
     //Join the threads
     for(unsigned int i=0;i<threads.size();i++){
         threads.at(i).join();
     }
+    writer->close();
+    if(graph != nullptr){
+        cover(graph.get(), {s});
+        graph->close();
+    }
+    if(clusters != nullptr){
+        clusters->close();
+    }
 
     //Save the new sample
     save(save_dir+"/", s);
 }
 
-void do_comparisons(vector<tuple<Sample*, Sample*>> comparisons, int cutoff){
+void do_comparisons(vector<tuple<Sample*, Sample*>> comparisons, int cutoff, ResultWriter* writer){
     //To be used by Thread to do comparisons in parallel
-    vector<tuple<string, string, int>> distances;
+    unique_ptr<ResultWriter> own_writer;
+    if(writer == nullptr){
+        //Not sharing a writer, so print to stdout
+        own_writer = open_writer("-");
+        writer = own_writer.get();
+    }
+    vector<Distance> distances;
     for(unsigned int i=0;i<comparisons.size();i++){
         Sample *s1 = get<0>(comparisons.at(i));
         Sample *s2 = get<1>(comparisons.at(i));
-        if(s1->uuid == s2->uuid){
+        if(s1->id == s2->id){
             continue;
         }
         int dist = s1->dist(s2, cutoff);
@@ -276,24 +495,272 @@ void do_comparisons(vector<tuple<Sample*, Sample*>> comparisons, int cutoff){
             continue;
         }
         
-        distances.push_back(make_tuple(s1->uuid, s2->uuid, dist));
-        if(distances.size() == 1000){
-            print_comparisons(distances);
-            distances = {};
+        distances.push_back(make_distance(s1, s2, dist));
+        if(distances.size() == result_buffer_size){
+            writer->push(distances);
         }
     }
-    print_comparisons(distances);
+    writer->push(distances);
+}
+
+/**
+* @brief Number of comparisons in each task of an add
+*/
+const size_t add_task_size = 4096;
+
+/**
+* @brief A block of comparisons for a single new sample
+*/
+class AddTask{
+    public:
+        /**
+        * @brief Index of the new sample in `AddPipeline::ready`
+        */
+        size_t sample;
+
+        /**
+        * @brief Whether this compares against earlier new samples rather than the existing collection
+        */
+        bool against_new;
+
+        /**
+        * @brief Range of samples to compare against
+        */
+        size_t start;
+        size_t end;
+};
+
+/**
+* @brief Compares new samples as soon as each is parsed. Comparisons against earlier new samples start straight away,
+            and against the existing collection as soon as it has loaded
+*/
+class AddPipeline{
+    public:
+        /**
+        * @brief Existing collection. Only set once
+        */
+        vector<Sample*> existing;
+
+        /**
+        * @brief New samples, in the order they were parsed. Slots below `ready_count` are never changed
+        */
+        vector<Sample*> ready;
+
+        /**
+        * @brief IDs in the existing collection, so a new sample with one of them is being added again
+        */
+        unordered_set<uint32_t> saved;
+
+        /**
+        * @brief Called with each sample being added again, before it is compared
+        */
+        function<void(Sample*)> readding;
+
+        AddPipeline(size_t new_count, int cutoff_, ResultWriter* writer_){
+            ready.resize(new_count);
+            cutoff = cutoff_;
+            writer = writer_;
+        }
+
+        /**
+        * @brief The existing collection has loaded
+        */
+        void loaded(vector<Sample*> samples){
+            //Exact duplicates grouped outside of the lock, so parsing carries on meanwhile
+            unique_ptr<DuplicateClasses> classes = make_unique<DuplicateClasses>(samples);
+            classes->report();
+            lock_guard<mutex> guard(lock);
+            existing_classes = std::move(classes);
+            existing = existing_classes->representatives;
+            existing_loaded = true;
+            for(size_t i=0;i<ready_count;i++){
+                queue_existing(i);
+            }
+            changed.notify_all();
+        }
+
+        /**
+        * @brief A new sample has been parsed
+        */
+        void parsed(Sample* sample){
+            if(readding && saved.contains(sample->id)){
+                //Nothing has been compared with it yet
+                readding(sample);
+            }
+            lock_guard<mutex> guard(lock);
+            if(ready_count == ready.size()){
+                throw invalid_argument("More new samples than expected");
+            }
+            size_t i = ready_count++;
+            ready.at(i) = sample;
+            note_qc(sample);
+            //Against the earlier new samples, so each pair is only done once
+            for(size_t start=0;start<i;start+=add_task_size){
+                tasks.push_back({i, true, start, min(i, start + add_task_size)});
+            }
+            if(existing_loaded){
+                queue_existing(i);
+            }
+            changed.notify_all();
+        }
+
+        /**
+        * @brief Every new sample has been parsed
+        */
+        void done_parsing(){
+            lock_guard<mutex> guard(lock);
+            parsing_done = true;
+            changed.notify_all();
+        }
+
+        /**
+        * @brief Do tasks until every new sample has been compared
+        */
+        void worker(){
+            vector<Distance> distances;
+            uint64_t done = 0;
+            while(true){
+                AddTask task;
+                {
+                    unique_lock<mutex> guard(lock);
+                    changed.wait(guard, [this]{ return tasks.size() > 0 || (parsing_done && existing_loaded); });
+                    if(tasks.size() == 0){
+                        break;
+                    }
+                    task = tasks.front();
+                    tasks.pop_front();
+                }
+                Sample* s = ready.at(task.sample);
+                const vector<Sample*> &others = task.against_new ? ready : existing;
+                for(size_t i=task.start;i<task.end;i++){
+                    Sample* other = others.at(i);
+                    //A representative still stands for its other members if this is a re-add of it
+                    bool fanned = !task.against_new && existing_classes->duplicates.contains(other->id);
+                    if(other->id == s->id && !fanned){
+                        continue;
+                    }
+                    done++;
+                    int dist = other->dist(s, cutoff);
+                    if(dist > cutoff){
+                        continue;
+                    }
+                    if(fanned){
+                        existing_classes->fan_out_new(other->id, s->id, dist, distances);
+                    }
+                    else{
+                        distances.push_back(make_distance(other, s, dist));
+                    }
+                    if(distances.size() >= result_buffer_size){
+                        writer->push(distances);
+                    }
+                }
+            }
+            writer->push(distances);
+            comparisons += done;
+        }
+
+        /**
+        * @brief Number of comparisons done
+        */
+        uint64_t compared(){
+            return comparisons;
+        }
+
+    private:
+        int cutoff;
+        ResultWriter* writer;
+
+        /**
+        * @brief Guards everything but `comparisons`
+        */
+        mutex lock;
+
+        /**
+        * @brief Signals new tasks, or the end of parsing or loading
+        */
+        condition_variable changed;
+
+        /**
+        * @brief Exact duplicates within the existing collection. `existing` is their representatives
+        */
+        unique_ptr<DuplicateClasses> existing_classes;
+
+        bool existing_loaded = false;
+        bool parsing_done = false;
+        size_t ready_count = 0;
+        deque<AddTask> tasks;
+        atomic<uint64_t> comparisons = 0;
+
+        /**
+        * @brief Queue the comparisons of a new sample against the existing collection. `lock` must be held
+        */
+        void queue_existing(size_t i){
+            for(size_t start=0;start<existing.size();start+=add_task_size){
+                tasks.push_back({i, false, start, min(existing.size(), start + add_task_size)});
+            }
+        }
+};
+
+/**
+* @brief Run an add. `producer` is run on the calling thread, and should hand the pipeline the existing collection
+            and each new sample while workers compare them
+*
+* @param new_count Number of new samples
+* @param saved IDs of the existing samples
+* @param cutoff SNP threshold
+* @param producer Loads the samples into the pipeline
+* @returns Number of results written
+*/
+uint64_t run_add(size_t new_count, unordered_set<uint32_t> saved, int cutoff, function<void(AddPipeline&)> producer){
+    unique_ptr<ResultWriter> writer = open_writer("-");
+    shared_ptr<NeighbourGraph> graph = attach_graph(save_dir, writer.get(), cutoff);
+    shared_ptr<Clusters> clusters = attach_clusters(save_dir, writer.get(), cutoff);
+    AddPipeline pipeline(new_count, cutoff, writer.get());
+    size_t existing_count = saved.size();
+    pipeline.saved = std::move(saved);
+    if(graph != nullptr){
+        pipeline.readding = [clusters](Sample* sample){
+            readd(save_dir, {sample}, clusters.get());
+        };
+    }
+    vector<thread> workers;
+    for(int i=0;i<thread_count;i++){
+        workers.push_back(thread(&AddPipeline::worker, &pipeline));
+    }
+    producer(pipeline);
+    pipeline.done_parsing();
+
+    //Join the threads
+    for(unsigned int i=0;i<workers.size();i++){
+        workers.at(i).join();
+    }
+    writer->close();
+    if(graph != nullptr){
+        cover(graph.get(), pipeline.ready);
+        graph->close();
+    }
+    if(clusters != nullptr){
+        clusters->close();
+    }
+    if(debug){
+        cout << "Added " << new_count << " new samples to an existing " << existing_count <<  " with " << pipeline.compared() << " comparisons" << endl;
+    }
+    return writer->written();
 }
 
 void add_many(string path, string reference, unordered_set<int> mask, int cutoff){
     // Like `add`, but handles adding >1 sample
     //Should be significantly faster by multithreading
 
-    //Load existing samples
-    vector<Sample*> existing = load_saves_multithreaded();
+    //Find the existing samples before any new ones are saved
+    Snapshot snapshot(save_dir);
+    vector<string> existing_paths = snapshot.catalog.paths();
+    unordered_set<uint32_t> saved;
+    for(const auto &[uuid, entry]: snapshot.catalog.entries){
+        saved.insert(intern_uuid(uuid));
+    }
 
     //Open the path, and treat each line as a new FASTA file
-    vector<Sample*> others;
     vector<string> other_paths;
     char ch;
     string acc;
@@ -320,173 +787,626 @@ void add_many(string path, string reference, unordered_set<int> mask, int cutoff
     }    
     fin.close();
 
-    //Load the samples multithreaded
-    //Do comparisons with multithreading
-    int chunk_size = other_paths.size() / thread_count;
-    vector<thread> threads;
-    for(int i=0;i<thread_count;i++){
-        vector<string> these(other_paths.begin() + i*chunk_size, other_paths.begin() + i*chunk_size + chunk_size);
-        threads.push_back(thread(parse_n, these, reference, mask, &others));
-    }
-    //Catch ones missed at the end due to rounding (doing on main thread)
-    for(unsigned int i=chunk_size*thread_count;i<other_paths.size();i++){
-        Sample *s = new Sample(other_paths.at(i), reference, mask);
-        mutex_lock.lock();
-            others.push_back(s);
+    //Load the existing samples while the new ones are parsed, comparing each new one as soon as it's ready
+    run_add(other_paths.size(), saved, cutoff, [&](AddPipeline &pipeline){
+        //Re-added samples overwrite their old saves, so only save once the existing samples have loaded
+        atomic<bool> existing_ready = false;
+        vector<Sample*> unsaved;
+        thread loader([&pipeline, &existing_paths, &existing_ready]{
+            pipeline.loaded(load_saves_multithreaded(existing_paths));
+            existing_ready = true;
+        });
+        atomic<size_t> next = 0;
+        vector<thread> parsers;
+        for(int i=0;i<thread_count;i++){
+            parsers.push_back(thread([&]{
+                size_t j;
+                while((j = next++) < other_paths.size()){
+                    Sample *s = new Sample(other_paths.at(j), reference, mask);
+                    pipeline.parsed(s);
+                    mutex_lock.lock();
+                        if(existing_ready){
+                            save(save_dir+"/", s);
+                        }
+                        else{
+                            unsaved.push_back(s);
+                        }
+                    mutex_lock.unlock();
+                }
+            }));
+        }
+        for(unsigned int i=0;i<parsers.size();i++){
+            parsers.at(i).join();
+        }
+        loader.join();
+        for(Sample* s: unsaved){
             save(save_dir+"/", s);
-        mutex_lock.unlock();
-    }
+        }
+    });
+}
 
-    //Join the threads
-    for(unsigned int i=0;i<threads.size();i++){
-        threads.at(i).join();
+uint64_t add_loaded(vector<Sample*> existing, vector<Sample*> others, int cutoff){
+    unordered_set<uint32_t> saved;
+    for(const Sample* s: existing){
+        saved.insert(s->id);
     }
+    return run_add(others.size(), saved, cutoff, [&existing, &others](AddPipeline &pipeline){
+        pipeline.loaded(existing);
+        for(Sample* s: others){
+            pipeline.parsed(s);
+        }
+    });
+}
 
-    vector<tuple<Sample*, Sample*>> comparisons;
-    //Compare each new one with an each existing comparison
-    for(unsigned int i=0;i<existing.size();i++){
-        for(unsigned int j=0;j<others.size();j++){
-            if(existing.at(i)->uuid == others.at(j)->uuid){
-                continue;
-            }
-            comparisons.push_back(make_tuple(existing.at(i), others.at(j)));
+int distance_lower_bound(const Sample* s, const SampleView &view){
+    //Each of one sample's variants counts unless the other has the same variant, or an N, there
+    //Positions masked by a profile can't count, so aren't included
+    int variants = unmasked_count(s->A) + unmasked_count(s->C) + unmasked_count(s->G) + unmasked_count(s->T);
+    int view_variants = unmasked_count(view.A) + unmasked_count(view.C) + unmasked_count(view.G) + unmasked_count(view.T);
+    return max({0, variants - view_variants - (int) view.N.size(), view_variants - variants - (int) s->N.size()});
+}
+
+vector<pair<uint32_t, int>> nearest(Sample* s, const vector<SampleView> &views, int k){
+    if(k < 1){
+        throw invalid_argument("Invalid k. Should be > 0");
+    }
+    //Most promising first, so the k-th best distance tightens quickly
+    vector<pair<int, size_t>> order;
+    order.reserve(views.size());
+    for(size_t i=0;i<views.size();i++){
+        if(views.at(i).id != s->id){
+            order.push_back({distance_lower_bound(s, views.at(i)), i});
         }
     }
-    //And compare each new one against other new ones
-    unordered_set<string> seen;
-    for(unsigned int i=0;i<others.size();i++){
-        Sample *s1 = others.at(i);
-        seen.insert(s1->uuid);
-        for(unsigned int j=0;j<others.size();j++){
-            Sample *s2 = others.at(j);
-            if(seen.contains(s2->uuid)){
-                continue;
-            }
-            else{
-                comparisons.push_back(make_tuple(s1, s2));
-            }
+    sort(order.begin(), order.end());
+
+    //Max heap of the best so far, so the top is the k-th best
+    priority_queue<pair<int, uint32_t>> best;
+    for(const auto &[bound, i]: order){
+        const SampleView &view = views.at(i);
+        if(best.size() < (size_t) k){
+            best.push({s->dist(view, max_distance), view.id});
+            continue;
+        }
+        int kth = best.top().first;
+        if(bound >= kth){
+            //Everything left is at least as far as the k-th best
+            break;
+        }
+        //Only needs to know if it's closer than the k-th best
+        int dist = s->dist(view, kth - 1);
+        if(dist < kth){
+            best.pop();
+            best.push({dist, view.id});
         }
     }
-    if(debug){
-        cout << "Adding " << others.size() << " new samples to an existing " << existing.size() <<  " with " << comparisons.size() << " comparisons" << endl;
+
+    vector<pair<uint32_t, int>> closest;
+    while(best.size() > 0){
+        closest.push_back({best.top().second, best.top().first});
+        best.pop();
     }
+    reverse(closest.begin(), closest.end());
+    return closest;
+}
 
-    //Do comparisons with multithreading
-    chunk_size = comparisons.size() / thread_count;
-    vector<thread> threads2;
-    for(int i=0;i<thread_count;i++){
-        vector<tuple<Sample*, Sample*>> these(comparisons.begin() + i*chunk_size, comparisons.begin() + i*chunk_size + chunk_size);
-        threads2.push_back(thread(do_comparisons, these, cutoff));
+vector<tuple<string, int>> nearest_samples(Sample* s, vector<Sample*> samples, int k){
+    vector<SampleView> views;
+    for(Sample* sample: samples){
+        views.push_back(sample->view());
     }
-    //Catch ones missed at the end due to rounding (doing on main thread)
+    vector<tuple<string, int>> closest;
+    for(const auto &[id, dist]: nearest(s, views, k)){
+        closest.push_back(make_tuple(uuid_of(id), dist));
+    }
+    return closest;
+}
 
-    for(unsigned int i=chunk_size*thread_count;i<comparisons.size();i++){
-        tuple<Sample*, Sample*> val = comparisons.at(i);
-        if(get<0>(val)->uuid == get<1>(val)->uuid){
-        }
-        int dist = get<0>(val)->dist(get<1>(val), cutoff);
-        if(dist <= cutoff){
-            mutex_lock.lock();
-                cout << get<0>(val)->uuid << " " << get<1>(val)->uuid << " " << dist << endl;
-            mutex_lock.unlock();
+void nearest_row(string path, string reference, unordered_set<int> mask, int k){
+    Sample *s = new Sample(path, reference, mask);
+    regions.restrict(s);
+    unique_ptr<SharedCollection> collection;
+    vector<Sample*> samples;
+    vector<SampleView> views;
+    if(shared_collection){
+        collection = make_unique<SharedCollection>(save_dir);
+        views = collection->samples;
+    }
+    else{
+        samples = load_saves_multithreaded();
+        for(Sample* sample: samples){
+            views.push_back(sample->view());
         }
     }
-
-    //Join the threads
-    for(unsigned int i=0;i<threads2.size();i++){
-        threads2.at(i).join();
+    for(const auto &[id, dist]: nearest(s, views, k)){
+        cout << s->uuid << " " << uuid_of(id) << " " << dist << "\n";
+    }
+    cout.flush();
+    for(Sample* sample: samples){
+        delete sample;
     }
+    delete s;
 }
 
 void compare_row(string path, string reference, unordered_set<int> mask, int cutoff){
     //Very similar to add_sample, but instead of saving to disk, print to stdout
     //This is because of how difficult it is to query the size of file created without cutoff
-    Sample *s = new Sample(path, reference, mask);
+    Sample *whole = new Sample(path, reference, mask);
+    //Compared within the regions, if any, but saved whole
+    Sample *s = regions.empty() ? whole : regions.restricted(whole);
 
-    vector<Sample*> samples = load_saves();
+    //Compared through views, so either a shared collection or the loaded saves can be used
+    unique_ptr<SharedCollection> collection;
+    vector<Sample*> samples;
+    vector<SampleView> views;
+    if(shared_collection){
+        collection = make_unique<SharedCollection>(save_dir);
+        views = collection->samples;
+    }
+    else{
+        samples = load_saves();
+        for(Sample* sample: samples){
+            views.push_back(sample->view());
+        }
+    }
     if(debug){
-        cout << "Comparing against " << samples.size() << endl;
+        cout << "Comparing against " << views.size() << endl;
+    }
+    //Only as far as the output, graph and clusters need, so comparisons can exit early
+    unique_ptr<NeighbourGraph> graph;
+    int compute_cutoff = cutoff;
+    if(graph_cutoff >= 0){
+        graph = make_unique<NeighbourGraph>(save_dir, graph_cutoff);
+        compute_cutoff = max(cutoff, graph->cutoff);
+    }
+    unique_ptr<Clusters> clusters;
+    if(cluster_cutoff >= 0){
+        clusters = make_unique<Clusters>(save_dir, cluster_cutoff);
+        compute_cutoff = max(compute_cutoff, clusters->cutoff);
     }
-    int closest_dist = 999999999;
-    string closest_uuid = "";
     bool found_within_cutoff = false;
-    for(unsigned int i=0;i<samples.size();i++){
-        if(samples.at(i)->uuid == s->uuid){
+    bool readding = false;
+    //Every distance is known here, so the graph can be updated directly
+    vector<Distance> graph_distances;
+    for(const SampleView &view: views){
+        if(view.id == s->id){
             //Same sample
+            readding = true;
             continue;
         }
-        int dist = s->dist(samples.at(i), 99999999);
-        if(dist <= closest_dist){
-            closest_dist = dist;
-            closest_uuid = samples.at(i)->uuid;
+        int dist = s->dist(view, compute_cutoff);
+        if(dist > compute_cutoff){
+            continue;
         }
+        graph_distances.push_back(make_distance(s->id, view.id, dist));
         if(dist > cutoff){
             continue;
         }
         found_within_cutoff = true;
-        cout << s->uuid << " " << samples.at(i)->uuid << " " << dist << endl;
+        cout << s->uuid << " " << uuid_of(view.id) << " " << dist << endl;
     }
     if(!found_within_cutoff){
         //Nothing found within the cutoff, so output nearest
-        cout << "Nearest: " << closest_uuid << " " << closest_dist << endl;
+        vector<pair<uint32_t, int>> closest = nearest(s, views, 1);
+        if(closest.size() > 0){
+            cout << "Nearest: " << uuid_of(closest.at(0).first) << " " << closest.at(0).second << endl;
+        }
+        else{
+            cout << "Nearest:  " << 999999999 << endl;
+        }
+    }
+    if(!whole->qc_pass){
+        //Not saved, so kept out of the graph and clusters
+        graph_distances.clear();
+    }
+    if(graph != nullptr){
+        if(readding){
+            readd(save_dir, {whole}, clusters.get());
+        }
+        //Cutoff is applied by the graph
+        graph->append(graph_distances);
+        cover(graph.get(), {whole});
+        graph->close();
+    }
+    if(clusters != nullptr){
+        clusters->append(graph_distances);
+        clusters->close();
     }
+    //Detach before saving, so a process attaching later doesn't wait on this one
+    views.clear();
+    collection.reset();
 
     //Save the sample in a new dir
-    save(save_dir+"/", s);
+    save(save_dir+"/", whole);
 }
 
-void compute_loaded(int cutoff, vector<Sample*> samples){
-    //Version of compute() without reading from disk
-    //Utilise multithreading for speed
+/**
+* @brief Remove the edges of some samples from a saves dir's neighbour graph, if it has one
+*/
+void remove_from_graph(string dir, const vector<string> &uuids){
+    if(!fs::exists(dir + "/" + graph_dirname + "/index.csr")){
+        return;
+    }
+    //The cutoff is only used when creating a graph
+    NeighbourGraph graph(dir, 0);
+    vector<Distance> edges;
+    for(const string &uuid: uuids){
+        for(const auto &[neighbour, dist]: graph_neighbours(dir, uuid, graph.cutoff)){
+            edges.push_back(make_distance(intern_uuid(uuid), intern_uuid(neighbour), dist));
+        }
+    }
+    graph.remove(edges);
+    //Until they're added again through the graph
+    vector<uint32_t> ids;
+    for(const string &uuid: uuids){
+        ids.push_back(intern_uuid(uuid));
+    }
+    graph.cover(ids, false);
+    graph.close();
+}
 
-    //Construct list of comparisons (but don't actually do any of them yet)
-    vector<tuple<Sample*, Sample*>> comparisons;
-    unordered_set<string> seen;
-    for(unsigned int i=0;i<samples.size();i++){
-        Sample *s1 = samples.at(i);
-        seen.insert(s1->uuid);
-        for(unsigned int j=0;j<samples.size();j++){
-            Sample *s2 = samples.at(j);
-            if(seen.contains(s2->uuid)){
-                //We've already done this comparison
-                continue;
+void remove_samples(string dir, vector<string> uuids){
+    Catalog catalog = load_catalog(dir);
+    for(const string &uuid: uuids){
+        if(!catalog.contains(uuid)){
+            throw invalid_argument("Can't remove a sample which isn't saved: " + uuid);
+        }
+    }
+    for(const string &uuid: uuids){
+        catalog_remove(dir, uuid);
+    }
+    remove_from_graph(dir, uuids);
+    if(debug){
+        cout << "Removed " << uuids.size() << " samples" << endl;
+    }
+}
+
+void readd(string dir, const vector<Sample*> &samples, Clusters* clusters){
+    vector<string> uuids;
+    vector<uint32_t> ids;
+    for(const Sample* sample: samples){
+        if(sample->qc_pass){
+            uuids.push_back(sample->uuid);
+            ids.push_back(sample->id);
+        }
+    }
+    if(uuids.size() == 0){
+        return;
+    }
+    remove_from_graph(dir, uuids);
+    if(clusters != nullptr){
+        //Merges through the old version may not hold either
+        clusters->dirty(ids);
+    }
+}
+
+uint64_t compact_saves(string dir){
+    //Again, in case a removal died before it got to the graph
+    vector<string> removed;
+    for(const auto &[uuid, file]: load_catalog(dir).removed){
+        removed.push_back(uuid);
+    }
+    remove_from_graph(dir, removed);
+    if(fs::exists(dir + "/" + graph_dirname + "/index.csr")){
+        compact_graph(dir);
+    }
+    //While the tombstones still say which samples were removed
+    compact_clusters(dir);
+    uint64_t deleted = collect_garbage(dir);
+    //Then the lines of what was deleted
+    uint64_t dropped = compact_catalog(dir);
+    if(debug){
+        cout << "Dropped " << dropped << " catalog lines" << endl;
+    }
+    return deleted;
+}
+
+/**
+* @brief State of a sample at a position: its base if it differs from the reference, `N`, or `R` for the reference
+*/
+char state_at(const SampleView &sample, int position){
+    if(binary_search(sample.A.begin(), sample.A.end(), position)){
+        return 'A';
+    }
+    if(binary_search(sample.C.begin(), sample.C.end(), position)){
+        return 'C';
+    }
+    if(binary_search(sample.G.begin(), sample.G.end(), position)){
+        return 'G';
+    }
+    if(binary_search(sample.T.begin(), sample.T.end(), position)){
+        return 'T';
+    }
+    if(binary_search(sample.N.begin(), sample.N.end(), position)){
+        return 'N';
+    }
+    return 'R';
+}
+
+vector<int> changed_positions(const Sample* before, const Sample* after){
+    vector<int> positions;
+    for(const Sample* s: {before, after}){
+        for(const vector<int>* x: {&s->A, &s->C, &s->G, &s->T, &s->N}){
+            positions.insert(positions.end(), x->begin(), x->end());
+        }
+    }
+    sort(positions.begin(), positions.end());
+    positions.erase(unique(positions.begin(), positions.end()), positions.end());
+    SampleView old_view = before->view();
+    SampleView new_view = after->view();
+    erase_if(positions, [&old_view, &new_view](int position){
+        return state_at(old_view, position) == state_at(new_view, position);
+    });
+    return positions;
+}
+
+vector<pair<uint32_t, int>> update_distances(Sample* before, Sample* after, const vector<SampleView> &views, const unordered_map<uint32_t, int> &known, const unordered_set<uint32_t> &covered, int known_cutoff, int cutoff){
+    vector<int> changed = changed_positions(before, after);
+    //Against a sample with the reference at every changed position, each changed position counts if it's a variant
+    int shift = 0;
+    SampleView old_view = before->view();
+    SampleView new_view = after->view();
+    for(const int &position: changed){
+        char was = state_at(old_view, position);
+        char is = state_at(new_view, position);
+        shift += (is != 'R' && is != 'N') - (was != 'R' && was != 'N');
+    }
+
+    vector<pair<uint32_t, int>> distances;
+    uint64_t compared = 0;
+    for(const SampleView &view: views){
+        if(view.id == after->id || view.id == before->id){
+            continue;
+        }
+        bool touched = false;
+        for(const int &position: changed){
+            if(state_at(view, position) != 'R'){
+                touched = true;
+                break;
+            }
+        }
+        auto found = known.find(view.id);
+        int dist;
+        if(!touched && found != known.end()){
+            dist = found->second + shift;
+        }
+        else if(!touched && covered.contains(view.id) && known_cutoff + shift >= cutoff){
+            //Was beyond the known distances, so still beyond the cutoff
+            continue;
+        }
+        else if(!touched && distance_lower_bound(after, view) > cutoff){
+            continue;
+        }
+        else{
+            dist = after->dist(view, cutoff);
+            compared++;
+        }
+        if(dist <= cutoff){
+            distances.push_back({view.id, dist});
+        }
+    }
+    if(debug){
+        cout << changed.size() << " positions changed, compared " << compared << " of " << views.size() << endl;
+    }
+    return distances;
+}
+
+void update_sample(string path, string reference, unordered_set<int> mask, int cutoff){
+    if(graph_cutoff < 0){
+        throw invalid_argument("Updating needs the neighbour graph for the old distances");
+    }
+    Sample *s = new Sample(path, reference, mask);
+    Sample *old = nullptr;
+    vector<string> paths;
+    {
+        Snapshot snapshot(save_dir);
+        for(const CatalogEntry &entry: snapshot.catalog.ordered()){
+            if(entry.uuid == s->uuid){
+                old = readSample(snapshot.catalog.dir + "/" + entry.file);
             }
             else{
-                comparisons.push_back(make_tuple(s1, s2));
+                paths.push_back(snapshot.catalog.dir + "/" + entry.file);
             }
         }
     }
+    if(old == nullptr){
+        throw invalid_argument("Can't update a sample which isn't saved: " + s->uuid);
+    }
+    //Only looked at through views, so either a shared collection or the loaded saves can be used
+    unique_ptr<SharedCollection> collection;
+    vector<Sample*> samples;
+    vector<SampleView> views;
+    if(shared_collection){
+        //The old version is in it too, but is skipped by its ID
+        collection = make_unique<SharedCollection>(save_dir);
+        views = collection->samples;
+    }
+    else{
+        samples = load_saves_multithreaded(paths);
+        for(Sample* sample: samples){
+            views.push_back(sample->view());
+        }
+    }
+
+    //Only as far as the output, graph and clusters need
+    NeighbourGraph graph(save_dir, graph_cutoff);
+    int compute_cutoff = max(cutoff, graph.cutoff);
+    unique_ptr<Clusters> clusters;
+    if(cluster_cutoff >= 0){
+        clusters = make_unique<Clusters>(save_dir, cluster_cutoff);
+        compute_cutoff = max(compute_cutoff, clusters->cutoff);
+    }
+    vector<pair<string, int>> neighbours = graph_neighbours(save_dir, s->uuid, graph.cutoff);
+    unordered_map<uint32_t, int> known;
+    for(const auto &[uuid, dist]: neighbours){
+        known[intern_uuid(uuid)] = dist;
+    }
+    //A missing edge only means beyond the cutoff if both ends are covered, so anything else is compared
+    unordered_set<uint32_t> covered;
+    unordered_set<string> coverage = graph_coverage(save_dir);
+    if(coverage.contains(s->uuid)){
+        for(const string &uuid: coverage){
+            covered.insert(intern_uuid(uuid));
+        }
+    }
+    vector<pair<uint32_t, int>> updated = update_distances(old, s, views, known, covered, graph.cutoff, compute_cutoff);
+
+    unordered_map<uint32_t, int> now;
+    vector<Distance> distances;
+    for(const auto &[id, dist]: updated){
+        now[id] = dist;
+        distances.push_back(make_distance(s->id, id, dist));
+        if(dist <= cutoff){
+            cout << s->uuid << " " << uuid_of(id) << " " << dist << endl;
+        }
+    }
+    vector<Distance> removed;
+    for(const auto &[uuid, dist]: neighbours){
+        uint32_t id = intern_uuid(uuid);
+        auto found = now.find(id);
+        int new_dist = found == now.end() ? max_distance : found->second;
+        if(dist <= cutoff && new_dist > cutoff){
+            cout << "Removed: " << s->uuid << " " << uuid_of(id) << endl;
+        }
+        if(new_dist > graph.cutoff){
+            removed.push_back(make_distance(s->id, id, dist));
+        }
+    }
+    if(s->qc_pass){
+        //Otherwise it isn't saved, so the old save's edges stand
+        graph.append(distances);
+        graph.remove(removed);
+        //Every distance within the cutoff is known now
+        cover(&graph, {s});
+    }
+    graph.close();
+    if(clusters != nullptr && s->qc_pass){
+        //Single linkage clusters only merge, so its cluster is rebuilt from the graph in case a pair moved apart
+        clusters->dirty({s->id});
+        clusters->append(distances);
+        clusters->close();
+    }
+
+    for(Sample* sample: samples){
+        delete sample;
+    }
+    delete old;
+    //Detach before saving, so a process attaching later doesn't wait on this one
+    views.clear();
+    collection.reset();
+    save(save_dir+"/", s);
+}
+
+void compute_loaded(int cutoff, vector<Sample*> samples){
+    //Version of compute() without reading from disk
+    //Utilise multithreading for speed
+
+    //Exact duplicates only need comparing once
+    DuplicateClasses classes(samples);
+    classes.report();
+
+    //Split the pairs into tiles rather than listing every comparison, with enough tiles to keep every thread busy
+    uint64_t min_tiles = resume_journal != "" ? checkpoint_min_tiles : (uint64_t) thread_count * 4;
+    vector<Tile> all_tiles = make_tiles(classes.representatives, min_tiles);
+    classes.assign(all_tiles);
+    vector<Tile> tiles = partition_tiles(all_tiles, 1, 1);
     if(debug){
-        cout << "Comparing " << samples.size() << " for a total of " << comparisons.size() << " comparisons" << endl;
+        uint64_t comparisons = 0;
+        for(const Tile &tile: tiles){
+            comparisons += tile.pairs();
+        }
+        cout << "Comparing " << classes.representatives.size() << " of " << samples.size() << " for a total of " << comparisons << " comparisons" << endl;
     }
 
-    //Clear output file ready for thread-by-thread appending
-    fstream output(output_file, fstream::out);
-    output.close();
+    if(resume_journal == ""){
+        //Clear output file ready for thread-by-thread appending
+        fstream output(output_file, fstream::out);
+        output.close();
+    }
 
     //Do comparisons with multithreading
-    int chunk_size = comparisons.size() / thread_count;
-    vector<thread> threads;
-    for(int i=0;i<thread_count;i++){
-        vector<tuple<Sample*, Sample*>> these(comparisons.begin() + i*chunk_size, comparisons.begin() + i*chunk_size + chunk_size);
-        threads.push_back(thread(do_comparisons, these, cutoff));
+    string job = "compute cutoff=" + to_string(cutoff) + " collection=" + collection_fingerprint(samples) + " tiles=" + to_string(tiles.size());
+    unique_ptr<ResultWriter> writer = open_tiled_writer(job, tiles);
+    compare_tiles(classes.representatives, tiles, cutoff, writer.get(), &classes);
+    writer->close();
+    report_tiers(writer.get());
+}
+
+void record_run(string dir, uint64_t marker, int cutoff){
+    fstream out(dir + "/" + runs_filename, fstream::out | fstream::app);
+    out << marker << "\t" << cutoff << "\n";
+    out.close();
+    if(!out.good()){
+        throw invalid_argument("Error recording run in " + dir);
     }
-    //Catch ones missed at the end due to rounding (doing on main thread)
-    vector<tuple<string, string, int>> distances;
-    for(unsigned int i=chunk_size*thread_count;i<comparisons.size();i++){
-        tuple<Sample*, Sample*> val = comparisons.at(i);
-        int dist = get<0>(val)->dist(get<1>(val), cutoff);
-        if(dist <= cutoff){
-            distances.push_back(make_tuple(get<0>(val)->uuid, get<1>(val)->uuid, dist));
+}
+
+uint64_t last_run(string dir, int cutoff){
+    fstream in(dir + "/" + runs_filename, fstream::in);
+    string line;
+    bool found = false;
+    uint64_t marker = 0;
+    while(getline(in, line)){
+        stringstream fields(line);
+        uint64_t run_marker;
+        int run_cutoff;
+        if(fields >> run_marker >> run_cutoff && run_cutoff == cutoff){
+            found = true;
+            marker = run_marker;
         }
     }
-    print_comparisons(distances);
+    if(!found){
+        throw invalid_argument("No earlier run with a cutoff of " + to_string(cutoff) + " in " + dir);
+    }
+    return marker;
+}
 
-    //Join the threads
-    for(unsigned int i=0;i<threads.size();i++){
-        threads.at(i).join();
+uint64_t compute_saves(int cutoff, uint64_t since){
+    //Pinned, so the marker recorded is exactly what was compared
+    Snapshot snapshot(save_dir);
+    if(since > snapshot.catalog.generation()){
+        throw invalid_argument("Marker " + to_string(since) + " is newer than the catalog of " + save_dir + ", was it rebuilt?");
+    }
+    vector<CatalogEntry> entries = snapshot.catalog.ordered();
+    //Samples already covered by the marker first, then any saved (or re-saved) after it
+    stable_partition(entries.begin(), entries.end(), [since](const CatalogEntry &entry){
+        return entry.end <= since;
+    });
+    vector<string> paths;
+    uint64_t covered = 0;
+    for(const CatalogEntry &entry: entries){
+        paths.push_back(snapshot.catalog.dir + "/" + entry.file);
+        if(entry.end <= since){
+            covered++;
+        }
     }
+    vector<Sample*> samples = load_saves_multithreaded(paths);
 
+    if(since == 0){
+        compute_loaded(cutoff, samples);
+    }
+    else{
+        //Only the new x old rectangle and the new x new triangle
+        uint64_t min_tiles = resume_journal != "" ? checkpoint_min_tiles : (uint64_t) thread_count * 4;
+        vector<Tile> tiles = partition_tiles(make_tiles(samples, min_tiles, covered), 1, 1);
+        if(debug){
+            cout << "Comparing " << samples.size() - covered << " samples saved since " << since << " against " << samples.size() << endl;
+        }
+        string job = "compute cutoff=" + to_string(cutoff) + " since=" + to_string(since) + " collection=" + collection_fingerprint(samples)
+                     + " tiles=" + to_string(tiles.size());
+        unique_ptr<ResultWriter> writer = open_tiled_writer(job, tiles, true);
+        compare_tiles(samples, tiles, cutoff, writer.get());
+        writer->close();
+        report_tiers(writer.get());
+    }
+    for(Sample* s: samples){
+        delete s;
+    }
+    if(query_mask.size() == 0 && regions.empty()){
+        //Runs mark how far the dir's own matrix is computed, which a mask profile's or regions' isn't
+        record_run(snapshot.catalog.dir, snapshot.catalog.generation(), cutoff);
+    }
+    return snapshot.catalog.generation();
 }
 
 void reference_compress(string path, string reference, unordered_set<int> mask, string guid){
@@ -498,6 +1418,7 @@ void reference_compress(string path, string reference, unordered_set<int> mask,
 void add_batch(string path, int cutoff){
     //**VERY** similar to `add_many`, but starting with reference compressed sequences
     vector<Sample*> existing = load_saves_multithreaded();
+    string existing_dir = save_dir;
     
     //Use the same method to load the new saves
     //So change the save dir as appropriate
@@ -505,78 +1426,41 @@ void add_batch(string path, int cutoff){
     save_dir = path;
     vector<Sample*> to_add = load_saves_multithreaded();
 
-    vector<tuple<Sample*, Sample*>> comparisons;
-    //Compare each new one with an each existing comparison
-    for(unsigned int i=0;i<existing.size();i++){
-        for(unsigned int j=0;j<to_add.size();j++){
-            if(existing.at(i)->uuid == to_add.at(j)->uuid){
-                continue;
-            }
-            comparisons.push_back(make_tuple(existing.at(i), to_add.at(j)));
-        }
-    }
-    //And compare each new one against other new ones
-    unordered_set<string> seen;
-    for(unsigned int i=0;i<to_add.size();i++){
-        Sample *s1 = to_add.at(i);
-        seen.insert(s1->uuid);
-        for(unsigned int j=0;j<to_add.size();j++){
-            Sample *s2 = to_add.at(j);
-            if(seen.contains(s2->uuid)){
-                continue;
-            }
-            else{
-                comparisons.push_back(make_tuple(s1, s2));
-            }
-        }
-    }
+    //Compare each new one with each existing one, and each other, as tiles over both together
+    vector<Sample*> samples = existing;
+    samples.insert(samples.end(), to_add.begin(), to_add.end());
+    uint64_t min_tiles = resume_journal != "" ? checkpoint_min_tiles : (uint64_t) thread_count * 4;
+    vector<Tile> tiles = partition_tiles(make_tiles(samples, min_tiles, existing.size()), 1, 1);
 
     //Do comparisons with multithreading
-    int chunk_size = comparisons.size() / thread_count;
-    vector<thread> threads;
-    for(int i=0;i<thread_count;i++){
-        vector<tuple<Sample*, Sample*>> these(comparisons.begin() + i*chunk_size, comparisons.begin() + i*chunk_size + chunk_size);
-        threads.push_back(thread(do_comparisons, these, cutoff));
+    string job = "add_batch cutoff=" + to_string(cutoff) + " collection=" + collection_fingerprint(samples)
+                 + " existing=" + to_string(existing.size()) + " tiles=" + to_string(tiles.size());
+    unique_ptr<ResultWriter> writer = open_tiled_writer(job, tiles);
+    shared_ptr<NeighbourGraph> graph = attach_graph(existing_dir, writer.get(), cutoff);
+    shared_ptr<Clusters> clusters = attach_clusters(existing_dir, writer.get(), cutoff);
+    compare_tiles(samples, tiles, cutoff, writer.get());
+    writer->close();
+    if(graph != nullptr){
+        cover(graph.get(), to_add);
+        graph->close();
     }
-
-    //Catch ones missed at the end due to rounding (doing on main thread)
-    vector<tuple<string, string, int>> distances;
-    for(unsigned int i=chunk_size*thread_count;i<comparisons.size();i++){
-        tuple<Sample*, Sample*> val = comparisons.at(i);
-        if(get<0>(val)->uuid == get<1>(val)->uuid){
-        }
-        int dist = get<0>(val)->dist(get<1>(val), cutoff);
-        if(dist <= cutoff){
-            distances.push_back({get<0>(val)->uuid,  get<1>(val)->uuid, dist});
-        }
-        if(distances.size() == 1000){
-            print_comparisons(distances);
-            distances = {};
-        }
+    if(clusters != nullptr){
+        clusters->close();
     }
-    print_comparisons(distances);
-
-    //Join the threads
-    for(unsigned int i=0;i<threads.size();i++){
-        threads.at(i).join();
-    }
-
-
-
 }
 
-vector<tuple<string, string, int>> ret_distances(vector<tuple<Sample*, Sample*>> comparisons, int cutoff){
+vector<Distance> ret_distances(vector<tuple<Sample*, Sample*>> comparisons, int cutoff){
     //To be used by Thread to do comparisons in parallel with no cutoff
-    vector<tuple<string, string, int>> distances;
+    vector<Distance> distances;
     for(unsigned int i=0;i<comparisons.size();i++){
         Sample *s1 = get<0>(comparisons.at(i));
         Sample *s2 = get<1>(comparisons.at(i));
-        if(s1->uuid == s2->uuid){
+        if(s1->id == s2->id){
             continue;
         }
         int dist = s1->dist(s2, cutoff);
         if(dist <= cutoff){
-            distances.push_back(make_tuple(s1->uuid, s2->uuid, dist));
+            distances.push_back(make_distance(s1, s2, dist));
         }
     }
     // Future return
@@ -590,14 +1474,14 @@ vector<tuple<string, string, int>> multi_matrix(vector<Sample *> samples, int th
     if(cutoff < 1){
         throw invalid_argument("Invalid cutoff. Should be > 0");
     }
-    unordered_set<string> seen;
+    unordered_set<uint32_t> seen;
     vector<tuple<Sample*, Sample*>> comparisons;
     for(unsigned int i=0;i<samples.size();i++){
         Sample *s1 = samples.at(i);
-        seen.insert(s1->uuid);
+        seen.insert(s1->id);
         for(unsigned int j=0;j<samples.size();j++){
             Sample *s2 = samples.at(j);
-            if(seen.contains(s2->uuid)){
+            if(seen.contains(s2->id)){
                 //We've already done this comparison
                 continue;
             }
@@ -609,8 +1493,8 @@ vector<tuple<string, string, int>> multi_matrix(vector<Sample *> samples, int th
 
     //Do comparisons with multithreading
     int chunk_size = comparisons.size() / thread_count;
-    vector<future<vector<tuple<string, string, int>>>> promises;
-    vector<tuple<string, string, int>> distances;
+    vector<future<vector<Distance>>> promises;
+    vector<Distance> distances;
 
     for(int i=0;i<thread_count;i++){
         vector<tuple<Sample*, Sample*>> these(comparisons.begin() + i*chunk_size, comparisons.begin() + i*chunk_size + chunk_size);
@@ -621,16 +1505,21 @@ vector<tuple<string, string, int>> multi_matrix(vector<Sample *> samples, int th
         tuple<Sample*, Sample*> val = comparisons.at(i);
         int dist = get<0>(val)->dist(get<1>(val), cutoff);
         if(dist <= cutoff){
-            distances.push_back(make_tuple(get<0>(val)->uuid, get<1>(val)->uuid, dist));
+            distances.push_back(make_distance(get<0>(val), get<1>(val), dist));
         }
     }
 
     //Join the threads
     for(unsigned int i=0;i<promises.size();i++){
-        vector<tuple<string, string, int>> dists = promises.at(i).get();
-        for(unsigned int j=0;j<dists.size();j++){
-            distances.push_back(dists.at(j));
-        }
+        vector<Distance> dists = promises.at(i).get();
+        distances.insert(distances.end(), dists.begin(), dists.end());
     }
-    return distances;
+
+    //Only resolve UUIDs now that all of the work is done
+    vector<tuple<string, string, int>> resolved;
+    resolved.reserve(distances.size());
+    for(const Distance &elem: distances){
+        resolved.push_back(make_tuple(uuid_of(elem.id1), uuid_of(elem.id2), elem.dist));
+    }
+    return resolved;
 }
\ No newline at end of file
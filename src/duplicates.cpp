@@ -0,0 +1,167 @@
+#include "include/duplicates.hpp"
+
+/**
+* @brief Grouping exact duplicates so each class is only compared once
+*/
+
+using namespace std;
+
+string duplicates_file = "";
+
+DuplicateClasses::DuplicateClasses(const vector<Sample*> &samples){
+    //Hashes can collide, so each hash can have several classes
+    unordered_map<uint64_t, vector<size_t>> by_hash;
+    vector<vector<Sample*>> classes;
+    for(Sample* s: samples){
+        vector<size_t> &candidates = by_hash[s->content_hash()];
+        bool found = false;
+        for(size_t c: candidates){
+            if(classes.at(c).front()->same_content(*s)){
+                classes.at(c).push_back(s);
+                found = true;
+                break;
+            }
+        }
+        if(!found){
+            candidates.push_back(classes.size());
+            classes.push_back({s});
+        }
+    }
+
+    if(classes.size() < 2){
+        representatives = samples;
+        return;
+    }
+    uint32_t largest = 0;
+    for(Sample* s: samples){
+        largest = max(largest, s->id);
+    }
+    positions.assign(samples.size() > 0 ? largest + 1 : 0, UINT32_MAX);
+    for(size_t i=0;i<samples.size();i++){
+        positions.at(samples.at(i)->id) = i;
+    }
+    for(const vector<Sample*> &members: classes){
+        representatives.push_back(members.front());
+        if(members.size() > 1){
+            vector<uint32_t> &ids = duplicates[members.front()->id];
+            for(Sample* s: members){
+                ids.push_back(s->id);
+            }
+        }
+    }
+}
+
+void DuplicateClasses::assign(const vector<Tile> &tiles){
+    //Tiles cover whole blocks of rows and columns, so find the first tile including each block
+    map<uint32_t, pair<uint32_t, uint32_t>> first_tile;
+    for(const Tile &tile: tiles){
+        first_tile.emplace(tile.row_start, make_pair(tile.row_end, tile.index));
+        first_tile.emplace(tile.col_start, make_pair(tile.col_end, tile.index));
+    }
+    for(uint32_t i=0;i<representatives.size();i++){
+        if(!duplicates.contains(representatives.at(i)->id)){
+            continue;
+        }
+        auto block = first_tile.upper_bound(i);
+        if(block == first_tile.begin()){
+            continue;
+        }
+        block--;
+        if(i < block->second.first){
+            assigned[block->second.second].push_back(representatives.at(i)->id);
+        }
+    }
+}
+
+void DuplicateClasses::fan_out(const Distance &distance, vector<Distance> &distances) const{
+    auto first = duplicates.find(distance.id1);
+    auto second = duplicates.find(distance.id2);
+    if(first == duplicates.end() && second == duplicates.end()){
+        distances.push_back(distance);
+        return;
+    }
+    vector<uint32_t> only_first = {distance.id1};
+    vector<uint32_t> only_second = {distance.id2};
+    const vector<uint32_t> &firsts = first == duplicates.end() ? only_first : first->second;
+    const vector<uint32_t> &seconds = second == duplicates.end() ? only_second : second->second;
+    auto position = [this](uint32_t id){
+        return id < positions.size() ? positions[id] : UINT32_MAX;
+    };
+    for(const uint32_t &id1: firsts){
+        for(const uint32_t &id2: seconds){
+            if(id1 == id2){
+                continue;
+            }
+            //Keep each pair in collection order, as if it had been compared directly
+            if(position(id1) > position(id2)){
+                distances.push_back(make_distance(id2, id1, distance.dist));
+            }
+            else{
+                distances.push_back(make_distance(id1, id2, distance.dist));
+            }
+        }
+    }
+}
+
+void DuplicateClasses::fan_out_new(uint32_t representative, uint32_t sample, int dist, vector<Distance> &distances) const{
+    auto found = duplicates.find(representative);
+    if(found == duplicates.end()){
+        distances.push_back(make_distance(representative, sample, dist));
+        return;
+    }
+    //Only the new sample is outside the collection, so the other members' distances to each other are untouched
+    for(const uint32_t &member: found->second){
+        if(member != sample){
+            distances.push_back(make_distance(member, sample, dist));
+        }
+    }
+}
+
+void DuplicateClasses::within(const Tile &tile, vector<Distance> &distances) const{
+    auto found = assigned.find(tile.index);
+    if(found == assigned.end()){
+        return;
+    }
+    for(const uint32_t &representative: found->second){
+        const vector<uint32_t> &members = duplicates.at(representative);
+        for(size_t i=0;i<members.size();i++){
+            for(size_t j=i+1;j<members.size();j++){
+                if(members.at(i) != members.at(j)){
+                    distances.push_back(make_distance(members.at(i), members.at(j), 0));
+                }
+            }
+        }
+    }
+}
+
+uint64_t DuplicateClasses::duplicate_count() const{
+    uint64_t count = 0;
+    for(const auto &[representative, members]: duplicates){
+        count += members.size() - 1;
+    }
+    return count;
+}
+
+void DuplicateClasses::report() const{
+    if(debug){
+        cout << "Found " << duplicates.size() << " classes of exact duplicates, with " << duplicate_count() << " duplicates" << endl;
+    }
+    if(duplicates_file == ""){
+        return;
+    }
+    fstream out(duplicates_file, fstream::out | fstream::trunc);
+    for(Sample* s: representatives){
+        auto members = duplicates.find(s->id);
+        if(members == duplicates.end()){
+            continue;
+        }
+        for(size_t i=0;i<members->second.size();i++){
+            out << (i > 0 ? "\t" : "") << uuid_of(members->second.at(i));
+        }
+        out << "\n";
+    }
+    out.close();
+    if(!out.good()){
+        throw invalid_argument("Error writing duplicates file: " + duplicates_file);
+    }
+}
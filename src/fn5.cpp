@@ -1,6 +1,14 @@
 #include "include/sample.hpp"
 #include "include/argparse.hpp"
 #include "include/comparisons.hpp"
+#include "include/server.hpp"
+#include "include/watch.hpp"
+#include "include/shared.hpp"
+#include "include/checkpoint.hpp"
+#include "include/duplicates.hpp"
+#include "include/knn.hpp"
+#include "include/aggregate.hpp"
+#include "include/remask.hpp"
 
 using namespace std;
 
@@ -39,11 +47,68 @@ int main(int nargs, const char* args_[]){
     if(check_flag(args, "--mask")){
         exclude_mask_path = args.at("--mask");
     }
+    if(check_flag(args, "--output_compression")){
+        output_compression = args.at("--output_compression");
+    }
+    if(check_flag(args, "--output_format")){
+        output_format = args.at("--output_format");
+    }
+    if(check_flag(args, "--sqlite")){
+        sqlite_path = args.at("--sqlite");
+    }
+    if(check_flag(args, "--graph_cutoff")){
+        graph_cutoff = stoi(args.at("--graph_cutoff"));
+    }
+    if(check_flag(args, "--cluster_cutoff")){
+        cluster_cutoff = stoi(args.at("--cluster_cutoff"));
+    }
+    if(check_flag(args, "--cluster_merges")){
+        cluster_merges_file = args.at("--cluster_merges");
+    }
+    if(check_flag(args, "--batch_size")){
+        batch_size = stoi(args.at("--batch_size"));
+    }
+    if(check_flag(args, "--batch_latency")){
+        batch_latency = stoi(args.at("--batch_latency"));
+    }
+    if(check_flag(args, "--shared_collection")){
+        shared_collection = args.at("--shared_collection") != "0";
+    }
+    if(check_flag(args, "--shared_dir")){
+        shared_dir = args.at("--shared_dir");
+    }
+    if(check_flag(args, "--tile_size")){
+        tile_size = stoi(args.at("--tile_size"));
+    }
     if(check_flag(args, "--debug")){
         if(args.at("--debug") != "0"){
             debug = true;
         }
     }
+    if(check_flag(args, "--regions")){
+        const vector<string> whole_sample_flags = {"--add", "--add_many", "--add_batch", "--update", "--serve", "--watch", "--client", "--remask"};
+        for(const string &flag: whole_sample_flags){
+            if(check_flag(args, flag)){
+                //These compare new samples with loaded ones, or keep distances, so need whole samples
+                throw invalid_argument("--regions can't be used with " + flag);
+            }
+        }
+        regions = Regions(args.at("--regions"));
+        //Distances within regions aren't the saves dir's own, so aren't kept in its graph or clusters
+        graph_cutoff = -1;
+        cluster_cutoff = -1;
+        //A shared collection holds whole samples
+        shared_collection = false;
+        if(debug){
+            cout << "Restricting to " << regions.intervals.size() << " regions covering " << regions.positions() << " positions" << endl;
+        }
+    }
+    if(check_flag(args, "--mask_profile")){
+        load_mask_profile(save_dir, args.at("--mask_profile"));
+        //Distances under a profile aren't the saves dir's own, so aren't kept in its graph or clusters
+        graph_cutoff = -1;
+        cluster_cutoff = -1;
+    }
 
 
     int cutoff = 20;
@@ -52,10 +117,191 @@ int main(int nargs, const char* args_[]){
         cutoff = stoi(args.at("--cutoff"));
     }
 
+    if(check_flag(args, "--rebuild_catalog")){
+        //Re-index an existing saves dir. Doesn't need the reference either
+        Catalog catalog = rebuild_catalog(args.at("--rebuild_catalog"));
+        if(debug){
+            cout << "Catalogued " << catalog.entries.size() << " samples in " << catalog.dir << endl;
+        }
+        return 0;
+    }
+
+    if(check_flag(args, "--client")){
+        //Send the request to a running `--serve` instead of doing it here
+        string socket_path = args.at("--client");
+        int request_cutoff = check_flag(args, "--cutoff") ? cutoff : -1;
+        auto read_fasta = [](string path){
+            fstream in(path, fstream::in | fstream::binary);
+            if(!in.good()){
+                throw invalid_argument("No such FASTA file " + path);
+            }
+            stringstream contents;
+            contents << in.rdbuf();
+            return contents.str();
+        };
+        string output;
+        if(check_flag(args, "--add")){
+            output = client_request(socket_path, "add", request_cutoff, "", read_fasta(args.at("--add")));
+        }
+        else if(check_flag(args, "--compare_row") && check_flag(args, "--nearest")){
+            //k is sent in place of the cutoff
+            output = client_request(socket_path, "nearest", stoi(args.at("--nearest")), "", read_fasta(args.at("--compare_row")));
+        }
+        else if(check_flag(args, "--compare_row")){
+            output = client_request(socket_path, "compare_row", request_cutoff, "", read_fasta(args.at("--compare_row")));
+        }
+        else if(check_flag(args, "--neighbours")){
+            output = client_request(socket_path, "neighbours", request_cutoff, args.at("--neighbours"));
+        }
+        else if(check_flag(args, "--remove")){
+            output = client_request(socket_path, "remove", request_cutoff, args.at("--remove"));
+        }
+        else if(check_flag(args, "--stats")){
+            output = client_request(socket_path, "stats", request_cutoff);
+        }
+        else if(check_flag(args, "--shutdown")){
+            output = client_request(socket_path, "shutdown", request_cutoff);
+        }
+        else{
+            throw invalid_argument("No request given for --client. Use one of --add, --compare_row, --neighbours, --remove, --stats or --shutdown");
+        }
+        cout << output;
+        cout.flush();
+        return 0;
+    }
+
+    if(check_flag(args, "--neighbours")){
+        //Answered from the neighbour graph, so no samples or reference needed
+        string uuid = args.at("--neighbours");
+        for(const auto &[neighbour, dist]: graph_neighbours(save_dir, uuid, cutoff)){
+            cout << uuid << " " << neighbour << " " << dist << "\n";
+        }
+        cout.flush();
+        return 0;
+    }
+
+    if(check_flag(args, "--remove")){
+        //Either a file of UUIDs, one per line, or comma separated UUIDs
+        string remove = args.at("--remove");
+        vector<string> uuids;
+        string uuid;
+        if(filesystem::is_regular_file(remove)){
+            fstream in(remove, fstream::in);
+            while(getline(in, uuid)){
+                if(uuid != ""){
+                    uuids.push_back(uuid);
+                }
+            }
+        }
+        else{
+            stringstream list(remove);
+            while(getline(list, uuid, ',')){
+                uuids.push_back(uuid);
+            }
+        }
+        remove_samples(save_dir, uuids);
+        return 0;
+    }
+
+    if(check_flag(args, "--compact")){
+        //Delete what removals and re-saves left behind
+        uint64_t deleted = compact_saves(args.at("--compact"));
+        if(debug){
+            cout << "Deleted " << deleted << " saves" << endl;
+        }
+        return 0;
+    }
+
+    if(check_flag(args, "--collect_garbage")){
+        //Remove replaced versions of saves which no running reader can see
+        uint64_t removed = collect_garbage(args.at("--collect_garbage"));
+        if(debug){
+            cout << "Removed " << removed << " old versions" << endl;
+        }
+        return 0;
+    }
+
+    if(check_flag(args, "--resume")){
+        resume_journal = args.at("--resume");
+    }
+    if(check_flag(args, "--checkpoint_interval")){
+        checkpoint_interval = stoi(args.at("--checkpoint_interval"));
+    }
+    if(check_flag(args, "--duplicates_file")){
+        duplicates_file = args.at("--duplicates_file");
+    }
+
+    if(check_flag(args, "--compact_graph")){
+        //Fold a saves dir's graph log into its index
+        compact_graph(args.at("--compact_graph"));
+        return 0;
+    }
+
+    if(check_flag(args, "--clusters")){
+        //Cluster of each sample in a saves dir
+        for(const auto &[uuid, cluster]: cluster_membership(args.at("--clusters"))){
+            cout << uuid << "\t" << cluster << "\n";
+        }
+        return 0;
+    }
+
+    if(check_flag(args, "--merge")){
+        //Combine the outputs of `--compute --partition` runs
+        merge_partitions(args.at("--merge"));
+        return 0;
+    }
+
+    if(check_flag(args, "--knn")){
+        //Every sample's k nearest, however far
+        compute_knn(stoi(args.at("--knn")), load_saves_multithreaded());
+        return 0;
+    }
+
+    if(check_flag(args, "--aggregate")){
+        //Summaries of the matrix, without outputting it
+        compute_aggregate(args.at("--aggregate"), cutoff, load_saves_multithreaded());
+        return 0;
+    }
+
     //Check for compute first as it doesn't need reference
     if(check_flag(args, "--compute")){
-        vector<Sample*> samples = load_saves_multithreaded();
-        compute_loaded(cutoff, samples);
+        if(check_flag(args, "--partition")){
+            vector<Sample*> samples = load_saves_multithreaded();
+            //Given as <i>/<n>, with i from 1 to n
+            string partition = args.at("--partition");
+            size_t slash = partition.find("/");
+            if(slash == string::npos){
+                throw invalid_argument("Invalid partition, expected <i>/<n>: " + partition);
+            }
+            string partition_dir = "partitions";
+            if(check_flag(args, "--partition_dir")){
+                partition_dir = args.at("--partition_dir");
+            }
+            compute_partition(cutoff, samples, stoi(partition.substr(0, slash)), stoi(partition.substr(slash+1)), partition_dir);
+            return 0;
+        }
+        if(check_flag(args, "--cutoffs")){
+            //Tiers of output, all computed in one pass at the largest
+            stringstream tiers(args.at("--cutoffs"));
+            string tier;
+            while(getline(tiers, tier, ',')){
+                output_cutoffs.push_back(stoi(tier));
+            }
+            if(output_cutoffs.size() == 0){
+                throw invalid_argument("Invalid cutoffs, expected <cutoff>,<cutoff>,...: " + args.at("--cutoffs"));
+            }
+            cutoff = *max_element(output_cutoffs.begin(), output_cutoffs.end());
+        }
+        uint64_t since = 0;
+        if(check_flag(args, "--since")){
+            //Either a marker, or the last run with this cutoff
+            string marker = args.at("--since");
+            since = marker == "last" ? last_run(save_dir, cutoff) : stoull(marker);
+        }
+        uint64_t marker = compute_saves(cutoff, since);
+        if(debug){
+            cout << "Run marker: " << marker << endl;
+        }
         return 0;
     }
 
@@ -63,10 +309,37 @@ int main(int nargs, const char* args_[]){
         add_batch(args.at("--add_batch"), cutoff);
     }
     
+    if(check_flag(args, "--remask")){
+        //Apply a larger mask to the saves, with `--mask` as the one they were written with
+        remask_saves(save_dir, load_mask(exclude_mask_path), load_mask(args.at("--remask")));
+        return 0;
+    }
+
     string reference = load_reference(ref_genome_path);
     
     unordered_set<int> mask = load_mask(exclude_mask_path);
 
+    const vector<string> parsing_flags = {"--serve", "--watch", "--bulk_load", "--add", "--add_many", "--update", "--compare_row", "--reference_compress"};
+    for(const string &flag: parsing_flags){
+        if(check_flag(args, flag)){
+            //Parsed samples are compared with (and saved alongside) the saves, so must be masked the same way
+            check_mask(save_dir, mask);
+            break;
+        }
+    }
+
+    if(check_flag(args, "--serve")){
+        //Stays resident until shut down
+        serve(args.at("--serve"), reference, mask, cutoff);
+        return 0;
+    }
+
+    if(check_flag(args, "--watch")){
+        //Runs until interrupted
+        watch(args.at("--watch"), reference, mask, cutoff);
+        return 0;
+    }
+
     if(check_flag(args, "--bulk_load")){
         bulk_load(args.at("--bulk_load"), reference, mask);
     }
@@ -79,7 +352,16 @@ int main(int nargs, const char* args_[]){
         add_many(args.at("--add_many"), reference, mask, cutoff);
     }
 
-    if(check_flag(args, "--compare_row")){
+    if(check_flag(args, "--update")){
+        //Replace a saved sample with a corrected version
+        update_sample(args.at("--update"), reference, mask, cutoff);
+    }
+
+    if(check_flag(args, "--compare_row") && check_flag(args, "--nearest")){
+        //The k nearest, rather than everything within the cutoff
+        nearest_row(args.at("--compare_row"), reference, mask, stoi(args.at("--nearest")));
+    }
+    else if(check_flag(args, "--compare_row")){
         compare_row(args.at("--compare_row"), reference, mask, cutoff);
     }
 
@@ -0,0 +1,34 @@
+#include "include/output.hpp"
+
+using namespace std;
+
+/**
+* @brief Convert a binary distance output back to `<guid1> <guid2> <dist>` text on stdout
+*/
+int main(int nargs, const char* args[]){
+    if(nargs != 2){
+        cerr << "Usage: fn5-dump <binary distance file>" << endl;
+        return 1;
+    }
+    string path = args[1];
+    if(path == "--version" || path == "-v"){
+        cout << "v2.0.7" << endl;
+        return 0;
+    }
+
+    string text;
+    read_binary_distances(path, [&text](const vector<string> &names, const vector<Distance> &distances){
+        for(const Distance &elem: distances){
+            text += names.at(elem.id1);
+            text += ' ';
+            text += names.at(elem.id2);
+            text += ' ';
+            text += to_string(elem.dist);
+            text += '\n';
+        }
+        fwrite(text.c_str(), 1, text.size(), stdout);
+        text.clear();
+    });
+    fflush(stdout);
+    return 0;
+}
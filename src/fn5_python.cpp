@@ -19,7 +19,10 @@ PYBIND11_MODULE(fn5, m) {
            load
            load_reference
            load_mask
+           set_mask_profile
+           Regions
            compute
+           nearest
     )pbdoc";
     #ifdef VERSION_INFO
         m.attr("__version__") = MACRO_STRINGIFY(VERSION_INFO);
@@ -30,7 +33,15 @@ PYBIND11_MODULE(fn5, m) {
         Sample object. Used to store sample data and compute distances.
         -----------------------
         )pbdoc")
-        .def_readwrite("uuid", &Sample::uuid,  R"pbdoc(
+        .def_property("uuid",
+            [](const Sample &s) {
+                return s.uuid;
+            },
+            [](Sample &s, string uuid) {
+                //Keep the interned ID in step with the UUID
+                s.uuid = uuid;
+                s.id = intern_uuid(uuid);
+            }, R"pbdoc(
         string: Sample UUID
         )pbdoc")
         .def_readwrite("A", &Sample::A,  R"pbdoc(
@@ -72,23 +83,32 @@ PYBIND11_MODULE(fn5, m) {
             mask (set[int]): Set of masked positions. See `load_mask`.
             uuid (str): Sample ID.
         )pbdoc", py::arg("filepath"), py::arg("reference"), py::arg("mask"), py::arg("uuid"))
-        .def("dist", &Sample::dist, R"pbdoc(
+        .def("dist", [](Sample &self, Sample* sample, int cutoff, const Regions* regions){
+            if(regions == nullptr || regions->empty()){
+                return self.dist(sample, cutoff);
+            }
+            unique_ptr<Sample> restricted_self(regions->restricted(&self));
+            unique_ptr<Sample> restricted_sample(regions->restricted(sample));
+            return restricted_self->dist(restricted_sample.get(), cutoff);
+        }, R"pbdoc(
         Calculate the distance between this sample and the given sample.
         -----------------------
 
         Args:
             sample (fn5.Sample): Sample to compare to. It is up to the user to ensure these are the same species.
             cutoff (int): SNP threshold. Set to 999999 for effectively no cutoff.
+            regions (fn5.Regions, optional): Only count positions within these regions. Defaults to genome wide.
+                For many comparisons, restrict each sample once with `Regions.restrict` instead.
         
         Returns:
             int: SNP distance. If returned distance = cutoff + 1, the sample was further away than the cutoff. 
-        )pbdoc", py::arg("sample"), py::arg("cutoff"))
+        )pbdoc", py::arg("sample"), py::arg("cutoff"), py::arg("regions") = (const Regions*) nullptr)
         .def("__repr__",
             [](const Sample &s) {
                 return "<fn5.Sample '" + s.uuid + "'>";
             }
         );
-    m.def("save", &save, R"pbdoc(
+    m.def("save", [](string path, Sample* sample){ save(path, sample); }, R"pbdoc(
         Save a sample to disk.
         -----------------------
 
@@ -126,17 +146,74 @@ PYBIND11_MODULE(fn5, m) {
         Returns:
             set[int]: Set of genome positions which should be masked.
         )pbdoc", py::arg("filename"));
-    m.def("compute", &multi_matrix, R"pbdoc(
+    m.def("set_mask_profile", &set_query_mask, R"pbdoc(
+        Ignore some positions in every distance from now on, on top of the mask samples were parsed with.
+        -----------------------
+
+        Args:
+            mask (set[int]): Genome positions to ignore. An empty set to stop ignoring any.
+        )pbdoc", py::arg("mask"));
+    py::class_<Regions>(m, "Regions", R"pbdoc(
+        Genomic intervals to restrict distances to, such as a gene panel.
+        -----------------------
+        )pbdoc")
+        .def(py::init<string>(), R"pbdoc(
+        Read regions from a BED file. The chromosome is ignored.
+        -----------------------
+
+        Args:
+            path (str): Path to the BED file. 0-based, half open intervals.
+        )pbdoc", py::arg("path"))
+        .def_readonly("intervals", &Regions::intervals, R"pbdoc(
+        list[tuple[int, int]]: Sorted, merged [start, end) intervals.
+        )pbdoc")
+        .def("restrict", &Regions::restricted, R"pbdoc(
+        Copy a sample, keeping only its positions within the regions.
+        -----------------------
+
+        Args:
+            sample (fn5.Sample): Sample to copy.
+
+        Returns:
+            fn5.Sample: The restricted copy.
+        )pbdoc", py::arg("sample"), py::return_value_policy::take_ownership);
+    m.def("compute", [](vector<Sample*> samples, int thread_count, int cutoff, const Regions* regions){
+        if(regions == nullptr || regions->empty()){
+            return multi_matrix(samples, thread_count, cutoff);
+        }
+        //Each sample is restricted once, rather than for every pair
+        vector<unique_ptr<Sample>> owned;
+        vector<Sample*> restricted;
+        for(Sample* s: samples){
+            owned.push_back(unique_ptr<Sample>(regions->restricted(s)));
+            restricted.push_back(owned.back().get());
+        }
+        return multi_matrix(restricted, thread_count, cutoff);
+    }, R"pbdoc(
         Compute a distance matrix for the given samples.
         -----------------------
 
         Args:
             samples (list[fn5.Sample]): List of samples who's distances should be computed.
             thread_count (int, optional): Number of threads to use for computation. Defaults to 4.
-            cutoff (int, optional): SNP cutoff to use. Defaults to 999999 for effectively no cutoff.
+            cutoff (int, optional): SNP cutoff to use. Defaults to 65535, the largest distance which can be returned,
+                for effectively no cutoff. With a higher cutoff, distances above 65535 are returned as 65535.
+            regions (fn5.Regions, optional): Only count positions within these regions. Defaults to genome wide.
 
         Returns:
             list[tuple[str, str, int]]: List of pairwise distances. If a pairwise distance is missing, is was further than SNP cutoff. Tuple format: (sample1.uuid, sample2.uuid, sample1.dist(sample2, cutoff))
-        )pbdoc", py::arg("samples") , py::arg("thread_count") = 4, py::arg("cutoff") = 999999);
+        )pbdoc", py::arg("samples") , py::arg("thread_count") = 4, py::arg("cutoff") = max_distance, py::arg("regions") = (const Regions*) nullptr);
+    m.def("nearest", &nearest_samples, R"pbdoc(
+        Find the k nearest samples to a sample exactly.
+        -----------------------
+
+        Args:
+            sample (fn5.Sample): Sample to find the neighbours of.
+            samples (list[fn5.Sample]): Samples to search.
+            k (int, optional): Number of neighbours to find. Defaults to 1.
+
+        Returns:
+            list[tuple[str, int]]: UUID and distance of up to k nearest samples, closest first.
+        )pbdoc", py::arg("sample"), py::arg("samples"), py::arg("k") = 1);
 }
 
@@ -0,0 +1,579 @@
+#include "include/graph.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <numeric>
+#include <string_view>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+* @brief Persistent neighbour graph, kept in the `graph` dir of a saves dir
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+const string graph_dirname = "graph";
+
+/**
+* @brief Get the graph dir of a saves dir
+*/
+string graph_dir_of(string dir){
+    while(dir.size() > 1 && dir[dir.size()-1] == '/'){
+        dir.pop_back();
+    }
+    return dir + "/" + graph_dirname;
+}
+
+/**
+* @brief Size of a file, or 0 if it doesn't exist
+*/
+uint64_t size_or_zero(string path){
+    error_code ec;
+    uint64_t size = fs::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+/**
+* @brief Holds an exclusive lock on a graph's lock file for its lifetime
+*/
+class GraphLockGuard{
+    public:
+        int fd;
+
+        GraphLockGuard(int fd_){
+            fd = fd_;
+            if(flock(fd, LOCK_EX) != 0){
+                throw invalid_argument("Error locking neighbour graph");
+            }
+        }
+
+        ~GraphLockGuard(){
+            flock(fd, LOCK_UN);
+        }
+};
+
+/**
+* @brief Open a graph's lock file
+*/
+int open_lock(string graph_dir){
+    int fd = open((graph_dir + "/lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0){
+        throw invalid_argument("Error opening neighbour graph: " + graph_dir);
+    }
+    return fd;
+}
+
+/**
+* @brief Read complete lines of `nodes.txt` (or `covered.txt`) from an offset
+*
+* @param path Path to the file
+* @param offset Byte offset to start at
+* @param names Vector to append the lines to
+* @returns The offset after the last complete line
+*/
+uint64_t read_nodes(string path, uint64_t offset, vector<string> &names){
+    uint64_t size = size_or_zero(path);
+    if(size <= offset){
+        return offset;
+    }
+    string data(size - offset, '\0');
+    fstream in(path, fstream::in | fstream::binary);
+    in.seekg(offset);
+    in.read(data.data(), data.size());
+    data.resize(in.gcount());
+    in.close();
+
+    size_t start = 0;
+    size_t end;
+    while((end = data.find('\n', start)) != string::npos){
+        names.push_back(data.substr(start, end - start));
+        start = end + 1;
+    }
+    return offset + start;
+}
+
+/**
+* @brief Read complete records of `edges.log` from an offset
+*/
+vector<Distance> read_edges(string path, uint64_t offset, uint64_t end){
+    vector<Distance> edges;
+    if(end <= offset){
+        return edges;
+    }
+    edges.resize((end - offset) / sizeof(Distance));
+    fstream in(path, fstream::in | fstream::binary);
+    in.seekg(offset);
+    in.read((char *) edges.data(), edges.size() * sizeof(Distance));
+    edges.resize(in.gcount() / sizeof(Distance));
+    in.close();
+    return edges;
+}
+
+/**
+* @brief Round up to a multiple of 8
+*/
+uint64_t align8(uint64_t size){
+    return (size + 7) & ~(uint64_t) 7;
+}
+
+/**
+* @brief Read only view of a graph's `index.csr`. Mapped, so looking up a node doesn't read the whole index
+*/
+class GraphIndex{
+    public:
+        GraphIndexHeader header;
+        const uint64_t* offsets = nullptr;
+        const uint64_t* name_offsets = nullptr;
+        const uint32_t* sorted = nullptr;
+        const GraphNeighbour* neighbours = nullptr;
+        const char* names = nullptr;
+
+        GraphIndex(string path){
+            int fd = open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                throw invalid_argument("Error opening neighbour graph index: " + path);
+            }
+            size = size_or_zero(path);
+            if(size < sizeof(GraphIndexHeader)){
+                ::close(fd);
+                throw invalid_argument("Malformed neighbour graph index: " + path);
+            }
+            data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if(data == MAP_FAILED){
+                data = nullptr;
+                throw invalid_argument("Error mapping neighbour graph index: " + path);
+            }
+            const char* base = (const char *) data;
+            memcpy(&header, base, sizeof(GraphIndexHeader));
+            if(memcmp(header.magic, "FN5G", 4) != 0 || header.version != graph_index_version){
+                unmap();
+                throw invalid_argument("Malformed neighbour graph index: " + path);
+            }
+            uint64_t n = header.node_count;
+            uint64_t pos = sizeof(GraphIndexHeader);
+            offsets = (const uint64_t *) (base + pos);
+            pos += (n + 1) * sizeof(uint64_t);
+            name_offsets = (const uint64_t *) (base + pos);
+            pos += (n + 1) * sizeof(uint64_t);
+            sorted = (const uint32_t *) (base + pos);
+            pos = align8(pos + n * sizeof(uint32_t));
+            neighbours = (const GraphNeighbour *) (base + pos);
+            pos += header.edge_count * sizeof(GraphNeighbour);
+            names = base + pos;
+            if(pos > size || offsets[n] != header.edge_count || pos + name_offsets[n] != size){
+                unmap();
+                throw invalid_argument("Malformed neighbour graph index: " + path);
+            }
+        }
+
+        ~GraphIndex(){
+            unmap();
+        }
+
+        /**
+        * @brief UUID of a node in the index
+        */
+        string_view name(uint32_t node) const{
+            return string_view(names + name_offsets[node], name_offsets[node + 1] - name_offsets[node]);
+        }
+
+        /**
+        * @brief Node ID of a UUID, or UINT32_MAX if it isn't in the index
+        */
+        uint32_t find(const string &uuid) const{
+            uint32_t low = 0;
+            uint32_t high = header.node_count;
+            while(low < high){
+                uint32_t mid = low + (high - low) / 2;
+                if(name(sorted[mid]) < uuid){
+                    low = mid + 1;
+                }
+                else{
+                    high = mid;
+                }
+            }
+            if(low < header.node_count && name(sorted[low]) == uuid){
+                return sorted[low];
+            }
+            return UINT32_MAX;
+        }
+
+    private:
+        void* data = nullptr;
+        uint64_t size = 0;
+
+        void unmap(){
+            if(data != nullptr){
+                munmap(data, size);
+                data = nullptr;
+            }
+        }
+};
+
+/**
+* @brief Write a graph's index, replacing the existing one
+*
+* @param graph_dir Graph dir
+* @param cutoff Graph's cutoff
+* @param names UUIDs by node ID
+* @param edges Neighbour entries as (node, neighbour, dist), sorted by node then (dist, neighbour)
+* @param log_size Bytes of `edges.log` covered
+* @param nodes_size Bytes of `nodes.txt` covered
+*/
+void write_index(string graph_dir, uint32_t cutoff, const vector<string> &names, const vector<Distance> &edges, uint64_t log_size, uint64_t nodes_size){
+    GraphIndexHeader header;
+    memcpy(header.magic, "FN5G", 4);
+    header.version = graph_index_version;
+    header.cutoff = cutoff;
+    header.node_count = names.size();
+    header.edge_count = edges.size();
+    header.log_size = log_size;
+    header.nodes_size = nodes_size;
+
+    vector<uint64_t> offsets(names.size() + 1, 0);
+    for(const Distance &edge: edges){
+        offsets[edge.id1 + 1]++;
+    }
+    vector<uint64_t> name_offsets(names.size() + 1, 0);
+    for(uint32_t i=0;i<names.size();i++){
+        offsets[i + 1] += offsets[i];
+        name_offsets[i + 1] = name_offsets[i] + names[i].size();
+    }
+    vector<uint32_t> sorted(names.size());
+    iota(sorted.begin(), sorted.end(), 0);
+    sort(sorted.begin(), sorted.end(), [&names](uint32_t a, uint32_t b){ return names[a] < names[b]; });
+    vector<GraphNeighbour> neighbours(edges.size());
+    for(uint64_t i=0;i<edges.size();i++){
+        neighbours[i].node = edges[i].id2;
+        neighbours[i].dist = edges[i].dist;
+    }
+
+    //Write alongside then rename, so readers always see a whole index
+    string path = graph_dir + "/index.csr";
+    fstream out(path + ".tmp", fstream::out | fstream::binary | fstream::trunc);
+    out.write((const char *) &header, sizeof(GraphIndexHeader));
+    out.write((const char *) offsets.data(), offsets.size() * sizeof(uint64_t));
+    out.write((const char *) name_offsets.data(), name_offsets.size() * sizeof(uint64_t));
+    out.write((const char *) sorted.data(), sorted.size() * sizeof(uint32_t));
+    uint64_t pos = sizeof(GraphIndexHeader) + (offsets.size() + name_offsets.size()) * sizeof(uint64_t) + sorted.size() * sizeof(uint32_t);
+    const char padding[8] = {0};
+    out.write(padding, align8(pos) - pos);
+    out.write((const char *) neighbours.data(), neighbours.size() * sizeof(GraphNeighbour));
+    for(const string &name: names){
+        out.write(name.c_str(), name.size());
+    }
+    out.close();
+    if(out.fail()){
+        throw invalid_argument("Error writing neighbour graph index: " + path);
+    }
+    fs::rename(path + ".tmp", path);
+}
+
+/**
+* @brief Fold the log into a graph's index. The lock must be held
+*/
+void compact_locked(string graph_dir){
+    GraphIndex index(graph_dir + "/index.csr");
+    vector<string> names;
+    uint64_t nodes_size = read_nodes(graph_dir + "/nodes.txt", 0, names);
+    uint64_t log_size = size_or_zero(graph_dir + "/edges.log");
+    log_size -= log_size % sizeof(Distance);
+    vector<Distance> logged = read_edges(graph_dir + "/edges.log", index.header.log_size, log_size);
+
+    //Existing entries first, then the log in order, so a stable sort keeps the latest entry for each pair last
+    vector<Distance> edges;
+    edges.reserve(index.header.edge_count + 2 * logged.size());
+    for(uint32_t node=0;node<index.header.node_count;node++){
+        for(uint64_t i=index.offsets[node];i<index.offsets[node + 1];i++){
+            edges.push_back({node, index.neighbours[i].node, index.neighbours[i].dist});
+        }
+    }
+    for(const Distance &edge: logged){
+        if(edge.id1 >= names.size() || edge.id2 >= names.size()){
+            throw invalid_argument("Neighbour graph log refers to an unknown node: " + graph_dir);
+        }
+        if(edge.id1 == edge.id2){
+            continue;
+        }
+        edges.push_back({edge.id1, edge.id2, edge.dist});
+        edges.push_back({edge.id2, edge.id1, edge.dist});
+    }
+    stable_sort(edges.begin(), edges.end(), [](const Distance &a, const Distance &b){
+        if(a.id1 != b.id1){
+            return a.id1 < b.id1;
+        }
+        return a.id2 < b.id2;
+    });
+    vector<Distance> kept;
+    kept.reserve(edges.size());
+    for(uint64_t i=0;i<edges.size();i++){
+        if(i + 1 < edges.size() && edges[i].id1 == edges[i + 1].id1 && edges[i].id2 == edges[i + 1].id2){
+            //Replaced by a later entry
+            continue;
+        }
+        if(edges[i].dist > index.header.cutoff){
+            //Removed
+            continue;
+        }
+        kept.push_back(edges[i]);
+    }
+    edges.clear();
+    edges.shrink_to_fit();
+    //Closest first within each node, so queries can stop at their cutoff
+    sort(kept.begin(), kept.end(), [](const Distance &a, const Distance &b){
+        if(a.id1 != b.id1){
+            return a.id1 < b.id1;
+        }
+        if(a.dist != b.dist){
+            return a.dist < b.dist;
+        }
+        return a.id2 < b.id2;
+    });
+    write_index(graph_dir, index.header.cutoff, names, kept, log_size, nodes_size);
+}
+
+NeighbourGraph::NeighbourGraph(string saves_dir, int cutoff_){
+    dir = graph_dir_of(saves_dir);
+    fs::create_directories(dir);
+    lock_fd = open_lock(dir);
+    GraphLockGuard guard(lock_fd);
+    if(!fs::exists(dir + "/index.csr")){
+        if(cutoff_ < 0 || cutoff_ > max_distance){
+            throw invalid_argument("Invalid neighbour graph cutoff: " + to_string(cutoff_));
+        }
+        //Everything already logged (if anything) is left for the next compaction
+        write_index(dir, cutoff_, {}, {}, 0, 0);
+    }
+    GraphIndex index(dir + "/index.csr");
+    cutoff = index.header.cutoff;
+}
+
+NeighbourGraph::~NeighbourGraph(){
+    try{
+        close();
+    }
+    catch(const exception &e){
+        cerr << e.what() << endl;
+    }
+}
+
+void NeighbourGraph::refresh_nodes(){
+    vector<string> names;
+    nodes_size = read_nodes(dir + "/nodes.txt", nodes_size, names);
+    for(const string &name: names){
+        uint32_t id = node_ids.size();
+        node_ids[name] = id;
+    }
+}
+
+uint32_t NeighbourGraph::node(uint32_t id, string &new_nodes){
+    if(id >= node_of.size()){
+        node_of.resize(id + 1, UINT32_MAX);
+    }
+    if(node_of[id] == UINT32_MAX){
+        string uuid = uuid_of(id);
+        auto found = node_ids.find(uuid);
+        if(found == node_ids.end()){
+            uint32_t n = node_ids.size();
+            node_ids[uuid] = n;
+            new_nodes += uuid;
+            new_nodes += '\n';
+            node_of[id] = n;
+        }
+        else{
+            node_of[id] = found->second;
+        }
+    }
+    return node_of[id];
+}
+
+void NeighbourGraph::append(const vector<Distance> &distances){
+    log(distances, false);
+}
+
+void NeighbourGraph::remove(const vector<Distance> &distances){
+    log(distances, true);
+}
+
+void NeighbourGraph::log(const vector<Distance> &distances, bool removing){
+    if(lock_fd < 0){
+        throw invalid_argument("Neighbour graph is closed");
+    }
+    GraphLockGuard guard(lock_fd);
+    //Other processes may have added nodes since
+    refresh_nodes();
+    vector<Distance> edges;
+    string new_nodes;
+    for(const Distance &elem: distances){
+        if(removing){
+            //Beyond any cutoff, so replaces the edge until it is dropped by a compaction
+            edges.push_back({node(elem.id1, new_nodes), node(elem.id2, new_nodes), max_distance});
+            continue;
+        }
+        if(elem.dist > cutoff){
+            continue;
+        }
+        edges.push_back({node(elem.id1, new_nodes), node(elem.id2, new_nodes), elem.dist});
+    }
+    if(edges.size() == 0){
+        return;
+    }
+
+    //Nodes go first so the log never refers to a node which isn't written
+    if(new_nodes.size() > 0){
+        fstream nodes(dir + "/nodes.txt", fstream::out | fstream::app | fstream::binary);
+        nodes.write(new_nodes.c_str(), new_nodes.size());
+        nodes.close();
+        if(nodes.fail()){
+            throw invalid_argument("Error writing neighbour graph nodes: " + dir);
+        }
+        nodes_size += new_nodes.size();
+    }
+    fstream edges_out(dir + "/edges.log", fstream::out | fstream::app | fstream::binary);
+    edges_out.write((const char *) edges.data(), edges.size() * sizeof(Distance));
+    edges_out.close();
+    if(edges_out.fail()){
+        throw invalid_argument("Error writing neighbour graph log: " + dir);
+    }
+}
+
+void NeighbourGraph::cover(const vector<uint32_t> &ids, bool covered){
+    if(lock_fd < 0){
+        throw invalid_argument("Neighbour graph is closed");
+    }
+    string lines;
+    for(const uint32_t &id: ids){
+        lines += (covered ? "covered\t" : "uncovered\t") + uuid_of(id) + "\n";
+    }
+    if(lines.size() == 0){
+        return;
+    }
+    GraphLockGuard guard(lock_fd);
+    fstream out(dir + "/covered.txt", fstream::out | fstream::app | fstream::binary);
+    out.write(lines.c_str(), lines.size());
+    out.close();
+    if(out.fail()){
+        throw invalid_argument("Error writing neighbour graph coverage: " + dir);
+    }
+}
+
+void NeighbourGraph::maintain(){
+    if(lock_fd < 0){
+        throw invalid_argument("Neighbour graph is closed");
+    }
+    GraphLockGuard guard(lock_fd);
+    GraphIndex index(dir + "/index.csr");
+    uint64_t logged = (size_or_zero(dir + "/edges.log") - index.header.log_size) / sizeof(Distance);
+    if(logged >= graph_compact_threshold){
+        compact_locked(dir);
+    }
+}
+
+void NeighbourGraph::close(){
+    if(lock_fd < 0){
+        return;
+    }
+    maintain();
+    ::close(lock_fd);
+    lock_fd = -1;
+}
+
+vector<pair<string, int>> graph_neighbours(string dir, string uuid, int cutoff){
+    string graph_dir = graph_dir_of(dir);
+    if(!fs::exists(graph_dir + "/index.csr")){
+        throw invalid_argument("No neighbour graph in " + dir);
+    }
+    GraphIndex index(graph_dir + "/index.csr");
+    if(cutoff > (int) index.header.cutoff){
+        throw invalid_argument("Cutoff of " + to_string(cutoff) + " is above the neighbour graph's cutoff of " + to_string(index.header.cutoff));
+    }
+
+    //Nodes and edges added since the last compaction
+    vector<string> tail_names;
+    read_nodes(graph_dir + "/nodes.txt", index.header.nodes_size, tail_names);
+    uint64_t log_size = size_or_zero(graph_dir + "/edges.log");
+    vector<Distance> logged = read_edges(graph_dir + "/edges.log", index.header.log_size, log_size);
+
+    uint32_t node = index.find(uuid);
+    for(uint32_t i=0;node == UINT32_MAX && i<tail_names.size();i++){
+        if(tail_names[i] == uuid){
+            node = index.header.node_count + i;
+        }
+    }
+    if(node == UINT32_MAX){
+        //Never been within the cutoff of anything
+        return {};
+    }
+
+    unordered_map<uint32_t, int> found;
+    if(node < index.header.node_count){
+        for(uint64_t i=index.offsets[node];i<index.offsets[node + 1];i++){
+            if(index.neighbours[i].dist > cutoff){
+                break;
+            }
+            found[index.neighbours[i].node] = index.neighbours[i].dist;
+        }
+    }
+    //Later entries replace earlier ones
+    for(const Distance &edge: logged){
+        if(edge.id1 == node && edge.id2 != node){
+            found[edge.id2] = edge.dist;
+        }
+        else if(edge.id2 == node && edge.id1 != node){
+            found[edge.id1] = edge.dist;
+        }
+    }
+
+    vector<pair<string, int>> neighbours;
+    for(const auto &[other, dist]: found){
+        if(dist > cutoff){
+            continue;
+        }
+        if(other < index.header.node_count){
+            neighbours.push_back(make_pair(string(index.name(other)), dist));
+        }
+        else if(other - index.header.node_count < tail_names.size()){
+            neighbours.push_back(make_pair(tail_names[other - index.header.node_count], dist));
+        }
+    }
+    sort(neighbours.begin(), neighbours.end(), [](const pair<string, int> &a, const pair<string, int> &b){
+        if(a.second != b.second){
+            return a.second < b.second;
+        }
+        return a.first < b.first;
+    });
+    return neighbours;
+}
+
+unordered_set<string> graph_coverage(string dir){
+    vector<string> lines;
+    //Only complete lines, so one being appended is left out
+    read_nodes(graph_dir_of(dir) + "/covered.txt", 0, lines);
+    unordered_set<string> covered;
+    for(const string &line: lines){
+        if(line.starts_with("covered\t")){
+            covered.insert(line.substr(8));
+        }
+        else if(line.starts_with("uncovered\t")){
+            covered.erase(line.substr(10));
+        }
+    }
+    return covered;
+}
+
+void compact_graph(string dir){
+    string graph_dir = graph_dir_of(dir);
+    if(!fs::exists(graph_dir + "/index.csr")){
+        throw invalid_argument("No neighbour graph in " + dir);
+    }
+    int fd = open_lock(graph_dir);
+    {
+        GraphLockGuard guard(fd);
+        compact_locked(graph_dir);
+    }
+    ::close(fd);
+}
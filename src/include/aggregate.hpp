@@ -0,0 +1,81 @@
+#pragma once
+#include "tiles.hpp"
+
+/**
+* @brief Summaries of a pairwise matrix (`--aggregate <mode>`), without outputting any pairs. Uses the same tiles and
+            kernel as `--compute`, but each thread reduces the distances within the cutoff into its own counts, which
+            are merged once every tile is done. Exact duplicates are compared once and counted for every member.
+
+    Modes:
+        `histogram`: number of pairs at each distance within the cutoff
+        `degree`: number of samples within the cutoff of each sample
+        `nearest`: each sample's nearest distance within the cutoff, or `-` if there is none
+
+    Output is TSV on stdout, with a header line
+*/
+
+using namespace std;
+
+/**
+* @brief Counts reduced from the distances within the cutoff, indexed by position in the collection
+*/
+class Aggregates{
+    public:
+        /**
+        * @brief Number of pairs at each distance
+        */
+        vector<uint64_t> histogram;
+
+        /**
+        * @brief Number of samples within the cutoff of each sample
+        */
+        vector<uint64_t> degree;
+
+        /**
+        * @brief Each sample's nearest distance, or `max_distance` if there is none within the cutoff
+        */
+        vector<int> nearest;
+
+        /**
+        * @brief Empty counts
+        *
+        * @param samples Number of samples in the collection
+        */
+        Aggregates(size_t samples);
+
+        /**
+        * @brief Count a distance between two samples, each of which stands for some number of identical samples
+        *
+        * @param i Position of the first sample
+        * @param j Position of the second sample
+        * @param dist Distance between them
+        * @param weight_i Number of samples the first stands for
+        * @param weight_j Number of samples the second stands for
+        */
+        void add(uint32_t i, uint32_t j, int dist, uint64_t weight_i=1, uint64_t weight_j=1);
+
+        /**
+        * @brief Add another thread's counts to these
+        *
+        * @param other Counts over the same collection
+        */
+        void merge(const Aggregates &other);
+};
+
+/**
+* @brief Reduce the distances within the cutoff between every pair of a collection, using `thread_count` threads
+*
+* @param cutoff SNP threshold
+* @param samples Collection
+* @returns Counts, indexed by position in `samples`
+*/
+Aggregates aggregate_loaded(int cutoff, const vector<Sample*> &samples);
+
+/**
+* @brief Write a summary of a collection's pairwise matrix to stdout
+*
+* @param mode One of `histogram`, `degree` or `nearest`
+* @param cutoff SNP threshold
+* @param samples Collection
+*/
+void compute_aggregate(string mode, int cutoff, vector<Sample*> samples);
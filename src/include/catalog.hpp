@@ -0,0 +1,260 @@
+#pragma once
+#include "sample.hpp"
+
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+/**
+* @brief Definition of the save catalog. A manifest of every sample in a saves dir, maintained by `save`
+
+    The catalog is append only, so any prefix of it is a consistent view of the saves dir. The generation is the
+    catalog's base (from its header) plus its size in bytes. Rebuilding the catalog starts the new file's base at the
+    old file's generation and keeps each entry's generation, so generations only ever increase. Save files are never changed once written: a sample's first save is `<uuid>.fn5`, and each re-save is
+    written to `versions/<v>/<uuid>.fn5` before its catalog line is appended, which publishes it.
+    Readers pin the generation they read with a `Snapshot`, and versions which have been replaced are removed by
+    `collect_garbage` once no pinned reader can still see them.
+    A sample is removed by appending a `removed\t<uuid>` tombstone, after which its save is treated like a replaced version
+*/
+
+using namespace std;
+
+/**
+* @brief Name of the catalog file within a saves dir
+*/
+extern const string catalog_filename;
+
+/**
+* @brief Name of the file within a saves dir recording matrix runs, by the generation they covered
+*/
+extern const string runs_filename;
+
+/**
+* @brief Name of the dir within a saves dir holding re-saved versions of samples
+*/
+extern const string versions_dirname;
+
+/**
+* @brief Name of the dir within a saves dir holding readers' snapshot pins
+*/
+extern const string readers_dirname;
+
+/**
+* @brief A single catalog record. One per saved sample
+*/
+class CatalogEntry{
+    public:
+        /**
+        * @brief Insertion sequence number. Dense, starting at 0, and stable across re-saves of the same UUID
+        */
+        uint32_t seq;
+
+        /**
+        * @brief The sample's UUID
+        */
+        string uuid;
+
+        /**
+        * @brief Save file containing the sample, relative to the saves dir
+        */
+        string file;
+
+        /**
+        * @brief Byte offset of the sample within `file`
+        */
+        uint64_t offset;
+
+        /**
+        * @brief Size of the sample's save in bytes
+        */
+        uint64_t size;
+
+        /**
+        * @brief Number of positions in each of A, C, G, T, N (in that order)
+        */
+        uint32_t counts[5];
+
+        /**
+        * @brief The first generation which can see this entry. The end of its line in the catalog, unless it was
+                carried over from before a rebuild
+        */
+        uint64_t end;
+};
+
+/**
+* @brief In memory copy of a saves dir's catalog. Membership checks do not touch the filesystem
+*/
+class Catalog{
+    public:
+        /**
+        * @brief Saves dir this catalog describes (no trailing /)
+        */
+        string dir;
+
+        /**
+        * @brief Entries keyed by UUID
+        */
+        unordered_map<string, CatalogEntry> entries;
+
+        /**
+        * @brief Size of the catalog file when it was read. Used to detect changes by other writers
+        */
+        uint64_t file_size = 0;
+
+        /**
+        * @brief Generation the catalog file starts at
+        */
+        uint64_t base = 0;
+
+        /**
+        * @brief Inode of the catalog file when it was read. A rebuild replaces the file, so this changes
+        */
+        uint64_t inode = 0;
+
+        /**
+        * @brief Next unused sequence number
+        */
+        uint32_t next_seq = 0;
+
+        /**
+        * @brief Save files of versions which have since been replaced, with the first generation which could see them
+                and the generation they were replaced in
+        */
+        map<string, pair<uint64_t, uint64_t>> superseded;
+
+        /**
+        * @brief Last save file of each removed UUID which hasn't been saved again. Empty if its file isn't known
+        */
+        unordered_map<string, string> removed;
+
+        /**
+        * @brief The generation this catalog is at
+        *
+        * @returns Base plus the size of the catalog file
+        */
+        uint64_t generation() const;
+
+        /**
+        * @brief Check if a UUID has been saved
+        *
+        * @param uuid UUID to check for
+        * @returns true if the UUID is in the catalog
+        */
+        bool contains(const string &uuid) const;
+
+        /**
+        * @brief Catalog entries in insertion order. This is the order samples should be loaded in
+        *
+        * @returns Vector of entries sorted by sequence number
+        */
+        vector<CatalogEntry> ordered() const;
+
+        /**
+        * @brief Paths to each save file, in insertion order
+        *
+        * @returns Vector of `<dir>/<file>` paths
+        */
+        vector<string> paths() const;
+};
+
+/**
+* @brief Get the catalog for a saves dir. If the dir has no catalog (i.e saves from an older version), it is rebuilt first
+*
+* @param dir Saves dir
+* @returns Snapshot of the catalog
+*/
+Catalog load_catalog(string dir);
+
+/**
+* @brief Record a newly written save in its dir's catalog. Threadsafe
+*
+* @param dir Saves dir the sample was saved in
+* @param sample Sample which was saved
+* @param file Filename of the save, relative to `dir`
+* @param offset Offset of the save within `file`
+* @param size Size of the save in bytes
+*/
+void catalog_add(string dir, Sample* sample, string file, uint64_t offset, uint64_t size);
+
+/**
+* @brief Remove a sample from its dir's catalog by appending a tombstone. Loaders skip it from then on. Threadsafe
+*
+* @param dir Saves dir
+* @param uuid UUID of the sample
+* @returns false if the UUID isn't saved
+*/
+bool catalog_remove(string dir, string uuid);
+
+/**
+* @brief Where to write a sample's next save
+*
+* @param dir Saves dir
+* @param uuid UUID of the sample
+* @returns Path relative to `dir`. `<uuid>.fn5` if it hasn't been saved before, otherwise a new version
+*/
+string catalog_save_path(string dir, string uuid);
+
+/**
+* @brief A pinned, consistent view of a saves dir. Nothing it refers to is removed until it is destroyed
+*/
+class Snapshot{
+    public:
+        /**
+        * @brief The catalog as of the pinned generation
+        */
+        Catalog catalog;
+
+        /**
+        * @brief Pin the current generation of a saves dir.
+                If a pin can't be created (e.g a read only saves dir), this is an unpinned catalog
+        *
+        * @param dir Saves dir
+        */
+        Snapshot(string dir);
+
+        /**
+        * @brief Release the pin
+        */
+        ~Snapshot();
+
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+    private:
+        /**
+        * @brief Path of the pin file
+        */
+        string pin_path;
+
+        /**
+        * @brief File descriptor of the pin, locked for as long as it is held. -1 if unpinned
+        */
+        int pin_fd = -1;
+};
+
+/**
+* @brief Remove replaced versions and removed samples which no pinned reader can still see, and pins left by
+            readers which have died
+*
+* @param dir Saves dir
+* @returns Number of save files removed
+*/
+uint64_t collect_garbage(string dir);
+
+/**
+* @brief Rewrite a saves dir's catalog without lines for replaced versions and removed samples which have been
+            collected, keeping every generation. Threadsafe, and safe against other processes saving
+*
+* @param dir Saves dir
+* @returns Number of lines dropped
+*/
+uint64_t compact_catalog(string dir);
+
+/**
+* @brief Rebuild a catalog from the contents of a saves dir. Existing sequence numbers and generations are kept where
+            possible, and anything else is given a generation after every earlier one (or any recorded run)
+*
+* @param dir Saves dir
+* @returns The rebuilt catalog
+*/
+Catalog rebuild_catalog(string dir);
@@ -0,0 +1,102 @@
+#pragma once
+#include "tiles.hpp"
+
+#include <set>
+
+/**
+* @brief Checkpoints for long tiled runs (`--compute` and `--add_batch`), so a run which dies can be resumed
+
+    With `--resume <journal>`, results go to `output_file`, and every `checkpoint_interval` seconds the output is
+    flushed and synced, then a line recording the tiles it now covers and its size is appended to the journal and synced.
+    Rerunning the same job with the same journal truncates the output back to the last checkpoint, and only compares
+    the tiles which aren't in the journal, so each result is output exactly once.
+
+    The journal is text: a `job` line describing the job, then a `checkpoint\t<output size>\t<tile>,<tile>,...` line
+    per checkpoint. A final line without a newline was torn by a crash, so is ignored
+*/
+
+using namespace std;
+
+/**
+* @brief Journal to checkpoint to, and resume from if it exists. Can be set with the `--resume` flag
+*/
+extern string resume_journal;
+
+/**
+* @brief Least number of seconds between checkpoints. Can be set with the `--checkpoint_interval` flag
+*/
+extern int checkpoint_interval;
+
+/**
+* @brief Number of tiles to aim for when checkpointing. Fixed, so reruns split the job the same way whatever the thread count
+*/
+const uint64_t checkpoint_min_tiles = 1024;
+
+/**
+* @brief A job's checkpoint journal
+*/
+class Journal{
+    public:
+        /**
+        * @brief Path to the journal
+        */
+        string path;
+
+        /**
+        * @brief Description of the job
+        */
+        string job;
+
+        /**
+        * @brief Tiles covered by the last checkpoint
+        */
+        set<uint64_t> done;
+
+        /**
+        * @brief Size of the output at the last checkpoint
+        */
+        uint64_t offset = 0;
+
+        /**
+        * @brief Open a journal, reading its checkpoints if it exists, or starting it if not
+        *
+        * @param path Path to the journal
+        * @param job Description of the job. Must match the journal's if it exists
+        */
+        Journal(string path, string job);
+
+        /**
+        * @brief Tiles still to be compared
+        *
+        * @param tiles Every tile of the job
+        * @returns Tiles not covered by a checkpoint
+        */
+        vector<Tile> remaining(const vector<Tile> &tiles) const;
+
+        /**
+        * @brief Truncate an output back to the last checkpoint, creating it if required
+        *
+        * @param output Path to the output
+        */
+        void resume(string output) const;
+
+        /**
+        * @brief Append and sync a checkpoint
+        *
+        * @param tiles Tiles completed since the last checkpoint
+        * @param size Size of the output, which must already be synced
+        */
+        void record(const vector<uint64_t> &tiles, uint64_t size);
+};
+
+/**
+* @brief Open a writer for a tiled job. If `resume_journal` is set, results go to `output_file` with checkpoints,
+            and tiles already checkpointed are removed from `tiles`. With `output_cutoffs`, results go to each tier's
+            output. Otherwise results go to stdout
+*
+* @param job Description of the job, including everything which changes its tiles
+* @param tiles Every tile of the job. Replaced with the tiles still to be compared
+* @param append Whether the job adds to an existing output, rather than replacing it
+* @returns Writer
+*/
+unique_ptr<ResultWriter> open_tiled_writer(string job, vector<Tile> &tiles, bool append=false);
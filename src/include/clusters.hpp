@@ -0,0 +1,154 @@
+#pragma once
+#include "output.hpp"
+
+/**
+* @brief Single linkage clusters of a saves dir, maintained as samples are added. Kept in `clusters.log` in the saves dir
+
+    The log is text: a `cutoff\t<cutoff>` line, then a `merge\t<uuid>\t<uuid>\t<dist>` line for each pair within the
+    cutoff which joined two clusters. So it is a spanning forest of the clusters, and replaying it into a union-find
+    gives every sample's cluster without loading any samples. A final line without a newline was torn by a crash, so
+    is ignored. Samples which aren't in the log are clusters of their own. A `dirty\t<uuid>` line marks a sample whose
+    distances have changed, so merges through it may no longer hold. Clusters of removed or dirty samples are rebuilt
+    from the neighbour graph when read, until `compact_clusters` rewrites the log without them
+*/
+
+using namespace std;
+
+/**
+* @brief Name of the clusters log within a saves dir
+*/
+extern const string clusters_filename;
+
+/**
+* @brief Largest distance linking a new clusters log. Negative to not maintain clusters. Can be set with the `--cluster_cutoff` flag
+*/
+extern int cluster_cutoff;
+
+/**
+* @brief File to write the merges made by each add to. Can be set with the `--cluster_merges` flag
+*/
+extern string cluster_merges_file;
+
+/**
+* @brief Union-find over interned IDs
+*/
+class UnionFind{
+    public:
+        /**
+        * @brief Root of the cluster containing an ID
+        */
+        uint32_t find(uint32_t id);
+
+        /**
+        * @brief Join the clusters of two IDs
+        *
+        * @returns Whether they were in different clusters
+        */
+        bool join(uint32_t id1, uint32_t id2);
+
+    private:
+        /**
+        * @brief Parent of each ID, itself for roots
+        */
+        vector<uint32_t> parent;
+
+        /**
+        * @brief Size of each root's cluster
+        */
+        vector<uint32_t> size;
+
+        /**
+        * @brief Make sure an ID has an entry
+        */
+        void grow(uint32_t id);
+};
+
+/**
+* @brief A saves dir's clusters, updated with distances found by adds. Feed with `ResultWriter::observe`
+*/
+class Clusters{
+    public:
+        /**
+        * @brief Largest distance linking two samples. Taken from the existing log if there is one
+        */
+        int cutoff;
+
+        /**
+        * @brief Merges made through this object, as `merge` lines of the log
+        */
+        vector<string> merges;
+
+        /**
+        * @brief Open a saves dir's clusters, starting the log if required
+        *
+        * @param dir Saves dir
+        * @param cutoff Largest distance linking two samples if starting the log
+        */
+        Clusters(string dir, int cutoff);
+
+        /**
+        * @brief Close the log if it hasn't been already
+        */
+        ~Clusters();
+
+        /**
+        * @brief Join the clusters of any pairs within the cutoff, logging the pairs which merged two clusters
+        *
+        * @param distances Distances between interned IDs
+        */
+        void append(const vector<Distance> &distances);
+
+        /**
+        * @brief Mark samples whose distances have changed, so their clusters are rebuilt from the neighbour graph
+        *
+        * @param ids Interned IDs of the samples
+        */
+        void dirty(const vector<uint32_t> &ids);
+
+        /**
+        * @brief Write `merges` to `cluster_merges_file` (if set), then release the log
+        */
+        void close();
+
+    private:
+        /**
+        * @brief Path to the log
+        */
+        string path;
+
+        /**
+        * @brief File descriptor of the log, locked while reading or appending. -1 once closed
+        */
+        int fd = -1;
+
+        /**
+        * @brief Bytes of the log replayed into `forest`
+        */
+        uint64_t replayed = 0;
+
+        /**
+        * @brief Clusters as far as `replayed`
+        */
+        UnionFind forest;
+
+        /**
+        * @brief Replay any merges logged since, by this or other processes. The lock must be held
+        */
+        void refresh();
+};
+
+/**
+* @brief Cluster of every sample in a saves dir, without loading any samples
+*
+* @param dir Saves dir
+* @returns (UUID, cluster) for each sample in insertion order. Each cluster is named by its first sample
+*/
+vector<pair<string, string>> cluster_membership(string dir);
+
+/**
+* @brief Rewrite a saves dir's clusters log without any removed or dirty samples, rebuilding their clusters from the
+            neighbour graph. Does nothing if there is no log
+*
+* @param dir Saves dir
+*/
+void compact_clusters(string dir);
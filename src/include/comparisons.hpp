@@ -1,5 +1,10 @@
 #pragma once
 #include "sample.hpp"
+#include "catalog.hpp"
+#include "output.hpp"
+#include "graph.hpp"
+#include "clusters.hpp"
+#include "regions.hpp"
 
 #include <mutex>
 #include <tuple>
@@ -38,7 +43,8 @@ extern int thread_count;
 extern string ref_genome_path;
 
 /**
-* @brief Default exclusion mask. Note that changing this without deleting saves **WILL** cause issues
+* @brief Default exclusion mask. Note that changing this without deleting saves **WILL** cause issues, unless the
+            saves are re-masked with `--remask`
             If this is set to "ignore", no mask will be used.
 */
 extern string exclude_mask_path;
@@ -49,7 +55,113 @@ extern string exclude_mask_path;
 extern bool debug;
 
 /**
-* @brief Load all saves from disk
+* @brief Compression to use for distance outputs. Either `none` or `gzip`. Can be changed with the `--output_compression` flag
+*/
+extern string output_compression;
+
+/**
+* @brief Format for distance outputs. One of `text`, `binary` or `binary_delta`. Can be changed with the `--output_format` flag
+*/
+extern string output_format;
+
+/**
+* @brief SQLite database to write distances to, instead of the usual outputs. Can be set with the `--sqlite` flag
+*/
+extern string sqlite_path;
+
+/**
+* @brief Open a writer for distances using the configured format and compression. Writes to `sqlite_path` if set
+*
+* @param path Where to write to. `-` for stdout
+* @returns The writer
+*/
+unique_ptr<ResultWriter> open_writer(string path);
+
+/**
+* @brief Cutoffs of the output tiers of a matrix. Empty for a single output. Can be set with the `--cutoffs` flag
+*/
+extern vector<int> output_cutoffs;
+
+/**
+* @brief Path of a tier's output, with the cutoff before the extension (`all.txt` -> `all.5.txt`)
+*
+* @param path Path of the whole output
+* @param cutoff Cutoff of the tier
+* @returns Path of the tier's output
+*/
+string tier_path(string path, int cutoff);
+
+/**
+* @brief Open a writer for every tier of `output_cutoffs`, each to its own file next to `output_file`.
+            The matrix should be computed to the largest cutoff, which is the writer returned; the others are its tees
+*
+* @param append Whether to add to the tiers' existing outputs, rather than clearing them
+* @returns Writer for the largest tier
+*/
+unique_ptr<ResultWriter> open_tiered_writer(bool append=false);
+
+/**
+* @brief Write the number of results in each tier to `output_file` with a `.tiers.tsv` extension, after the writer has
+            closed. Does nothing without `output_cutoffs`
+*
+* @param writer Writer from `open_tiered_writer`
+*/
+void report_tiers(ResultWriter* writer);
+
+/**
+* @brief Note whether a new sample passed QC. One which didn't is never saved, so its distances are kept out of the
+            graph and clusters (see `passing_qc`)
+*
+* @param sample New sample
+*/
+void note_qc(const Sample* sample);
+
+/**
+* @brief Distances which don't involve a new sample which failed QC
+*
+* @param distances Distances to filter
+* @returns The distances between samples which will be saved
+*/
+vector<Distance> passing_qc(const vector<Distance> &distances);
+
+/**
+* @brief Largest distance kept in a new neighbour graph. Negative to not update the graph. Can be set with the `--graph_cutoff` flag
+*/
+extern int graph_cutoff;
+
+/**
+* @brief Record new samples as covered by a graph once all of their comparisons have been appended to it.
+            Ones which failed QC are skipped
+*
+* @param graph Graph the comparisons were appended to
+* @param samples New samples
+*/
+void cover(NeighbourGraph* graph, const vector<Sample*> &samples);
+
+/**
+* @brief Open the saves dir's neighbour graph (unless disabled) and add everything the writer sees to it.
+            If the graph's cutoff is above `cutoff`, `cutoff` is raised to match and the writer limited to the original
+*
+* @param dir Saves dir
+* @param writer Writer to observe
+* @param cutoff Cutoff for the comparisons. May be raised
+* @returns The graph, to be closed after the writer. nullptr if disabled
+*/
+shared_ptr<NeighbourGraph> attach_graph(string dir, ResultWriter* writer, int &cutoff);
+
+/**
+* @brief Open the saves dir's clusters (unless disabled) and join any pairs the writer sees within their cutoff.
+            If the clusters' cutoff is above `cutoff`, `cutoff` is raised to match and the writer limited to the original
+*
+* @param dir Saves dir
+* @param writer Writer to observe
+* @param cutoff Cutoff for the comparisons. May be raised
+* @returns The clusters, to be closed after the writer. nullptr if disabled
+*/
+shared_ptr<Clusters> attach_clusters(string dir, ResultWriter* writer, int &cutoff);
+
+/**
+* @brief Load all saves from disk, in catalog order
 *
 * @returns Vector of samples
 */
@@ -64,12 +176,20 @@ vector<Sample*> load_saves();
 void load_save_thread(vector<string> filenames, vector<Sample*> *acc);
 
 /**
-* @brief Load all saves using multithreading
+* @brief Load all saves using multithreading. Samples are returned in catalog order
 *
 * @returns Vector of all loaded saves
 */
 vector<Sample*> load_saves_multithreaded();
 
+/**
+* @brief Load specific saves using multithreading. Samples are returned in the same order
+*
+* @param filenames Paths to the saves
+* @returns Vector of loaded saves
+*/
+vector<Sample*> load_saves_multithreaded(vector<string> filenames);
+
 
 /**
 * @brief Parse the FASTA files defined in `paths` and save to disk in a threadsafe manner
@@ -94,16 +214,16 @@ vector<Sample*> bulk_load(string path, string reference, unordered_set<int> mask
 /**
 * @brief Save a list of comparisons to disk. Threadsafe
 *
-* @param comparisons List of precomputed comparisons. Tuples of (guid1, guid2, dist)
+* @param comparisons List of precomputed comparisons. UUIDs are resolved here
 */
-void save_comparisons(vector<tuple<string, string, int>> comparisons);
+void save_comparisons(const vector<Distance> &comparisons);
 
 /**
 * @brief Print a list of comparisons to stdout. Threadsafe
 *
-* @param comparisons List of precomputed comparisons. Tuples of (guid1, guid2, dist)
+* @param comparisons List of precomputed comparisons. UUIDs are resolved here
 */
-void print_comparisons(vector<tuple<string, string, int>> comparisons);
+void print_comparisons(const vector<Distance> &comparisons);
 
 
 /**
@@ -112,8 +232,9 @@ void print_comparisons(vector<tuple<string, string, int>> comparisons);
 * @param paths List of save paths
 * @param sample Pre-loaded sample
 * @param cutoff SNP cutoff 
+* @param writer Writer to hand results to. If not given, results are appended to `output_file`
 */
-void do_comparisons_from_disk(vector<string> paths, Sample* sample, int cutoff);
+void do_comparisons_from_disk(vector<string> paths, Sample* sample, int cutoff, ResultWriter* writer = nullptr);
 
 /**
 * @brief Add a single new FASTA to saved samples. Compute distances between this sample and all existing saves
@@ -126,15 +247,17 @@ void do_comparisons_from_disk(vector<string> paths, Sample* sample, int cutoff);
 void add_sample(string path, string reference, unordered_set<int> mask, int cutoff);
 
 /**
-* @brief Find distances between given sample pairs, printing results to stdout
+* @brief Find distances between given sample pairs, buffering results locally and handing them to a writer
 *
 * @param comparisons Pairs of samples to find distances between
 * @param cutoff SNP cutoff
+* @param writer Writer to hand results to. If not given, results are printed to stdout
 */
-void do_comparisons(vector<tuple<Sample*, Sample*>> comparisons, int cutoff);
+void do_comparisons(vector<tuple<Sample*, Sample*>> comparisons, int cutoff, ResultWriter* writer = nullptr);
 
 /**
-* @brief Similar to `add`, but loads to memory once to add multiple samples
+* @brief Similar to `add`, but loads to memory once to add multiple samples.
+            The existing samples load while the new ones are parsed, and each new sample is compared as soon as it's parsed
 *
 * @param path Path to a line separated file of FASTA paths
 * @param reference Reference nucleotides
@@ -143,6 +266,58 @@ void do_comparisons(vector<tuple<Sample*, Sample*>> comparisons, int cutoff);
 */
 void add_many(string path, string reference, unordered_set<int> mask, int cutoff);
 
+/**
+* @brief Compare new samples against existing samples and each other, all already in memory.
+            Each new sample is compared in blocks, so even a single new sample uses every thread
+*
+* @param existing Samples already in the collection
+* @param others New samples
+* @param cutoff SNP threshold
+* @returns Number of results written
+*/
+uint64_t add_loaded(vector<Sample*> existing, vector<Sample*> others, int cutoff);
+
+/**
+* @brief Lower bound on the distance between two samples, from how many positions each has
+*
+* @param s Sample
+* @param view Other sample
+* @returns A distance which `s->dist(view, ...)` is never below
+*/
+int distance_lower_bound(const Sample* s, const SampleView &view);
+
+/**
+* @brief Find the k nearest samples exactly. Samples are compared in order of their lower bound, each with the current
+            k-th best distance as its cutoff, stopping once no sample left can be closer
+*
+* @param s Sample to find the neighbours of
+* @param views Samples to search. Any with the same ID as `s` are skipped
+* @param k Number of neighbours to find
+* @returns (ID, distance) of up to k nearest samples, closest first. Equal distances are ordered by
+            interned ID, but which of several samples tied at the k-th distance are kept is unspecified
+*/
+vector<pair<uint32_t, int>> nearest(Sample* s, const vector<SampleView> &views, int k);
+
+/**
+* @brief Find the k nearest of some samples. To be used by Python API
+*
+* @param s Sample to find the neighbours of
+* @param samples Samples to search
+* @param k Number of neighbours to find
+* @returns (UUID, distance) of up to k nearest samples, closest first
+*/
+vector<tuple<string, int>> nearest_samples(Sample* s, vector<Sample*> samples, int k = 1);
+
+/**
+* @brief Print the k nearest saved samples to a sample. Nothing is saved
+*
+* @param path Path to a FASTA file
+* @param reference Reference nucleotides
+* @param mask Exclusion mask
+* @param k Number of neighbours to find
+*/
+void nearest_row(string path, string reference, unordered_set<int> mask, int k);
+
 /**
 * @brief Add a sample to existing saves. Prints results to stdout. Returns nearest if no samples within cutoff
 *
@@ -153,6 +328,74 @@ void add_many(string path, string reference, unordered_set<int> mask, int cutoff
 */
 void compare_row(string path, string reference, unordered_set<int> mask, int cutoff);
 
+/**
+* @brief Remove samples from a saves dir. Each is tombstoned in the catalog, so every loader skips it from then on,
+            then its edges are removed from the neighbour graph. Their saves are left for `compact_saves`
+*
+* @param dir Saves dir
+* @param uuids UUIDs to remove. Nothing is removed unless every one is saved
+*/
+void remove_samples(string dir, vector<string> uuids);
+
+/**
+* @brief Get ready to add samples again. Their old edges may not hold for the new versions, so are removed from the
+            neighbour graph (which uncovers them) before any new ones are appended, and their clusters marked dirty so
+            they're rebuilt from the graph. Ones which failed QC aren't saved, so keep theirs
+*
+* @param dir Saves dir
+* @param samples Samples being added again
+* @param clusters The saves dir's clusters, if they're maintained
+*/
+void readd(string dir, const vector<Sample*> &samples, Clusters* clusters=nullptr);
+
+/**
+* @brief Tidy a saves dir after removals: make sure the graph has no edges to removed samples and compact it, rewrite
+            the clusters log without them, then delete the saves of removed samples and replaced versions which no
+            pinned reader can still see, and compact the catalog. No other saves are rewritten
+*
+* @param dir Saves dir
+* @returns Number of save files deleted
+*/
+uint64_t compact_saves(string dir);
+
+/**
+* @brief Positions where two versions of a sample differ: a different base, or an N on only one side
+*
+* @param before Old version
+* @param after New version
+* @returns Sorted positions
+*/
+vector<int> changed_positions(const Sample* before, const Sample* after);
+
+/**
+* @brief Distances from a corrected sample. Distances only change at the changed positions, so samples without
+            variants or Ns at any of them are just shifted from the old version's known distances, and only the rest
+            are compared
+*
+* @param before Old version
+* @param after New version
+* @param views Collection to find distances to
+* @param known Old version's distances by interned ID, up to `known_cutoff`
+* @param covered Interned IDs for which `known` is complete, so a missing one is beyond `known_cutoff`.
+            Anything else without a known distance is compared
+* @param known_cutoff Largest distance `known` is complete to
+* @param cutoff SNP threshold
+* @returns (ID, distance) of every sample in `views` within `cutoff` of the new version, in collection order
+*/
+vector<pair<uint32_t, int>> update_distances(Sample* before, Sample* after, const vector<SampleView> &views, const unordered_map<uint32_t, int> &known, const unordered_set<uint32_t> &covered, int known_cutoff, int cutoff);
+
+/**
+* @brief Replace a saved sample with a corrected version, using the neighbour graph for its old distances.
+            Prints its distances within the cutoff, then a `Removed: ` line for each pair which was within the cutoff
+            but no longer is. The graph and clusters are updated, then the new version saved
+*
+* @param path Path to a FASTA file of the new version. Its UUID must already be saved
+* @param reference Reference nucleotides
+* @param mask Exclusion mask
+* @param cutoff SNP threshold
+*/
+void update_sample(string path, string reference, unordered_set<int> mask, int cutoff);
+
 /**
 * @brief Compute a pairwise matrix of specified samples already in memory
 * 
@@ -161,6 +404,34 @@ void compare_row(string path, string reference, unordered_set<int> mask, int cut
 */
 void compute_loaded(int cutoff, vector<Sample*> samples);
 
+/**
+* @brief Record a completed matrix run in a saves dir, so a later run can compute only what has changed since
+*
+* @param dir Saves dir
+* @param marker Catalog generation the run covered
+* @param cutoff SNP threshold of the run
+*/
+void record_run(string dir, uint64_t marker, int cutoff);
+
+/**
+* @brief Get the marker of the last completed matrix run with a given cutoff
+*
+* @param dir Saves dir
+* @param cutoff SNP threshold
+* @returns Catalog generation the run covered
+*/
+uint64_t last_run(string dir, int cutoff);
+
+/**
+* @brief Compute a matrix of the saves in `save_dir`, then record the run.
+            If given a marker, only pairs including a sample saved after it are computed, and the output is not cleared
+*
+* @param cutoff SNP threshold
+* @param since Marker of an earlier run (the catalog generation it covered), or 0 for every pair
+* @returns Marker of this run
+*/
+uint64_t compute_saves(int cutoff, uint64_t since=0);
+
 /**
 * @brief Reference compress a single sample
 *
@@ -184,7 +455,7 @@ void add_batch(string path, int cutoff);
 *
 * @param samples Vector of samples to compute matrix for
 * @param thread_count Number of threads to use. Defaults to 4
-* @param cutoff SNP threshold to cutoff at. Defaults to arbirarily high (999999).
-* @returns Vector of distances
+* @param cutoff SNP threshold to cutoff at. Defaults to `max_distance`, the largest distance which can be returned
+* @returns Vector of distances. Ones above `max_distance` (only possible with a higher cutoff) are saturated at it
 */
-vector<tuple<string, string, int>> multi_matrix(vector<Sample*> samples, int thread_count = 4, int cutoff = 9999999);
\ No newline at end of file
+vector<tuple<string, string, int>> multi_matrix(vector<Sample*> samples, int thread_count = 4, int cutoff = max_distance);
\ No newline at end of file
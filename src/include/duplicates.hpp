@@ -0,0 +1,97 @@
+#pragma once
+#include "tiles.hpp"
+
+/**
+* @brief Exact duplicates. Samples with identical positions (resubmissions, technical replicates) are grouped into
+            classes by `content_hash`, so only the first of each class needs comparing. Each distance between two
+            representatives is then fanned out to every pair of their members, and members of the same class are
+            at distance 0 from each other
+*/
+
+using namespace std;
+
+/**
+* @brief File to write the duplicate classes found to, one class per line. Can be set with the `--duplicates_file` flag
+*/
+extern string duplicates_file;
+
+/**
+* @brief A collection grouped into classes of exact duplicates
+*/
+class DuplicateClasses{
+    public:
+        /**
+        * @brief First sample of each class, in collection order. Only these need comparing
+        */
+        vector<Sample*> representatives;
+
+        /**
+        * @brief IDs of the members of each class with more than one, in collection order, keyed by the representative's ID
+        */
+        unordered_map<uint32_t, vector<uint32_t>> duplicates;
+
+        /**
+        * @brief Group a collection. A collection which is all one class is left ungrouped, as there would be no
+                pairs of representatives to output its members from
+        *
+        * @param samples Collection, in a fixed order
+        */
+        DuplicateClasses(const vector<Sample*> &samples);
+
+        /**
+        * @brief Decide which tile outputs the distances within each class: the first one including its representative
+        *
+        * @param tiles Every tile of `representatives`, before any are filtered out
+        */
+        void assign(const vector<Tile> &tiles);
+
+        /**
+        * @brief Add a distance between two representatives as the distances between every pair of their members
+        *
+        * @param distance Distance to fan out
+        * @param distances Results to add to
+        */
+        void fan_out(const Distance &distance, vector<Distance> &distances) const;
+
+        /**
+        * @brief Add a distance between a representative and a new sample as the distances between each member and the
+                new sample. A member with the new sample's ID is its old version, so is left out. This includes the
+                representative itself when it's the one re-added
+        *
+        * @param representative Interned ID of the representative
+        * @param sample Interned ID of the new sample
+        * @param dist Distance between them
+        * @param distances Results to add to
+        */
+        void fan_out_new(uint32_t representative, uint32_t sample, int dist, vector<Distance> &distances) const;
+
+        /**
+        * @brief Add the distances within the classes a tile was assigned
+        *
+        * @param tile Tile
+        * @param distances Results to add to
+        */
+        void within(const Tile &tile, vector<Distance> &distances) const;
+
+        /**
+        * @brief Number of samples which aren't representatives
+        */
+        uint64_t duplicate_count() const;
+
+        /**
+        * @brief Write each class with more than one member to `duplicates_file` (if set), one per line of tab separated
+                UUIDs with the representative first
+        */
+        void report() const;
+
+    private:
+        /**
+        * @brief Position of each sample in the collection, indexed by ID. UINT32_MAX if not in the collection
+        */
+        vector<uint32_t> positions;
+
+        /**
+        * @brief Representatives of the classes with more than one member, keyed by the tile which outputs their distances
+        */
+        unordered_map<uint32_t, vector<uint32_t>> assigned;
+};
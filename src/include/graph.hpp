@@ -0,0 +1,215 @@
+#pragma once
+#include "output.hpp"
+
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+* @brief Persistent neighbour graph, kept in the `graph` dir of a saves dir. Nodes are persistent sample IDs,
+            assigned in order of first appearance in `nodes.txt` (one UUID per line)
+
+    * `edges.log`: Append only log of `Distance` records between node IDs. Later records for a pair replace earlier ones,
+        and records beyond the cutoff remove the edge
+    * `index.csr`: Compacted adjacency index covering a prefix of `nodes.txt` and `edges.log`. Laid out as a
+        `GraphIndexHeader`, uint64 neighbour offsets by node (node_count + 1), uint64 name offsets by node (node_count + 1),
+        uint32 node IDs sorted by UUID (node_count), padding to 8 bytes, `GraphNeighbour`s (edge_count) sorted by
+        (dist, node) for each node, then the UUIDs
+    * `covered.txt`: Log of `covered\t<uuid>` and `uncovered\t<uuid>` lines. A sample is covered once every distance
+        within the cutoff between it and the collection at the time has been logged. Between two covered samples, a
+        missing edge means they're beyond the cutoff. Samples saved without the graph (e.g `--bulk_load`) never are
+    * `lock`: Held while appending or compacting
+*/
+
+using namespace std;
+
+/**
+* @brief Name of the graph dir within a saves dir
+*/
+extern const string graph_dirname;
+
+/**
+* @brief Number of uncompacted edges in the log which triggers a compaction when a graph is maintained
+*/
+const uint64_t graph_compact_threshold = 65536;
+
+/**
+* @brief Header of a graph's `index.csr`
+*/
+struct __attribute__((packed)) GraphIndexHeader{
+    /**
+    * @brief Always `FN5G`
+    */
+    char magic[4];
+
+    /**
+    * @brief Index format version
+    */
+    uint32_t version;
+
+    /**
+    * @brief Largest distance stored in the graph. Fixed when the graph is created
+    */
+    uint32_t cutoff;
+
+    /**
+    * @brief Number of nodes in the index
+    */
+    uint32_t node_count;
+
+    /**
+    * @brief Number of neighbour entries in the index. Each edge is stored once for each end
+    */
+    uint64_t edge_count;
+
+    /**
+    * @brief Bytes of `edges.log` covered by the index
+    */
+    uint64_t log_size;
+
+    /**
+    * @brief Bytes of `nodes.txt` covered by the index
+    */
+    uint64_t nodes_size;
+};
+
+/**
+* @brief A single entry of a node's adjacency list
+*/
+struct __attribute__((packed)) GraphNeighbour{
+    /**
+    * @brief Node ID of the neighbour
+    */
+    uint32_t node;
+
+    /**
+    * @brief SNP distance to the neighbour
+    */
+    uint16_t dist;
+};
+
+/**
+* @brief Version of the graph index written
+*/
+const uint32_t graph_index_version = 1;
+
+/**
+* @brief Appends edges to a saves dir's neighbour graph. Feed with `ResultWriter::observe`
+*/
+class NeighbourGraph{
+    public:
+        /**
+        * @brief Largest distance stored. Taken from the existing graph if there is one
+        */
+        int cutoff;
+
+        /**
+        * @brief Open a saves dir's graph, creating it if required
+        *
+        * @param dir Saves dir
+        * @param cutoff Largest distance to store if creating the graph
+        */
+        NeighbourGraph(string dir, int cutoff);
+
+        /**
+        * @brief Close the graph if it hasn't been already
+        */
+        ~NeighbourGraph();
+
+        /**
+        * @brief Append edges to the log. Distances above `cutoff` are ignored
+        *
+        * @param distances Distances between interned IDs
+        */
+        void append(const vector<Distance> &distances);
+
+        /**
+        * @brief Remove edges, by logging them beyond any cutoff. They are dropped by the next compaction
+        *
+        * @param distances Pairs of interned IDs to remove. Their distances are ignored
+        */
+        void remove(const vector<Distance> &distances);
+
+        /**
+        * @brief Record samples as covered, once all of their comparisons have been appended
+        *
+        * @param ids Interned IDs of the samples
+        * @param covered false to withdraw it, such as when the samples are removed
+        */
+        void cover(const vector<uint32_t> &ids, bool covered=true);
+
+        /**
+        * @brief Compact the graph if enough edges have been logged since it was last compacted
+        */
+        void maintain();
+
+        /**
+        * @brief Maintain the graph, then release it
+        */
+        void close();
+
+    private:
+        /**
+        * @brief Graph dir
+        */
+        string dir;
+
+        /**
+        * @brief File descriptor of the lock file. -1 once closed
+        */
+        int lock_fd = -1;
+
+        /**
+        * @brief Node IDs by UUID, as far as `nodes_size` into `nodes.txt`
+        */
+        unordered_map<string, uint32_t> node_ids;
+
+        /**
+        * @brief Bytes of `nodes.txt` read into `node_ids`
+        */
+        uint64_t nodes_size = 0;
+
+        /**
+        * @brief Node IDs by interned ID. UINT32_MAX if not looked up yet
+        */
+        vector<uint32_t> node_of;
+
+        /**
+        * @brief Read any nodes added to `nodes.txt` since it was last read. The lock must be held
+        */
+        void refresh_nodes();
+
+        /**
+        * @brief Get the node ID of an interned ID, adding a node to `new_nodes` if required. The lock must be held
+        */
+        uint32_t node(uint32_t id, string &new_nodes);
+
+        /**
+        * @brief Append edges to the log, or remove them
+        */
+        void log(const vector<Distance> &distances, bool removing);
+};
+
+/**
+* @brief Find a sample's neighbours in a saves dir's graph without loading any samples
+*
+* @param dir Saves dir
+* @param uuid UUID of the sample
+* @param cutoff Largest distance to include. Must be within the graph's cutoff
+* @returns (UUID, distance) for each neighbour, sorted by distance then UUID
+*/
+vector<pair<string, int>> graph_neighbours(string dir, string uuid, int cutoff);
+
+/**
+* @brief Samples covered by a saves dir's graph. See `NeighbourGraph::cover`
+*
+* @param dir Saves dir
+* @returns UUIDs of the covered samples. Empty if there is no graph
+*/
+unordered_set<string> graph_coverage(string dir);
+
+/**
+* @brief Fold all logged edges into a saves dir's graph index
+*
+* @param dir Saves dir
+*/
+void compact_graph(string dir);
@@ -0,0 +1,34 @@
+#pragma once
+#include "tiles.hpp"
+
+/**
+* @brief k nearest neighbour graph of a whole collection (`--knn k`). Every sample's k closest samples, however far away
+
+    Samples are sorted by how many variants they have, so similar samples tend to be in the same or nearby tiles, and
+    tiles are compared nearest the diagonal first. Each sample keeps a bounded heap of its best k so far, and the k-th
+    best distance is its cutoff. A pair is compared once, with the larger of its two samples' cutoffs, and skipped
+    entirely if its lower bound is beyond both. Ties are broken by position, so the result doesn't depend on the
+    order tiles finish in.
+
+    The graph is written through the usual output formats as k directed distances per sample, closest first
+*/
+
+using namespace std;
+
+/**
+* @brief Find every sample's k nearest neighbours exactly, using `thread_count` threads
+*
+* @param samples Collection
+* @param k Number of neighbours per sample
+* @returns (index in `samples`, distance) of each sample's neighbours, closest first
+*/
+vector<vector<pair<uint32_t, int>>> knn_graph(const vector<Sample*> &samples, int k);
+
+/**
+* @brief Write a collection's k nearest neighbour graph to stdout
+*
+* @param k Number of neighbours per sample
+* @param samples Collection
+* @returns Number of distances written
+*/
+uint64_t compute_knn(int k, vector<Sample*> samples);
@@ -0,0 +1,418 @@
+#pragma once
+#include "sample.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <sqlite3.h>
+#include <zlib.h>
+
+/**
+* @brief Writing of computed distances. Workers fill their own buffers, and hand them off to a single writer thread
+
+    Binary distance format (`--output_format binary` or `binary_delta`). All integers are little endian.
+    The file is a series of blocks, each starting with a `BlockHeader`:
+
+    * `F`: File header. Payload is the 4 byte magic `FN5D` then a uint32 version. Starts a new ID space, so
+        outputs from several runs can be concatenated
+    * `I`: Sample ID table. Payload is the uint32 first ID, then `count` UUIDs as a uint16 length and the bytes.
+        Always precedes any records which use those IDs
+    * `R`: `count` raw `Distance` records (10 bytes each), written directly from the result buffers
+    * `D`: `count` records sorted by (id1, id2) and delta compressed. Each record is 3 LEB128 varints:
+        the change in id1, id2 (or the change in id2 if id1 was unchanged), and the distance
+
+    SQLite outputs (`--sqlite`) go into a `distances` table matching `db/model.py`, with guid1 < guid2
+*/
+
+using namespace std;
+
+/**
+* @brief A single computed distance between two samples, by interned ID (see `intern_uuid`).
+            UUIDs are only resolved when written out. Packed so buffers of these can be written directly
+*/
+struct __attribute__((packed)) Distance{
+    /**
+    * @brief Interned ID of the first sample
+    */
+    uint32_t id1;
+
+    /**
+    * @brief Interned ID of the second sample
+    */
+    uint32_t id2;
+
+    /**
+    * @brief SNP distance. Distances which don't fit are saturated at `max_distance`
+    */
+    uint16_t dist;
+};
+
+/**
+* @brief Largest distance which can be stored in a `Distance`
+*/
+const int max_distance = UINT16_MAX;
+
+/**
+* @brief Header for each block of the binary distance format
+*/
+struct __attribute__((packed)) BlockHeader{
+    /**
+    * @brief Block type. One of `F`, `I`, `R` or `D`
+    */
+    char type;
+
+    /**
+    * @brief Number of items in the block
+    */
+    uint32_t count;
+
+    /**
+    * @brief Size of the payload following this header in bytes
+    */
+    uint64_t size;
+};
+
+/**
+* @brief Version of the binary distance format written
+*/
+const uint32_t binary_format_version = 1;
+
+/**
+* @brief Number of results a worker buffers before handing them to the writer
+*/
+const size_t result_buffer_size = 65536;
+
+/**
+* @brief Number of rows inserted into SQLite per transaction
+*/
+const uint64_t sqlite_transaction_size = 1 << 20;
+
+/**
+* @brief Construct a `Distance`, saturating the distance if required
+*
+* @param s1 First sample
+* @param s2 Second sample
+* @param dist SNP distance between them
+* @returns Distance record
+*/
+Distance make_distance(Sample* s1, Sample* s2, int dist);
+
+/**
+* @brief Construct a `Distance` between interned IDs, saturating the distance if required
+*
+* @param id1 First sample's ID
+* @param id2 Second sample's ID
+* @param dist SNP distance between them
+* @returns Distance record
+*/
+Distance make_distance(uint32_t id1, uint32_t id2, int dist);
+
+/**
+* @brief Format distances as `<guid1> <guid2> <dist>` lines
+*
+* @param distances Distances to format
+* @param acc String to append the lines to
+*/
+void format_distances(const vector<Distance> &distances, string &acc);
+
+/**
+* @brief Read a binary distance output, which may also be gzip compressed
+*
+* @param path Path to the output
+* @param callback Called for each block of records, with the UUIDs by ID at that point in the file
+*/
+void read_binary_distances(string path, function<void(const vector<string>&, const vector<Distance>&)> callback);
+
+/**
+* @brief An item handed to the writer thread. Either a buffer of results, or a mark recording that some unit of work
+            (pushed before the mark) is done
+*/
+struct WriterItem{
+    vector<Distance> distances;
+
+    /**
+    * @brief Whether this is a mark, after any results
+    */
+    bool is_mark = false;
+
+    /**
+    * @brief Caller's tag for the mark
+    */
+    uint64_t mark = 0;
+};
+
+/**
+* @brief Writes distances from any number of worker threads using a single writer thread.
+            Workers hand over whole buffers, so the only locking is once per buffer
+*/
+class ResultWriter{
+    public:
+        /**
+        * @brief Start a writer
+        *
+        * @param path File to append to. `-` writes to stdout
+        * @param compression Either `none` or `gzip`
+        * @param format One of `text` (`<guid1> <guid2> <dist>` lines), `binary`, `binary_delta`
+                or `sqlite` (`path` is a database, which is created if required)
+        */
+        ResultWriter(string path, string compression="none", string format="text");
+
+        /**
+        * @brief Close the writer if it hasn't been already
+        */
+        ~ResultWriter();
+
+        /**
+        * @brief Hand a buffer of results to the writer thread. Blocks if the writer has fallen far behind
+        *
+        * @param distances Buffer of results. This is moved from, so is empty afterwards
+        */
+        void push(vector<Distance> &distances);
+
+        /**
+        * @brief Add an observer, called on the writer thread with every buffer of results before it is written.
+                Must be called before any results are pushed
+        *
+        * @param observer Function to call with each buffer
+        */
+        void observe(function<void(const vector<Distance>&)> observer);
+
+        /**
+        * @brief Only write results within a cutoff. Observers still see every result. If called more than once,
+                the lowest cutoff is kept. Must be called before any results are pushed
+        *
+        * @param cutoff Largest distance to write
+        */
+        void limit(int cutoff);
+
+        /**
+        * @brief Also write the results within a cutoff to another writer, which is closed along with this one.
+                Must be called before any results are pushed
+        *
+        * @param other Writer to pass results on to
+        * @param cutoff Largest distance to pass on
+        */
+        void tee(unique_ptr<ResultWriter> other, int cutoff);
+
+        /**
+        * @brief Writers results are passed on to, with their cutoffs
+        */
+        vector<pair<int, unique_ptr<ResultWriter>>> tees;
+
+        /**
+        * @brief Hand over the last buffer of a unit of work along with a mark recording that the unit is done. They're
+                handed over together, so a checkpoint can't fall between another thread's results and its mark
+        *
+        * @param tag Caller's tag for the unit of work
+        * @param distances Last buffer of results for the unit. This is moved from, so is empty afterwards
+        */
+        void mark(uint64_t tag, vector<Distance> &distances);
+
+        /**
+        * @brief Periodically make the output durable, then report which marks it covers. Only for uncompressed text
+                files. Must be called before any results are pushed
+        *
+        * @param interval_ms Least time between checkpoints. A final checkpoint is always made on close
+        * @param callback Called on the writer thread with the marks since the last checkpoint, and the size of the
+                output which is durable
+        */
+        void checkpoint_every(int interval_ms, function<void(const vector<uint64_t>&, uint64_t)> callback);
+
+        /**
+        * @brief Whether checkpoints are being made. If so, a checkpoint covers everything written so far, so a unit of
+                work's results should all be handed over with its mark
+        */
+        bool checkpointing() const;
+
+        /**
+        * @brief Write everything which has been pushed, then stop the writer thread and close the output.
+                Throws if the writer thread failed
+        */
+        void close();
+
+        /**
+        * @brief Number of results written so far
+        */
+        uint64_t written();
+
+    private:
+        /**
+        * @brief Buffers waiting to be written
+        */
+        deque<WriterItem> queue;
+
+        /**
+        * @brief Guards `queue` and `closing`
+        */
+        mutex queue_lock;
+
+        /**
+        * @brief Signals changes to `queue`
+        */
+        condition_variable queue_changed;
+
+        /**
+        * @brief Set once no more buffers will be pushed
+        */
+        bool closing = false;
+
+        /**
+        * @brief Whether `close` has finished
+        */
+        bool closed = false;
+
+        /**
+        * @brief Number of results written
+        */
+        atomic<uint64_t> count = 0;
+
+        /**
+        * @brief Uncompressed output. nullptr when compressing
+        */
+        FILE* out = nullptr;
+
+        /**
+        * @brief Compressed output. nullptr when not compressing
+        */
+        gzFile gz_out = nullptr;
+
+        /**
+        * @brief SQLite output. nullptr unless the format is `sqlite`
+        */
+        sqlite3* db = nullptr;
+
+        /**
+        * @brief Prepared insert for SQLite outputs
+        */
+        sqlite3_stmt* insert = nullptr;
+
+        /**
+        * @brief Rows inserted in the current SQLite transaction
+        */
+        uint64_t in_transaction = 0;
+
+        /**
+        * @brief Error from the writer thread, rethrown by `close`
+        */
+        exception_ptr error;
+
+        /**
+        * @brief Called with every buffer before it is written
+        */
+        vector<function<void(const vector<Distance>&)>> observers;
+
+        /**
+        * @brief Largest distance written
+        */
+        int output_cutoff = max_distance;
+
+        /**
+        * @brief Called with each checkpoint. Empty if not checkpointing
+        */
+        function<void(const vector<uint64_t>&, uint64_t)> checkpoint_callback;
+
+        /**
+        * @brief Least time between checkpoints
+        */
+        chrono::milliseconds checkpoint_interval;
+
+        /**
+        * @brief Marks seen since the last checkpoint
+        */
+        vector<uint64_t> marks;
+
+        /**
+        * @brief Make everything written so far durable, then report it. `text` is written out first
+        */
+        void checkpoint(string &text);
+
+        /**
+        * @brief Pass a buffer of results to the observers and tees, then write it. Writer thread only
+        */
+        void write_item(vector<Distance> &distances, string &text);
+
+        /**
+        * @brief The writer thread
+        */
+        thread writer;
+
+        /**
+        * @brief UUIDs already resolved by the writer thread, by interned ID
+        */
+        vector<string> names;
+
+        /**
+        * @brief Whether each entry of `names` has been resolved
+        */
+        vector<bool> resolved;
+
+        /**
+        * @brief Output format
+        */
+        string format;
+
+        /**
+        * @brief Number of IDs which have been written to a binary output's ID table
+        */
+        uint32_t ids_written = 0;
+
+        /**
+        * @brief Writer thread's main loop
+        */
+        void run();
+
+        /**
+        * @brief Write a single buffer of results
+        */
+        void write_buffer(const vector<Distance> &distances, string &text);
+
+        /**
+        * @brief Write a single buffer of results in a binary format. Sorts the buffer if delta compressing
+        */
+        void write_binary_buffer(vector<Distance> &distances);
+
+        /**
+        * @brief Insert a single buffer of results into SQLite, committing every `sqlite_transaction_size` rows
+        */
+        void write_sqlite_buffer(const vector<Distance> &distances);
+
+        /**
+        * @brief Open (and create if required) the SQLite database
+        */
+        void open_sqlite(string path);
+
+        /**
+        * @brief Run a statement against the SQLite database
+        */
+        void sqlite_exec(string sql);
+
+        /**
+        * @brief Throw if an SQLite call failed
+        */
+        void sqlite_check(int rc, int expected=SQLITE_OK);
+
+        /**
+        * @brief Write any IDs interned since the last ID table
+        */
+        void write_ids();
+
+        /**
+        * @brief Write a block of the binary format
+        */
+        void write_block(char type, uint32_t count, const char* data, uint64_t size);
+
+        /**
+        * @brief Look up a UUID, caching it for the writer thread
+        */
+        const string& name(uint32_t id);
+
+        /**
+        * @brief Write raw bytes to the output
+        */
+        void write_bytes(const char* data, size_t size);
+};
@@ -0,0 +1,75 @@
+#pragma once
+#include "sample.hpp"
+
+/**
+* @brief Restricting distances to a set of genomic intervals (`--regions <bed>`), such as a gene panel.
+
+    Positions outside the regions are dropped from each sample once, when it's loaded, so every comparison after that
+    only sees the positions within the regions. A sample's positions are sorted, so each interval is found with
+    `lower_bound`, starting from where the previous interval ended (a skip pointer), rather than by scanning them all.
+    Regions are given as BED: `<chrom>\t<start>\t<end>`, 0-based and half open. The chromosome is ignored, as FN5
+    compares against a single reference sequence
+*/
+
+using namespace std;
+
+/**
+* @brief Sorted, non-overlapping intervals of genome positions
+*/
+class Regions{
+    public:
+        /**
+        * @brief Half open intervals [start, end), sorted and merged
+        */
+        vector<pair<int, int>> intervals;
+
+        /**
+        * @brief No regions, for the whole genome
+        */
+        Regions() = default;
+
+        /**
+        * @brief Read regions from a BED file. Header, track, browser and comment lines are skipped
+        *
+        * @param path Path to the BED file
+        */
+        Regions(string path);
+
+        /**
+        * @brief Whether there are no regions, so distances are genome wide
+        */
+        bool empty() const;
+
+        /**
+        * @brief Number of positions covered by the regions
+        */
+        uint64_t positions() const;
+
+        /**
+        * @brief Positions within the regions
+        *
+        * @param positions Sorted positions
+        * @returns The sorted positions which are within an interval. All of them if there are no regions
+        */
+        vector<int> restrict(const vector<int> &positions) const;
+
+        /**
+        * @brief Drop a sample's positions outside the regions. The sample shouldn't be saved afterwards
+        *
+        * @param sample Sample to restrict in place
+        */
+        void restrict(Sample* sample) const;
+
+        /**
+        * @brief Copy of a sample with only the positions within the regions
+        *
+        * @param sample Sample to copy
+        * @returns A new sample, with the same UUID
+        */
+        Sample* restricted(const Sample* sample) const;
+};
+
+/**
+* @brief Regions distances are restricted to. Empty for genome wide. Set with the `--regions` flag
+*/
+extern Regions regions;
@@ -0,0 +1,89 @@
+#pragma once
+#include "sample.hpp"
+
+/**
+* @brief Re-masking a saves dir (`--remask <new mask>`). Masked positions are simply absent from a sample, so adding
+            positions to the mask can be applied to saves by dropping those positions, without re-parsing any FASTA.
+            Positions can't be unmasked this way, so the new mask must contain the old one.
+
+    The mask a saves dir was written with is recorded in `mask.tsv` as `<fingerprint>\t<number of positions>`. If there
+    is no record, the old mask is taken to be `--mask`
+
+    Masks can also be applied at query time instead (`--mask_profile <name>`), so one store (usually parsed with
+    `--mask ignore`) can serve several masks. Profiles are mask files kept in the `masks` dir of a saves dir, as
+    `<name>.txt`, and are applied by the distance kernel and lower bounds as a bitset
+*/
+
+using namespace std;
+
+/**
+* @brief Name of the mask record within a saves dir
+*/
+extern const string mask_filename;
+
+/**
+* @brief Fingerprint of a mask, independent of the order of its positions
+*
+* @param mask Mask
+* @returns FNV-1a hash of the sorted positions, in hex
+*/
+string mask_fingerprint(const unordered_set<int> &mask);
+
+/**
+* @brief Fingerprint of the mask a saves dir was written with
+*
+* @param dir Saves dir
+* @returns The recorded fingerprint, or "" if none is recorded
+*/
+string recorded_mask(string dir);
+
+/**
+* @brief Check a mask matches the one a saves dir was written with, before saving anything parsed with it.
+            Samples masked differently would have distances to the rest which are wrong
+*
+* @param dir Saves dir
+* @param mask Mask
+*/
+void check_mask(string dir, const unordered_set<int> &mask);
+
+/**
+* @brief Record the mask a saves dir is now written with
+*
+* @param dir Saves dir
+* @param mask Mask
+*/
+void record_mask(string dir, const unordered_set<int> &mask);
+
+/**
+* @brief Drop masked positions from a sample
+*
+* @param sample Sample to mask
+* @param positions Sorted positions to drop
+* @returns Whether any were dropped
+*/
+bool remask(Sample* sample, const vector<int> &positions);
+
+/**
+* @brief Re-mask every save in a saves dir, using `thread_count` threads. Each changed sample is re-saved as a new
+            version, so pinned readers are unaffected. Distances can only shrink, so if the dir has a neighbour graph
+            or clusters they are brought up to date by comparing the re-masked saves
+*
+* @param dir Saves dir
+* @param old_mask Mask the saves were written with. Must match the recorded mask, if there is one
+* @param new_mask Mask to apply. Must contain `old_mask`
+* @returns Number of saves rewritten
+*/
+uint64_t remask_saves(string dir, const unordered_set<int> &old_mask, const unordered_set<int> &new_mask);
+
+/**
+* @brief Name of the dir of mask profiles within a saves dir
+*/
+extern const string mask_profiles_dirname;
+
+/**
+* @brief Ignore a saves dir's named mask profile in every distance from now on
+*
+* @param dir Saves dir
+* @param name Name of the profile. Its mask is `<dir>/masks/<name>.txt`
+*/
+void load_mask_profile(string dir, string name);
@@ -15,6 +15,11 @@
 #include <tuple>
 #include <stdexcept>
 #include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <shared_mutex>
+#include <span>
 
 /**
 * @brief Definition of the `Sample` class, and functions for saving and loading samples
@@ -22,6 +27,23 @@
 
 using namespace std;
 
+/**
+* @brief Read only view of a sample's positions, which may be held elsewhere (e.g a shared collection)
+*/
+class SampleView{
+    public:
+        span<const int> A;
+        span<const int> C;
+        span<const int> G;
+        span<const int> T;
+        span<const int> N;
+
+        /**
+        * @brief Interned ID of the sample's UUID
+        */
+        uint32_t id;
+};
+
 class Sample{
     public:
         /**
@@ -54,6 +76,12 @@ class Sample{
         */
         string uuid;
 
+        /**
+        * @brief Dense integer ID interned from `uuid`. Used in place of the UUID for comparisons and results.
+                If `uuid` is changed, this should be updated with `intern_uuid`
+        */
+        uint32_t id;
+
         /**
         * @brief Whether a sample has passed QC (N% < 50%). If this is false, the sample
                 is not saved, so only vald when instanciated from FASTA
@@ -89,6 +117,21 @@ class Sample{
         */
         bool operator== (const Sample &s2) const;
 
+        /**
+        * @brief Hash of this sample's positions, ignoring its UUID. Samples with the same positions have the same hash
+        *
+        * @returns 64 bit hash of A, C, G, T and N
+        */
+        uint64_t content_hash() const;
+
+        /**
+        * @brief Check if another sample has exactly the same positions, whatever its UUID. Such samples are at distance 0
+        *
+        * @param s2 The other sample
+        * @returns true when A, C, G, T and N all match
+        */
+        bool same_content(const Sample &s2) const;
+
         /**
          * @brief Find the SNP distance between this sample and another
          * 
@@ -98,6 +141,20 @@ class Sample{
          */
         int dist(Sample* sample, int cutoff);
 
+        /**
+         * @brief Find the SNP distance between this sample and a view of another. Same as `dist(Sample*, int)`
+         *
+         * @param sample View of the sample to compare to
+         * @param cutoff Distance to stop caring after (for speed)
+         * @return int The distance between the two samples. If dist == cutoff + 1, the sample is further away and shouldn't be counted
+         */
+        int dist(const SampleView &sample, int cutoff);
+
+        /**
+        * @brief View of this sample's positions. Only valid while the sample is unchanged
+        */
+        SampleView view() const;
+
     private:
         /**
          * @brief Private method for comparing arbitrary nucleotide positions. i.e find the difference of A's or C's etc
@@ -106,13 +163,57 @@ class Sample{
          * @param this_n Set of places this sample has an N value
          * @param sample_x Set of places the other sample is nucleotide `x` different from the reference
          * @param sample_n Set of places the other sample has an N value
-         * @param acc Accumulator set of the places which the samples differ
-         * @param cutoff Distance to stop caring after (for speed)
-         * @return int The distance between the two samples. If dist == cutoff + 1, the sample is further away and shouldn't be counted
+         * @param acc Accumulator set of the places which the samples differ. Added to in place
+         * @param cutoff Distance to stop caring after (for speed). Stops once `acc` holds cutoff + 1 positions
          */
-        unordered_set<int> dist_x(vector<int> this_x, vector<int> this_n, vector<int> sample_x, vector<int> sample_n, unordered_set<int> acc, unsigned int cutoff);
+        void dist_x(span<const int> this_x, span<const int> this_n, span<const int> sample_x, span<const int> sample_n, unordered_set<int> &acc, unsigned int cutoff);
 };
 
+/**
+* @brief Positions ignored by distances at query time (a mask profile), as a bitset. These are on top of the mask
+            samples were parsed with, so one unmasked store can serve several masks. Empty when there's no profile
+*/
+extern vector<uint64_t> query_mask;
+
+/**
+* @brief Set the positions ignored by distances at query time. Not threadsafe, so set before comparing
+*
+* @param mask Positions to ignore. Empty for none
+*/
+void set_query_mask(const unordered_set<int> &mask);
+
+/**
+* @brief Number of positions in a list which aren't ignored at query time. Used by lower bounds, as masked positions
+            can't contribute to a distance
+*
+* @param positions Positions
+* @returns Number of positions not in `query_mask`
+*/
+size_t unmasked_count(span<const int> positions);
+
+/**
+* @brief Intern a UUID, giving a dense 32 bit ID which is unique to that UUID for the lifetime of the process. Threadsafe
+*
+* @param uuid UUID to intern
+* @returns ID of the UUID
+*/
+uint32_t intern_uuid(const string &uuid);
+
+/**
+* @brief Resolve an interned ID back to its UUID. Threadsafe
+*
+* @param id ID returned from `intern_uuid`
+* @returns The UUID
+*/
+string uuid_of(uint32_t id);
+
+/**
+* @brief Number of UUIDs interned so far. IDs are always less than this
+*
+* @returns Number of interned UUIDs
+*/
+uint32_t interned_count();
+
 /**
 * @brief **DEPRECIATED** Save the contents of an unordered set to disk using binary.
 *
@@ -130,12 +231,14 @@ void save_n(vector<int> to_save, string filename);
 vector<int> load_n(string filename);
 
 /**
-* @brief Save a sample to disk
+* @brief Save a sample to disk, recording it in the dir's catalog
 * 
 * @param filename Directory to save in. Actual save will be <filename>/<uuid>.fn5
 * @param sample Sample to save
+* @param collect Whether to remove replaced versions which no reader can see. Callers replacing many saves can
+            instead call `collect_garbage` once they're done
 */
-void save(string filename, Sample* sample);
+void save(string filename, Sample* sample, bool collect=true);
 
 /**
 * @brief Load a sample from disk
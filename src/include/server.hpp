@@ -0,0 +1,69 @@
+#pragma once
+#include "comparisons.hpp"
+
+/**
+* @brief Resident server mode. Loads the collection once, then answers requests over a Unix domain socket
+
+    Every message is a frame: a little endian uint32 length, then that many bytes.
+    A request's first line is tab separated `<command>\t<cutoff>\t<argument>`, and anything after it is data.
+    A cutoff of -1 uses the server's `--cutoff`. Commands:
+
+    * `add`: Add a sample, saving it and adding it to the neighbour graph. The argument is a FASTA path
+        readable by the server, or empty to send the FASTA as the data. Replies with the new distances
+    * `compare_row`: As `add`, but only replies with the distances. Nothing is saved
+    * `nearest`: The k nearest samples to a sample, with k given in place of the cutoff. The argument is as for `add`.
+        Nothing is saved
+    * `neighbours`: Neighbours of the UUID in the argument, from the neighbour graph
+    * `remove`: Remove the sample with the UUID in the argument, as `--remove`, and drop it from memory.
+        Replies with no output, or an error if it isn't saved
+    * `stats`: Tab separated statistics about the server
+    * `shutdown`: Stop the server
+
+    Responses are `ok` or `error` on the first line, then the output (or error message)
+*/
+
+using namespace std;
+
+/**
+* @brief Largest frame accepted
+*/
+const uint32_t max_frame_size = 1 << 30;
+
+/**
+* @brief Send a single frame
+*
+* @param fd Socket to send on
+* @param payload Frame contents
+*/
+void send_frame(int fd, const string &payload);
+
+/**
+* @brief Receive a single frame
+*
+* @param fd Socket to receive on
+* @param payload Set to the frame contents
+* @returns false if the socket closed cleanly before the frame started
+*/
+bool recv_frame(int fd, string &payload);
+
+/**
+* @brief Load all saves, then serve requests until shut down. Requests are handled by `thread_count` threads
+*
+* @param socket_path Path to create the socket at
+* @param reference Reference genome
+* @param mask Positions to mask
+* @param cutoff Default SNP cutoff for requests
+*/
+void serve(string socket_path, string reference, unordered_set<int> mask, int cutoff);
+
+/**
+* @brief Send a single request to a server
+*
+* @param socket_path Path of the server's socket
+* @param command Request command
+* @param cutoff SNP cutoff, or -1 for the server's default
+* @param argument Request argument
+* @param data Request data
+* @returns The server's output. Throws if the request failed
+*/
+string client_request(string socket_path, string command, int cutoff, string argument="", string data="");
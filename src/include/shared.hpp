@@ -0,0 +1,183 @@
+#pragma once
+#include "catalog.hpp"
+
+/**
+* @brief Shared collection. The first process to need a saves dir's collection publishes it as a file in `shared_dir`,
+            and later processes on the same node map it read only instead of loading every save themselves
+
+    The file is named from the saves dir, and laid out as a `SharedHeader`, a `SharedEntry` per sample in catalog order,
+    padding to 8 bytes, the positions of every sample (A, C, G, T then N for each), then the UUIDs.
+
+    Each process attached holds a shared `flock` on the file, so the kernel keeps the reference count (and drops it if
+    a process dies). The last process to detach removes the file. The generation is taken from the catalog, so once
+    anything is saved the next process to attach publishes a new file in place of the stale one
+*/
+
+using namespace std;
+
+/**
+* @brief Whether to use a shared collection for `--add` and `--compare_row`. Can be set with the `--shared_collection` flag
+*/
+extern bool shared_collection;
+
+/**
+* @brief Dir shared collections are published in. Should be memory backed
+*/
+extern string shared_dir;
+
+/**
+* @brief Version of the shared collection layout
+*/
+const uint32_t shared_collection_version = 1;
+
+/**
+* @brief Header of a shared collection
+*/
+struct __attribute__((packed)) SharedHeader{
+    /**
+    * @brief Always `FN5C`
+    */
+    char magic[4];
+
+    /**
+    * @brief Layout version
+    */
+    uint32_t version;
+
+    /**
+    * @brief Generation of the catalog the collection was published from
+    */
+    uint64_t generation;
+
+    /**
+    * @brief Last modified time of the catalog the collection was published from, in nanoseconds
+    */
+    int64_t modified;
+
+    /**
+    * @brief Number of samples
+    */
+    uint64_t sample_count;
+
+    /**
+    * @brief Byte offset of the positions
+    */
+    uint64_t positions_offset;
+
+    /**
+    * @brief Byte offset of the UUIDs
+    */
+    uint64_t names_offset;
+
+    /**
+    * @brief Size of the whole file in bytes
+    */
+    uint64_t size;
+};
+
+/**
+* @brief Where a single sample is within a shared collection
+*/
+struct __attribute__((packed)) SharedEntry{
+    /**
+    * @brief Index of the sample's first position
+    */
+    uint64_t start;
+
+    /**
+    * @brief Number of positions in each of A, C, G, T, N (in that order). Used as a summary for prefiltering
+    */
+    uint32_t counts[5];
+
+    /**
+    * @brief Offset of the UUID from `names_offset`
+    */
+    uint64_t name_offset;
+
+    /**
+    * @brief Length of the UUID
+    */
+    uint32_t name_size;
+};
+
+/**
+* @brief A saves dir's collection, attached read only. Detaches when destroyed
+*/
+class SharedCollection{
+    public:
+        /**
+        * @brief Views of every sample, in catalog order. Valid until the collection is destroyed
+        */
+        vector<SampleView> samples;
+
+        /**
+        * @brief Whether this process published the collection, rather than attaching to an existing one
+        */
+        bool published = false;
+
+        /**
+        * @brief Attach to a saves dir's shared collection, publishing it first if there isn't a current one
+        *
+        * @param dir Saves dir
+        */
+        SharedCollection(string dir);
+
+        /**
+        * @brief Detach, removing the collection if nothing else is attached
+        */
+        ~SharedCollection();
+
+        SharedCollection(const SharedCollection&) = delete;
+        SharedCollection& operator=(const SharedCollection&) = delete;
+
+    private:
+        /**
+        * @brief Path of the published file
+        */
+        string path;
+
+        /**
+        * @brief File descriptor holding the shared lock. -1 if not attached
+        */
+        int fd = -1;
+
+        /**
+        * @brief Start of the mapping
+        */
+        void* base = nullptr;
+
+        /**
+        * @brief Size of the mapping
+        */
+        uint64_t size = 0;
+
+        /**
+        * @brief Try to attach to the file currently at `path`
+        *
+        * @param generation Catalog generation expected
+        * @param modified Catalog modified time expected
+        * @returns true if attached. false if there is no file, or it is stale
+        */
+        bool attach(uint64_t generation, int64_t modified);
+
+        /**
+        * @brief Load every save in the catalog and publish them at `path`, staying attached. The publish lock must be held
+        *
+        * @param catalog Catalog to publish
+        * @param modified Catalog modified time
+        */
+        void publish(const Catalog &catalog, int64_t modified);
+
+        /**
+        * @brief Fill `samples` from the mapping
+        */
+        void index();
+};
+
+/**
+* @brief Path a saves dir's shared collection is published at
+*
+* @param dir Saves dir
+* @returns Path within `shared_dir`
+*/
+string shared_collection_path(string dir);
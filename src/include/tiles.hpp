@@ -0,0 +1,121 @@
+#pragma once
+#include "comparisons.hpp"
+
+/**
+* @brief Tiled pairwise comparisons. The upper triangle of the pair space is split into tiles of rows x columns of the
+            collection, which can be shared out between threads, or between partitions run as separate processes
+
+    A partition (`--compute <cutoff> --partition <i>/<n>`) writes its distances to `<dir>/part-<i>-of-<n>.fn5d`
+    (binary format, `.gz` if compressed), then a manifest `<dir>/part-<i>-of-<n>.manifest` describing the collection and
+    each tile it computed. The manifest is written last, so a partition without one is incomplete.
+    `--merge <dir>` checks that the manifests agree and cover every tile exactly once, then outputs every distance
+*/
+
+using namespace std;
+
+class DuplicateClasses;
+
+/**
+* @brief Most samples along each side of a tile. Smaller tiles are used if there wouldn't be enough to share out.
+            Can be set with the `--tile_size` flag
+*/
+extern int tile_size;
+
+/**
+* @brief Number of tiles to aim for per partition, so partitions can be balanced
+*/
+const int tiles_per_partition = 16;
+
+/**
+* @brief Version of the partition manifest written
+*/
+const int manifest_version = 1;
+
+/**
+* @brief A block of pairs. Rows [row_start, row_end) against columns [col_start, col_end) of the collection,
+            only including pairs where the row is before the column
+*/
+class Tile{
+    public:
+        /**
+        * @brief Position of the tile in the full set of tiles
+        */
+        uint32_t index;
+
+        uint32_t row_start;
+        uint32_t row_end;
+        uint32_t col_start;
+        uint32_t col_end;
+
+        /**
+        * @brief Estimated cost of comparing the tile, from the number of positions in its samples
+        */
+        uint64_t cost;
+
+        /**
+        * @brief Number of pairs in the tile
+        */
+        uint64_t pairs() const;
+};
+
+/**
+* @brief Split the upper triangle of a collection's pairs into tiles. Deterministic for a given collection, `min_tiles`
+            and `first_column`
+*
+* @param samples Collection, in a fixed order
+* @param min_tiles Tiles are made smaller (down to single samples) until there are at least this many
+* @param first_column Only include pairs whose column is at least this. Used to compare samples from here on against
+            the ones before them and each other, without comparing the ones before against each other
+* @returns Tiles, in order of `index`
+*/
+vector<Tile> make_tiles(const vector<Sample*> &samples, uint64_t min_tiles, uint64_t first_column=0);
+
+/**
+* @brief Deterministically share tiles out between partitions, balanced by estimated cost
+*
+* @param tiles Every tile
+* @param partitions Number of partitions
+* @param partition Partition to get the tiles of, from 1 to `partitions`
+* @returns The partition's tiles, most costly first
+*/
+vector<Tile> partition_tiles(const vector<Tile> &tiles, int partitions, int partition);
+
+/**
+* @brief Compare every pair within some tiles, using `thread_count` threads which each take the next tile.
+            Each tile's results are followed by a mark of its index, so the writer can checkpoint completed tiles
+*
+* @param samples Collection the tiles refer to
+* @param tiles Tiles to compare
+* @param cutoff SNP threshold
+* @param writer Writer to hand results to
+* @param classes If given, `samples` are the representatives of these classes, and results are fanned out to their members
+* @returns Number of results within the cutoff from each tile, in the same order as `tiles`
+*/
+vector<uint64_t> compare_tiles(const vector<Sample*> &samples, const vector<Tile> &tiles, int cutoff, ResultWriter* writer, const DuplicateClasses* classes=nullptr);
+
+/**
+* @brief Fingerprint of a collection's samples and their order, so partitions can check they used the same collection
+*
+* @param samples Collection
+* @returns Hex digest
+*/
+string collection_fingerprint(const vector<Sample*> &samples);
+
+/**
+* @brief Compute a single partition of a pairwise matrix, writing its output and manifest into `dir`
+*
+* @param cutoff SNP threshold
+* @param samples Collection
+* @param partition Partition to compute, from 1 to `partitions`
+* @param partitions Number of partitions
+* @param dir Dir to write to. Created if required
+*/
+void compute_partition(int cutoff, vector<Sample*> samples, int partition, int partitions, string dir);
+
+/**
+* @brief Check a dir of partitions covers every tile exactly once, then output all of their distances
+*
+* @param dir Dir containing the partitions
+* @returns Number of distances output
+*/
+uint64_t merge_partitions(string dir);
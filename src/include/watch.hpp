@@ -0,0 +1,47 @@
+#pragma once
+#include "comparisons.hpp"
+
+/**
+* @brief Spool dir watcher. Picks up new FASTA and `.fn5` files as they arrive, and adds them in micro-batches
+            against a collection kept in memory
+
+    Files are moved to `done/` in the spool dir once added, and files which couldn't be parsed or failed QC to `failed/`.
+    A line per batch is appended to `metrics.tsv` in the spool dir
+*/
+
+using namespace std;
+
+/**
+* @brief Largest number of files in a batch. Can be set with the `--batch_size` flag
+*/
+extern int batch_size;
+
+/**
+* @brief Longest a file waits for its batch to fill before the batch is added anyway, in milliseconds.
+            Can be set with the `--batch_latency` flag
+*/
+extern int batch_latency;
+
+/**
+* @brief Name of the metrics file within a spool dir
+*/
+extern const string metrics_filename;
+
+/**
+* @brief Check if a file in a spool dir should be added
+*
+* @param filename Name of the file
+* @returns true for FASTA files (`.fasta`, `.fa`, `.fas`, `.fna`) and reference compressed saves (`.fn5`)
+*/
+bool is_spool_file(string filename);
+
+/**
+* @brief Watch a spool dir, adding files in batches until interrupted. Files already there are added first.
+            Each batch's distances are output when the batch is done
+*
+* @param spool_dir Dir to watch
+* @param reference Reference nucleotides
+* @param mask Exclude mask
+* @param cutoff SNP threshold
+*/
+void watch(string spool_dir, string reference, unordered_set<int> mask, int cutoff);
@@ -0,0 +1,196 @@
+#include "include/knn.hpp"
+#include <numeric>
+
+/**
+* @brief k nearest neighbour graphs, using the tiled scheduler
+*/
+
+using namespace std;
+
+/**
+* @brief Number of locks shared between the samples' heaps
+*/
+const size_t knn_lock_stripes = 4096;
+
+/**
+* @brief State shared by the threads of a kNN search
+*/
+class KnnSearch{
+    public:
+        int k;
+
+        /**
+        * @brief Collection, sorted by number of variants
+        */
+        vector<Sample*> samples;
+
+        /**
+        * @brief Number of variants (A, C, G and T) and Ns of each sample, for lower bounds
+        */
+        vector<int> variants;
+        vector<int> ns;
+
+        /**
+        * @brief Max heap of each sample's best (distance, position) so far
+        */
+        vector<vector<pair<int, uint32_t>>> heaps;
+
+        /**
+        * @brief Each sample's k-th best distance so far, or `max_distance` until it has k. Only ever decreases
+        */
+        unique_ptr<atomic<int>[]> kth;
+
+        /**
+        * @brief Guard the heaps, by position modulo `knn_lock_stripes`
+        */
+        vector<mutex> locks;
+
+        atomic<uint64_t> compared = 0;
+        atomic<uint64_t> skipped = 0;
+
+        KnnSearch(const vector<Sample*> &sorted, int k_) : locks(knn_lock_stripes){
+            k = k_;
+            samples = sorted;
+            heaps.resize(samples.size());
+            kth = make_unique<atomic<int>[]>(samples.size());
+            for(Sample* s: samples){
+                //Positions masked by a profile can't count, so aren't included
+                variants.push_back(unmasked_count(s->A) + unmasked_count(s->C) + unmasked_count(s->G) + unmasked_count(s->T));
+                ns.push_back(s->N.size());
+            }
+            for(size_t i=0;i<samples.size();i++){
+                kth[i] = max_distance;
+            }
+        }
+
+        /**
+        * @brief Offer a sample a neighbour, keeping it if it's better than the k-th best
+        */
+        void offer(uint32_t position, uint32_t other, int dist){
+            if(dist > kth[position]){
+                return;
+            }
+            lock_guard<mutex> guard(locks.at(position % knn_lock_stripes));
+            vector<pair<int, uint32_t>> &heap = heaps.at(position);
+            pair<int, uint32_t> candidate = {dist, other};
+            if(heap.size() < (size_t) k){
+                heap.push_back(candidate);
+                push_heap(heap.begin(), heap.end());
+                if(heap.size() == (size_t) k){
+                    kth[position] = heap.front().first;
+                }
+            }
+            else if(candidate < heap.front()){
+                //Ties are broken by position, so the result is the same whatever order pairs are offered in
+                pop_heap(heap.begin(), heap.end());
+                heap.back() = candidate;
+                push_heap(heap.begin(), heap.end());
+                kth[position] = heap.front().first;
+            }
+        }
+
+        /**
+        * @brief Compare every pair in a tile which could be in either sample's k nearest
+        */
+        void compare_tile(const Tile &tile){
+            uint64_t done = 0;
+            uint64_t pruned = 0;
+            for(uint32_t i=tile.row_start;i<tile.row_end;i++){
+                Sample* s1 = samples.at(i);
+                for(uint32_t j=max(tile.col_start, i + 1);j<tile.col_end;j++){
+                    Sample* s2 = samples.at(j);
+                    if(s1->id == s2->id){
+                        continue;
+                    }
+                    //Only needs to be exact if it could displace either's k-th best
+                    int cutoff = max(kth[i].load(), kth[j].load());
+                    int bound = max({0, variants.at(i) - variants.at(j) - ns.at(j), variants.at(j) - variants.at(i) - ns.at(i)});
+                    if(bound > cutoff){
+                        pruned++;
+                        continue;
+                    }
+                    done++;
+                    int dist = s1->dist(s2, cutoff);
+                    offer(i, j, dist);
+                    offer(j, i, dist);
+                }
+            }
+            compared += done;
+            skipped += pruned;
+        }
+};
+
+/**
+* @brief Compare tiles taken from a shared counter until there are none left. To be used by a thread
+*/
+void knn_thread(KnnSearch* search, const vector<Tile>* tiles, atomic<size_t>* next){
+    for(size_t t=(*next)++;t<tiles->size();t=(*next)++){
+        search->compare_tile(tiles->at(t));
+    }
+}
+
+vector<vector<pair<uint32_t, int>>> knn_graph(const vector<Sample*> &samples, int k){
+    if(k < 1){
+        throw invalid_argument("Invalid k. Should be > 0");
+    }
+    //Samples with similar numbers of variants are more likely to be close, so put them in the same tiles
+    vector<uint32_t> order(samples.size());
+    iota(order.begin(), order.end(), 0);
+    auto variant_count = [&samples](uint32_t i){
+        Sample* s = samples.at(i);
+        return s->A.size() + s->C.size() + s->G.size() + s->T.size();
+    };
+    stable_sort(order.begin(), order.end(), [&variant_count](uint32_t a, uint32_t b){
+        return variant_count(a) < variant_count(b);
+    });
+    vector<Sample*> sorted;
+    for(const uint32_t &i: order){
+        sorted.push_back(samples.at(i));
+    }
+    KnnSearch search(sorted, k);
+
+    //Nearest the diagonal first, so each sample's cutoff tightens before the less promising tiles
+    vector<Tile> tiles = make_tiles(sorted, (uint64_t) thread_count * 4);
+    stable_sort(tiles.begin(), tiles.end(), [](const Tile &a, const Tile &b){
+        return a.col_start - a.row_start < b.col_start - b.row_start;
+    });
+    atomic<size_t> next = 0;
+    vector<thread> threads;
+    for(int i=1;i<thread_count;i++){
+        threads.push_back(thread(knn_thread, &search, &tiles, &next));
+    }
+    knn_thread(&search, &tiles, &next);
+    for(thread &t: threads){
+        t.join();
+    }
+    if(debug){
+        cout << "Compared " << search.compared << " pairs, skipped " << search.skipped << " by their lower bound" << endl;
+    }
+
+    vector<vector<pair<uint32_t, int>>> graph(samples.size());
+    for(size_t i=0;i<sorted.size();i++){
+        vector<pair<int, uint32_t>> &heap = search.heaps.at(i);
+        sort_heap(heap.begin(), heap.end());
+        for(const auto &[dist, position]: heap){
+            graph.at(order.at(i)).push_back({order.at(position), dist});
+        }
+    }
+    return graph;
+}
+
+uint64_t compute_knn(int k, vector<Sample*> samples){
+    vector<vector<pair<uint32_t, int>>> graph = knn_graph(samples, k);
+    unique_ptr<ResultWriter> writer = open_writer("-");
+    vector<Distance> distances;
+    for(size_t i=0;i<samples.size();i++){
+        for(const auto &[neighbour, dist]: graph.at(i)){
+            distances.push_back(make_distance(samples.at(i), samples.at(neighbour), dist));
+            if(distances.size() >= result_buffer_size){
+                writer->push(distances);
+            }
+        }
+    }
+    writer->push(distances);
+    writer->close();
+    return writer->written();
+}
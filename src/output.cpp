@@ -0,0 +1,640 @@
+#include "include/output.hpp"
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+* @brief Writing of computed distances. Workers fill their own buffers, and hand them off to a single writer thread
+*/
+
+using namespace std;
+
+/**
+* @brief Maximum number of buffers queued for the writer before workers wait for it
+*/
+const size_t max_queued_buffers = 64;
+
+/**
+* @brief Size of the writer's output buffer
+*/
+const size_t write_buffer_size = 1 << 22;
+
+Distance make_distance(Sample* s1, Sample* s2, int dist){
+    return make_distance(s1->id, s2->id, dist);
+}
+
+Distance make_distance(uint32_t id1, uint32_t id2, int dist){
+    Distance d;
+    d.id1 = id1;
+    d.id2 = id2;
+    d.dist = min(dist, max_distance);
+    return d;
+}
+
+/**
+* @brief Append an integer to a string without going through a stream
+*/
+void append_int(string &acc, uint64_t value){
+    char digits[24];
+    char* end = to_chars(digits, digits + sizeof(digits), value).ptr;
+    acc.append(digits, end - digits);
+}
+
+void format_distances(const vector<Distance> &distances, string &acc){
+    for(const Distance &elem: distances){
+        acc += uuid_of(elem.id1);
+        acc += ' ';
+        acc += uuid_of(elem.id2);
+        acc += ' ';
+        append_int(acc, elem.dist);
+        acc += '\n';
+    }
+}
+
+/**
+* @brief Append an unsigned LEB128 varint to a string
+*/
+void append_varint(string &acc, uint64_t value){
+    while(value >= 0x80){
+        acc += (char) ((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    acc += (char) value;
+}
+
+/**
+* @brief Read an unsigned LEB128 varint, advancing `pos`
+*/
+uint64_t read_varint(const string &data, size_t &pos){
+    uint64_t value = 0;
+    int shift = 0;
+    while(true){
+        if(pos >= data.size() || shift > 63){
+            throw invalid_argument("Malformed delta block in distance file");
+        }
+        unsigned char byte = data[pos++];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if(byte < 0x80){
+            return value;
+        }
+        shift += 7;
+    }
+}
+
+/**
+* @brief Read exactly `size` bytes from a gzFile
+*
+* @returns false if the file ended before any bytes were read
+*/
+bool read_exact(gzFile in, char* data, uint64_t size, string path){
+    uint64_t done = 0;
+    while(done < size){
+        unsigned int chunk = min(size - done, (uint64_t) 1 << 30);
+        int n = gzread(in, data + done, chunk);
+        if(n <= 0){
+            if(done == 0 && n == 0){
+                return false;
+            }
+            throw invalid_argument("Truncated distance file: " + path);
+        }
+        done += n;
+    }
+    return true;
+}
+
+void read_binary_distances(string path, function<void(const vector<string>&, const vector<Distance>&)> callback){
+    //gzopen reads uncompressed files transparently
+    gzFile in = gzopen(path.c_str(), "rb");
+    if(in == nullptr){
+        throw invalid_argument("Invalid distance file: " + path);
+    }
+    gzbuffer(in, write_buffer_size);
+    vector<string> names;
+    vector<Distance> distances;
+    string payload;
+    bool seen_header = false;
+    BlockHeader header;
+    while(read_exact(in, (char *) &header, sizeof(BlockHeader), path)){
+        if(!seen_header && (header.type != 'F' || header.size != 8)){
+            //Check before trusting the size, in case this is some other file
+            throw invalid_argument("Not an FN5 distance file: " + path);
+        }
+        payload.resize(header.size);
+        if(header.type == 'R'){
+            //Raw records can be read straight into the buffer
+            if(header.size != (uint64_t) header.count * sizeof(Distance)){
+                throw invalid_argument("Malformed record block in distance file: " + path);
+            }
+            distances.resize(header.count);
+            read_exact(in, (char *) distances.data(), header.size, path);
+        }
+        else{
+            read_exact(in, payload.data(), header.size, path);
+        }
+
+        if(header.type == 'F'){
+            uint32_t version;
+            if(header.size != 8 || payload.substr(0, 4) != "FN5D"){
+                throw invalid_argument("Not an FN5 distance file: " + path);
+            }
+            memcpy(&version, payload.data() + 4, 4);
+            if(version != binary_format_version){
+                throw invalid_argument("Unsupported distance file version " + to_string(version) + ": " + path);
+            }
+            //Each run has its own IDs
+            names.clear();
+            seen_header = true;
+        }
+        else if(header.type == 'I'){
+            uint32_t first_id;
+            memcpy(&first_id, payload.data(), 4);
+            size_t pos = 4;
+            names.resize(first_id + header.count);
+            for(uint32_t i=0;i<header.count;i++){
+                uint16_t len;
+                if(pos + 2 > payload.size()){
+                    throw invalid_argument("Malformed ID block in distance file: " + path);
+                }
+                memcpy(&len, payload.data() + pos, 2);
+                names.at(first_id + i) = payload.substr(pos + 2, len);
+                pos += 2 + len;
+            }
+        }
+        else if(header.type == 'R'){
+            callback(names, distances);
+        }
+        else if(header.type == 'D'){
+            distances.resize(header.count);
+            size_t pos = 0;
+            uint32_t id1 = 0;
+            uint32_t id2 = 0;
+            for(uint32_t i=0;i<header.count;i++){
+                uint64_t id1_delta = read_varint(payload, pos);
+                if(id1_delta == 0){
+                    id2 += read_varint(payload, pos);
+                }
+                else{
+                    id1 += id1_delta;
+                    id2 = read_varint(payload, pos);
+                }
+                distances[i].id1 = id1;
+                distances[i].id2 = id2;
+                distances[i].dist = read_varint(payload, pos);
+            }
+            callback(names, distances);
+        }
+        else{
+            throw invalid_argument("Unknown block in distance file: " + path);
+        }
+    }
+    gzclose(in);
+}
+
+ResultWriter::ResultWriter(string path, string compression, string format_){
+    if(compression != "none" && compression != "gzip"){
+        throw invalid_argument("Invalid output compression: " + compression);
+    }
+    if(format_ != "text" && format_ != "binary" && format_ != "binary_delta" && format_ != "sqlite"){
+        throw invalid_argument("Invalid output format: " + format_);
+    }
+    format = format_;
+    if(format == "sqlite"){
+        if(path == "-" || compression != "none"){
+            throw invalid_argument("SQLite outputs must be written to an uncompressed database file");
+        }
+        open_sqlite(path);
+    }
+    else if(compression == "gzip"){
+        if(path == "-"){
+            //Flush anything already written to stdout so it stays in order
+            cout.flush();
+            fflush(stdout);
+            gz_out = gzdopen(dup(fileno(stdout)), "wb");
+        }
+        else{
+            gz_out = gzopen(path.c_str(), "ab");
+        }
+        if(gz_out == nullptr){
+            throw invalid_argument("Error opening output file: " + path);
+        }
+        gzbuffer(gz_out, write_buffer_size);
+    }
+    else{
+        if(path == "-"){
+            cout.flush();
+            out = stdout;
+        }
+        else{
+            out = fopen(path.c_str(), "ab");
+            if(out == nullptr){
+                throw invalid_argument("Error opening output file: " + path);
+            }
+        }
+    }
+    if(format == "binary" || format == "binary_delta"){
+        char header[8] = {'F', 'N', '5', 'D'};
+        memcpy(header + 4, &binary_format_version, 4);
+        write_block('F', 0, header, sizeof(header));
+    }
+    writer = thread(&ResultWriter::run, this);
+}
+
+ResultWriter::~ResultWriter(){
+    try{
+        close();
+    }
+    catch(const exception &e){
+        cerr << e.what() << endl;
+    }
+}
+
+void ResultWriter::push(vector<Distance> &distances){
+    if(distances.size() == 0){
+        return;
+    }
+    unique_lock<mutex> guard(queue_lock);
+    //Back pressure so a slow output doesn't buffer the whole matrix in memory
+    queue_changed.wait(guard, [this]{ return queue.size() < max_queued_buffers; });
+    WriterItem item;
+    item.distances = std::move(distances);
+    queue.push_back(std::move(item));
+    distances = {};
+    queue_changed.notify_all();
+}
+
+void ResultWriter::mark(uint64_t tag, vector<Distance> &distances){
+    unique_lock<mutex> guard(queue_lock);
+    queue_changed.wait(guard, [this]{ return queue.size() < max_queued_buffers; });
+    WriterItem item;
+    item.distances = std::move(distances);
+    item.is_mark = true;
+    item.mark = tag;
+    queue.push_back(std::move(item));
+    distances = {};
+    queue_changed.notify_all();
+}
+
+void ResultWriter::checkpoint_every(int interval_ms, function<void(const vector<uint64_t>&, uint64_t)> callback){
+    if(gz_out != nullptr || out == nullptr || out == stdout || format != "text"){
+        //Resuming truncates the output back to a checkpoint, so it has to be a plain file
+        throw invalid_argument("Checkpoints need an uncompressed text output file");
+    }
+    checkpoint_interval = chrono::milliseconds(interval_ms);
+    checkpoint_callback = callback;
+}
+
+bool ResultWriter::checkpointing() const{
+    return (bool) checkpoint_callback;
+}
+
+void ResultWriter::checkpoint(string &text){
+    if(text.size() > 0){
+        write_bytes(text.c_str(), text.size());
+        text.clear();
+    }
+    if(fflush(out) != 0 || fsync(fileno(out)) != 0){
+        throw invalid_argument(string("Error flushing output: ") + strerror(errno));
+    }
+    struct stat info;
+    fstat(fileno(out), &info);
+    checkpoint_callback(marks, info.st_size);
+    marks.clear();
+}
+
+void ResultWriter::observe(function<void(const vector<Distance>&)> observer){
+    observers.push_back(observer);
+}
+
+void ResultWriter::limit(int cutoff){
+    output_cutoff = min(output_cutoff, cutoff);
+}
+
+void ResultWriter::tee(unique_ptr<ResultWriter> other, int cutoff){
+    tees.push_back({cutoff, std::move(other)});
+}
+
+void ResultWriter::close(){
+    if(closed){
+        return;
+    }
+    {
+        lock_guard<mutex> guard(queue_lock);
+        closing = true;
+    }
+    queue_changed.notify_all();
+    writer.join();
+    closed = true;
+    for(auto &[cutoff, other]: tees){
+        //Everything has been passed on now
+        try{
+            other->close();
+        }
+        catch(...){
+            if(error == nullptr){
+                error = current_exception();
+            }
+        }
+    }
+
+    if(db != nullptr){
+        if(error == nullptr && in_transaction > 0){
+            try{
+                sqlite_exec("COMMIT");
+            }
+            catch(...){
+                error = current_exception();
+            }
+        }
+        sqlite3_finalize(insert);
+        sqlite3_close(db);
+    }
+    else{
+        //Buffered data is only written here, so this is where a full disk shows up
+        bool failed;
+        if(gz_out != nullptr){
+            failed = gzclose(gz_out) != Z_OK;
+        }
+        else if(out == stdout){
+            failed = fflush(out) != 0;
+        }
+        else{
+            failed = fclose(out) != 0;
+        }
+        if(failed && error == nullptr){
+            error = make_exception_ptr(invalid_argument(string("Error closing output: ") + strerror(errno)));
+        }
+    }
+    if(error != nullptr){
+        rethrow_exception(error);
+    }
+}
+
+uint64_t ResultWriter::written(){
+    return count;
+}
+
+void ResultWriter::run(){
+    string text;
+    text.reserve(write_buffer_size);
+    auto last_checkpoint = chrono::steady_clock::now();
+    while(true){
+        WriterItem item;
+        {
+            unique_lock<mutex> guard(queue_lock);
+            queue_changed.wait(guard, [this]{ return closing || queue.size() > 0; });
+            if(queue.size() == 0){
+                //Closing, and nothing left to write
+                break;
+            }
+            item = std::move(queue.front());
+            queue.pop_front();
+        }
+        queue_changed.notify_all();
+        if(error != nullptr){
+            //Keep draining so workers don't block, but there's nowhere to write to
+            continue;
+        }
+        vector<Distance> &distances = item.distances;
+        try{
+            if(distances.size() > 0){
+                write_item(distances, text);
+            }
+            if(item.is_mark && checkpoint_callback){
+                //After the mark's own results, so a checkpoint covers all of them
+                marks.push_back(item.mark);
+                if(chrono::steady_clock::now() - last_checkpoint >= checkpoint_interval){
+                    checkpoint(text);
+                    last_checkpoint = chrono::steady_clock::now();
+                }
+            }
+        }
+        catch(...){
+            error = current_exception();
+        }
+    }
+    if(checkpoint_callback && error == nullptr){
+        //Everything is done, so covers every mark left
+        try{
+            checkpoint(text);
+        }
+        catch(...){
+            error = current_exception();
+        }
+    }
+    if(error != nullptr){
+        return;
+    }
+    try{
+        if(text.size() > 0){
+            write_bytes(text.c_str(), text.size());
+        }
+        if(format == "binary" || format == "binary_delta"){
+            //Always include the ID table, even if there were no results
+            write_ids();
+        }
+    }
+    catch(...){
+        error = current_exception();
+    }
+}
+
+void ResultWriter::write_item(vector<Distance> &distances, string &text){
+    for(const auto &observer: observers){
+        observer(distances);
+    }
+    for(auto &[cutoff, other]: tees){
+        vector<Distance> within;
+        for(const Distance &d: distances){
+            if(d.dist <= cutoff){
+                within.push_back(d);
+            }
+        }
+        other->push(within);
+    }
+    if(output_cutoff < max_distance){
+        erase_if(distances, [this](const Distance &d){ return d.dist > output_cutoff; });
+    }
+    if(format == "text"){
+        write_buffer(distances, text);
+    }
+    else if(format == "sqlite"){
+        write_sqlite_buffer(distances);
+    }
+    else{
+        write_binary_buffer(distances);
+    }
+}
+
+void ResultWriter::write_buffer(const vector<Distance> &distances, string &text){
+    for(const Distance &elem: distances){
+        text += name(elem.id1);
+        text += ' ';
+        text += name(elem.id2);
+        text += ' ';
+        append_int(text, elem.dist);
+        text += '\n';
+        if(text.size() >= write_buffer_size){
+            write_bytes(text.c_str(), text.size());
+            text.clear();
+        }
+    }
+    count += distances.size();
+}
+
+void ResultWriter::write_binary_buffer(vector<Distance> &distances){
+    //Every ID used by this buffer was interned before it was pushed, so is covered here
+    write_ids();
+    if(format == "binary"){
+        //Written directly from the result buffer
+        write_block('R', distances.size(), (const char *) distances.data(), distances.size() * sizeof(Distance));
+    }
+    else{
+        sort(distances.begin(), distances.end(), [](const Distance &a, const Distance &b){
+            if(a.id1 != b.id1){
+                return a.id1 < b.id1;
+            }
+            return a.id2 < b.id2;
+        });
+        string encoded;
+        encoded.reserve(distances.size() * 4);
+        uint32_t id1 = 0;
+        uint32_t id2 = 0;
+        for(const Distance &elem: distances){
+            if(elem.id1 == id1){
+                append_varint(encoded, 0);
+                append_varint(encoded, elem.id2 - id2);
+            }
+            else{
+                append_varint(encoded, elem.id1 - id1);
+                append_varint(encoded, elem.id2);
+            }
+            append_varint(encoded, elem.dist);
+            id1 = elem.id1;
+            id2 = elem.id2;
+        }
+        write_block('D', distances.size(), encoded.c_str(), encoded.size());
+    }
+    count += distances.size();
+}
+
+void ResultWriter::open_sqlite(string path){
+    if(sqlite3_open(path.c_str(), &db) != SQLITE_OK){
+        string message = sqlite3_errmsg(db);
+        sqlite3_close(db);
+        db = nullptr;
+        throw invalid_argument("Error opening SQLite database " + path + ": " + message);
+    }
+    try{
+        //Other runs may be writing to the same database
+        sqlite3_busy_timeout(db, 60000);
+        sqlite_exec("PRAGMA journal_mode=WAL");
+        sqlite_exec("PRAGMA synchronous=NORMAL");
+        sqlite_exec("CREATE TABLE IF NOT EXISTS distances(guid1 VARCHAR(100) NOT NULL, guid2 VARCHAR(100) NOT NULL, dist INTEGER, PRIMARY KEY(guid1, guid2))");
+        //The primary key already indexes guid1
+        sqlite_exec("CREATE INDEX IF NOT EXISTS ix_distances_guid2 ON distances(guid2)");
+        sqlite_check(sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO distances(guid1, guid2, dist) VALUES (?, ?, ?)", -1, &insert, nullptr));
+    }
+    catch(...){
+        sqlite3_finalize(insert);
+        sqlite3_close(db);
+        throw;
+    }
+}
+
+void ResultWriter::sqlite_exec(string sql){
+    char* message = nullptr;
+    if(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &message) != SQLITE_OK){
+        string reason = message == nullptr ? sqlite3_errmsg(db) : message;
+        sqlite3_free(message);
+        throw invalid_argument("SQLite error: " + reason);
+    }
+}
+
+void ResultWriter::sqlite_check(int rc, int expected){
+    if(rc != expected){
+        throw invalid_argument("SQLite error: " + string(sqlite3_errmsg(db)));
+    }
+}
+
+void ResultWriter::write_sqlite_buffer(const vector<Distance> &distances){
+    for(const Distance &elem: distances){
+        if(in_transaction == 0){
+            sqlite_exec("BEGIN");
+        }
+        //Sorted as in db/model.py so each pair has a single row
+        //Resolve both first, as resolving can move `names`
+        name(elem.id1);
+        name(elem.id2);
+        const string* guid1 = &names[elem.id1];
+        const string* guid2 = &names[elem.id2];
+        if(*guid2 < *guid1){
+            swap(guid1, guid2);
+        }
+        sqlite3_bind_text(insert, 1, guid1->c_str(), guid1->size(), SQLITE_STATIC);
+        sqlite3_bind_text(insert, 2, guid2->c_str(), guid2->size(), SQLITE_STATIC);
+        sqlite3_bind_int(insert, 3, elem.dist);
+        sqlite_check(sqlite3_step(insert), SQLITE_DONE);
+        sqlite3_reset(insert);
+        in_transaction++;
+        if(in_transaction >= sqlite_transaction_size){
+            sqlite_exec("COMMIT");
+            in_transaction = 0;
+        }
+    }
+    count += distances.size();
+}
+
+void ResultWriter::write_ids(){
+    uint32_t total = interned_count();
+    if(total == ids_written){
+        return;
+    }
+    string payload;
+    payload.append((const char *) &ids_written, 4);
+    for(uint32_t id=ids_written;id<total;id++){
+        const string &uuid = name(id);
+        uint16_t len = min(uuid.size(), (size_t) UINT16_MAX);
+        payload.append((const char *) &len, 2);
+        payload.append(uuid, 0, len);
+    }
+    write_block('I', total - ids_written, payload.c_str(), payload.size());
+    ids_written = total;
+}
+
+void ResultWriter::write_block(char type, uint32_t count, const char* data, uint64_t size){
+    BlockHeader header;
+    header.type = type;
+    header.count = count;
+    header.size = size;
+    write_bytes((const char *) &header, sizeof(BlockHeader));
+    write_bytes(data, size);
+}
+
+const string& ResultWriter::name(uint32_t id){
+    if(id >= names.size()){
+        names.resize(id + 1);
+        resolved.resize(id + 1, false);
+    }
+    if(!resolved[id]){
+        names[id] = uuid_of(id);
+        resolved[id] = true;
+    }
+    return names[id];
+}
+
+void ResultWriter::write_bytes(const char* data, size_t size){
+    if(size == 0){
+        return;
+    }
+    //A short write is an error (e.g a full disk), rather than a silently truncated output
+    if(gz_out != nullptr){
+        if(gzwrite(gz_out, data, size) != (int) size){
+            int gz_errno;
+            throw invalid_argument(string("Error writing output: ") + gzerror(gz_out, &gz_errno));
+        }
+    }
+    else if(fwrite(data, 1, size, out) != size){
+        throw invalid_argument(string("Error writing output: ") + strerror(errno));
+    }
+}
@@ -0,0 +1,95 @@
+#include "include/regions.hpp"
+#include <sstream>
+#include <climits>
+
+/**
+* @brief Restricting samples to a set of genomic intervals
+*/
+
+using namespace std;
+
+Regions regions;
+
+Regions::Regions(string path){
+    fstream in(path, fstream::in);
+    if(!in.good()){
+        throw invalid_argument("Invalid regions path: " + path);
+    }
+    string line;
+    while(getline(in, line)){
+        if(line == "" || line.starts_with("#") || line.starts_with("track") || line.starts_with("browser")){
+            continue;
+        }
+        stringstream fields(line);
+        string chrom;
+        long start = -1;
+        long end = -1;
+        if(!(fields >> chrom >> start >> end) || start < 0 || end <= start || end > INT_MAX){
+            throw invalid_argument("Invalid BED line in " + path + ": " + line);
+        }
+        intervals.push_back({start, end});
+    }
+    if(intervals.size() == 0){
+        throw invalid_argument("No regions in " + path);
+    }
+    //Sorted and merged, so each position is in at most one interval
+    sort(intervals.begin(), intervals.end());
+    vector<pair<int, int>> merged;
+    for(const pair<int, int> &interval: intervals){
+        if(merged.size() > 0 && interval.first <= merged.back().second){
+            merged.back().second = max(merged.back().second, interval.second);
+        }
+        else{
+            merged.push_back(interval);
+        }
+    }
+    intervals = merged;
+}
+
+bool Regions::empty() const{
+    return intervals.size() == 0;
+}
+
+uint64_t Regions::positions() const{
+    uint64_t total = 0;
+    for(const auto &[start, end]: intervals){
+        total += end - start;
+    }
+    return total;
+}
+
+vector<int> Regions::restrict(const vector<int> &positions) const{
+    if(empty()){
+        //Genome wide
+        return positions;
+    }
+    vector<int> within;
+    auto from = positions.begin();
+    for(const auto &[start, end]: intervals){
+        //Only ever moves forward, so each interval only searches what's left
+        auto first = lower_bound(from, positions.end(), start);
+        from = lower_bound(first, positions.end(), end);
+        within.insert(within.end(), first, from);
+        if(from == positions.end()){
+            break;
+        }
+    }
+    return within;
+}
+
+void Regions::restrict(Sample* sample) const{
+    if(empty()){
+        return;
+    }
+    for(vector<int>* x: {&sample->A, &sample->C, &sample->G, &sample->T, &sample->N}){
+        *x = restrict(*x);
+    }
+}
+
+Sample* Regions::restricted(const Sample* sample) const{
+    Sample* copy = new Sample(restrict(sample->A), restrict(sample->C), restrict(sample->G), restrict(sample->T), restrict(sample->N));
+    copy->uuid = sample->uuid;
+    copy->id = sample->id;
+    copy->qc_pass = sample->qc_pass;
+    return copy;
+}
@@ -0,0 +1,209 @@
+#include "include/remask.hpp"
+#include "include/comparisons.hpp"
+#include "include/duplicates.hpp"
+#include "include/tiles.hpp"
+
+/**
+* @brief Re-masking saves in place of re-parsing their FASTA
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+const string mask_filename = "mask.tsv";
+
+const string mask_profiles_dirname = "masks";
+
+string mask_fingerprint(const unordered_set<int> &mask){
+    vector<int> positions(mask.begin(), mask.end());
+    sort(positions.begin(), positions.end());
+    //FNV-1a over each position
+    uint64_t hash = 14695981039346656037ULL;
+    for(const int &position: positions){
+        for(const char &ch: to_string(position) + "\n"){
+            hash ^= (unsigned char) ch;
+            hash *= 1099511628211ULL;
+        }
+    }
+    stringstream digest;
+    digest << hex << setw(16) << setfill('0') << hash;
+    return digest.str();
+}
+
+string recorded_mask(string dir){
+    fstream in(dir + "/" + mask_filename, fstream::in);
+    if(!in.good()){
+        return "";
+    }
+    string fingerprint;
+    getline(in, fingerprint, '\t');
+    return fingerprint;
+}
+
+void check_mask(string dir, const unordered_set<int> &mask){
+    string recorded = recorded_mask(dir);
+    if(recorded != "" && recorded != mask_fingerprint(mask)){
+        throw invalid_argument("Saves in " + dir + " were written with a different mask to --mask");
+    }
+}
+
+void record_mask(string dir, const unordered_set<int> &mask){
+    //Moved into place, so the record is never partial
+    string path = dir + "/" + mask_filename;
+    string tmp_path = path + ".tmp." + to_string(getpid());
+    fstream out(tmp_path, fstream::out | fstream::trunc);
+    out << mask_fingerprint(mask) << "\t" << mask.size() << "\n";
+    out.close();
+    if(!out.good()){
+        fs::remove(tmp_path);
+        throw invalid_argument("Error recording mask: " + path);
+    }
+    fs::rename(tmp_path, path);
+}
+
+void load_mask_profile(string dir, string name){
+    string path = dir + "/" + mask_profiles_dirname + "/" + name + ".txt";
+    if(name == "" || name.find('/') != string::npos || !fs::is_regular_file(path)){
+        throw invalid_argument("Unknown mask profile: " + name);
+    }
+    unordered_set<int> mask = load_mask(path);
+    set_query_mask(mask);
+    if(debug){
+        cout << "Masking " << mask.size() << " positions with profile " << name << endl;
+    }
+}
+
+bool remask(Sample* sample, const vector<int> &positions){
+    bool changed = false;
+    for(vector<int>* x: {&sample->A, &sample->C, &sample->G, &sample->T, &sample->N}){
+        size_t before = x->size();
+        erase_if(*x, [&positions](int position){
+            return binary_search(positions.begin(), positions.end(), position);
+        });
+        changed = changed || x->size() != before;
+    }
+    return changed;
+}
+
+/**
+* @brief Re-mask saves taken from a shared counter until there are none left. To be used by a thread
+*/
+void remask_thread(string dir, const vector<CatalogEntry>* entries, const vector<int>* positions, atomic<size_t>* next, atomic<uint64_t>* rewritten){
+    for(size_t i=(*next)++;i<entries->size();i=(*next)++){
+        const CatalogEntry &entry = entries->at(i);
+        //One at a time, so memory doesn't grow with the collection
+        Sample* s = readSample(dir + "/" + entry.file);
+        s->uuid = entry.uuid;
+        s->id = intern_uuid(entry.uuid);
+        if(remask(s, *positions)){
+            save(dir, s, false);
+            (*rewritten)++;
+        }
+        delete s;
+    }
+}
+
+/**
+* @brief Bring a saves dir's neighbour graph and clusters up to date with its saves, if it has either
+*/
+void relink(string dir){
+    shared_ptr<NeighbourGraph> graph;
+    shared_ptr<Clusters> clusters;
+    int cutoff = -1;
+    if(fs::exists(dir + "/" + graph_dirname + "/index.csr")){
+        //The cutoff is only used when creating a graph
+        graph = make_shared<NeighbourGraph>(dir, 0);
+        cutoff = max(cutoff, graph->cutoff);
+    }
+    if(fs::exists(dir + "/" + clusters_filename)){
+        clusters = make_shared<Clusters>(dir, 0);
+        cutoff = max(cutoff, clusters->cutoff);
+    }
+    if(cutoff < 0){
+        return;
+    }
+    vector<string> paths;
+    {
+        Snapshot snapshot(dir);
+        paths = snapshot.catalog.paths();
+    }
+    vector<Sample*> samples = load_saves_multithreaded(paths);
+    DuplicateClasses classes(samples);
+    vector<Tile> tiles = make_tiles(classes.representatives, (uint64_t) thread_count * 4);
+    classes.assign(tiles);
+
+    //Nothing is output, the graph and clusters see every distance within the cutoff
+    ResultWriter writer("/dev/null");
+    writer.limit(-1);
+    if(graph != nullptr){
+        //Later edges for a pair replace earlier ones, so shrunk distances are updated
+        writer.observe([graph](const vector<Distance> &distances){
+            graph->append(distances);
+        });
+    }
+    if(clusters != nullptr){
+        writer.observe([clusters](const vector<Distance> &distances){
+            clusters->append(distances);
+        });
+    }
+    compare_tiles(classes.representatives, tiles, cutoff, &writer, &classes);
+    writer.close();
+    if(graph != nullptr){
+        graph->close();
+    }
+    if(clusters != nullptr){
+        clusters->close();
+    }
+    for(Sample* s: samples){
+        delete s;
+    }
+}
+
+uint64_t remask_saves(string dir, const unordered_set<int> &old_mask, const unordered_set<int> &new_mask){
+    if(query_mask.size() > 0){
+        //The graph and clusters would be brought up to date with the profile's distances
+        throw invalid_argument("Can't re-mask with a mask profile");
+    }
+    check_mask(dir, old_mask);
+    vector<int> positions;
+    for(const int &position: old_mask){
+        if(!new_mask.contains(position)){
+            throw invalid_argument("New mask doesn't contain position " + to_string(position) + " of the old mask. Positions can't be unmasked");
+        }
+    }
+    for(const int &position: new_mask){
+        if(!old_mask.contains(position)){
+            positions.push_back(position);
+        }
+    }
+    sort(positions.begin(), positions.end());
+
+    atomic<uint64_t> rewritten = 0;
+    if(positions.size() > 0){
+        vector<CatalogEntry> entries;
+        {
+            //Entries of a snapshot are never replaced from under it
+            Snapshot snapshot(dir);
+            entries = snapshot.catalog.ordered();
+            atomic<size_t> next = 0;
+            vector<thread> threads;
+            for(int i=1;i<thread_count;i++){
+                threads.push_back(thread(remask_thread, dir, &entries, &positions, &next, &rewritten));
+            }
+            remask_thread(dir, &entries, &positions, &next, &rewritten);
+            for(thread &t: threads){
+                t.join();
+            }
+        }
+        //Once, rather than after every re-save
+        collect_garbage(dir);
+        relink(dir);
+    }
+    //Last, so re-running an interrupted remask with the old mask picks up where it left off
+    record_mask(dir, new_mask);
+    if(debug){
+        cout << "Masked " << positions.size() << " more positions, rewriting " << rewritten << " of saves" << endl;
+    }
+    return rewritten;
+}
@@ -1,7 +1,10 @@
 #include "include/sample.hpp"
+#include "include/catalog.hpp"
 #include <cstddef>
 #include <stdexcept>
 #include <vector>
+#include <atomic>
+#include <unistd.h>
 
 /**
 * @brief Definition of the `Sample` class, and functions for saving and loading samples
@@ -9,6 +12,94 @@
 
 using namespace std;
 
+/**
+* @brief UUIDs by interned ID. A deque so references stay valid as it grows
+*/
+deque<string> interned_uuids;
+
+/**
+* @brief Interned IDs by UUID
+*/
+unordered_map<string, uint32_t> uuid_ids;
+
+/**
+* @brief Guards the interning tables. Lookups are far more common than inserts, so this is shared
+*/
+shared_mutex intern_lock;
+
+/**
+* @brief Used to give each temporary save file in this process a unique name
+*/
+atomic<uint64_t> save_count = 0;
+
+uint32_t intern_uuid(const string &uuid){
+    {
+        shared_lock<shared_mutex> guard(intern_lock);
+        auto found = uuid_ids.find(uuid);
+        if(found != uuid_ids.end()){
+            return found->second;
+        }
+    }
+    unique_lock<shared_mutex> guard(intern_lock);
+    //Check again, as another thread may have interned this while we didn't hold the lock
+    auto found = uuid_ids.find(uuid);
+    if(found != uuid_ids.end()){
+        return found->second;
+    }
+    uint32_t id = interned_uuids.size();
+    interned_uuids.push_back(uuid);
+    uuid_ids[uuid] = id;
+    return id;
+}
+
+string uuid_of(uint32_t id){
+    shared_lock<shared_mutex> guard(intern_lock);
+    if(id >= interned_uuids.size()){
+        throw invalid_argument("Unknown sample ID: " + to_string(id));
+    }
+    return interned_uuids.at(id);
+}
+
+uint32_t interned_count(){
+    shared_lock<shared_mutex> guard(intern_lock);
+    return interned_uuids.size();
+}
+
+vector<uint64_t> query_mask;
+
+void set_query_mask(const unordered_set<int> &mask){
+    query_mask.clear();
+    for(const int &position: mask){
+        if(position < 0){
+            throw invalid_argument("Invalid mask position: " + to_string(position));
+        }
+        uint64_t word = position >> 6;
+        if(word >= query_mask.size()){
+            query_mask.resize(word + 1, 0);
+        }
+        query_mask.at(word) |= 1ULL << (position & 63);
+    }
+}
+
+/**
+* @brief Whether a position is ignored at query time. Without a profile this is a single comparison
+*/
+inline bool query_masked(int position){
+    uint64_t word = (uint32_t) position >> 6;
+    return word < query_mask.size() && ((query_mask[word] >> (position & 63)) & 1);
+}
+
+size_t unmasked_count(span<const int> positions){
+    if(query_mask.size() == 0){
+        return positions.size();
+    }
+    size_t count = 0;
+    for(const int &position: positions){
+        count += !query_masked(position);
+    }
+    return count;
+}
+
 
 Sample::Sample(string filename, string reference, unordered_set<int> mask, string guid){
     char ch;
@@ -43,6 +134,7 @@ Sample::Sample(string filename, string reference, unordered_set<int> mask, strin
         //Given a GUID, so use it
         uuid = guid;
     }
+    id = intern_uuid(uuid);
 
     int i = 0;
     while (fin >> noskipws >> ch) {
@@ -98,6 +190,8 @@ Sample::Sample(vector<int> a, vector<int> c, vector<int> g, vector<int> t, vecto
     G = g;
     T = t;
     N = n;
+    //No UUID yet, so whoever sets one should re-intern
+    id = intern_uuid(uuid);
     //As samples are not saved if they don't pass QC, this is implicitly true
     qc_pass = true;
 }
@@ -112,22 +206,63 @@ bool Sample::operator== (const Sample &s2) const{
     return check;
 }
 
+uint64_t Sample::content_hash() const{
+    //FNV-1a over each list's length then its positions, so positions can't move between lists without changing the hash
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](uint64_t value){
+        for(int i=0;i<8;i++){
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+    };
+    for(const vector<int>* type: {&A, &C, &G, &T, &N}){
+        add(type->size());
+        for(const int &position: *type){
+            add((uint32_t) position);
+        }
+    }
+    return hash;
+}
+
+bool Sample::same_content(const Sample &s2) const{
+    return A == s2.A && C == s2.C && G == s2.G && T == s2.T && N == s2.N;
+}
+
 int Sample::dist(Sample* sample, int cutoff_){
+    return dist(sample->view(), cutoff_);
+}
+
+int Sample::dist(const SampleView &sample, int cutoff_){
     unordered_set<int> acc;
     unsigned int cutoff = cutoff_;
-    acc = dist_x(A, N, sample->A, sample->N, acc, cutoff);
-    acc = dist_x(C, N, sample->C, sample->N, acc, cutoff);
-    acc = dist_x(T, N, sample->T, sample->N, acc, cutoff);
-    acc = dist_x(G, N, sample->G, sample->N, acc, cutoff);
+    dist_x(A, N, sample.A, sample.N, acc, cutoff);
+    dist_x(C, N, sample.C, sample.N, acc, cutoff);
+    dist_x(T, N, sample.T, sample.N, acc, cutoff);
+    dist_x(G, N, sample.G, sample.N, acc, cutoff);
     return acc.size();
 }
 
-unordered_set<int> Sample::dist_x(vector<int> this_x, vector<int> this_n, vector<int> sample_x, vector<int> sample_n, unordered_set<int> acc, unsigned int cutoff){
+SampleView Sample::view() const{
+    SampleView v;
+    v.A = A;
+    v.C = C;
+    v.G = G;
+    v.T = T;
+    v.N = N;
+    v.id = id;
+    return v;
+}
+
+void Sample::dist_x(span<const int> this_x, span<const int> this_n, span<const int> sample_x, span<const int> sample_n, unordered_set<int> &acc, unsigned int cutoff){
     //Increment cutoff so we can reject distances > cutoff entirely
     cutoff++;
     for(const int &elem: this_x){
         if(acc.size() == cutoff){
-            return acc;
+            return;
+        }
+        if(query_masked(elem)){
+            //Masked by the profile, so never counts
+            continue;
         }
         if(!binary_search(sample_x.begin(), sample_x.end(), elem)){
             //Not a in sample
@@ -139,7 +274,10 @@ unordered_set<int> Sample::dist_x(vector<int> this_x, vector<int> this_n, vector
     }
     for(const int &elem: sample_x){
         if(acc.size() == cutoff){
-            return acc;
+            return;
+        }
+        if(query_masked(elem)){
+            continue;
         }
         if(!binary_search(this_x.begin(), this_x.end(), elem)){
             //Not a in sample
@@ -149,8 +287,6 @@ unordered_set<int> Sample::dist_x(vector<int> this_x, vector<int> this_n, vector
             }
         }
     }
-
-    return acc;
 }
 
 void save_n(vector<int> to_save, string filename){
@@ -227,6 +363,7 @@ Sample* load_old(string filename){
         }
     }
     s->uuid = uuid;
+    s->id = intern_uuid(uuid);
 
     // We now have instanciated the old save, so write the new-style version and clean up
     string base_filename = filename.substr(0, filename.size()-uuid.size());
@@ -240,7 +377,7 @@ Sample* load_old(string filename){
     return s;
 }
 
-void save(string filename, Sample* sample){
+void save(string filename, Sample* sample, bool collect){
     /**
     File format:
     Integers are written as binary integers (i.e 4 chars per int)
@@ -265,12 +402,19 @@ void save(string filename, Sample* sample){
         //No trailing / so add
         filename += '/';
     }
-    filename += sample->uuid;
-    filename = filename + ".fn5";
+    string dir = filename;
+    //Re-saves go to a new version, so readers of the old one are unaffected
+    string relative = catalog_save_path(dir, sample->uuid);
+    filename += relative;
+    if(relative != sample->uuid + ".fn5"){
+        std::filesystem::create_directories(std::filesystem::path(filename).parent_path());
+    }
+    //Written to a temporary file and moved into place, so a partial save is never seen
+    string tmp_filename = filename + ".tmp." + to_string(getpid()) + "." + to_string(save_count++);
 
     const vector<char> types = {'A', 'C', 'G', 'T', 'N'};
 
-    fstream out(filename, fstream::binary | fstream::out);
+    fstream out(tmp_filename, fstream::binary | fstream::out | fstream::trunc);
     if(!out.good()){
         throw invalid_argument("Error writing save file: " + filename);
     }
@@ -311,7 +455,20 @@ void save(string filename, Sample* sample){
             out.write(p_, 4);
         }
     }
+    uint64_t size = out.tellp();
     out.close();
+    if(!out.good()){
+        std::filesystem::remove(tmp_filename);
+        throw invalid_argument("Error writing save file: " + filename);
+    }
+    std::filesystem::rename(tmp_filename, filename);
+
+    //Record in the catalog so loaders don't need to scan the dir
+    catalog_add(dir, sample, relative, 0, size);
+    if(collect && relative != sample->uuid + ".fn5"){
+        //Replaced a version, which may now be unused
+        collect_garbage(dir);
+    }
 }
 
 Sample* readSample(string filename){
@@ -425,6 +582,7 @@ Sample* readSample(string filename){
         }
     }
     s->uuid = uuid;
+    s->id = intern_uuid(uuid);
     return s;
 }
 
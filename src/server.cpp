@@ -0,0 +1,534 @@
+#include "include/server.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <shared_mutex>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+* @brief Resident server mode. Loads the collection once, then answers requests over a Unix domain socket
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+void send_frame(int fd, const string &payload){
+    if(payload.size() > max_frame_size){
+        throw invalid_argument("Frame too large: " + to_string(payload.size()) + " bytes");
+    }
+    uint32_t size = payload.size();
+    string frame((const char *) &size, 4);
+    frame += payload;
+    size_t sent = 0;
+    while(sent < frame.size()){
+        ssize_t n = send(fd, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            throw invalid_argument("Error sending frame: " + string(strerror(errno)));
+        }
+        sent += n;
+    }
+}
+
+/**
+* @brief Receive exactly `size` bytes
+*
+* @returns false if the socket closed before any bytes were received
+*/
+bool recv_exact(int fd, char* data, size_t size){
+    size_t done = 0;
+    while(done < size){
+        ssize_t n = recv(fd, data + done, size - done, 0);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            if(done == 0 && n == 0){
+                return false;
+            }
+            throw invalid_argument("Connection closed mid frame");
+        }
+        done += n;
+    }
+    return true;
+}
+
+bool recv_frame(int fd, string &payload){
+    uint32_t size;
+    if(!recv_exact(fd, (char *) &size, 4)){
+        return false;
+    }
+    if(size > max_frame_size){
+        throw invalid_argument("Frame too large: " + to_string(size) + " bytes");
+    }
+    payload.resize(size);
+    if(size > 0 && !recv_exact(fd, payload.data(), size)){
+        throw invalid_argument("Connection closed mid frame");
+    }
+    return true;
+}
+
+/**
+* @brief Make the address of a socket path
+*/
+sockaddr_un socket_address(string socket_path){
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(address.sun_path)){
+        throw invalid_argument("Socket path too long: " + socket_path);
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    return address;
+}
+
+/**
+* @brief Listening socket, so signal handlers can stop the server
+*/
+atomic<int> listen_fd = -1;
+
+/**
+* @brief Stop accepting connections. Safe to call from a signal handler
+*/
+void stop_listening(int signal=0){
+    int fd = listen_fd;
+    if(fd >= 0){
+        shutdown(fd, SHUT_RDWR);
+    }
+}
+
+/**
+* @brief State shared by the request threads
+*/
+class Server{
+    public:
+        /**
+        * @brief The whole collection, in load order
+        */
+        vector<Sample*> samples;
+
+        /**
+        * @brief Index into `samples` by interned ID
+        */
+        unordered_map<uint32_t, size_t> positions;
+
+        /**
+        * @brief Guards `samples` and `positions`. Held shared while comparing
+        */
+        shared_mutex samples_lock;
+
+        /**
+        * @brief Held for the whole of an add, so concurrent adds are compared against each other
+        */
+        mutex add_lock;
+
+        /**
+        * @brief The saves dir's neighbour graph. nullptr if disabled
+        */
+        unique_ptr<NeighbourGraph> graph;
+
+        /**
+        * @brief The saves dir's clusters. nullptr if disabled
+        */
+        unique_ptr<Clusters> clusters;
+
+        string reference;
+        unordered_set<int> mask;
+        int cutoff;
+
+        /**
+        * @brief Set once the server should stop
+        */
+        atomic<bool> stopping = false;
+
+        /**
+        * @brief Number of requests answered
+        */
+        atomic<uint64_t> requests = 0;
+
+        /**
+        * @brief When the server started answering requests
+        */
+        chrono::steady_clock::time_point started;
+
+        /**
+        * @brief Connections waiting for a request thread
+        */
+        deque<int> pending;
+
+        /**
+        * @brief Connections being handled, so they can be closed on shutdown
+        */
+        unordered_set<int> active;
+
+        /**
+        * @brief Guards `pending` and `active`
+        */
+        mutex connections_lock;
+
+        /**
+        * @brief Signals changes to `pending` and `stopping`
+        */
+        condition_variable connections_changed;
+
+        /**
+        * @brief Answer a single request
+        *
+        * @param request Request frame
+        * @returns Response frame
+        */
+        string handle(const string &request);
+
+        /**
+        * @brief Request thread's main loop
+        */
+        void worker();
+
+        /**
+        * @brief Parse the sample a request refers to
+        */
+        Sample* parse_sample(const string &path, const string &data);
+
+        /**
+        * @brief Compare a sample against the whole collection. `samples_lock` must be held
+        */
+        vector<Distance> compare(Sample* sample, int cutoff);
+};
+
+/**
+* @brief Number of FASTA files received over the socket so far, for unique temporary names
+*/
+atomic<uint64_t> received_fastas = 0;
+
+Sample* Server::parse_sample(const string &path, const string &data){
+    if(path != ""){
+        return new Sample(path, reference, mask);
+    }
+    //Samples are only parsed from files, so go via a temporary one
+    fs::path temp = fs::temp_directory_path() / ("fn5_" + to_string(getpid()) + "_" + to_string(received_fastas++) + ".fasta");
+    fstream out(temp, fstream::out | fstream::binary);
+    out.write(data.c_str(), data.size());
+    out.close();
+    try{
+        Sample* sample = new Sample(temp, reference, mask);
+        fs::remove(temp);
+        return sample;
+    }
+    catch(...){
+        fs::remove(temp);
+        throw;
+    }
+}
+
+vector<Distance> Server::compare(Sample* sample, int cutoff){
+    vector<Distance> distances;
+    for(Sample* other: samples){
+        if(other->id == sample->id){
+            continue;
+        }
+        int dist = sample->dist(other, cutoff);
+        if(dist <= cutoff){
+            distances.push_back(make_distance(sample, other, dist));
+        }
+    }
+    return distances;
+}
+
+string Server::handle(const string &request){
+    size_t line_end = request.find('\n');
+    string line = request.substr(0, line_end);
+    string data = line_end == string::npos ? "" : request.substr(line_end + 1);
+    vector<string> fields;
+    size_t start = 0;
+    while(true){
+        size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab - start));
+        if(tab == string::npos){
+            break;
+        }
+        start = tab + 1;
+    }
+    while(fields.size() < 3){
+        fields.push_back("");
+    }
+    string command = fields.at(0);
+    int request_cutoff = fields.at(1) == "" ? -1 : stoi(fields.at(1));
+    if(request_cutoff < 0){
+        request_cutoff = cutoff;
+    }
+    string argument = fields.at(2);
+
+    string output;
+    if(command == "add"){
+        Sample* sample = parse_sample(argument, data);
+        lock_guard<mutex> adding(add_lock);
+        //Compare as far as the graph and clusters need, but only reply within the cutoff
+        int compute_cutoff = request_cutoff;
+        if(graph != nullptr){
+            compute_cutoff = max(compute_cutoff, graph->cutoff);
+        }
+        if(clusters != nullptr){
+            compute_cutoff = max(compute_cutoff, clusters->cutoff);
+        }
+        vector<Distance> distances;
+        {
+            shared_lock<shared_mutex> reading(samples_lock);
+            distances = compare(sample, compute_cutoff);
+        }
+        if(graph != nullptr && sample->qc_pass){
+            if(positions.contains(sample->id)){
+                //Only adds change positions, so this doesn't need the samples lock
+                readd(save_dir, {sample}, clusters.get());
+            }
+            //A sample which failed QC isn't saved, so is kept out of the graph and clusters
+            graph->append(distances);
+            graph->cover({sample->id});
+            graph->maintain();
+        }
+        if(clusters != nullptr && sample->qc_pass){
+            clusters->append(distances);
+        }
+        erase_if(distances, [request_cutoff](const Distance &d){ return d.dist > request_cutoff; });
+        format_distances(distances, output);
+
+        save(save_dir + "/", sample);
+        if(!sample->qc_pass){
+            output += "||QC_FAIL: " + sample->uuid + "||\n";
+            delete sample;
+        }
+        else{
+            unique_lock<shared_mutex> writing(samples_lock);
+            auto existing = positions.find(sample->id);
+            if(existing != positions.end()){
+                //Re-added, so replace the old version
+                delete samples.at(existing->second);
+                samples.at(existing->second) = sample;
+            }
+            else{
+                positions[sample->id] = samples.size();
+                samples.push_back(sample);
+            }
+        }
+    }
+    else if(command == "remove"){
+        lock_guard<mutex> adding(add_lock);
+        remove_samples(save_dir, {argument});
+        unique_lock<shared_mutex> writing(samples_lock);
+        auto existing = positions.find(intern_uuid(argument));
+        if(existing != positions.end()){
+            delete samples.at(existing->second);
+            samples.erase(samples.begin() + existing->second);
+            positions.clear();
+            for(size_t i=0;i<samples.size();i++){
+                positions[samples.at(i)->id] = i;
+            }
+        }
+    }
+    else if(command == "compare_row"){
+        Sample* sample = parse_sample(argument, data);
+        vector<Distance> distances;
+        {
+            shared_lock<shared_mutex> reading(samples_lock);
+            distances = compare(sample, request_cutoff);
+        }
+        format_distances(distances, output);
+        delete sample;
+    }
+    else if(command == "nearest"){
+        //The cutoff field holds k
+        Sample* sample = parse_sample(argument, data);
+        int k = fields.at(1) == "" ? 1 : stoi(fields.at(1));
+        vector<pair<uint32_t, int>> closest;
+        {
+            shared_lock<shared_mutex> reading(samples_lock);
+            vector<SampleView> views;
+            views.reserve(samples.size());
+            for(Sample* other: samples){
+                views.push_back(other->view());
+            }
+            closest = nearest(sample, views, k);
+        }
+        for(const auto &[id, dist]: closest){
+            output += sample->uuid + " " + uuid_of(id) + " " + to_string(dist) + "\n";
+        }
+        delete sample;
+    }
+    else if(command == "neighbours"){
+        for(const auto &[neighbour, dist]: graph_neighbours(save_dir, argument, request_cutoff)){
+            output += argument + " " + neighbour + " " + to_string(dist) + "\n";
+        }
+    }
+    else if(command == "stats"){
+        size_t sample_count;
+        {
+            shared_lock<shared_mutex> reading(samples_lock);
+            sample_count = samples.size();
+        }
+        uint64_t uptime = chrono::duration_cast<chrono::seconds>(chrono::steady_clock::now() - started).count();
+        output += "samples\t" + to_string(sample_count) + "\n";
+        output += "requests\t" + to_string(requests) + "\n";
+        output += "uptime\t" + to_string(uptime) + "\n";
+        output += "cutoff\t" + to_string(cutoff) + "\n";
+    }
+    else if(command == "shutdown"){
+        stopping = true;
+        stop_listening();
+    }
+    else{
+        throw invalid_argument("Unknown command: " + command);
+    }
+    requests++;
+    return "ok\n" + output;
+}
+
+void Server::worker(){
+    while(true){
+        int fd;
+        {
+            unique_lock<mutex> guard(connections_lock);
+            connections_changed.wait(guard, [this]{ return stopping || pending.size() > 0; });
+            if(pending.size() == 0){
+                return;
+            }
+            fd = pending.front();
+            pending.pop_front();
+            active.insert(fd);
+        }
+        try{
+            string request;
+            while(recv_frame(fd, request)){
+                string response;
+                try{
+                    response = handle(request);
+                }
+                catch(const exception &e){
+                    response = "error\n" + string(e.what());
+                }
+                send_frame(fd, response);
+            }
+        }
+        catch(const exception &e){
+            //Connection failed, so there's nobody to report to
+            if(debug){
+                cerr << e.what() << endl;
+            }
+        }
+        {
+            lock_guard<mutex> guard(connections_lock);
+            active.erase(fd);
+        }
+        close(fd);
+    }
+}
+
+void serve(string socket_path, string reference, unordered_set<int> mask, int cutoff){
+    Server server;
+    server.reference = reference;
+    server.mask = mask;
+    server.cutoff = cutoff;
+    server.samples = load_saves_multithreaded();
+    for(size_t i=0;i<server.samples.size();i++){
+        server.positions[server.samples.at(i)->id] = i;
+    }
+    if(graph_cutoff >= 0){
+        server.graph = make_unique<NeighbourGraph>(save_dir, graph_cutoff);
+    }
+    if(cluster_cutoff >= 0){
+        server.clusters = make_unique<Clusters>(save_dir, cluster_cutoff);
+    }
+
+    //Only listen once loaded, so clients can connect as soon as the socket exists
+    sockaddr_un address = socket_address(socket_path);
+    unlink(socket_path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || bind(fd, (sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 128) != 0){
+        throw invalid_argument("Error listening on " + socket_path + ": " + strerror(errno));
+    }
+    listen_fd = fd;
+    signal(SIGINT, stop_listening);
+    signal(SIGTERM, stop_listening);
+    server.started = chrono::steady_clock::now();
+    if(debug){
+        cout << "Serving " << server.samples.size() << " samples on " << socket_path << endl;
+    }
+
+    vector<thread> workers;
+    for(int i=0;i<thread_count;i++){
+        workers.push_back(thread(&Server::worker, &server));
+    }
+    while(true){
+        int client = accept(fd, nullptr, nullptr);
+        if(client < 0){
+            if(errno == EINTR && !server.stopping){
+                continue;
+            }
+            //Listening socket shut down
+            break;
+        }
+        lock_guard<mutex> guard(server.connections_lock);
+        server.pending.push_back(client);
+        server.connections_changed.notify_one();
+    }
+
+    {
+        lock_guard<mutex> guard(server.connections_lock);
+        server.stopping = true;
+        //Wake up anything waiting on an idle connection
+        for(const int &client: server.active){
+            shutdown(client, SHUT_RD);
+        }
+        for(const int &client: server.pending){
+            close(client);
+        }
+        server.pending.clear();
+    }
+    server.connections_changed.notify_all();
+    for(thread &t: workers){
+        t.join();
+    }
+    listen_fd = -1;
+    close(fd);
+    unlink(socket_path.c_str());
+    if(server.graph != nullptr){
+        server.graph->close();
+    }
+    if(server.clusters != nullptr){
+        server.clusters->close();
+    }
+}
+
+string client_request(string socket_path, string command, int cutoff, string argument, string data){
+    sockaddr_un address = socket_address(socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (sockaddr *) &address, sizeof(address)) != 0){
+        if(fd >= 0){
+            close(fd);
+        }
+        throw invalid_argument("Error connecting to " + socket_path + ": " + strerror(errno));
+    }
+    string response;
+    try{
+        send_frame(fd, command + "\t" + to_string(cutoff) + "\t" + argument + "\n" + data);
+        if(!recv_frame(fd, response)){
+            throw invalid_argument("Server closed the connection");
+        }
+    }
+    catch(...){
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    size_t line_end = response.find('\n');
+    string status = response.substr(0, line_end);
+    string output = line_end == string::npos ? "" : response.substr(line_end + 1);
+    if(status != "ok"){
+        throw invalid_argument("Server error: " + output);
+    }
+    return output;
+}
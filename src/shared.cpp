@@ -0,0 +1,232 @@
+#include "include/shared.hpp"
+#include "include/comparisons.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+* @brief Shared collections, published once per node and mapped read only by every other process
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+bool shared_collection = false;
+
+string shared_dir = "/dev/shm";
+
+string shared_collection_path(string dir){
+    //Named from the absolute saves dir, so every process using the dir agrees
+    string absolute = fs::weakly_canonical(fs::absolute(dir)).string();
+    stringstream name;
+    name << shared_dir << "/fn5-" << hex << hash<string>{}(absolute) << ".collection";
+    return name.str();
+}
+
+/**
+* @brief Last modified time of a saves dir's catalog in nanoseconds, or 0 if there is no catalog
+*/
+int64_t catalog_modified(string dir){
+    error_code err;
+    auto modified = fs::last_write_time(dir + "/" + catalog_filename, err);
+    if(err){
+        return 0;
+    }
+    return chrono::duration_cast<chrono::nanoseconds>(modified.time_since_epoch()).count();
+}
+
+/**
+* @brief Round up to a multiple of 8
+*/
+uint64_t align_shared(uint64_t offset){
+    return (offset + 7) & ~((uint64_t) 7);
+}
+
+SharedCollection::SharedCollection(string dir){
+    //Pinned so the saves can't be collected while publishing
+    Snapshot snapshot(dir);
+    const Catalog &catalog = snapshot.catalog;
+    int64_t modified = catalog_modified(catalog.dir);
+    path = shared_collection_path(catalog.dir);
+    if(attach(catalog.generation(), modified)){
+        return;
+    }
+
+    //Only one process publishes at a time, the rest wait then attach to what it published
+    string lock_path = path + ".lock";
+    int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0){
+        throw invalid_argument("Error locking shared collection: " + lock_path + ": " + strerror(errno));
+    }
+    try{
+        if(!attach(catalog.generation(), modified)){
+            publish(catalog, modified);
+        }
+    }
+    catch(...){
+        close(lock_fd);
+        throw;
+    }
+    close(lock_fd);
+}
+
+SharedCollection::~SharedCollection(){
+    if(base != nullptr){
+        munmap(base, size);
+    }
+    if(fd < 0){
+        return;
+    }
+    //If the exclusive lock is free, nothing else is attached
+    flock(fd, LOCK_UN);
+    if(flock(fd, LOCK_EX | LOCK_NB) == 0){
+        //Only remove it if it hasn't already been replaced by a newer generation
+        struct stat ours, current;
+        if(fstat(fd, &ours) == 0 && stat(path.c_str(), &current) == 0 && ours.st_ino == current.st_ino && ours.st_dev == current.st_dev){
+            unlink(path.c_str());
+        }
+    }
+    close(fd);
+}
+
+bool SharedCollection::attach(uint64_t generation, int64_t modified){
+    int candidate = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(candidate < 0){
+        return false;
+    }
+    if(flock(candidate, LOCK_SH) != 0){
+        close(candidate);
+        return false;
+    }
+    //The last process attached may have removed it between opening and locking
+    struct stat ours, current;
+    if(fstat(candidate, &ours) != 0 || stat(path.c_str(), &current) != 0 || ours.st_ino != current.st_ino || ours.st_dev != current.st_dev
+            || (uint64_t) ours.st_size < sizeof(SharedHeader)){
+        close(candidate);
+        return false;
+    }
+    void* mapped = mmap(nullptr, ours.st_size, PROT_READ, MAP_SHARED, candidate, 0);
+    if(mapped == MAP_FAILED){
+        close(candidate);
+        return false;
+    }
+    const SharedHeader* header = (const SharedHeader*) mapped;
+    if(memcmp(header->magic, "FN5C", 4) != 0 || header->version != shared_collection_version || header->size != (uint64_t) ours.st_size
+            || header->generation != generation || header->modified != modified){
+        //Stale, so leave it for the publisher to replace
+        munmap(mapped, ours.st_size);
+        close(candidate);
+        return false;
+    }
+    fd = candidate;
+    base = mapped;
+    size = ours.st_size;
+    index();
+    return true;
+}
+
+void SharedCollection::publish(const Catalog &catalog, int64_t modified){
+    vector<Sample*> loaded = load_saves_multithreaded(catalog.paths());
+
+    SharedHeader header;
+    memcpy(header.magic, "FN5C", 4);
+    header.version = shared_collection_version;
+    header.generation = catalog.generation();
+    header.modified = modified;
+    header.sample_count = loaded.size();
+
+    vector<SharedEntry> entries(loaded.size());
+    uint64_t positions = 0;
+    uint64_t names_size = 0;
+    for(size_t i=0;i<loaded.size();i++){
+        Sample* s = loaded.at(i);
+        SharedEntry &entry = entries.at(i);
+        entry.start = positions;
+        const vector<int>* types[5] = {&s->A, &s->C, &s->G, &s->T, &s->N};
+        for(int j=0;j<5;j++){
+            entry.counts[j] = types[j]->size();
+            positions += types[j]->size();
+        }
+        entry.name_offset = names_size;
+        entry.name_size = s->uuid.size();
+        names_size += s->uuid.size();
+    }
+    header.positions_offset = align_shared(sizeof(SharedHeader) + entries.size() * sizeof(SharedEntry));
+    header.names_offset = header.positions_offset + positions * sizeof(int);
+    header.size = header.names_offset + names_size;
+
+    //Written to a temporary file and renamed into place, so nothing ever attaches to a partial collection
+    string tmp_path = path + ".tmp." + to_string(getpid());
+    int out = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(out < 0){
+        throw invalid_argument("Error writing shared collection: " + tmp_path + ": " + strerror(errno));
+    }
+    if(ftruncate(out, header.size) != 0){
+        close(out);
+        unlink(tmp_path.c_str());
+        throw invalid_argument("Error writing shared collection: " + tmp_path + ": " + strerror(errno));
+    }
+    char* mapped = (char*) mmap(nullptr, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, out, 0);
+    if(mapped == MAP_FAILED){
+        close(out);
+        unlink(tmp_path.c_str());
+        throw invalid_argument("Error mapping shared collection: " + tmp_path + ": " + strerror(errno));
+    }
+    memcpy(mapped, &header, sizeof(SharedHeader));
+    memcpy(mapped + sizeof(SharedHeader), entries.data(), entries.size() * sizeof(SharedEntry));
+    int* position_data = (int*) (mapped + header.positions_offset);
+    char* name_data = mapped + header.names_offset;
+    for(size_t i=0;i<loaded.size();i++){
+        Sample* s = loaded.at(i);
+        int* at = position_data + entries.at(i).start;
+        for(const vector<int>* type: {&s->A, &s->C, &s->G, &s->T, &s->N}){
+            memcpy(at, type->data(), type->size() * sizeof(int));
+            at += type->size();
+        }
+        memcpy(name_data + entries.at(i).name_offset, s->uuid.data(), s->uuid.size());
+        delete s;
+    }
+    munmap(mapped, header.size);
+
+    //Attached before it's visible, so it can't be removed from under us
+    flock(out, LOCK_SH);
+    if(rename(tmp_path.c_str(), path.c_str()) != 0){
+        close(out);
+        unlink(tmp_path.c_str());
+        throw invalid_argument("Error publishing shared collection: " + path + ": " + strerror(errno));
+    }
+    base = mmap(nullptr, header.size, PROT_READ, MAP_SHARED, out, 0);
+    if(base == MAP_FAILED){
+        base = nullptr;
+        close(out);
+        throw invalid_argument("Error mapping shared collection: " + path + ": " + strerror(errno));
+    }
+    fd = out;
+    size = header.size;
+    published = true;
+    index();
+}
+
+void SharedCollection::index(){
+    const char* start = (const char*) base;
+    const SharedHeader* header = (const SharedHeader*) start;
+    const SharedEntry* entries = (const SharedEntry*) (start + sizeof(SharedHeader));
+    const int* positions = (const int*) (start + header->positions_offset);
+    const char* names = start + header->names_offset;
+
+    samples.resize(header->sample_count);
+    for(uint64_t i=0;i<header->sample_count;i++){
+        const SharedEntry &entry = entries[i];
+        const int* at = positions + entry.start;
+        span<const int>* types[5] = {&samples.at(i).A, &samples.at(i).C, &samples.at(i).G, &samples.at(i).T, &samples.at(i).N};
+        for(int j=0;j<5;j++){
+            *types[j] = span<const int>(at, entry.counts[j]);
+            at += entry.counts[j];
+        }
+        samples.at(i).id = intern_uuid(string(names + entry.name_offset, entry.name_size));
+    }
+}
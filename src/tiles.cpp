@@ -0,0 +1,408 @@
+#include "include/tiles.hpp"
+#include "include/duplicates.hpp"
+#include <iomanip>
+
+/**
+* @brief Tiled pairwise comparisons, and splitting them between partitions
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+int tile_size = 512;
+
+uint64_t Tile::pairs() const{
+    uint64_t rows = row_end - row_start;
+    if(row_start == col_start){
+        //On the diagonal, so only the pairs above it
+        return rows * (rows - 1) / 2;
+    }
+    return rows * (col_end - col_start);
+}
+
+vector<Tile> make_tiles(const vector<Sample*> &samples, uint64_t min_tiles, uint64_t first_column){
+    uint64_t n = samples.size();
+    first_column = min(first_column, n);
+    //Each comparison walks the differences of both samples, so cost a sample by its number of differences
+    vector<uint64_t> weights(n + 1, 0);
+    for(uint64_t i=0;i<n;i++){
+        Sample* s = samples.at(i);
+        weights.at(i+1) = weights.at(i) + s->A.size() + s->C.size() + s->G.size() + s->T.size() + 1;
+    }
+
+    uint64_t block = max(tile_size, 1);
+    auto count_tiles = [n, first_column](uint64_t block){
+        //Every block of rows before the first column against every block of columns, then the triangle after it
+        uint64_t before = (first_column + block - 1) / block;
+        uint64_t after = (n - first_column + block - 1) / block;
+        return before * after + after * (after + 1) / 2;
+    };
+    while(block > 1 && count_tiles(block) < min_tiles){
+        block = (block + 1) / 2;
+    }
+
+    //Blocks are split at the first column, so no tile straddles it
+    vector<uint64_t> starts;
+    for(uint64_t i=0;i<first_column;i+=block){
+        starts.push_back(i);
+    }
+    for(uint64_t i=first_column;i<n;i+=block){
+        starts.push_back(i);
+    }
+    starts.push_back(n);
+
+    vector<Tile> tiles;
+    for(size_t row=0;row+1<starts.size();row++){
+        for(size_t col=row;col+1<starts.size();col++){
+            if(starts.at(col) < first_column){
+                continue;
+            }
+            Tile tile;
+            tile.row_start = starts.at(row);
+            tile.row_end = starts.at(row + 1);
+            tile.col_start = starts.at(col);
+            tile.col_end = starts.at(col + 1);
+            if(tile.pairs() == 0){
+                continue;
+            }
+            uint64_t row_weight = weights.at(tile.row_end) - weights.at(tile.row_start);
+            uint64_t col_weight = weights.at(tile.col_end) - weights.at(tile.col_start);
+            if(row == col){
+                //Each sample is in (rows - 1) pairs
+                tile.cost = (tile.row_end - tile.row_start - 1) * row_weight;
+            }
+            else{
+                tile.cost = (tile.col_end - tile.col_start) * row_weight + (tile.row_end - tile.row_start) * col_weight;
+            }
+            tile.index = tiles.size();
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+vector<Tile> partition_tiles(const vector<Tile> &tiles, int partitions, int partition){
+    if(partitions < 1 || partition < 1 || partition > partitions){
+        throw invalid_argument("Invalid partition " + to_string(partition) + "/" + to_string(partitions));
+    }
+    //Longest processing time first: most costly tiles first, each to the least loaded partition
+    vector<Tile> ordered = tiles;
+    stable_sort(ordered.begin(), ordered.end(), [](const Tile &a, const Tile &b){
+        return a.cost > b.cost;
+    });
+    vector<uint64_t> loads(partitions, 0);
+    vector<Tile> assigned;
+    for(const Tile &tile: ordered){
+        int least = min_element(loads.begin(), loads.end()) - loads.begin();
+        loads.at(least) += tile.cost;
+        if(least == partition - 1){
+            assigned.push_back(tile);
+        }
+    }
+    return assigned;
+}
+
+/**
+* @brief Compare tiles taken from a shared counter until there are none left. To be used by a thread
+*/
+void compare_tiles_thread(const vector<Sample*>* samples, const vector<Tile>* tiles, atomic<size_t>* next, int cutoff, ResultWriter* writer, vector<uint64_t>* results, const DuplicateClasses* classes){
+    vector<Distance> distances;
+    //Another thread's mark can checkpoint whatever has been written, so a tile is only handed over whole, with its mark
+    bool whole_tiles = writer->checkpointing();
+    for(size_t t=(*next)++;t<tiles->size();t=(*next)++){
+        const Tile &tile = tiles->at(t);
+        uint64_t found = 0;
+        if(classes != nullptr){
+            classes->within(tile, distances);
+            found = distances.size();
+        }
+        for(uint32_t i=tile.row_start;i<tile.row_end;i++){
+            Sample* s1 = samples->at(i);
+            for(uint32_t j=max(tile.col_start, i + 1);j<tile.col_end;j++){
+                Sample* s2 = samples->at(j);
+                if(s1->id == s2->id){
+                    continue;
+                }
+                int dist = s1->dist(s2, cutoff);
+                if(dist > cutoff){
+                    continue;
+                }
+                if(classes != nullptr){
+                    size_t before = distances.size();
+                    classes->fan_out(make_distance(s1, s2, dist), distances);
+                    found += distances.size() - before;
+                }
+                else{
+                    distances.push_back(make_distance(s1, s2, dist));
+                    found++;
+                }
+                if(!whole_tiles && distances.size() >= result_buffer_size){
+                    writer->push(distances);
+                }
+            }
+        }
+        //Each tile is only taken by one thread
+        results->at(t) = found;
+        //The rest of the tile with its mark
+        writer->mark(tile.index, distances);
+    }
+}
+
+vector<uint64_t> compare_tiles(const vector<Sample*> &samples, const vector<Tile> &tiles, int cutoff, ResultWriter* writer, const DuplicateClasses* classes){
+    vector<uint64_t> results(tiles.size(), 0);
+    atomic<size_t> next = 0;
+    vector<thread> threads;
+    for(int i=1;i<thread_count;i++){
+        threads.push_back(thread(compare_tiles_thread, &samples, &tiles, &next, cutoff, writer, &results, classes));
+    }
+    compare_tiles_thread(&samples, &tiles, &next, cutoff, writer, &results, classes);
+    for(thread &t: threads){
+        t.join();
+    }
+    return results;
+}
+
+string collection_fingerprint(const vector<Sample*> &samples){
+    //FNV-1a over each UUID and its counts
+    uint64_t hash = 14695981039346656037ULL;
+    auto add = [&hash](const string &text){
+        for(const char &ch: text){
+            hash ^= (unsigned char) ch;
+            hash *= 1099511628211ULL;
+        }
+    };
+    for(Sample* s: samples){
+        add(s->uuid + "\t" + to_string(s->A.size()) + "\t" + to_string(s->C.size()) + "\t" + to_string(s->G.size())
+            + "\t" + to_string(s->T.size()) + "\t" + to_string(s->N.size()) + "\n");
+    }
+    stringstream digest;
+    digest << hex << setw(16) << setfill('0') << hash;
+    return digest.str();
+}
+
+/**
+* @brief Contents of a partition manifest
+*/
+class Manifest{
+    public:
+        /**
+        * @brief Path to the manifest
+        */
+        string path;
+
+        /**
+        * @brief Header fields by name
+        */
+        map<string, string> fields;
+
+        /**
+        * @brief (index, pairs, results) of each tile
+        */
+        vector<tuple<uint64_t, uint64_t, uint64_t>> tiles;
+
+        /**
+        * @brief Get a numeric header field
+        */
+        uint64_t number(string name) const;
+};
+
+uint64_t Manifest::number(string name) const{
+    auto field = fields.find(name);
+    if(field == fields.end()){
+        throw invalid_argument("Malformed partition manifest, no " + name + ": " + path);
+    }
+    try{
+        return stoull(field->second);
+    }
+    catch(logic_error &err){
+        throw invalid_argument("Malformed partition manifest, bad " + name + ": " + path);
+    }
+}
+
+/**
+* @brief Read a partition manifest
+*/
+Manifest read_manifest(string path){
+    Manifest manifest;
+    manifest.path = path;
+    fstream in(path, fstream::in);
+    if(!in.good()){
+        throw invalid_argument("Invalid partition manifest: " + path);
+    }
+    string line;
+    while(getline(in, line)){
+        if(line == "" || line[0] == '#'){
+            continue;
+        }
+        vector<string> parts;
+        stringstream fields(line);
+        string part;
+        while(getline(fields, part, '\t')){
+            parts.push_back(part);
+        }
+        if(parts.at(0) == "tile"){
+            if(parts.size() != 8){
+                throw invalid_argument("Malformed partition manifest: " + path);
+            }
+            try{
+                manifest.tiles.push_back({stoull(parts.at(1)), stoull(parts.at(6)), stoull(parts.at(7))});
+            }
+            catch(logic_error &err){
+                throw invalid_argument("Malformed partition manifest: " + path);
+            }
+        }
+        else if(parts.size() == 2){
+            manifest.fields[parts.at(0)] = parts.at(1);
+        }
+        else{
+            throw invalid_argument("Malformed partition manifest: " + path);
+        }
+    }
+    if(manifest.number("version") != (uint64_t) manifest_version){
+        throw invalid_argument("Unsupported partition manifest version: " + path);
+    }
+    return manifest;
+}
+
+void compute_partition(int cutoff, vector<Sample*> samples, int partition, int partitions, string dir){
+    vector<Tile> tiles = make_tiles(samples, (uint64_t) tiles_per_partition * partitions);
+    vector<Tile> mine = partition_tiles(tiles, partitions, partition);
+    if(debug){
+        uint64_t pairs = 0;
+        for(const Tile &tile: mine){
+            pairs += tile.pairs();
+        }
+        cout << "Partition " << partition << "/" << partitions << ": " << mine.size() << " of " << tiles.size() << " tiles, "
+             << pairs << " comparisons" << endl;
+    }
+
+    fs::create_directories(dir);
+    string name = "part-" + to_string(partition) + "-of-" + to_string(partitions);
+    string output = name + ".fn5d" + (output_compression == "gzip" ? ".gz" : "");
+    string manifest_path = dir + "/" + name + ".manifest";
+    //Any previous run of this partition is incomplete until the new manifest is written
+    fs::remove(manifest_path);
+    fs::remove(dir + "/" + output);
+
+    //Always binary, so the output carries its own UUIDs
+    unique_ptr<ResultWriter> writer = make_unique<ResultWriter>(dir + "/" + output, output_compression, "binary");
+    vector<uint64_t> results = compare_tiles(samples, mine, cutoff, writer.get());
+    writer->close();
+
+    stringstream manifest;
+    manifest << "#fn5 partition manifest\n";
+    manifest << "version\t" << manifest_version << "\n";
+    manifest << "partition\t" << partition << "\n";
+    manifest << "partitions\t" << partitions << "\n";
+    manifest << "samples\t" << samples.size() << "\n";
+    manifest << "tiles\t" << tiles.size() << "\n";
+    manifest << "cutoff\t" << cutoff << "\n";
+    manifest << "collection\t" << collection_fingerprint(samples) << "\n";
+    manifest << "output\t" << output << "\n";
+    manifest << "results\t" << writer->written() << "\n";
+    manifest << "#tile\tindex\trow_start\trow_end\tcol_start\tcol_end\tpairs\tresults\n";
+    for(size_t i=0;i<mine.size();i++){
+        const Tile &tile = mine.at(i);
+        manifest << "tile\t" << tile.index << "\t" << tile.row_start << "\t" << tile.row_end << "\t" << tile.col_start << "\t"
+                 << tile.col_end << "\t" << tile.pairs() << "\t" << results.at(i) << "\n";
+    }
+    string tmp = manifest_path + ".tmp";
+    fstream out(tmp, fstream::out | fstream::trunc);
+    out << manifest.str();
+    out.close();
+    if(!out.good()){
+        throw invalid_argument("Error writing partition manifest: " + tmp);
+    }
+    fs::rename(tmp, manifest_path);
+}
+
+uint64_t merge_partitions(string dir){
+    vector<Manifest> manifests;
+    if(!fs::is_directory(dir)){
+        throw invalid_argument("Invalid partition dir: " + dir);
+    }
+    for(const auto &item: fs::directory_iterator(dir)){
+        if(item.path().extension() == ".manifest"){
+            manifests.push_back(read_manifest(item.path().string()));
+        }
+    }
+    if(manifests.size() == 0){
+        throw invalid_argument("No partition manifests in " + dir);
+    }
+
+    //Every partition must have been computed over the same collection and tiles
+    const Manifest &first = manifests.at(0);
+    const vector<string> shared_fields = {"partitions", "samples", "tiles", "cutoff", "collection", "output"};
+    for(const Manifest &manifest: manifests){
+        for(const string &field: shared_fields){
+            if(!manifest.fields.contains(field) || !first.fields.contains(field) || (field != "output" && manifest.fields.at(field) != first.fields.at(field))){
+                throw invalid_argument("Partitions disagree on " + field + ": " + first.path + " and " + manifest.path);
+            }
+        }
+    }
+    uint64_t partitions = first.number("partitions");
+    uint64_t samples = first.number("samples");
+    uint64_t tile_count = first.number("tiles");
+    vector<bool> seen_partitions(partitions, false);
+    vector<bool> seen_tiles(tile_count, false);
+    uint64_t pairs = 0;
+    for(const Manifest &manifest: manifests){
+        uint64_t partition = manifest.number("partition");
+        if(partition < 1 || partition > partitions || seen_partitions.at(partition - 1)){
+            throw invalid_argument("Unexpected or repeated partition " + to_string(partition) + ": " + manifest.path);
+        }
+        seen_partitions.at(partition - 1) = true;
+        uint64_t results = 0;
+        for(const auto &[index, tile_pairs, tile_results]: manifest.tiles){
+            if(index >= tile_count || seen_tiles.at(index)){
+                throw invalid_argument("Unexpected or repeated tile " + to_string(index) + ": " + manifest.path);
+            }
+            seen_tiles.at(index) = true;
+            pairs += tile_pairs;
+            results += tile_results;
+        }
+        if(results != manifest.number("results")){
+            throw invalid_argument("Partition's tile results don't add up: " + manifest.path);
+        }
+    }
+    for(uint64_t i=0;i<partitions;i++){
+        if(!seen_partitions.at(i)){
+            throw invalid_argument("Missing partition " + to_string(i + 1) + "/" + to_string(partitions) + " in " + dir);
+        }
+    }
+    uint64_t expected_pairs = samples > 0 ? samples * (samples - 1) / 2 : 0;
+    if(find(seen_tiles.begin(), seen_tiles.end(), false) != seen_tiles.end() || pairs != expected_pairs){
+        throw invalid_argument("Partitions don't cover every pair in " + dir);
+    }
+
+    //Check every output is complete before writing anything
+    for(const Manifest &manifest: manifests){
+        uint64_t records = 0;
+        read_binary_distances(dir + "/" + manifest.fields.at("output"), [&records](const vector<string> &names, const vector<Distance> &distances){
+            records += distances.size();
+        });
+        if(records != manifest.number("results")){
+            throw invalid_argument("Partition output is incomplete: " + dir + "/" + manifest.fields.at("output"));
+        }
+    }
+
+    unique_ptr<ResultWriter> writer = open_writer("-");
+    for(const Manifest &manifest: manifests){
+        //IDs within the output are local to it, so map them to this process's
+        vector<uint32_t> ids;
+        read_binary_distances(dir + "/" + manifest.fields.at("output"), [&ids, &writer](const vector<string> &names, const vector<Distance> &distances){
+            while(ids.size() < names.size()){
+                ids.push_back(intern_uuid(names.at(ids.size())));
+            }
+            vector<Distance> mapped;
+            mapped.reserve(distances.size());
+            for(const Distance &d: distances){
+                mapped.push_back(make_distance(ids.at(d.id1), ids.at(d.id2), d.dist));
+            }
+            writer->push(mapped);
+        });
+    }
+    writer->close();
+    return writer->written();
+}
@@ -0,0 +1,326 @@
+#include "include/watch.hpp"
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/**
+* @brief Spool dir watcher. Picks up new files as they arrive, and adds them in micro-batches
+*/
+
+namespace fs = std::filesystem;
+
+using namespace std;
+
+int batch_size = 64;
+
+int batch_latency = 1000;
+
+const string metrics_filename = "metrics.tsv";
+
+/**
+* @brief Set by SIGINT/SIGTERM. The current batch is finished, and anything pending added before stopping
+*/
+atomic<bool> watch_stopping = false;
+
+void stop_watching(int signal){
+    watch_stopping = true;
+}
+
+/**
+* @brief Lower case extension of a filename, or "" if there isn't one
+*/
+string extension_of(string filename){
+    size_t dot = filename.find_last_of(".");
+    if(dot == string::npos || dot == 0){
+        return "";
+    }
+    string ext = filename.substr(dot+1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext;
+}
+
+bool is_spool_file(string filename){
+    string ext = extension_of(filename);
+    return ext == "fasta" || ext == "fa" || ext == "fas" || ext == "fna" || ext == "fn5";
+}
+
+/**
+* @brief A file waiting to be added
+*/
+class SpoolFile{
+    public:
+        /**
+        * @brief Filename within the spool dir
+        */
+        string name;
+
+        /**
+        * @brief When the file was picked up
+        */
+        chrono::steady_clock::time_point arrived;
+};
+
+/**
+* @brief State of a running watcher
+*/
+class Watcher{
+    public:
+        string spool_dir;
+        string reference;
+        unordered_set<int> mask;
+        int cutoff;
+
+        /**
+        * @brief The whole collection, including everything added so far
+        */
+        vector<Sample*> samples;
+
+        /**
+        * @brief Index into `samples` by interned ID
+        */
+        unordered_map<uint32_t, size_t> positions;
+
+        /**
+        * @brief Files waiting to be added, oldest first
+        */
+        deque<SpoolFile> pending;
+
+        /**
+        * @brief Names of files in `pending`
+        */
+        unordered_set<string> queued;
+
+        /**
+        * @brief Number of batches added so far
+        */
+        uint64_t batches = 0;
+
+        /**
+        * @brief Queue a file if it should be added and isn't already queued
+        */
+        void queue(string name);
+
+        /**
+        * @brief Queue everything already in the spool dir
+        */
+        void scan();
+
+        /**
+        * @brief Parse, save and add a batch of files, then record its metrics
+        */
+        void add_batch(vector<SpoolFile> batch);
+};
+
+void Watcher::queue(string name){
+    if(!is_spool_file(name) || queued.contains(name)){
+        return;
+    }
+    if(!fs::is_regular_file(spool_dir + "/" + name)){
+        return;
+    }
+    SpoolFile file;
+    file.name = name;
+    file.arrived = chrono::steady_clock::now();
+    pending.push_back(file);
+    queued.insert(name);
+}
+
+void Watcher::scan(){
+    //Sorted so files already waiting are added in a stable order
+    vector<string> names;
+    for(const auto &item: fs::directory_iterator(spool_dir)){
+        names.push_back(item.path().filename());
+    }
+    sort(names.begin(), names.end());
+    for(const string &name: names){
+        queue(name);
+    }
+}
+
+/**
+* @brief Parse every `step`th file of a batch, starting at `start`. Each slot is only written by one thread
+*/
+void parse_spool_files(vector<string> paths, size_t start, size_t step, string reference, unordered_set<int> mask, vector<Sample*> *parsed, vector<string> *errors){
+    for(size_t i=start;i<paths.size();i+=step){
+        try{
+            if(extension_of(paths.at(i)) == "fn5"){
+                parsed->at(i) = readSample(paths.at(i));
+            }
+            else{
+                parsed->at(i) = new Sample(paths.at(i), reference, mask);
+            }
+        }
+        catch(const exception &e){
+            errors->at(i) = e.what();
+        }
+    }
+}
+
+void Watcher::add_batch(vector<SpoolFile> batch){
+    auto started = chrono::steady_clock::now();
+    batches++;
+
+    vector<string> paths;
+    for(const SpoolFile &file: batch){
+        paths.push_back(spool_dir + "/" + file.name);
+    }
+    vector<Sample*> parsed(paths.size(), nullptr);
+    vector<string> errors(paths.size());
+    vector<thread> threads;
+    size_t parse_threads = min((size_t) thread_count, paths.size());
+    for(size_t t=1;t<parse_threads;t++){
+        threads.push_back(thread(parse_spool_files, paths, t, parse_threads, reference, mask, &parsed, &errors));
+    }
+    parse_spool_files(paths, 0, max(parse_threads, (size_t) 1), reference, mask, &parsed, &errors);
+    for(thread &t: threads){
+        t.join();
+    }
+
+    vector<Sample*> others;
+    vector<size_t> added;
+    for(size_t i=0;i<batch.size();i++){
+        queued.erase(batch.at(i).name);
+        if(parsed.at(i) == nullptr){
+            cerr << "Failed to add " << paths.at(i) << ": " << errors.at(i) << endl;
+        }
+        else if(!parsed.at(i)->qc_pass){
+            //Not saved, so kept out of the collection rather than replacing a good version
+            save(save_dir + "/", parsed.at(i));
+            delete parsed.at(i);
+        }
+        else{
+            save(save_dir + "/", parsed.at(i));
+            others.push_back(parsed.at(i));
+            added.push_back(i);
+            continue;
+        }
+        fs::rename(paths.at(i), spool_dir + "/failed/" + batch.at(i).name);
+    }
+
+    uint64_t comparisons = others.size() * samples.size() + others.size() * (others.size() - 1) / 2;
+    for(Sample* sample: others){
+        if(positions.contains(sample->id)){
+            //Not compared against its old self
+            comparisons--;
+        }
+    }
+    uint64_t results = add_loaded(samples, others, cutoff);
+    //Only once added, so if that fails they're picked up again on restart
+    for(const size_t &i: added){
+        fs::rename(paths.at(i), spool_dir + "/done/" + batch.at(i).name);
+    }
+    for(Sample* sample: others){
+        auto existing = positions.find(sample->id);
+        if(existing != positions.end()){
+            //Re-added, so replace the old version
+            delete samples.at(existing->second);
+            samples.at(existing->second) = sample;
+        }
+        else{
+            positions[sample->id] = samples.size();
+            samples.push_back(sample);
+        }
+    }
+
+    auto finished = chrono::steady_clock::now();
+    double compute_ms = chrono::duration<double, milli>(finished - started).count();
+    double latency_ms = chrono::duration<double, milli>(finished - batch.front().arrived).count();
+    double throughput = compute_ms > 0 ? others.size() * 1000.0 / compute_ms : 0;
+
+    string metrics_path = spool_dir + "/" + metrics_filename;
+    bool new_metrics = !fs::exists(metrics_path);
+    fstream metrics(metrics_path, fstream::out | fstream::app);
+    if(new_metrics){
+        metrics << "batch\tsamples\tfailed\tcollection\tcomparisons\tresults\tlatency_ms\tcompute_ms\tsamples_per_s" << endl;
+    }
+    metrics << batches << "\t" << others.size() << "\t" << batch.size() - others.size() << "\t" << samples.size() << "\t"
+            << comparisons << "\t" << results << "\t" << (uint64_t) latency_ms << "\t" << (uint64_t) compute_ms << "\t"
+            << (uint64_t) throughput << endl;
+    metrics.close();
+    if(debug){
+        cerr << "Batch " << batches << ": added " << others.size() << " samples in " << (uint64_t) compute_ms << "ms, "
+             << (uint64_t) latency_ms << "ms after the first arrived" << endl;
+    }
+}
+
+void watch(string spool_dir, string reference, unordered_set<int> mask, int cutoff){
+    if(batch_size < 1 || batch_latency < 0){
+        throw invalid_argument("Invalid batch size or latency");
+    }
+    Watcher watcher;
+    while(spool_dir.size() > 1 && spool_dir[spool_dir.size()-1] == '/'){
+        spool_dir.pop_back();
+    }
+    watcher.spool_dir = spool_dir;
+    watcher.reference = reference;
+    watcher.mask = mask;
+    watcher.cutoff = cutoff;
+    if(!fs::is_directory(spool_dir)){
+        throw invalid_argument("Invalid spool dir: " + spool_dir);
+    }
+    fs::create_directories(spool_dir + "/done");
+    fs::create_directories(spool_dir + "/failed");
+
+    watcher.samples = load_saves_multithreaded();
+    for(size_t i=0;i<watcher.samples.size();i++){
+        watcher.positions[watcher.samples.at(i)->id] = i;
+    }
+
+    //Watch before scanning so nothing arriving in between is missed
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0 || inotify_add_watch(fd, spool_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0){
+        throw invalid_argument("Error watching " + spool_dir + ": " + strerror(errno));
+    }
+    watch_stopping = false;
+    signal(SIGINT, stop_watching);
+    signal(SIGTERM, stop_watching);
+    watcher.scan();
+
+    alignas(inotify_event) char events[65536];
+    while(true){
+        bool stopping = watch_stopping;
+        auto now = chrono::steady_clock::now();
+        auto deadline = now;
+        if(watcher.pending.size() > 0){
+            deadline = watcher.pending.front().arrived + chrono::milliseconds(batch_latency);
+        }
+        if(watcher.pending.size() >= (size_t) batch_size || (watcher.pending.size() > 0 && (now >= deadline || stopping))){
+            size_t n = min(watcher.pending.size(), (size_t) batch_size);
+            vector<SpoolFile> batch(watcher.pending.begin(), watcher.pending.begin() + n);
+            watcher.pending.erase(watcher.pending.begin(), watcher.pending.begin() + n);
+            watcher.add_batch(batch);
+            continue;
+        }
+        if(stopping){
+            break;
+        }
+
+        //Wake up for the next deadline, and regularly to check for signals
+        int timeout = 1000;
+        if(watcher.pending.size() > 0){
+            timeout = min((int64_t) timeout, (int64_t) chrono::duration_cast<chrono::milliseconds>(deadline - now).count() + 1);
+        }
+        pollfd poll_fd = {fd, POLLIN, 0};
+        if(poll(&poll_fd, 1, timeout) <= 0){
+            continue;
+        }
+        ssize_t n;
+        while((n = read(fd, events, sizeof(events))) > 0){
+            for(char* p=events;p<events+n;){
+                inotify_event* event = (inotify_event *) p;
+                if(event->mask & IN_Q_OVERFLOW){
+                    //Missed some events, so look for anything new
+                    watcher.scan();
+                }
+                else if(event->len > 0 && !(event->mask & IN_ISDIR)){
+                    watcher.queue(event->name);
+                }
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+    close(fd);
+}
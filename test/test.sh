@@ -25,10 +25,151 @@ done
 ./fn5 --bulk_load test/all.txt --saves_dir test/saves --reference NC_045512.fasta --mask ignore
 ./fn5 --compute 20 --saves_dir test/saves > test/output/1.txt
 
-./fn5 --add test/cases/4.fasta --saves_dir test/saves --output_file test/output/2.txt --reference NC_045512.fasta --mask ignore
+./fn5 --add test/cases/4.fasta --saves_dir test/saves --output_file test/output/2.txt --reference NC_045512.fasta --mask ignore --cluster_merges test/output/25.tsv
 
 ./fn5 --add_many test/two_samples.txt --saves_dir test/saves --reference NC_045512.fasta --mask ignore > test/output/3.txt
 
 ./fn5 --compare_row test/cases/4.fasta --saves_dir test/saves --reference NC_045512.fasta --mask ignore > test/output/4.txt
 
 
+
+./fn5 --compute 20 --saves_dir test/saves --output_format binary > test/output/5.fn5d
+./fn5-dump test/output/5.fn5d > test/output/5.txt
+
+./fn5 --compute 20 --saves_dir test/saves --output_format binary_delta --output_compression gzip > test/output/6.fn5d.gz
+./fn5-dump test/output/6.fn5d.gz > test/output/6.txt
+
+./fn5 --compute 20 --saves_dir test/saves --sqlite test/output/7.db
+
+./fn5 --neighbours sample4 --saves_dir test/saves > test/output/8.txt
+./fn5 --neighbours sample4 --saves_dir test/saves --cutoff 11 > test/output/9.txt
+
+#Resident server. Re-adding sample4 should give the same as adding it directly
+./fn5 --serve test/output/fn5.sock --saves_dir test/saves --reference NC_045512.fasta --mask ignore --threads 2 &
+for i in $(seq 100);
+do
+    if [ -S test/output/fn5.sock ]; then break; fi
+    sleep 0.1
+done
+./fn5 --client test/output/fn5.sock --add test/cases/4.fasta > test/output/10.txt
+./fn5 --client test/output/fn5.sock --neighbours sample4 --cutoff 11 > test/output/11.txt
+./fn5 --client test/output/fn5.sock --stats 1 > test/output/12.txt
+./fn5 --client test/output/fn5.sock --compare_row test/cases/4.fasta --nearest 2 > test/output/20.txt
+./fn5 --client test/output/fn5.sock --shutdown 1
+wait
+
+#Spool dir watcher. Files already waiting go in the first batch, then new arrivals in another
+mkdir -p test/output/spool
+cp test/cases/1.fasta test/cases/4.fasta test/output/spool/
+./fn5 --watch test/output/spool --saves_dir test/saves --reference NC_045512.fasta --mask ignore --batch_latency 200 > test/output/13.txt &
+watcher=$!
+for i in $(seq 100);
+do
+    if [ -f test/output/spool/metrics.tsv ] && [ $(wc -l < test/output/spool/metrics.tsv) -ge 2 ]; then break; fi
+    sleep 0.1
+done
+#With a re-add of sample1 which fails QC, so is neither added nor replaces the good version
+sed '2,$ s/[ACGT]/N/g' test/cases/1.fasta > test/output/qc_fail.fasta
+cp test/cases/2.fasta test/output/qc_fail.fasta test/output/spool/
+for i in $(seq 100);
+do
+    if [ $(wc -l < test/output/spool/metrics.tsv) -ge 3 ]; then break; fi
+    sleep 0.1
+done
+kill -TERM $watcher
+wait $watcher
+
+#Shared collection. The first process publishes it, and it's removed once nothing is attached
+./fn5 --compare_row test/cases/4.fasta --saves_dir test/saves --reference NC_045512.fasta --mask ignore --shared_collection 1 --shared_dir test/output > test/output/14.txt
+
+#Partitioned matrix. Each partition is a separate process, then they're merged
+for i in 1 2 3;
+do
+    ./fn5 --compute 20 --saves_dir test/saves --partition $i/3 --partition_dir test/output/partitions
+done
+./fn5 --merge test/output/partitions > test/output/15.txt
+
+#Checkpointed matrix. Rerunning a finished job resumes with nothing left to do, so the output is unchanged
+./fn5 --compute 20 --saves_dir test/saves --resume test/output/16.journal --output_file test/output/16.txt
+./fn5 --compute 20 --saves_dir test/saves --resume test/output/16.journal --output_file test/output/16.txt
+
+#Incremental matrix. Only pairs including samples saved since the last run are added
+rm -rf test/output/since_saves
+mkdir -p test/output/since_saves
+for i in 1 2;
+do
+    ./fn5 --reference_compress test/cases/$i.fasta --saves_dir test/output/since_saves --reference NC_045512.fasta --mask ignore > /dev/null
+done
+./fn5 --compute 20 --saves_dir test/output/since_saves > test/output/17.txt
+for i in 3 4;
+do
+    ./fn5 --reference_compress test/cases/$i.fasta --saves_dir test/output/since_saves --reference NC_045512.fasta --mask ignore > /dev/null
+done
+./fn5 --compute 20 --saves_dir test/output/since_saves --since last >> test/output/17.txt
+
+#Exact duplicates. A resubmission of sample2 is only compared once, then given sample2's distances
+mkdir -p test/output/dup_saves
+for i in 1 2 3 4;
+do
+    ./fn5 --reference_compress test/cases/$i.fasta --saves_dir test/output/dup_saves --reference NC_045512.fasta --mask ignore > /dev/null
+done
+./fn5 --reference_compress test/cases/2.fasta --guid sample2copy --saves_dir test/output/dup_saves --reference NC_045512.fasta --mask ignore > /dev/null
+./fn5 --compute 20 --saves_dir test/output/dup_saves --duplicates_file test/output/18.tsv > test/output/18.txt
+
+#k nearest, both directly and from the server
+./fn5 --compare_row test/cases/4.fasta --nearest 2 --saves_dir test/saves --reference NC_045512.fasta --mask ignore > test/output/19.txt
+
+#k nearest neighbour graph of the whole collection
+./fn5 --knn 2 --saves_dir test/saves > test/output/21.txt
+
+#Output tiers from a single pass
+./fn5 --compute 0 --cutoffs 1,20 --saves_dir test/saves --output_file test/output/22.txt
+
+#Summaries of the matrix without outputting it
+./fn5 --aggregate histogram --saves_dir test/saves > test/output/23.tsv
+./fn5 --aggregate degree --saves_dir test/saves > test/output/24.tsv
+
+#Clusters maintained by the adds
+./fn5 --clusters test/saves > test/output/26.tsv
+
+#Correcting a sample. sample1 is resubmitted as a copy of sample4
+mkdir -p test/output/update_saves
+for i in 1 2 3 4;
+do
+    ./fn5 --add test/cases/$i.fasta --saves_dir test/output/update_saves --output_file test/output/update_adds.txt --reference NC_045512.fasta --mask ignore
+done
+sed 's/|sample4$/|sample1/' test/cases/4.fasta > test/output/1_corrected.fasta
+./fn5 --update test/output/1_corrected.fasta --cutoff 5 --saves_dir test/output/update_saves --reference NC_045512.fasta --mask ignore > test/output/27.txt
+./fn5 --neighbours sample1 --saves_dir test/output/update_saves > test/output/28.txt
+
+#Removing a sample hides it from loaders and the graph straight away, then compaction deletes its save
+./fn5 --remove sample4 --saves_dir test/output/update_saves
+./fn5 --neighbours sample1 --saves_dir test/output/update_saves > test/output/29.txt
+./fn5 --compute 20 --saves_dir test/output/update_saves > test/output/30.txt
+./fn5 --compact test/output/update_saves
+ls test/output/update_saves > test/output/31.txt
+
+#Masking every position after the fact leaves nothing to differ
+seq 0 29902 > test/output/all_mask.txt
+./fn5 --remask test/output/all_mask.txt --saves_dir test/output/update_saves --mask ignore
+#So adding a sample parsed with the old mask is refused
+if ./fn5 --add test/cases/4.fasta --saves_dir test/output/update_saves --reference NC_045512.fasta --mask ignore; then exit 1; fi
+./fn5 --compute 20 --saves_dir test/output/update_saves > test/output/32.txt
+./fn5 --neighbours sample1 --saves_dir test/output/update_saves > test/output/33.txt
+
+#A mask profile over an unmasked store. Masking every position at query time leaves nothing to differ
+mkdir -p test/output/since_saves/masks
+seq 0 29902 > test/output/since_saves/masks/all.txt
+./fn5 --compute 20 --saves_dir test/output/since_saves --mask_profile all > test/output/34.txt
+./fn5 --compare_row test/cases/4.fasta --saves_dir test/output/since_saves --reference NC_045512.fasta --mask ignore --mask_profile all > test/output/35.txt
+
+#Distances within a gene panel. Only 5 of sample4's SNPs are within it
+printf "track name=panel\nNC_045512.2\t14100\t14110\tpanel\n" > test/output/panel.bed
+./fn5 --compute 20 --saves_dir test/output/since_saves --regions test/output/panel.bed > test/output/36.txt
+./fn5 --compare_row test/cases/4.fasta --saves_dir test/output/since_saves --reference NC_045512.fasta --mask ignore --regions test/output/panel.bed > test/output/37.txt
+
+#Updating in a bulk loaded store, which never had a graph, compares everything rather than trusting the empty graph
+mkdir -p test/output/bulk_update_saves
+./fn5 --bulk_load test/all.txt --saves_dir test/output/bulk_update_saves --reference NC_045512.fasta --mask ignore
+./fn5 --compute 20 --saves_dir test/output/bulk_update_saves > /dev/null
+./fn5 --update test/cases/1.fasta --saves_dir test/output/bulk_update_saves --reference NC_045512.fasta --mask ignore > test/output/38.txt
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+#include "../src/include/aggregate.hpp"
+
+/**
+* @brief Test the aggregates match counting every pair, including exact duplicates, whatever the tiles and threads
+*/
+TEST(aggregate, counts){
+    int old_tile_size = tile_size;
+    int old_thread_count = thread_count;
+    vector<Sample*> samples;
+    for(int i=0;i<30;i++){
+        vector<int> a, n;
+        //Every 7th is a copy of the one before
+        int base = i % 7 == 6 ? i - 1 : i;
+        for(int j=(base * 5) % 17;j<(base * 5) % 17 + base % 9;j++){
+            a.push_back(j);
+        }
+        if(base % 4 == 0){
+            n = {1, 2, 30};
+        }
+        Sample* s = new Sample(a, {}, {}, {}, n);
+        s->uuid = "aggregate" + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        samples.push_back(s);
+    }
+
+    int cutoff = 4;
+    vector<uint64_t> histogram(cutoff + 1, 0);
+    vector<uint64_t> degree(samples.size(), 0);
+    vector<int> nearest(samples.size(), max_distance);
+    for(size_t i=0;i<samples.size();i++){
+        for(size_t j=i+1;j<samples.size();j++){
+            int dist = samples.at(i)->dist(samples.at(j), cutoff);
+            if(dist <= cutoff){
+                histogram.at(dist)++;
+                degree.at(i)++;
+                degree.at(j)++;
+                nearest.at(i) = min(nearest.at(i), dist);
+                nearest.at(j) = min(nearest.at(j), dist);
+            }
+        }
+    }
+    while(histogram.size() > 0 && histogram.back() == 0){
+        histogram.pop_back();
+    }
+    ASSERT_GT(histogram.at(0), 0);
+
+    for(int size: {3, 512}){
+        for(int threads: {1, 4}){
+            tile_size = size;
+            thread_count = threads;
+            Aggregates counts = aggregate_loaded(cutoff, samples);
+            while(counts.histogram.size() > 0 && counts.histogram.back() == 0){
+                counts.histogram.pop_back();
+            }
+            ASSERT_EQ(histogram, counts.histogram);
+            ASSERT_EQ(degree, counts.degree);
+            ASSERT_EQ(nearest, counts.nearest);
+        }
+    }
+
+    testing::internal::CaptureStdout();
+    compute_aggregate("nearest", cutoff, samples);
+    string output = testing::internal::GetCapturedStdout();
+    ASSERT_EQ(0u, output.find("uuid\tnearest\naggregate0\t"));
+    ASSERT_THROW(compute_aggregate("mean", cutoff, samples), invalid_argument);
+
+    for(Sample* s: samples){
+        delete s;
+    }
+    tile_size = old_tile_size;
+    thread_count = old_thread_count;
+}
@@ -0,0 +1,265 @@
+#include <gtest/gtest.h>
+#include "../src/include/catalog.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Test that `save` maintains the catalog
+*/
+TEST(catalog, save){
+    string dir = "cases/dummy/catalog_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+
+    Sample* s3 = new Sample("cases/dummy/3.fasta", reference, mask);
+    Sample* s1 = new Sample("cases/dummy/1.fasta", reference, mask);
+    Sample* s5 = new Sample("cases/dummy/5.fasta", reference, mask);
+    save(dir, s3);
+    save(dir, s1);
+    save(dir, s5);
+
+    Catalog catalog = load_catalog(dir);
+    ASSERT_EQ(3, catalog.entries.size());
+    ASSERT_TRUE(catalog.contains("uuid1"));
+    ASSERT_TRUE(catalog.contains("uuid3"));
+    ASSERT_TRUE(catalog.contains("uuid5"));
+    ASSERT_FALSE(catalog.contains("uuid2"));
+
+    //Load order should be insertion order, not filename order
+    vector<string> expected_paths = {dir + "/uuid3.fn5", dir + "/uuid1.fn5", dir + "/uuid5.fn5"};
+    ASSERT_EQ(expected_paths, catalog.paths());
+
+    CatalogEntry entry = catalog.entries.at("uuid5");
+    ASSERT_EQ(2, entry.seq);
+    ASSERT_EQ("uuid5.fn5", entry.file);
+    ASSERT_EQ(0, entry.offset);
+    ASSERT_EQ(fs::file_size(dir + "/uuid5.fn5"), entry.size);
+    ASSERT_EQ(s5->A.size(), entry.counts[0]);
+    ASSERT_EQ(s5->C.size(), entry.counts[1]);
+    ASSERT_EQ(s5->G.size(), entry.counts[2]);
+    ASSERT_EQ(s5->T.size(), entry.counts[3]);
+    ASSERT_EQ(s5->N.size(), entry.counts[4]);
+
+    //Saving again shouldn't change the sequence number
+    save(dir, s3);
+    catalog = load_catalog(dir);
+    ASSERT_EQ(3, catalog.entries.size());
+    ASSERT_EQ(0, catalog.entries.at("uuid3").seq);
+    ASSERT_EQ(3, catalog.next_seq);
+
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test `rebuild_catalog`, including from old style saves
+*/
+TEST(catalog, rebuild_catalog){
+    string dir = "cases/dummy/catalog_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+
+    Sample* s2 = new Sample("cases/dummy/2.fasta", reference, mask);
+    Sample* s4 = new Sample("cases/dummy/4.fasta", reference, mask);
+    save(dir, s4);
+    save(dir, s2);
+
+    //Rebuilding keeps existing sequence numbers and generations, and only moves the generation forwards
+    Catalog before = load_catalog(dir);
+    Catalog catalog = rebuild_catalog(dir);
+    ASSERT_EQ(0, catalog.entries.at("uuid4").seq);
+    ASSERT_EQ(1, catalog.entries.at("uuid2").seq);
+    ASSERT_EQ(before.entries.at("uuid4").end, catalog.entries.at("uuid4").end);
+    ASSERT_EQ(before.entries.at("uuid2").end, catalog.entries.at("uuid2").end);
+    ASSERT_EQ(before.generation(), catalog.base);
+    //Same contents, so the same size, but a new file which has to be read again
+    ASSERT_EQ(catalog.generation(), load_catalog(dir).generation());
+    ASSERT_EQ(before.entries.at("uuid2").end, load_catalog(dir).entries.at("uuid2").end);
+
+    //Write an old style save without going through `save`
+    Sample* s5 = new Sample("cases/dummy/5.fasta", reference, mask);
+    save_n(s5->A, dir + "/uuid5.A");
+    save_n(s5->C, dir + "/uuid5.C");
+    save_n(s5->G, dir + "/uuid5.G");
+    save_n(s5->T, dir + "/uuid5.T");
+    save_n(s5->N, dir + "/uuid5.N");
+
+    //With no catalog, one should be built from the dir contents
+    fs::remove(dir + "/" + catalog_filename);
+    catalog = load_catalog(dir);
+    ASSERT_EQ(3, catalog.entries.size());
+    ASSERT_EQ("uuid5", catalog.entries.at("uuid5").file);
+    ASSERT_EQ(s5->N.size(), catalog.entries.at("uuid5").counts[4]);
+
+    //Loading the old style save converts it, and the catalog follows
+    Sample* loaded = readSample(dir + "/uuid5");
+    ASSERT_EQ(*s5, *loaded);
+    catalog = load_catalog(dir);
+    ASSERT_EQ(3, catalog.entries.size());
+    ASSERT_EQ("uuid5.fn5", catalog.entries.at("uuid5").file);
+    ASSERT_FALSE(fs::exists(dir + "/uuid5.A"));
+
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test that re-saves are versioned, snapshots keep the version they saw, and old versions are collected
+*/
+TEST(catalog, snapshots){
+    string dir = "cases/dummy/catalog_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    Sample* s = new Sample({1}, {}, {}, {}, {});
+    s->uuid = "snapshot1";
+    s->id = intern_uuid(s->uuid);
+    save(dir, s);
+    ASSERT_EQ("snapshot1.fn5", load_catalog(dir).entries.at("snapshot1").file);
+
+    uint64_t removed = 0;
+    {
+        Snapshot first(dir);
+        s->A = {2};
+        save(dir, s);
+        //The first save is untouched, and the snapshot still refers to it
+        ASSERT_EQ(vector<string>{dir + "/snapshot1.fn5"}, first.catalog.paths());
+        ASSERT_EQ(vector<int>{1}, readSample(first.catalog.paths().at(0))->A);
+
+        Catalog latest = load_catalog(dir);
+        ASSERT_EQ("versions/1/snapshot1.fn5", latest.entries.at("snapshot1").file);
+        ASSERT_EQ(0, latest.entries.at("snapshot1").seq);
+        ASSERT_EQ(vector<int>{2}, readSample(latest.paths().at(0))->A);
+
+        {
+            Snapshot second(dir);
+            s->A = {3};
+            save(dir, s);
+            //Version 1 is still pinned by the second snapshot
+            ASSERT_TRUE(fs::exists(dir + "/versions/1/snapshot1.fn5"));
+            ASSERT_EQ(vector<int>{2}, readSample(second.catalog.paths().at(0))->A);
+        }
+        //Nothing else could see version 1, but the first save is always kept
+        removed = collect_garbage(dir);
+    }
+    ASSERT_EQ(1, removed);
+    ASSERT_FALSE(fs::exists(dir + "/versions/1/snapshot1.fn5"));
+    ASSERT_TRUE(fs::exists(dir + "/snapshot1.fn5"));
+    ASSERT_EQ(vector<int>{3}, readSample(load_catalog(dir).paths().at(0))->A);
+
+    //A pin which isn't held belongs to a reader which has died
+    fstream dead(dir + "/" + readers_dirname + "/dead.pin", fstream::out);
+    dead << "00000000000000000000";
+    dead.close();
+    s->A = {4};
+    save(dir, s);
+    ASSERT_FALSE(fs::exists(dir + "/" + readers_dirname + "/dead.pin"));
+    ASSERT_FALSE(fs::exists(dir + "/versions/2/snapshot1.fn5"));
+
+    //Rebuilding finds the latest version
+    fs::remove(dir + "/" + catalog_filename);
+    ASSERT_EQ("versions/3/snapshot1.fn5", load_catalog(dir).entries.at("snapshot1").file);
+
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test removed samples are hidden straight away, collected once nothing can see them, and can be saved again
+*/
+TEST(catalog, remove){
+    string dir = "cases/dummy/catalog_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    for(string uuid: {"removeA", "removeB"}){
+        Sample* s = new Sample({1}, {}, {}, {}, {});
+        s->uuid = uuid;
+        s->id = intern_uuid(s->uuid);
+        save(dir, s);
+    }
+    {
+        Snapshot pinned(dir);
+        ASSERT_TRUE(catalog_remove(dir, "removeA"));
+        ASSERT_FALSE(catalog_remove(dir, "removeA"));
+        ASSERT_FALSE(catalog_remove(dir, "not_saved"));
+        Catalog catalog = load_catalog(dir);
+        ASSERT_EQ(vector<string>{dir + "/removeB.fn5"}, catalog.paths());
+        ASSERT_EQ("removeA.fn5", catalog.removed.at("removeA"));
+        //Still visible to the snapshot, so kept
+        ASSERT_EQ(0, collect_garbage(dir));
+        ASSERT_EQ(2, pinned.catalog.paths().size());
+    }
+    ASSERT_EQ(1, collect_garbage(dir));
+    ASSERT_FALSE(fs::exists(dir + "/removeA.fn5"));
+
+    //Saving again after a removal goes to a new version, as the old save could still have been being read
+    Sample* s = new Sample({2}, {}, {}, {}, {});
+    s->uuid = "removeA";
+    s->id = intern_uuid(s->uuid);
+    save(dir, s);
+    Catalog catalog = load_catalog(dir);
+    ASSERT_EQ("versions/1/removeA.fn5", catalog.entries.at("removeA").file);
+    ASSERT_EQ(2, catalog.entries.at("removeA").seq);
+    ASSERT_FALSE(catalog.removed.contains("removeA"));
+
+    //Rebuilding doesn't bring back a removed sample whose save hasn't been collected
+    ASSERT_TRUE(catalog_remove(dir, "removeB"));
+    ASSERT_TRUE(fs::exists(dir + "/removeB.fn5"));
+    catalog = rebuild_catalog(dir);
+    ASSERT_EQ(vector<string>{dir + "/versions/1/removeA.fn5"}, catalog.paths());
+    ASSERT_EQ(vector<string>{dir + "/versions/1/removeA.fn5"}, load_catalog(dir).paths());
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test compacting the catalog drops the lines of collected saves, and keeps generations and pinned versions
+*/
+TEST(catalog, compact){
+    string dir = "cases/dummy/catalog_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    auto make = [](string uuid, int position){
+        Sample* s = new Sample({position}, {}, {}, {}, {});
+        s->uuid = uuid;
+        s->id = intern_uuid(s->uuid);
+        return s;
+    };
+    save(dir, make("compactA", 1));
+    save(dir, make("compactA", 2));
+    unique_ptr<Snapshot> pinned = make_unique<Snapshot>(dir);
+    save(dir, make("compactA", 3));
+    save(dir, make("compactA", 4));
+    save(dir, make("compactB", 1));
+    catalog_remove(dir, "compactB");
+    save(dir, make("compactC", 1));
+    Catalog before = load_catalog(dir);
+
+    //Version 2 and compactB are collected (some by the saves), and the first save kept, which only leaves lines for
+    //current saves and version 1, which is still pinned
+    collect_garbage(dir);
+    ASSERT_FALSE(fs::exists(dir + "/versions/2/compactA.fn5"));
+    ASSERT_FALSE(fs::exists(dir + "/compactB.fn5"));
+    ASSERT_EQ(4, compact_catalog(dir));
+    Catalog after = load_catalog(dir);
+    ASSERT_EQ(before.paths(), after.paths());
+    ASSERT_EQ(before.generation(), after.base);
+    for(const auto &[uuid, entry]: before.entries){
+        ASSERT_EQ(entry.end, after.entries.at(uuid).end);
+        ASSERT_EQ(entry.seq, after.entries.at(uuid).seq);
+    }
+    ASSERT_FALSE(after.removed.contains("compactB"));
+    ASSERT_EQ(0, collect_garbage(dir));
+    ASSERT_TRUE(fs::exists(dir + "/versions/1/compactA.fn5"));
+
+    pinned.reset();
+    ASSERT_EQ(1, collect_garbage(dir));
+    ASSERT_EQ(1, compact_catalog(dir));
+    ASSERT_EQ(0, compact_catalog(dir));
+    ASSERT_EQ(before.paths(), load_catalog(dir).paths());
+    fs::remove_all(dir);
+}
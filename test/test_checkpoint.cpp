@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include "../src/include/checkpoint.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Test resuming a matrix from part way through gives every result exactly once
+*/
+TEST(checkpoint, resume){
+    string dir = "cases/dummy/checkpoint";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    string old_output_file = output_file;
+    int old_interval = checkpoint_interval;
+    vector<Sample*> samples = tile_samples(12);
+
+    testing::internal::CaptureStdout();
+    compute_loaded(5, samples);
+    string expected = testing::internal::GetCapturedStdout();
+
+    auto lines = [](string path){
+        multiset<string> acc;
+        fstream in(path, fstream::in);
+        string line;
+        while(getline(in, line)){
+            acc.insert(line);
+        }
+        return acc;
+    };
+    fstream expected_file(dir + "/expected.txt", fstream::out);
+    expected_file << expected;
+    expected_file.close();
+
+    //Checkpoint after every tile
+    output_file = dir + "/out.txt";
+    resume_journal = dir + "/journal";
+    checkpoint_interval = 0;
+    compute_loaded(5, samples);
+    ASSERT_EQ(lines(dir + "/expected.txt"), lines(output_file));
+
+    //Die after a few checkpoints, with more written since and a torn checkpoint
+    vector<string> journal;
+    {
+        fstream in(resume_journal, fstream::in);
+        string line;
+        while(getline(in, line)){
+            journal.push_back(line);
+        }
+    }
+    ASSERT_LT(10, journal.size());
+    fstream out(resume_journal, fstream::out | fstream::trunc);
+    for(int i=0;i<8;i++){
+        out << journal.at(i) << "\n";
+    }
+    out << "checkpoint\t9";
+    out.close();
+    Journal partial(resume_journal, journal.at(1).substr(4));
+    ASSERT_LT(0, partial.done.size());
+    fstream garbage(output_file, fstream::out | fstream::app);
+    garbage << "partial result\n";
+    garbage.close();
+
+    compute_loaded(5, samples);
+    ASSERT_EQ(lines(dir + "/expected.txt"), lines(output_file));
+
+    //A different job can't resume from the journal
+    ASSERT_THROW(compute_loaded(6, samples), invalid_argument);
+
+    output_file = old_output_file;
+    resume_journal = "";
+    checkpoint_interval = old_interval;
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test resuming from any checkpoint of a multi-threaded job whose tiles each have more results than a buffer
+*/
+TEST(checkpoint, resume_dense){
+    string dir = "cases/dummy/checkpoint_dense";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    string old_output_file = output_file;
+    int old_interval = checkpoint_interval;
+    int old_thread_count = thread_count;
+    int old_tile_size = tile_size;
+    thread_count = 4;
+    tile_size = 260;
+
+    //Every pair is 2 apart, so the tiles off the diagonal have 67600 results each
+    vector<Sample*> samples;
+    for(int i=0;i<780;i++){
+        Sample* s = new Sample({i}, {}, {}, {}, {});
+        s->uuid = "dense" + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        samples.push_back(s);
+    }
+    vector<Tile> all_tiles = make_tiles(samples, 1);
+    ASSERT_EQ(6, all_tiles.size());
+    auto run = [&samples, &all_tiles](){
+        vector<Tile> tiles = all_tiles;
+        unique_ptr<ResultWriter> writer = open_tiled_writer("dense", tiles);
+        compare_tiles(samples, tiles, 2, writer.get());
+        writer->close();
+    };
+    auto lines = [](string path){
+        vector<string> acc;
+        fstream in(path, fstream::in);
+        string line;
+        while(getline(in, line)){
+            acc.push_back(line);
+        }
+        sort(acc.begin(), acc.end());
+        return acc;
+    };
+
+    output_file = dir + "/out.txt";
+    resume_journal = dir + "/journal";
+    checkpoint_interval = 0;
+    run();
+    vector<string> expected = lines(output_file);
+    ASSERT_EQ(780 * 779 / 2, expected.size());
+    fs::copy_file(output_file, dir + "/full.txt");
+    vector<string> journal;
+    {
+        fstream in(resume_journal, fstream::in);
+        string line;
+        while(getline(in, line)){
+            journal.push_back(line);
+        }
+    }
+
+    //Every checkpoint only covers whole tiles, so resuming from any of them gives every result once
+    for(size_t kept=3;kept<journal.size();kept++){
+        //As it was when it died
+        fs::copy_file(dir + "/full.txt", output_file, fs::copy_options::overwrite_existing);
+        fstream out(resume_journal, fstream::out | fstream::trunc);
+        for(size_t i=0;i<kept;i++){
+            out << journal.at(i) << "\n";
+        }
+        out.close();
+        run();
+        ASSERT_EQ(expected, lines(output_file));
+    }
+
+    for(Sample* s: samples){
+        delete s;
+    }
+    output_file = old_output_file;
+    resume_journal = "";
+    checkpoint_interval = old_interval;
+    thread_count = old_thread_count;
+    tile_size = old_tile_size;
+    fs::remove_all(dir);
+}
@@ -0,0 +1,282 @@
+#include <gtest/gtest.h>
+#include "../src/include/comparisons.hpp"
+#include "../src/include/shared.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Test clusters are merged by pairs within their cutoff, persist, and survive a torn log
+*/
+TEST(clusters, merge_and_query){
+    string old_merges_file = cluster_merges_file;
+    string dir = "cases/dummy/cluster_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+    for(string name: {"1", "2", "3", "4", "5"}){
+        save(dir, new Sample("cases/dummy/" + name + ".fasta", reference, mask));
+    }
+    auto id = [](string uuid){
+        return intern_uuid(uuid);
+    };
+
+    //Nothing logged, so every sample is its own cluster
+    vector<pair<string, string>> expected = {{"uuid1", "uuid1"}, {"uuid2", "uuid2"}, {"uuid3", "uuid3"}, {"uuid4", "uuid4"}, {"uuid5", "uuid5"}};
+    ASSERT_EQ(expected, cluster_membership(dir));
+    {
+        Clusters clusters(dir, 2);
+        ASSERT_EQ(2, clusters.cutoff);
+        vector<Distance> distances = {
+            {id("uuid2"), id("uuid1"), 1},
+            {id("uuid3"), id("uuid4"), 2},
+            //Already joined
+            {id("uuid1"), id("uuid2"), 1},
+            //Above the cutoff
+            {id("uuid4"), id("uuid5"), 3},
+        };
+        clusters.append(distances);
+        vector<string> merges = {"merge\tuuid2\tuuid1\t1", "merge\tuuid3\tuuid4\t2"};
+        ASSERT_EQ(merges, clusters.merges);
+    }
+    expected = {{"uuid1", "uuid1"}, {"uuid2", "uuid1"}, {"uuid3", "uuid3"}, {"uuid4", "uuid3"}, {"uuid5", "uuid5"}};
+    ASSERT_EQ(expected, cluster_membership(dir));
+
+    //A crash part way through a line
+    fstream torn(dir + "/" + clusters_filename, fstream::out | fstream::app);
+    torn << "merge\tuuid5";
+    torn.close();
+    ASSERT_EQ(expected, cluster_membership(dir));
+
+    cluster_merges_file = dir + "/merges.tsv";
+    {
+        //The cutoff is fixed when the log is started
+        Clusters clusters(dir, 20);
+        ASSERT_EQ(2, clusters.cutoff);
+        vector<Distance> distances = {{id("uuid4"), id("uuid2"), 0}};
+        clusters.append(distances);
+        clusters.close();
+    }
+    fstream merges(cluster_merges_file, fstream::in);
+    string line;
+    getline(merges, line);
+    ASSERT_EQ("merge\tuuid4\tuuid2\t0", line);
+    ASSERT_FALSE(getline(merges, line));
+    expected = {{"uuid1", "uuid1"}, {"uuid2", "uuid1"}, {"uuid3", "uuid1"}, {"uuid4", "uuid1"}, {"uuid5", "uuid5"}};
+    ASSERT_EQ(expected, cluster_membership(dir));
+
+    cluster_merges_file = old_merges_file;
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test a new sample which fails QC can't join clusters, as it's never saved
+*/
+TEST(clusters, qc_fail){
+    int old_graph_cutoff = graph_cutoff;
+    int old_cluster_cutoff = cluster_cutoff;
+    string old_save_dir = save_dir;
+    graph_cutoff = -1;
+    cluster_cutoff = 1;
+    save_dir = "cases/dummy/cluster_qc_saves";
+    fs::remove_all(save_dir);
+    fs::create_directories(save_dir);
+
+    //2 SNPs apart, but both 1 from the bridge
+    vector<Sample*> existing = {new Sample({}, {0}, {}, {}, {}), new Sample({}, {}, {}, {5}, {})};
+    for(int i=0;i<2;i++){
+        existing.at(i)->uuid = "cluster_qc" + to_string(i);
+        existing.at(i)->id = intern_uuid(existing.at(i)->uuid);
+        save(save_dir, existing.at(i));
+    }
+    Sample* bridge = new Sample({}, {}, {}, {}, {});
+    bridge->uuid = "cluster_qc_bridge";
+    bridge->id = intern_uuid(bridge->uuid);
+    bridge->qc_pass = false;
+    testing::internal::CaptureStdout();
+    add_loaded(existing, {bridge}, 1);
+    testing::internal::GetCapturedStdout();
+    vector<pair<string, string>> expected = {{"cluster_qc0", "cluster_qc0"}, {"cluster_qc1", "cluster_qc1"}};
+    ASSERT_EQ(expected, cluster_membership(save_dir));
+
+    //Once it passes, it does join them
+    bridge->qc_pass = true;
+    testing::internal::CaptureStdout();
+    add_loaded(existing, {bridge}, 1);
+    testing::internal::GetCapturedStdout();
+    expected = {{"cluster_qc0", "cluster_qc0"}, {"cluster_qc1", "cluster_qc0"}};
+    ASSERT_EQ(expected, cluster_membership(save_dir));
+
+    for(Sample* s: existing){
+        delete s;
+    }
+    delete bridge;
+    fs::remove_all(save_dir);
+    graph_cutoff = old_graph_cutoff;
+    cluster_cutoff = old_cluster_cutoff;
+    save_dir = old_save_dir;
+}
+
+/**
+* @brief Test removing the only sample bridging two parts of a cluster splits it, before and after compaction
+*/
+TEST(clusters, remove_bridge){
+    int old_cluster_cutoff = cluster_cutoff;
+    string old_save_dir = save_dir;
+    cluster_cutoff = 1;
+    save_dir = "cases/dummy/cluster_bridge_saves";
+    fs::remove_all(save_dir);
+    fs::create_directories(save_dir);
+
+    //The bridge is 1 SNP from each of the others, which are 2 apart, except for the identical a and c
+    vector<Sample*> existing = {new Sample({}, {0}, {}, {}, {}), new Sample({}, {}, {}, {5}, {})};
+    vector<Sample*> others = {new Sample({}, {}, {}, {}, {}), new Sample({}, {0}, {}, {}, {})};
+    vector<string> names = {"bridge_a", "bridge_b", "bridge", "bridge_c"};
+    vector<Sample*> samples = existing;
+    samples.insert(samples.end(), others.begin(), others.end());
+    for(size_t i=0;i<samples.size();i++){
+        samples.at(i)->uuid = names.at(i);
+        samples.at(i)->id = intern_uuid(names.at(i));
+        save(save_dir, samples.at(i));
+    }
+    testing::internal::CaptureStdout();
+    add_loaded(existing, others, 1);
+    testing::internal::GetCapturedStdout();
+    vector<pair<string, string>> expected = {{"bridge_a", "bridge_a"}, {"bridge_b", "bridge_a"}, {"bridge", "bridge_a"}, {"bridge_c", "bridge_a"}};
+    ASSERT_EQ(expected, cluster_membership(save_dir));
+
+    remove_samples(save_dir, {"bridge"});
+    expected = {{"bridge_a", "bridge_a"}, {"bridge_b", "bridge_b"}, {"bridge_c", "bridge_a"}};
+    ASSERT_EQ(expected, cluster_membership(save_dir));
+
+    //The log is rewritten without the bridge
+    compact_saves(save_dir);
+    ASSERT_EQ(expected, cluster_membership(save_dir));
+    fstream log(save_dir + "/" + clusters_filename, fstream::in);
+    string line;
+    getline(log, line);
+    ASSERT_EQ("cutoff\t1", line);
+    getline(log, line);
+    ASSERT_EQ("merge\tbridge_a\tbridge_c\t0", line);
+    ASSERT_FALSE(getline(log, line));
+    log.close();
+
+    for(Sample* s: samples){
+        delete s;
+    }
+    fs::remove_all(save_dir);
+    cluster_cutoff = old_cluster_cutoff;
+    save_dir = old_save_dir;
+}
+
+/**
+* @brief Test updating a sample away from its cluster splits it, through a shared collection
+*/
+TEST(clusters, update_split){
+    int old_cluster_cutoff = cluster_cutoff;
+    int old_graph_cutoff = graph_cutoff;
+    string old_save_dir = save_dir;
+    string old_shared_dir = shared_dir;
+    cluster_cutoff = 1;
+    graph_cutoff = 5;
+    save_dir = "cases/dummy/cluster_update_saves";
+    shared_dir = save_dir + "/shm";
+    fs::remove_all(save_dir);
+    fs::create_directories(shared_dir);
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+
+    //uuid4 is 1 SNP from uuid1 and uuid2, which join through it
+    vector<Sample*> samples;
+    for(string name: {"1", "2", "3", "4"}){
+        samples.push_back(new Sample("cases/dummy/" + name + ".fasta", reference, mask));
+        save(save_dir, samples.back());
+    }
+    testing::internal::CaptureStdout();
+    add_loaded({samples.at(0)}, {samples.at(1), samples.at(2), samples.at(3)}, 1);
+    testing::internal::GetCapturedStdout();
+    vector<pair<string, string>> expected = {{"uuid1", "uuid1"}, {"uuid2", "uuid1"}, {"uuid3", "uuid1"}, {"uuid4", "uuid1"}};
+    vector<pair<string, string>> before = cluster_membership(save_dir);
+
+    //Corrected to uuid5's sequence, far from everything
+    fstream in("cases/dummy/5.fasta", fstream::in);
+    string header, sequence;
+    getline(in, header);
+    getline(in, sequence);
+    in.close();
+    fstream out(save_dir + "/uuid4.fasta", fstream::out);
+    out << ">This is a dummy FASTA file|uuid4\n" << sequence << "\n";
+    out.close();
+    shared_collection = true;
+    testing::internal::CaptureStdout();
+    update_sample(save_dir + "/uuid4.fasta", reference, mask, 1);
+    testing::internal::GetCapturedStdout();
+    shared_collection = false;
+    vector<pair<string, string>> after = cluster_membership(save_dir);
+    vector<pair<string, string>> split = {{"uuid1", "uuid1"}, {"uuid2", "uuid1"}, {"uuid3", "uuid1"}, {"uuid4", "uuid4"}};
+
+    //The log is rewritten without the dirty sample's old merges
+    compact_saves(save_dir);
+    vector<pair<string, string>> compacted = cluster_membership(save_dir);
+    bool dirty = false;
+    fstream log(save_dir + "/" + clusters_filename, fstream::in);
+    string line;
+    while(getline(log, line)){
+        dirty = dirty || line.starts_with("dirty");
+    }
+    log.close();
+
+    for(Sample* s: samples){
+        delete s;
+    }
+    fs::remove_all(save_dir);
+    cluster_cutoff = old_cluster_cutoff;
+    graph_cutoff = old_graph_cutoff;
+    save_dir = old_save_dir;
+    shared_dir = old_shared_dir;
+    ASSERT_EQ(expected, before);
+    ASSERT_EQ(split, after);
+    ASSERT_EQ(split, compacted);
+    ASSERT_FALSE(dirty);
+}
+
+TEST(clusters, readd_split){
+    int old_cluster_cutoff = cluster_cutoff;
+    int old_graph_cutoff = graph_cutoff;
+    string old_save_dir = save_dir;
+    cluster_cutoff = 1;
+    graph_cutoff = 2;
+    save_dir = "cases/dummy/cluster_readd_saves";
+    fs::remove_all(save_dir);
+    fs::create_directories(save_dir);
+
+    vector<Sample*> samples = {new Sample({1}, {}, {}, {}, {}), new Sample({1, 2}, {}, {}, {}, {}), new Sample({5, 6, 7}, {}, {}, {}, {})};
+    vector<string> names = {"readd_a", "readd_b", "readd_c"};
+    for(size_t i=0;i<samples.size();i++){
+        samples.at(i)->uuid = names.at(i);
+        samples.at(i)->id = intern_uuid(names.at(i));
+        save(save_dir, samples.at(i));
+    }
+    testing::internal::CaptureStdout();
+    add_loaded({samples.at(0)}, {samples.at(1), samples.at(2)}, 2);
+    vector<pair<string, string>> before = cluster_membership(save_dir);
+
+    //Now far from readd_a, and 1 SNP from readd_c
+    Sample* changed = new Sample({5, 6}, {}, {}, {}, {});
+    changed->uuid = "readd_b";
+    changed->id = intern_uuid(changed->uuid);
+    add_loaded(samples, {changed}, 2);
+    testing::internal::GetCapturedStdout();
+    vector<pair<string, string>> after = cluster_membership(save_dir);
+
+    for(Sample* s: samples){
+        delete s;
+    }
+    delete changed;
+    fs::remove_all(save_dir);
+    cluster_cutoff = old_cluster_cutoff;
+    graph_cutoff = old_graph_cutoff;
+    save_dir = old_save_dir;
+    ASSERT_EQ((vector<pair<string, string>>{{"readd_a", "readd_a"}, {"readd_b", "readd_a"}, {"readd_c", "readd_c"}}), before);
+    ASSERT_EQ((vector<pair<string, string>>{{"readd_a", "readd_a"}, {"readd_b", "readd_b"}, {"readd_c", "readd_b"}}), after);
+}
@@ -178,18 +178,40 @@ TEST(comparisons, bulk_load){
     ASSERT_TRUE(vectors_equal(expected, actual));
 }
 
+/**
+* @brief Test `make_distance`
+*/
+TEST(comparisons, make_distance){
+    Sample* s1 = new Sample({}, {}, {}, {}, {});
+    s1->uuid = "make_distance1";
+    s1->id = intern_uuid(s1->uuid);
+    Sample* s2 = new Sample({}, {}, {}, {}, {});
+    s2->uuid = "make_distance2";
+    s2->id = intern_uuid(s2->uuid);
+
+    Distance d = make_distance(s1, s2, 12);
+    ASSERT_EQ(s1->id, d.id1);
+    ASSERT_EQ(s2->id, d.id2);
+    ASSERT_EQ(12, d.dist);
+
+    //Too large to store, so should saturate
+    d = make_distance(s1, s2, 100000);
+    ASSERT_EQ(max_distance, d.dist);
+    ASSERT_EQ(10, sizeof(Distance));
+}
+
 /**
 * @brief Test `save_comparisons`
 */
 TEST(comparisons, save_comparisons){
     output_file = "test_save_comparisons.txt";
     //Random dummy data here
-    vector<tuple<string, string, int>> comparisons = {
-        {"guid1", "guid2", 0},
-        {"guid1", "guid3", 1},
-        {"guid1", "guid4", 2},
-        {"guid1", "guid5", 0},
-        {"guid1", "guid6", 9},
+    vector<Distance> comparisons = {
+        {intern_uuid("guid1"), intern_uuid("guid2"), 0},
+        {intern_uuid("guid1"), intern_uuid("guid3"), 1},
+        {intern_uuid("guid1"), intern_uuid("guid4"), 2},
+        {intern_uuid("guid1"), intern_uuid("guid5"), 0},
+        {intern_uuid("guid1"), intern_uuid("guid6"), 9},
     };
     string expected = "guid1 guid2 0\nguid1 guid3 1\nguid1 guid4 2\nguid1 guid5 0\nguid1 guid6 9\n";
 
@@ -215,12 +237,12 @@ TEST(comparisons, save_comparisons){
 */
 TEST(comparisons, print_comparisons){
     //Random dummy data here
-    vector<tuple<string, string, int>> comparisons = {
-        {"guid1", "guid2", 0},
-        {"guid1", "guid3", 1},
-        {"guid1", "guid4", 2},
-        {"guid1", "guid5", 0},
-        {"guid1", "guid6", 9},
+    vector<Distance> comparisons = {
+        {intern_uuid("guid1"), intern_uuid("guid2"), 0},
+        {intern_uuid("guid1"), intern_uuid("guid3"), 1},
+        {intern_uuid("guid1"), intern_uuid("guid4"), 2},
+        {intern_uuid("guid1"), intern_uuid("guid5"), 0},
+        {intern_uuid("guid1"), intern_uuid("guid6"), 9},
     };
     string expected = "guid1 guid2 0\nguid1 guid3 1\nguid1 guid4 2\nguid1 guid5 0\nguid1 guid6 9\n";
 
@@ -331,8 +353,8 @@ TEST(comparisons, add_many){
     //Clear the saves dir first
     save_dir = "cases/dummy/saves";
     for (const auto & entry : fs::directory_iterator(save_dir)){
-        string p = entry.path();
-        remove(p.c_str());
+        //Including re-saved versions, which would otherwise be found when the catalog is rebuilt
+        fs::remove_all(entry.path());
     }
 
     //We're adding sample 4 and 5 for the test here
@@ -397,6 +419,98 @@ TEST(comparisons, add_many){
 }
 
 
+/**
+* @brief Test `add_loaded` with more existing samples than fit in a single task
+*/
+TEST(comparisons, add_loaded){
+    int old_graph_cutoff = graph_cutoff;
+    graph_cutoff = -1;
+
+    //Each existing sample is 1 SNP from both new samples, which are identical to each other
+    vector<Sample*> existing;
+    for(int i=0;i<5000;i++){
+        Sample* s = new Sample({i}, {}, {}, {}, {});
+        s->uuid = "add_loaded_existing" + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        existing.push_back(s);
+    }
+    vector<Sample*> others;
+    for(int i=0;i<2;i++){
+        Sample* s = new Sample({}, {}, {}, {}, {});
+        s->uuid = "add_loaded_new" + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        others.push_back(s);
+    }
+
+    testing::internal::CaptureStdout();
+    uint64_t written = add_loaded(existing, others, 1);
+    string actual = testing::internal::GetCapturedStdout();
+    ASSERT_EQ(10001, written);
+    ASSERT_EQ(10001, count(actual.begin(), actual.end(), '\n'));
+    ASSERT_NE(string::npos, actual.find("add_loaded_new0 add_loaded_new1 0\n"));
+    ASSERT_NE(string::npos, actual.find("add_loaded_existing4999 add_loaded_new1 1\n"));
+
+    graph_cutoff = old_graph_cutoff;
+}
+
+/**
+* @brief Test a new sample which fails QC is compared, but kept out of the neighbour graph as it's never saved
+*/
+TEST(comparisons, add_qc_fail){
+    string old_save_dir = save_dir;
+    string old_output_file = output_file;
+    save_dir = "cases/dummy/qc_fail_saves";
+    fs::remove_all(save_dir);
+    fs::create_directories(save_dir);
+    output_file = save_dir + "/out.txt";
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+    for(string name: {"1", "2", "3", "4"}){
+        save(save_dir, new Sample("cases/dummy/" + name + ".fasta", reference, mask));
+    }
+
+    //uuid4 with a quarter of it N
+    string path = save_dir + "/qc_fail.fasta";
+    fstream fasta(path, fstream::out);
+    fasta << ">qc_fail\nNGAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAANNNNNNNNNNNNNNNNNNNN\n";
+    fasta.close();
+    testing::internal::CaptureStdout();
+    add_sample(path, reference, mask, 20);
+    string actual = testing::internal::GetCapturedStdout();
+    ASSERT_NE(string::npos, actual.find("||QC_FAIL: qc_fail||"));
+    ASSERT_FALSE(load_catalog(save_dir).entries.contains("qc_fail"));
+    //Still compared
+    fstream out(output_file, fstream::in);
+    string compared((istreambuf_iterator<char>(out)), istreambuf_iterator<char>());
+    ASSERT_NE(string::npos, compared.find("qc_fail uuid4 0\n"));
+
+    //Nor through a batch add
+    Sample* batch = new Sample({}, {}, {}, {}, {});
+    batch->uuid = "qc_fail_batch";
+    batch->id = intern_uuid(batch->uuid);
+    batch->qc_pass = false;
+    vector<Sample*> existing = load_saves();
+    testing::internal::CaptureStdout();
+    add_loaded(existing, {batch}, 20);
+    testing::internal::GetCapturedStdout();
+    for(Sample* s: existing){
+        delete s;
+    }
+    delete batch;
+
+    for(string uuid: {"uuid1", "uuid2", "uuid3", "uuid4"}){
+        for(const auto &[neighbour, dist]: graph_neighbours(save_dir, uuid, 20)){
+            ASSERT_FALSE(neighbour.starts_with("qc_fail"));
+        }
+    }
+    ASSERT_EQ(0, graph_neighbours(save_dir, "qc_fail", 20).size());
+    ASSERT_EQ(0, graph_neighbours(save_dir, "qc_fail_batch", 20).size());
+
+    fs::remove_all(save_dir);
+    save_dir = old_save_dir;
+    output_file = old_output_file;
+}
+
 /**
 * @brief Test `compare_row`
 */
@@ -492,3 +606,239 @@ TEST(comparisons, compute_loaded){
 }
 
 
+
+/**
+* @brief Test computing only the pairs including samples saved since an earlier run
+*/
+TEST(comparisons, compute_saves_since){
+    string old_save_dir = save_dir;
+    save_dir = "cases/dummy/since_saves";
+    fs::remove_all(save_dir);
+    fs::create_directories(save_dir);
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+    for(string name: {"1", "2", "3"}){
+        save(save_dir, new Sample("cases/dummy/" + name + ".fasta", reference, mask));
+    }
+
+    auto lines = [](string text){
+        vector<string> acc;
+        stringstream in(text);
+        string line;
+        while(getline(in, line)){
+            acc.push_back(line);
+        }
+        return acc;
+    };
+    testing::internal::CaptureStdout();
+    uint64_t first = compute_saves(99999);
+    ASSERT_EQ(3, lines(testing::internal::GetCapturedStdout()).size());
+    ASSERT_EQ(first, last_run(save_dir, 99999));
+    ASSERT_THROW(last_run(save_dir, 5), invalid_argument);
+
+    for(string name: {"4", "5"}){
+        save(save_dir, new Sample("cases/dummy/" + name + ".fasta", reference, mask));
+    }
+    testing::internal::CaptureStdout();
+    uint64_t second = compute_saves(99999, first);
+    vector<string> actual = lines(testing::internal::GetCapturedStdout());
+    ASSERT_LT(first, second);
+    ASSERT_EQ(second, last_run(save_dir, 99999));
+
+    //New x old, then new x new
+    vector<string> expected = {
+        "uuid1 uuid4 1",
+        "uuid2 uuid4 1",
+        "uuid3 uuid4 2",
+        "uuid1 uuid5 79",
+        "uuid2 uuid5 79",
+        "uuid3 uuid5 77",
+        "uuid4 uuid5 78"
+    };
+    ASSERT_TRUE(vectors_equal(expected, actual));
+
+    //Nothing new, so nothing to compute
+    testing::internal::CaptureStdout();
+    compute_saves(99999, second);
+    ASSERT_EQ("", testing::internal::GetCapturedStdout());
+
+    //Rebuilding the catalog keeps what the run covered
+    rebuild_catalog(save_dir);
+    testing::internal::CaptureStdout();
+    compute_saves(99999, second);
+    ASSERT_EQ("", testing::internal::GetCapturedStdout());
+
+    //Without the old catalog, everything is newer than any run
+    fs::remove(save_dir + "/" + catalog_filename);
+    testing::internal::CaptureStdout();
+    compute_saves(99999, last_run(save_dir, 99999));
+    ASSERT_EQ(10, lines(testing::internal::GetCapturedStdout()).size());
+    ASSERT_THROW(compute_saves(99999, load_catalog(save_dir).generation() + 1), invalid_argument);
+
+    fs::remove_all(save_dir);
+    save_dir = old_save_dir;
+}
+
+/**
+* @brief Test that each output tier has exactly the results within its cutoff, from one pass
+*/
+TEST(comparisons, cutoff_tiers){
+    string old_output_file = output_file;
+    string dir = "cases/dummy/tiers";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    output_file = dir + "/all.txt";
+    output_cutoffs = {2, 1, 99999};
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+    vector<Sample*> samples;
+    for(string name: {"1", "2", "3", "4", "5"}){
+        samples.push_back(new Sample("cases/dummy/" + name + ".fasta", reference, mask));
+    }
+    compute_loaded(99999, samples);
+    output_cutoffs = {};
+
+    auto lines = [](string path){
+        vector<string> acc;
+        fstream in(path, fstream::in);
+        string line;
+        while(getline(in, line)){
+            acc.push_back(line);
+        }
+        return acc;
+    };
+    ASSERT_EQ(dir + "/all.2.txt", tier_path(output_file, 2));
+    vector<string> all = lines(tier_path(output_file, 99999));
+    ASSERT_EQ(10, all.size());
+    vector<string> stats = {"cutoff\tresults"};
+    for(int cutoff: {1, 2, 99999}){
+        vector<string> expected;
+        for(const string &line: all){
+            if(stoi(line.substr(line.rfind(' ') + 1)) <= cutoff){
+                expected.push_back(line);
+            }
+        }
+        ASSERT_TRUE(vectors_equal(expected, lines(tier_path(output_file, cutoff))));
+        stats.push_back(to_string(cutoff) + "\t" + to_string(expected.size()));
+    }
+    ASSERT_EQ(stats, lines(dir + "/all.tiers.tsv"));
+    ASSERT_EQ(5, lines(tier_path(output_file, 1)).size());
+
+    for(Sample* s: samples){
+        delete s;
+    }
+    fs::remove_all(dir);
+    output_file = old_output_file;
+}
+
+/**
+* @brief A collection of 40 samples with overlapping runs of positions, some other bases and some Ns, so distances
+            and bounds vary
+*
+* @param prefix Prefix of the UUIDs, which are numbered from 0
+*/
+vector<Sample*> synthetic_collection(string prefix){
+    vector<Sample*> samples;
+    for(int i=0;i<40;i++){
+        vector<int> a, c, n;
+        for(int j=(i * 7) % 23;j<(i * 7) % 23 + i % 11;j++){
+            a.push_back(j);
+        }
+        if(i % 3 == 0){
+            c = {50 + i % 4};
+        }
+        if(i % 5 == 0){
+            n = {2, 3, 40};
+        }
+        Sample* s = new Sample(a, c, {}, {}, n);
+        s->uuid = prefix + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+/**
+* @brief Test the k nearest match comparing against everything, and the lower bound holds
+*/
+TEST(comparisons, nearest){
+    vector<Sample*> samples = synthetic_collection("nearest");
+    vector<SampleView> views;
+    for(Sample* s: samples){
+        views.push_back(s->view());
+    }
+    for(Sample* s: samples){
+        vector<int> dists;
+        for(Sample* other: samples){
+            if(other->id == s->id){
+                continue;
+            }
+            int dist = s->dist(other, 99999);
+            ASSERT_LE(distance_lower_bound(s, other->view()), dist);
+            dists.push_back(dist);
+        }
+        sort(dists.begin(), dists.end());
+        for(int k: {1, 3, 50}){
+            vector<pair<uint32_t, int>> closest = nearest(s, views, k);
+            ASSERT_EQ(min(k, 39), closest.size());
+            for(size_t i=0;i<closest.size();i++){
+                ASSERT_NE(s->id, closest.at(i).first);
+                ASSERT_EQ(dists.at(i), closest.at(i).second);
+            }
+        }
+    }
+    ASSERT_THROW(nearest(samples.at(0), views, 0), invalid_argument);
+}
+
+/**
+* @brief Test distances from a corrected sample match comparing it to everything
+*/
+TEST(comparisons, update_distances){
+    vector<Sample*> samples = synthetic_collection("update");
+    vector<SampleView> views;
+    for(Sample* s: samples){
+        views.push_back(s->view());
+    }
+
+    Sample* before = samples.at(7);
+    //Gains and loses variants, changes a base, and gains an N
+    vector<Sample*> corrections = {
+        new Sample({3, 4, 5, 6}, {}, {}, {}, {}),
+        new Sample({0, 1, 2, 3, 4, 5, 6, 7, 8}, {51}, {}, {}, {}),
+        new Sample({}, {}, {}, {}, {10}),
+        new Sample({1}, {7}, {}, {}, {}),
+    };
+    for(Sample* after: corrections){
+        after->uuid = before->uuid;
+        after->id = before->id;
+        ASSERT_GT(changed_positions(before, after).size(), 0);
+        for(int known_cutoff: {0, 3, 10}){
+            unordered_map<uint32_t, int> known;
+            unordered_set<uint32_t> covered;
+            for(Sample* s: samples){
+                covered.insert(s->id);
+                int dist = before->dist(s, known_cutoff);
+                if(s != before && dist <= known_cutoff){
+                    known[s->id] = dist;
+                }
+            }
+            for(int cutoff: {0, 3, 10}){
+                vector<pair<uint32_t, int>> expected;
+                for(Sample* s: samples){
+                    int dist = after->dist(s, cutoff);
+                    if(s != before && dist <= cutoff){
+                        expected.push_back({s->id, dist});
+                    }
+                }
+                ASSERT_EQ(expected, update_distances(before, after, views, known, covered, known_cutoff, cutoff));
+                //Nothing known or covered, such as a bulk loaded collection, so everything is compared
+                ASSERT_EQ(expected, update_distances(before, after, views, {}, {}, known_cutoff, cutoff));
+            }
+        }
+        delete after;
+    }
+    ASSERT_EQ(0, changed_positions(before, before).size());
+    for(Sample* s: samples){
+        delete s;
+    }
+}
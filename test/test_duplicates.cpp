@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include "../src/include/duplicates.hpp"
+
+/**
+* @brief Make a collection of `count` samples, each a copy of one of `distinct` different samples
+*/
+vector<Sample*> duplicate_samples(string name, int count, int distinct){
+    vector<Sample*> samples;
+    for(int i=0;i<count;i++){
+        vector<int> a;
+        for(int j=0;j<i % distinct;j++){
+            a.push_back(j);
+        }
+        Sample* s = new Sample(a, {}, {}, {}, {100});
+        s->uuid = name + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+/**
+* @brief Test grouping exact duplicates
+*/
+TEST(duplicates, classes){
+    vector<Sample*> samples = duplicate_samples("dup_classes", 10, 3);
+    ASSERT_EQ(samples.at(0)->content_hash(), samples.at(3)->content_hash());
+    ASSERT_NE(samples.at(0)->content_hash(), samples.at(1)->content_hash());
+    ASSERT_TRUE(samples.at(1)->same_content(*samples.at(4)));
+
+    //Moving a position between lists is a different sample
+    Sample moved({}, {1}, {}, {}, {});
+    Sample original({1}, {}, {}, {}, {});
+    ASSERT_NE(moved.content_hash(), original.content_hash());
+    ASSERT_FALSE(moved.same_content(original));
+
+    DuplicateClasses classes(samples);
+    ASSERT_EQ(3, classes.representatives.size());
+    ASSERT_EQ(samples.at(2)->id, classes.representatives.at(2)->id);
+    ASSERT_EQ(7, classes.duplicate_count());
+    vector<uint32_t> expected = {samples.at(0)->id, samples.at(3)->id, samples.at(6)->id, samples.at(9)->id};
+    ASSERT_EQ(expected, classes.duplicates.at(samples.at(0)->id));
+
+    //Fanned out to every pair of members, in collection order
+    vector<Distance> distances;
+    classes.fan_out(make_distance(samples.at(1), samples.at(2), 1), distances);
+    ASSERT_EQ(9, distances.size());
+    for(const Distance &d: distances){
+        ASSERT_EQ(1, d.dist);
+        ASSERT_LT(uuid_of(d.id1).substr(11), uuid_of(d.id2).substr(11));
+    }
+
+    //All one class isn't grouped
+    DuplicateClasses same(duplicate_samples("dup_same", 4, 1));
+    ASSERT_EQ(4, same.representatives.size());
+    ASSERT_EQ(0, same.duplicate_count());
+}
+
+/**
+* @brief Test a matrix with duplicates matches comparing every pair
+*/
+TEST(duplicates, compute){
+    int old_tile_size = tile_size;
+    tile_size = 2;
+    vector<Sample*> samples = duplicate_samples("dup_compute", 13, 4);
+
+    multiset<string> expected;
+    for(size_t i=0;i<samples.size();i++){
+        for(size_t j=i+1;j<samples.size();j++){
+            int dist = samples.at(i)->dist(samples.at(j), 2);
+            if(dist <= 2){
+                expected.insert(samples.at(i)->uuid + " " + samples.at(j)->uuid + " " + to_string(dist));
+            }
+        }
+    }
+
+    testing::internal::CaptureStdout();
+    compute_loaded(2, samples);
+    string actual = testing::internal::GetCapturedStdout();
+    multiset<string> lines;
+    stringstream in(actual);
+    string line;
+    while(getline(in, line)){
+        lines.insert(line);
+    }
+    ASSERT_EQ(expected, lines);
+
+    //Adding a copy of an existing sample fans out to its whole class
+    int old_graph_cutoff = graph_cutoff;
+    graph_cutoff = -1;
+    vector<Sample*> others = duplicate_samples("dup_added", 1, 1);
+    testing::internal::CaptureStdout();
+    add_loaded(samples, others, 0);
+    actual = testing::internal::GetCapturedStdout();
+    ASSERT_EQ(4, count(actual.begin(), actual.end(), '\n'));
+    ASSERT_NE(string::npos, actual.find("dup_compute12 dup_added0 0\n"));
+
+    graph_cutoff = old_graph_cutoff;
+    tile_size = old_tile_size;
+}
+
+/**
+* @brief Test re-adding a representative with changed content only compares it to the rest of its class
+*/
+TEST(duplicates, readd_representative){
+    int old_graph_cutoff = graph_cutoff;
+    int old_cluster_cutoff = cluster_cutoff;
+    graph_cutoff = -1;
+    cluster_cutoff = -1;
+    //dup_readd0 represents 0, 2 and 4, and dup_readd1 represents 1, 3 and 5
+    vector<Sample*> samples = duplicate_samples("dup_readd", 6, 2);
+    Sample* changed = new Sample({50}, {}, {}, {}, {100});
+    changed->uuid = "dup_readd0";
+    changed->id = intern_uuid(changed->uuid);
+
+    testing::internal::CaptureStdout();
+    add_loaded(samples, {changed}, 5);
+    string actual = testing::internal::GetCapturedStdout();
+    multiset<string> lines;
+    stringstream in(actual);
+    string line;
+    while(getline(in, line)){
+        lines.insert(line);
+    }
+    //Nothing between the untouched members, which are still identical
+    multiset<string> expected = {
+        "dup_readd2 dup_readd0 1", "dup_readd4 dup_readd0 1",
+        "dup_readd1 dup_readd0 2", "dup_readd3 dup_readd0 2", "dup_readd5 dup_readd0 2",
+    };
+    graph_cutoff = old_graph_cutoff;
+    cluster_cutoff = old_cluster_cutoff;
+    for(Sample* s: samples){
+        delete s;
+    }
+    delete changed;
+    ASSERT_EQ(expected, lines);
+}
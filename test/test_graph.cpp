@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include "../src/include/graph.hpp"
+#include "../src/include/comparisons.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Test appending to and querying a neighbour graph, before and after compaction
+*/
+TEST(graph, append_and_query){
+    string dir = "cases/dummy/graph_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    ASSERT_THROW(graph_neighbours(dir, "graph1", 5), invalid_argument);
+    {
+        NeighbourGraph graph(dir, 10);
+        ASSERT_EQ(10, graph.cutoff);
+        vector<Distance> distances = {
+            {intern_uuid("graph1"), intern_uuid("graph2"), 3},
+            {intern_uuid("graph3"), intern_uuid("graph1"), 0},
+            {intern_uuid("graph2"), intern_uuid("graph3"), 7},
+            //Above the graph's cutoff so not kept
+            {intern_uuid("graph1"), intern_uuid("graph4"), 11},
+        };
+        graph.append(distances);
+        graph.close();
+    }
+    vector<pair<string, int>> expected = {{"graph3", 0}, {"graph2", 3}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph1", 10));
+    expected = {{"graph3", 0}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph1", 2));
+    ASSERT_EQ(0, graph_neighbours(dir, "graph4", 10).size());
+    ASSERT_EQ(0, graph_neighbours(dir, "not_a_sample", 10).size());
+    ASSERT_THROW(graph_neighbours(dir, "graph1", 11), invalid_argument);
+
+    //Answers should be the same from the index as from the log
+    compact_graph(dir);
+    expected = {{"graph3", 0}, {"graph2", 3}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph1", 10));
+    expected = {{"graph1", 3}, {"graph3", 7}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph2", 10));
+
+    {
+        //The cutoff is fixed when the graph is created
+        NeighbourGraph graph(dir, 20);
+        ASSERT_EQ(10, graph.cutoff);
+        //Later distances replace earlier ones, including moving out of the cutoff
+        vector<Distance> distances = {
+            {intern_uuid("graph2"), intern_uuid("graph1"), 5},
+            {intern_uuid("graph3"), intern_uuid("graph2"), 10},
+            {intern_uuid("graph5"), intern_uuid("graph1"), 1},
+        };
+        graph.append(distances);
+    }
+    expected = {{"graph3", 0}, {"graph5", 1}, {"graph2", 5}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph1", 10));
+    expected = {{"graph1", 5}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph2", 9));
+    compact_graph(dir);
+    expected = {{"graph3", 0}, {"graph5", 1}, {"graph2", 5}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph1", 10));
+    expected = {{"graph1", 5}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph2", 9));
+    expected = {{"graph1", 1}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "graph5", 10));
+
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test removed edges are gone both before and after compaction
+*/
+TEST(graph, remove){
+    string dir = "cases/dummy/graph_remove_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    {
+        NeighbourGraph graph(dir, 10);
+        vector<Distance> distances = {
+            {intern_uuid("remove1"), intern_uuid("remove2"), 3},
+            {intern_uuid("remove1"), intern_uuid("remove3"), 4},
+        };
+        graph.append(distances);
+        distances = {{intern_uuid("remove2"), intern_uuid("remove1"), 0}};
+        graph.remove(distances);
+    }
+    vector<pair<string, int>> expected = {{"remove3", 4}};
+    ASSERT_EQ(expected, graph_neighbours(dir, "remove1", 10));
+    ASSERT_EQ(0, graph_neighbours(dir, "remove2", 10).size());
+    compact_graph(dir);
+    ASSERT_EQ(expected, graph_neighbours(dir, "remove1", 10));
+    ASSERT_EQ(0, graph_neighbours(dir, "remove2", 10).size());
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test adding a sample again drops its edges to old neighbours the new version is beyond the cutoff of
+*/
+TEST(graph, readd){
+    string old_save_dir = save_dir;
+    int old_graph_cutoff = graph_cutoff;
+    int old_cluster_cutoff = cluster_cutoff;
+    save_dir = "cases/dummy/graph_readd_saves";
+    graph_cutoff = 2;
+    cluster_cutoff = -1;
+    fs::remove_all(save_dir);
+    fs::create_directories(save_dir);
+
+    vector<Sample*> samples = {new Sample({1}, {}, {}, {}, {}), new Sample({1, 2}, {}, {}, {}, {}), new Sample({5, 6, 7}, {}, {}, {}, {})};
+    vector<string> names = {"readd_a", "readd_b", "readd_c"};
+    for(size_t i=0;i<samples.size();i++){
+        samples.at(i)->uuid = names.at(i);
+        samples.at(i)->id = intern_uuid(names.at(i));
+        save(save_dir, samples.at(i));
+    }
+    testing::internal::CaptureStdout();
+    add_loaded({samples.at(0)}, {samples.at(1), samples.at(2)}, 2);
+    vector<pair<string, int>> before = graph_neighbours(save_dir, "readd_b", 2);
+
+    //Now far from readd_a, and close to readd_c
+    Sample* changed = new Sample({5, 6}, {}, {}, {}, {});
+    changed->uuid = "readd_b";
+    changed->id = intern_uuid(changed->uuid);
+    add_loaded(samples, {changed}, 2);
+    testing::internal::GetCapturedStdout();
+    vector<pair<string, int>> after = graph_neighbours(save_dir, "readd_b", 2);
+    vector<pair<string, int>> a_after = graph_neighbours(save_dir, "readd_a", 2);
+    bool covered = graph_coverage(save_dir).contains("readd_b");
+
+    for(Sample* s: samples){
+        delete s;
+    }
+    delete changed;
+    fs::remove_all(save_dir);
+    save_dir = old_save_dir;
+    graph_cutoff = old_graph_cutoff;
+    cluster_cutoff = old_cluster_cutoff;
+    ASSERT_EQ((vector<pair<string, int>>{{"readd_a", 1}}), before);
+    ASSERT_EQ((vector<pair<string, int>>{{"readd_c", 1}}), after);
+    ASSERT_EQ(0, a_after.size());
+    ASSERT_TRUE(covered);
+}
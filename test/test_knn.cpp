@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include "../src/include/knn.hpp"
+
+/**
+* @brief Test every sample's k nearest match comparing every pair, and are the same whatever the tiles
+*/
+TEST(knn, graph){
+    int old_tile_size = tile_size;
+    vector<Sample*> samples;
+    for(int i=0;i<30;i++){
+        vector<int> a, n;
+        for(int j=(i * 5) % 17;j<(i * 5) % 17 + i % 9;j++){
+            a.push_back(j);
+        }
+        if(i % 4 == 0){
+            n = {1, 2, 30};
+        }
+        Sample* s = new Sample(a, {}, {}, {}, n);
+        s->uuid = "knn" + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        samples.push_back(s);
+    }
+
+    for(int k: {1, 4, 40}){
+        vector<vector<pair<uint32_t, int>>> expected_graph;
+        for(int size: {3, 512}){
+            tile_size = size;
+            vector<vector<pair<uint32_t, int>>> graph = knn_graph(samples, k);
+            ASSERT_EQ(samples.size(), graph.size());
+            for(size_t i=0;i<samples.size();i++){
+                vector<int> dists;
+                for(size_t j=0;j<samples.size();j++){
+                    if(i != j){
+                        dists.push_back(samples.at(i)->dist(samples.at(j), 99999));
+                    }
+                }
+                sort(dists.begin(), dists.end());
+                ASSERT_EQ(min(k, 29), graph.at(i).size());
+                for(size_t n=0;n<graph.at(i).size();n++){
+                    ASSERT_NE(i, graph.at(i).at(n).first);
+                    ASSERT_EQ(dists.at(n), graph.at(i).at(n).second);
+                }
+            }
+            if(expected_graph.size() > 0){
+                ASSERT_EQ(expected_graph, graph);
+            }
+            expected_graph = graph;
+        }
+    }
+    ASSERT_THROW(knn_graph(samples, 0), invalid_argument);
+    tile_size = old_tile_size;
+}
@@ -0,0 +1,273 @@
+#include <gtest/gtest.h>
+#include "../src/include/output.hpp"
+
+/**
+* @brief Read a whole (optionally gzipped) file into a string
+*/
+string read_output(string path){
+    gzFile in = gzopen(path.c_str(), "rb");
+    string contents;
+    char buffer[4096];
+    int n;
+    while((n = gzread(in, buffer, sizeof(buffer))) > 0){
+        contents.append(buffer, n);
+    }
+    gzclose(in);
+    return contents;
+}
+
+/**
+* @brief Split a string into lines, sorted so order from threads doesn't matter
+*/
+vector<string> sorted_lines(string text){
+    vector<string> lines;
+    string acc;
+    for(const char &c: text){
+        if(c == '\n'){
+            lines.push_back(acc);
+            acc = "";
+        }
+        else{
+            acc += c;
+        }
+    }
+    sort(lines.begin(), lines.end());
+    return lines;
+}
+
+/**
+* @brief Test `format_distances`
+*/
+TEST(output, format_distances){
+    vector<Distance> distances = {
+        {intern_uuid("fmt1"), intern_uuid("fmt2"), 0},
+        {intern_uuid("fmt2"), intern_uuid("fmt3"), 65535},
+    };
+    string actual;
+    format_distances(distances, actual);
+    ASSERT_EQ("fmt1 fmt2 0\nfmt2 fmt3 65535\n", actual);
+}
+
+/**
+* @brief Test that a `ResultWriter` collects results from many threads
+*/
+TEST(output, result_writer){
+    string path = "test_result_writer.txt";
+    remove(path.c_str());
+
+    vector<string> expected;
+    {
+        ResultWriter writer(path);
+        vector<thread> threads;
+        for(int t=0;t<4;t++){
+            string prefix = "writer" + to_string(t) + "_";
+            for(int i=0;i<1000;i++){
+                expected.push_back(prefix + "a " + prefix + to_string(i) + " " + to_string(i % 20));
+            }
+            threads.push_back(thread([prefix, &writer]{
+                vector<Distance> distances;
+                for(int i=0;i<1000;i++){
+                    distances.push_back({intern_uuid(prefix + "a"), intern_uuid(prefix + to_string(i)), (uint16_t) (i % 20)});
+                    if(distances.size() == 64){
+                        writer.push(distances);
+                        ASSERT_EQ(0, distances.size());
+                    }
+                }
+                writer.push(distances);
+            }));
+        }
+        for(thread &t: threads){
+            t.join();
+        }
+        writer.close();
+        ASSERT_EQ(4000, writer.written());
+    }
+    sort(expected.begin(), expected.end());
+    ASSERT_EQ(expected, sorted_lines(read_output(path)));
+
+    //Further writers should append
+    {
+        ResultWriter writer(path);
+        vector<Distance> distances = {{intern_uuid("writer_extra1"), intern_uuid("writer_extra2"), 3}};
+        writer.push(distances);
+    }
+    ASSERT_EQ(4001, sorted_lines(read_output(path)).size());
+    remove(path.c_str());
+}
+
+/**
+* @brief Test gzip compressed output
+*/
+TEST(output, result_writer_gzip){
+    string path = "test_result_writer.txt.gz";
+    remove(path.c_str());
+    {
+        ResultWriter writer(path, "gzip");
+        vector<Distance> distances = {
+            {intern_uuid("gz1"), intern_uuid("gz2"), 1},
+            {intern_uuid("gz1"), intern_uuid("gz3"), 2},
+        };
+        writer.push(distances);
+        writer.close();
+    }
+    //Check that this is actually compressed
+    fstream in(path, fstream::in | fstream::binary);
+    unsigned char magic[2];
+    in.read((char *) magic, 2);
+    in.close();
+    ASSERT_EQ(0x1f, magic[0]);
+    ASSERT_EQ(0x8b, magic[1]);
+
+    ASSERT_EQ("gz1 gz2 1\ngz1 gz3 2\n", read_output(path));
+    remove(path.c_str());
+
+    ASSERT_THROW(ResultWriter(path, "lzma"), invalid_argument);
+}
+
+/**
+* @brief Test that binary outputs can be read back, in each format
+*/
+TEST(output, binary_round_trip){
+    vector<Distance> expected;
+    for(uint32_t i=0;i<500;i++){
+        //Deliberately out of order to check sorting of delta blocks
+        uint32_t id1 = intern_uuid("binary" + to_string(i % 7));
+        uint32_t id2 = intern_uuid("binary_other" + to_string(499 - i));
+        expected.push_back({id1, id2, (uint16_t) (i * 131 % 65536)});
+    }
+    auto key = [](const Distance &d){
+        return make_tuple(uuid_of(d.id1), uuid_of(d.id2), (int) d.dist);
+    };
+    vector<tuple<string, string, int>> expected_keys;
+    for(const Distance &d: expected){
+        expected_keys.push_back(key(d));
+    }
+    sort(expected_keys.begin(), expected_keys.end());
+
+    for(string format: {"binary", "binary_delta"}){
+        for(string compression: {"none", "gzip"}){
+            string path = "test_binary_output.fn5d";
+            remove(path.c_str());
+            {
+                ResultWriter writer(path, compression, format);
+                vector<Distance> first(expected.begin(), expected.begin() + 200);
+                vector<Distance> second(expected.begin() + 200, expected.end());
+                writer.push(first);
+                writer.push(second);
+                writer.close();
+                ASSERT_EQ(500, writer.written());
+            }
+
+            vector<tuple<string, string, int>> actual;
+            int blocks = 0;
+            read_binary_distances(path, [&actual, &blocks](const vector<string> &names, const vector<Distance> &distances){
+                blocks++;
+                for(const Distance &d: distances){
+                    actual.push_back(make_tuple(names.at(d.id1), names.at(d.id2), (int) d.dist));
+                }
+            });
+            sort(actual.begin(), actual.end());
+            ASSERT_EQ(2, blocks);
+            ASSERT_EQ(expected_keys, actual);
+            remove(path.c_str());
+        }
+    }
+}
+
+/**
+* @brief Test that malformed binary outputs are rejected
+*/
+TEST(output, binary_malformed){
+    string path = "test_binary_malformed.fn5d";
+    fstream out(path, fstream::out | fstream::binary);
+    out << "uuid1 uuid2 3\n";
+    out.close();
+    auto ignore = [](const vector<string> &names, const vector<Distance> &distances){};
+    ASSERT_THROW(read_binary_distances(path, ignore), invalid_argument);
+    ASSERT_THROW(read_binary_distances("does_not_exist.fn5d", ignore), invalid_argument);
+    remove(path.c_str());
+}
+
+/**
+* @brief Test writing distances into SQLite
+*/
+TEST(output, result_writer_sqlite){
+    string path = "test_result_writer.db";
+    remove(path.c_str());
+    {
+        ResultWriter writer(path, "none", "sqlite");
+        vector<Distance> distances = {
+            {intern_uuid("sql2"), intern_uuid("sql1"), 4},
+            {intern_uuid("sql1"), intern_uuid("sql3"), 7},
+        };
+        writer.push(distances);
+        writer.close();
+        ASSERT_EQ(2, writer.written());
+    }
+    //Writing the same pair again should replace it rather than failing
+    {
+        ResultWriter writer(path, "none", "sqlite");
+        vector<Distance> distances = {{intern_uuid("sql1"), intern_uuid("sql2"), 5}};
+        writer.push(distances);
+    }
+
+    sqlite3* db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(path.c_str(), &db));
+    sqlite3_stmt* query;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT guid1, guid2, dist FROM distances ORDER BY guid1, guid2", -1, &query, nullptr));
+    vector<string> actual;
+    while(sqlite3_step(query) == SQLITE_ROW){
+        actual.push_back(string((const char *) sqlite3_column_text(query, 0)) + " " + (const char *) sqlite3_column_text(query, 1) + " " + to_string(sqlite3_column_int(query, 2)));
+    }
+    sqlite3_finalize(query);
+    sqlite3_close(db);
+    vector<string> expected = {"sql1 sql2 5", "sql1 sql3 7"};
+    ASSERT_EQ(expected, actual);
+    remove(path.c_str());
+    remove((path + "-wal").c_str());
+    remove((path + "-shm").c_str());
+
+    ASSERT_THROW(ResultWriter("-", "none", "sqlite"), invalid_argument);
+    ASSERT_THROW(ResultWriter(path, "gzip", "sqlite"), invalid_argument);
+}
+
+/**
+* @brief Test that observers see every result, while the output is limited
+*/
+TEST(output, result_writer_observe){
+    string path = "test_result_writer_observe.txt";
+    remove(path.c_str());
+    vector<Distance> observed;
+    {
+        ResultWriter writer(path);
+        writer.observe([&observed](const vector<Distance> &distances){
+            observed.insert(observed.end(), distances.begin(), distances.end());
+        });
+        writer.limit(5);
+        vector<Distance> distances = {
+            {intern_uuid("observe1"), intern_uuid("observe2"), 5},
+            {intern_uuid("observe1"), intern_uuid("observe3"), 6},
+        };
+        writer.push(distances);
+        writer.close();
+        ASSERT_EQ(1, writer.written());
+    }
+    ASSERT_EQ(2, observed.size());
+    ASSERT_EQ("observe1 observe2 5\n", read_output(path));
+    remove(path.c_str());
+}
+
+/**
+* @brief Test a write which fails (here a full disk) is an error from `close`, rather than a truncated output
+*/
+TEST(output, result_writer_full_disk){
+    for(string compression: {"none", "gzip"}){
+        ResultWriter writer("/dev/full", compression);
+        vector<Distance> distances;
+        for(int i=0;i<10000;i++){
+            distances.push_back({intern_uuid("full1"), intern_uuid("full" + to_string(i)), 1});
+        }
+        writer.push(distances);
+        ASSERT_THROW(writer.close(), invalid_argument);
+    }
+}
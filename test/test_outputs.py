@@ -1,3 +1,6 @@
+import os
+import sys
+
 import pytest
 
 '''All files are parsed into a set to avoid order based issues due to multithreading
@@ -65,4 +68,315 @@ def test_4():
             "sample4 sample2 11",
         ]
     expected = set([tuple(sorted(x.split(" "))) for x in expected])
-    assert actual == expected
\ No newline at end of file
+    assert actual == expected
+
+def test_5():
+    '''Binary outputs should convert back to the same as the text output
+    '''
+    with open("test/output/1.txt") as f:
+        expected = set([tuple(sorted(line.strip().split(" "))) for line in f])
+
+    for path in ["test/output/5.txt", "test/output/6.txt"]:
+        with open(path) as f:
+            actual = set([tuple(sorted(line.strip().split(" "))) for line in f])
+        assert actual == expected
+
+def test_6():
+    '''The Python reader should read both binary formats
+    '''
+    sys.path.insert(0, "db")
+    from distances import is_binary, read_distances
+
+    with open("test/output/1.txt") as f:
+        expected = set([tuple(sorted(line.strip().split(" "))) for line in f])
+
+    for path in ["test/output/5.fn5d", "test/output/6.fn5d.gz"]:
+        assert is_binary(path)
+        actual = set([tuple(sorted([g1, g2, str(d)])) for g1, g2, d in read_distances(path)])
+        assert actual == expected
+    assert not is_binary("test/output/1.txt")
+
+def test_7():
+    '''SQLite outputs should have the same distances as the text output, with sorted GUIDs
+    '''
+    import sqlite3
+
+    with open("test/output/1.txt") as f:
+        expected = set([tuple(sorted(line.strip().split(" "))) for line in f])
+
+    db = sqlite3.connect("test/output/7.db")
+    rows = db.execute("SELECT guid1, guid2, dist FROM distances").fetchall()
+    db.close()
+    assert all(g1 < g2 for g1, g2, _ in rows)
+    actual = set([tuple(sorted([g1, g2, str(d)])) for g1, g2, d in rows])
+    assert actual == expected
+
+def test_8():
+    '''The neighbour graph should have been kept up to date by the adds
+    '''
+    with open("test/output/8.txt") as f:
+        actual = [line.strip() for line in f]
+    assert actual == [
+        "sample4 sample2 11",
+        "sample4 sample3 11",
+        "sample4 sample1 12",
+        ]
+
+    with open("test/output/9.txt") as f:
+        actual = [line.strip() for line in f]
+    assert actual == [
+        "sample4 sample2 11",
+        "sample4 sample3 11",
+        ]
+
+def test_9():
+    '''Requests to a resident server
+    '''
+    with open("test/output/10.txt") as f:
+        actual = set([tuple(sorted(line.strip().split(" "))) for line in f])
+    expected = set([
+        "sample4 sample1 12",
+        "sample4 sample3 11",
+        "sample4 sample2 11",
+        ])
+    expected = set([tuple(sorted(x.split(" "))) for x in expected])
+    assert actual == expected
+
+    with open("test/output/11.txt") as f:
+        actual = [line.strip() for line in f]
+    assert actual == [
+        "sample4 sample2 11",
+        "sample4 sample3 11",
+        ]
+
+    with open("test/output/12.txt") as f:
+        stats = dict(line.strip().split("\t") for line in f)
+    assert stats["samples"] == "4"
+    assert stats["requests"] == "2"
+
+def test_10():
+    '''Spool dir watcher
+    '''
+    with open("test/output/13.txt") as f:
+        lines = [line.strip() for line in f]
+    assert "||QC_FAIL: sample1||" in lines
+    actual = set([tuple(sorted(line.split(" "))) for line in lines if not line.startswith("||")])
+    with open("test/output/1.txt") as f:
+        expected = set([tuple(sorted(line.strip().split(" "))) for line in f])
+    assert actual == expected
+
+    with open("test/output/spool/metrics.tsv") as f:
+        lines = [line.strip().split("\t") for line in f]
+    header = lines[0]
+    batches = [dict(zip(header, line)) for line in lines[1:]]
+    assert [b["samples"] for b in batches] == ["2", "1"]
+    assert [b["collection"] for b in batches] == ["4", "4"]
+    #Re-adding samples already in the collection gives both orders of their pair, as with --add_many
+    assert [b["results"] for b in batches] == ["7", "3"]
+    assert [b["failed"] for b in batches] == ["0", "1"]
+    assert sorted(os.listdir("test/output/spool/done")) == ["1.fasta", "2.fasta", "4.fasta"]
+    assert os.listdir("test/output/spool/failed") == ["qc_fail.fasta"]
+
+def test_11():
+    '''Comparing against a shared collection should match comparing against loaded saves
+    '''
+    with open("test/output/4.txt") as f:
+        expected = set([tuple(sorted(line.strip().split(" "))) for line in f])
+    with open("test/output/14.txt") as f:
+        actual = set([tuple(sorted(line.strip().split(" "))) for line in f])
+    assert actual == expected
+    assert [name for name in os.listdir("test/output") if name.endswith(".collection")] == []
+
+def test_12():
+    '''Merging partitions should give the same as computing the whole matrix at once
+    '''
+    with open("test/output/15.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    with open("test/output/1.txt") as f:
+        expected = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    assert actual == expected
+    assert sorted(os.listdir("test/output/partitions")) == [
+        "part-1-of-3.fn5d", "part-1-of-3.manifest",
+        "part-2-of-3.fn5d", "part-2-of-3.manifest",
+        "part-3-of-3.fn5d", "part-3-of-3.manifest",
+        ]
+
+def test_13():
+    '''A checkpointed matrix should match the whole matrix, and resuming it shouldn't duplicate anything
+    '''
+    with open("test/output/16.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    with open("test/output/1.txt") as f:
+        expected = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    assert actual == expected
+    with open("test/output/16.journal") as f:
+        assert f.readline() == "#fn5 checkpoint journal\n"
+        assert f.readline().startswith("job\tcompute cutoff=20 ")
+
+def test_14():
+    '''A matrix refreshed with only the pairs including new samples should match the whole matrix
+    '''
+    with open("test/output/17.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    with open("test/output/1.txt") as f:
+        expected = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    assert actual == expected
+    with open("test/output/since_saves/runs.tsv") as f:
+        assert len(f.readlines()) == 2
+
+def test_15():
+    '''A duplicate should be reported, and have the same distances as the sample it duplicates
+    '''
+    with open("test/output/18.tsv") as f:
+        assert f.read() == "sample2\tsample2copy\n"
+    with open("test/output/18.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    with open("test/output/1.txt") as f:
+        expected = [line.strip().split(" ") for line in f]
+    copies = [[name.replace("sample2", "sample2copy") for name in line] for line in expected if "sample2" in line]
+    expected = sorted([tuple(sorted(line)) for line in expected + copies] + [("0", "sample2", "sample2copy")])
+    assert actual == expected
+
+def test_16():
+    '''The 2 nearest to sample4 are sample2 and sample3, closer than sample1
+    '''
+    for path in ["test/output/19.txt", "test/output/20.txt"]:
+        with open(path) as f:
+            actual = set([tuple(line.strip().split(" ")) for line in f])
+        assert actual == {("sample4", "sample2", "11"), ("sample4", "sample3", "11")}
+
+def test_17():
+    '''Each sample's 2 nearest, however far away
+    '''
+    with open("test/output/21.txt") as f:
+        actual = sorted([tuple(line.strip().split(" ")) for line in f])
+    expected = sorted([
+        ("sample1", "sample2", "1"), ("sample1", "sample3", "1"),
+        ("sample2", "sample3", "0"), ("sample2", "sample1", "1"),
+        ("sample3", "sample2", "0"), ("sample3", "sample1", "1"),
+        ("sample4", "sample2", "11"), ("sample4", "sample3", "11"),
+        ])
+    assert actual == expected
+
+def test_18():
+    '''Each tier should have the results within its cutoff, and count them
+    '''
+    with open("test/output/1.txt") as f:
+        expected = sorted([tuple(line.strip().split(" ")) for line in f])
+    counts = []
+    for cutoff in [1, 20]:
+        with open(f"test/output/22.{cutoff}.txt") as f:
+            actual = sorted([tuple(line.strip().split(" ")) for line in f])
+        within = [line for line in expected if int(line[2]) <= cutoff]
+        assert actual == within
+        counts.append(f"{cutoff}\t{len(within)}\n")
+    with open("test/output/22.tiers.tsv") as f:
+        assert f.read() == "cutoff\tresults\n" + "".join(counts)
+
+def test_19():
+    '''Aggregates should match counting the matrix
+    '''
+    with open("test/output/1.txt") as f:
+        pairs = [line.strip().split(" ") for line in f]
+    histogram = {}
+    degree = {}
+    for a, b, dist in pairs:
+        histogram[int(dist)] = histogram.get(int(dist), 0) + 1
+        degree[a] = degree.get(a, 0) + 1
+        degree[b] = degree.get(b, 0) + 1
+    with open("test/output/23.tsv") as f:
+        assert f.read() == "distance\tpairs\n" + "".join(f"{d}\t{histogram[d]}\n" for d in sorted(histogram))
+    with open("test/output/24.tsv") as f:
+        lines = [line.strip().split("\t") for line in f]
+    assert lines[0] == ["uuid", "neighbours"]
+    assert {uuid: int(count) for uuid, count in lines[1:] if count != "0"} == degree
+
+def test_20():
+    '''Clusters should be single linkage at 12 over every pair the adds found, and the merges reported
+    '''
+    with open("test/output/2.txt") as f:
+        added = [line.strip().split(" ") for line in f]
+    with open("test/output/25.tsv") as f:
+        merges = sorted([line.strip().split("\t") for line in f])
+    assert merges == sorted([["merge"] + line for line in added if int(line[2]) <= 12])
+
+    with open("test/output/26.tsv") as f:
+        actual = [line.strip().split("\t") for line in f]
+    parent = {uuid: uuid for uuid, _ in actual}
+    def find(uuid):
+        while parent[uuid] != uuid:
+            uuid = parent[uuid]
+        return uuid
+    for path in ["test/output/2.txt", "test/output/3.txt", "test/output/4.txt", "test/output/10.txt"]:
+        with open(path) as f:
+            for line in f:
+                a, b, dist = line.strip().split(" ")
+                if int(dist) <= 12:
+                    parent[find(a)] = find(b)
+    names = {}
+    expected = []
+    for uuid, _ in actual:
+        names.setdefault(find(uuid), uuid)
+        expected.append([uuid, names[find(uuid)]])
+    assert actual == expected
+
+def test_21():
+    '''Correcting sample1 to a copy of sample4 should move it away from sample2 and sample3, and update the graph
+    '''
+    with open("test/output/27.txt") as f:
+        assert f.read() == "sample1 sample4 0\nRemoved: sample1 sample2\nRemoved: sample1 sample3\n"
+    with open("test/output/28.txt") as f:
+        assert f.read() == "sample1 sample4 0\nsample1 sample2 11\nsample1 sample3 11\n"
+
+def test_22():
+    '''sample4 should be gone from the graph and matrix once removed, and its save once compacted
+    '''
+    with open("test/output/29.txt") as f:
+        assert f.read() == "sample1 sample2 11\nsample1 sample3 11\n"
+    with open("test/output/30.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    assert actual == sorted([("11", "sample1", "sample2"), ("11", "sample1", "sample3"), ("0", "sample2", "sample3")])
+    with open("test/output/31.txt") as f:
+        files = f.read().split("\n")
+    assert "sample4.fn5" not in files
+    assert "sample3.fn5" in files
+
+def test_23():
+    '''Re-masking every position should make every distance 0, in the saves and the graph
+    '''
+    with open("test/output/32.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    assert actual == sorted([("0", "sample1", "sample2"), ("0", "sample1", "sample3"), ("0", "sample2", "sample3")])
+    with open("test/output/33.txt") as f:
+        assert f.read() == "sample1 sample2 0\nsample1 sample3 0\n"
+    with open("test/output/update_saves/mask.tsv") as f:
+        assert f.read().split("\t")[1] == "29903\n"
+
+def test_24():
+    '''Masking every position with a profile should make every distance 0, without touching the saves
+    '''
+    with open("test/output/34.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    pairs = [("sample1", "sample2"), ("sample1", "sample3"), ("sample1", "sample4"), ("sample2", "sample3"), ("sample2", "sample4"), ("sample3", "sample4")]
+    assert actual == sorted([("0", a, b) for a, b in pairs])
+    with open("test/output/35.txt") as f:
+        actual = sorted([line.strip() for line in f])
+    assert actual == ["sample4 sample1 0", "sample4 sample2 0", "sample4 sample3 0"]
+
+def test_25():
+    '''Restricted to the panel, sample4 should be 5 from the others, and they should be identical
+    '''
+    with open("test/output/36.txt") as f:
+        actual = sorted([tuple(sorted(line.strip().split(" "))) for line in f])
+    expected = [("0", "sample1", "sample2"), ("0", "sample1", "sample3"), ("0", "sample2", "sample3"), ("5", "sample1", "sample4"), ("5", "sample2", "sample4"), ("5", "sample3", "sample4")]
+    assert actual == sorted(expected)
+    with open("test/output/37.txt") as f:
+        actual = sorted([line.strip() for line in f])
+    assert actual == ["sample4 sample1 5", "sample4 sample2 5", "sample4 sample3 5"]
+
+def test_26():
+    '''Updating sample1 in a bulk loaded store should find every neighbour, although none are in the graph
+    '''
+    with open("test/output/38.txt") as f:
+        actual = sorted([line.strip() for line in f])
+    assert actual == ["sample1 sample2 1", "sample1 sample3 1", "sample1 sample4 12"]
@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include "../src/include/comparisons.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Test regions are read from BED and restrict distances to positions within them
+*/
+TEST(regions, restrict){
+    string path = "cases/dummy/regions.bed";
+    fstream bed(path, fstream::out);
+    bed << "track name=panel\n";
+    bed << "#chrom\tstart\tend\n";
+    bed << "reference\t70\t73\tgene2\n";
+    bed << "reference\t10\t20\tgene1\n";
+    //Overlaps gene1, so is merged into it
+    bed << "reference\t15\t21\n";
+    bed.close();
+
+    Regions panel(path);
+    vector<pair<int, int>> expected = {{10, 21}, {70, 73}};
+    ASSERT_EQ(expected, panel.intervals);
+    ASSERT_EQ(14, panel.positions());
+    ASSERT_EQ(vector<int>({10, 20, 72}), panel.restrict(vector<int>({0, 9, 10, 20, 21, 69, 72, 73, 100})));
+    ASSERT_EQ(vector<int>(), panel.restrict(vector<int>({0, 5})));
+    ASSERT_EQ(vector<int>({0, 5}), Regions().restrict(vector<int>({0, 5})));
+
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+    Sample* s1 = new Sample("cases/dummy/1.fasta", reference, mask);
+    Sample* s4 = new Sample("cases/dummy/4.fasta", reference, mask);
+    Sample* s5 = new Sample("cases/dummy/5.fasta", reference, mask);
+    //uuid4 has a T at 72, and uuid5 a G everywhere
+    ASSERT_EQ(79, s1->dist(s5, 100));
+    Sample* r1 = panel.restricted(s1);
+    Sample* r4 = panel.restricted(s4);
+    ASSERT_EQ("uuid4", r4->uuid);
+    ASSERT_EQ(s4->id, r4->id);
+    ASSERT_EQ(1, r1->dist(r4, 20));
+    panel.restrict(s5);
+    ASSERT_EQ(14, s5->G.size());
+    ASSERT_EQ(14, r1->dist(s5, 20));
+    //uuid4's T at 72 is still a different base to uuid5's G
+    ASSERT_EQ(14, r4->dist(s5, 20));
+
+    bed = fstream(path, fstream::out);
+    bed << "reference\t20\t10\n";
+    bed.close();
+    ASSERT_THROW(Regions bad(path), invalid_argument);
+    ASSERT_THROW(Regions missing("cases/dummy/missing.bed"), invalid_argument);
+
+    for(Sample* s: {s1, s4, s5, r1, r4}){
+        delete s;
+    }
+    fs::remove(path);
+}
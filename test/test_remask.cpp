@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include "../src/include/comparisons.hpp"
+#include "../src/include/remask.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Test re-masking drops the new positions from saves, updates the graph and records the mask
+*/
+TEST(remask, remask_saves){
+    string dir = "cases/dummy/remask_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+    for(string name: {"1", "2", "3", "4", "5"}){
+        save(dir, new Sample("cases/dummy/" + name + ".fasta", reference, mask));
+    }
+    {
+        NeighbourGraph graph(dir, 20);
+        graph.append({{intern_uuid("uuid1"), intern_uuid("uuid3"), 1}});
+        graph.close();
+    }
+
+    ASSERT_EQ(mask_fingerprint({14, 1}), mask_fingerprint({1, 14}));
+    ASSERT_NE(mask_fingerprint({1}), mask_fingerprint({1, 14}));
+
+    //Positions can't be unmasked
+    ASSERT_THROW(remask_saves(dir, mask, {14}), invalid_argument);
+    ASSERT_EQ("", recorded_mask(dir));
+
+    //uuid3 and uuid5 have a G at 14
+    ASSERT_EQ(2, remask_saves(dir, mask, {1, 14}));
+    ASSERT_EQ(mask_fingerprint({1, 14}), recorded_mask(dir));
+    Catalog catalog = load_catalog(dir);
+    Sample* s = readSample(dir + "/" + catalog.entries.at("uuid3").file);
+    ASSERT_EQ(vector<int>(), s->G);
+    ASSERT_EQ(vector<int>({0}), s->N);
+    delete s;
+    s = readSample(dir + "/" + catalog.entries.at("uuid1").file);
+    ASSERT_EQ(vector<int>({0}), s->C);
+    delete s;
+
+    //The shrunk distance replaces the one in the graph
+    vector<pair<string, int>> neighbours = graph_neighbours(dir, "uuid3", 20);
+    ASSERT_EQ(1, count(neighbours.begin(), neighbours.end(), pair<string, int>("uuid1", 0)));
+
+    //Saves are now written with the new mask, so the old one no longer matches, for re-masking or saving
+    ASSERT_THROW(remask_saves(dir, mask, {1, 14, 20}), invalid_argument);
+    ASSERT_THROW(check_mask(dir, mask), invalid_argument);
+    check_mask(dir, {14, 1});
+    //Only uuid5 has anything at 20
+    ASSERT_EQ(1, remask_saves(dir, {1, 14}, {1, 14, 20}));
+    ASSERT_EQ(mask_fingerprint({1, 14, 20}), recorded_mask(dir));
+
+    fs::remove_all(dir);
+}
+
+/**
+* @brief Test a mask profile is applied by the distance kernel and lower bounds, over samples parsed without a mask
+*/
+TEST(remask, mask_profile){
+    string dir = "cases/dummy/profile_saves";
+    fs::remove_all(dir);
+    fs::create_directories(dir + "/" + mask_profiles_dirname);
+    string reference = load_reference("cases/dummy/reference.fasta");
+    vector<Sample*> samples;
+    for(string name: {"1", "2", "3", "4", "5"}){
+        samples.push_back(new Sample("cases/dummy/" + name + ".fasta", reference, {}));
+    }
+    fstream profile(dir + "/" + mask_profiles_dirname + "/panel.txt", fstream::out);
+    for(int i=1;i<80;i++){
+        profile << i << "\n";
+    }
+    profile.close();
+
+    //uuid3 has a G at 14, uuid5 is all G
+    ASSERT_EQ(1, samples.at(0)->dist(samples.at(2), 20));
+    ASSERT_EQ(79, distance_lower_bound(samples.at(4), samples.at(1)->view()));
+    ASSERT_THROW(load_mask_profile(dir, "missing"), invalid_argument);
+    load_mask_profile(dir, "panel");
+    ASSERT_EQ(0, samples.at(0)->dist(samples.at(2), 20));
+    ASSERT_EQ(1, samples.at(0)->dist(samples.at(4), 20));
+    //Only uuid5's G at 0 is left
+    ASSERT_EQ(1, distance_lower_bound(samples.at(4), samples.at(1)->view()));
+    ASSERT_EQ(1, samples.at(4)->dist(samples.at(1), 20));
+    //Positions past the end of the profile are never masked
+    ASSERT_EQ(1, unmasked_count(vector<int>({5, 100})));
+    ASSERT_THROW(remask_saves(dir, {}, {1}), invalid_argument);
+
+    set_query_mask({});
+    ASSERT_EQ(1, samples.at(0)->dist(samples.at(2), 20));
+    for(Sample* s: samples){
+        delete s;
+    }
+    fs::remove_all(dir);
+}
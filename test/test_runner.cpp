@@ -2,6 +2,20 @@
 #include "test_argparse.cpp"
 #include "test_sample.cpp"
 #include "test_comparisons.cpp"
+#include "test_catalog.cpp"
+#include "test_output.cpp"
+#include "test_graph.cpp"
+#include "test_server.cpp"
+#include "test_watch.cpp"
+#include "test_shared.cpp"
+#include "test_tiles.cpp"
+#include "test_checkpoint.cpp"
+#include "test_duplicates.cpp"
+#include "test_knn.cpp"
+#include "test_aggregate.cpp"
+#include "test_clusters.cpp"
+#include "test_remask.cpp"
+#include "test_regions.cpp"
 
 int main(int argc, char** argv){
     testing::InitGoogleTest();
@@ -529,3 +529,24 @@ TEST(sample, save_load){
 }
 
 
+
+/**
+* @brief Test `intern_uuid` and `uuid_of`
+*/
+TEST(sample, intern_uuid){
+    uint32_t a = intern_uuid("intern_a");
+    uint32_t b = intern_uuid("intern_b");
+    ASSERT_NE(a, b);
+    ASSERT_EQ(a, intern_uuid("intern_a"));
+    ASSERT_EQ("intern_a", uuid_of(a));
+    ASSERT_EQ("intern_b", uuid_of(b));
+
+    //Samples are interned as they are created or loaded
+    string reference = load_reference("cases/dummy/reference.fasta");
+    unordered_set<int> mask = load_mask("cases/dummy/mask.txt");
+    Sample* s1 = new Sample("cases/dummy/1.fasta", reference, mask);
+    ASSERT_EQ(intern_uuid("uuid1"), s1->id);
+    Sample* s1_named = new Sample("cases/dummy/1.fasta", reference, mask, "renamed");
+    ASSERT_EQ(intern_uuid("renamed"), s1_named->id);
+    ASSERT_NE(s1->id, s1_named->id);
+}
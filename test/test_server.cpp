@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include "../src/include/server.hpp"
+#include <sys/socket.h>
+
+/**
+* @brief Test that frames survive a round trip, including empty and binary ones
+*/
+TEST(server, frames){
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    string binary("a\0b\nc", 5);
+    send_frame(fds[0], "add\t-1\t\n>sample\nACGT\n");
+    send_frame(fds[0], "");
+    send_frame(fds[0], binary);
+    close(fds[0]);
+
+    string payload;
+    ASSERT_TRUE(recv_frame(fds[1], payload));
+    ASSERT_EQ("add\t-1\t\n>sample\nACGT\n", payload);
+    ASSERT_TRUE(recv_frame(fds[1], payload));
+    ASSERT_EQ("", payload);
+    ASSERT_TRUE(recv_frame(fds[1], payload));
+    ASSERT_EQ(binary, payload);
+    //Closed cleanly between frames
+    ASSERT_FALSE(recv_frame(fds[1], payload));
+    close(fds[1]);
+
+    //Closed part way through a frame
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    uint32_t size = 10;
+    ASSERT_EQ(4, write(fds[0], &size, 4));
+    ASSERT_EQ(3, write(fds[0], "abc", 3));
+    close(fds[0]);
+    ASSERT_THROW(recv_frame(fds[1], payload), invalid_argument);
+    close(fds[1]);
+
+    ASSERT_THROW(client_request("does_not_exist.sock", "stats", -1), invalid_argument);
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include "../src/include/shared.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Test publishing, attaching to and replacing a shared collection
+*/
+TEST(shared, publish_and_attach){
+    string dir = "cases/dummy/shared_saves";
+    string old_shared_dir = shared_dir;
+    shared_dir = "cases/dummy/shm";
+    fs::remove_all(dir);
+    fs::remove_all(shared_dir);
+    fs::create_directories(dir);
+    fs::create_directories(shared_dir);
+
+    vector<Sample*> samples;
+    for(int i=0;i<3;i++){
+        Sample* s = new Sample({i, 10}, {20 + i}, {}, {}, {30, 31 + i});
+        s->uuid = "shared" + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        save(dir + "/", s);
+        samples.push_back(s);
+    }
+    string path = shared_collection_path(dir);
+
+    {
+        SharedCollection first(dir);
+        ASSERT_TRUE(first.published);
+        ASSERT_TRUE(fs::exists(path));
+        ASSERT_EQ(3, first.samples.size());
+        for(int i=0;i<3;i++){
+            const SampleView &view = first.samples.at(i);
+            ASSERT_EQ(samples.at(i)->id, view.id);
+            ASSERT_TRUE(equal(view.A.begin(), view.A.end(), samples.at(i)->A.begin(), samples.at(i)->A.end()));
+            ASSERT_TRUE(equal(view.N.begin(), view.N.end(), samples.at(i)->N.begin(), samples.at(i)->N.end()));
+            for(Sample* s: samples){
+                ASSERT_EQ(s->dist(samples.at(i), 10), s->dist(view, 10));
+            }
+        }
+
+        //Same generation, so attached rather than published again
+        SharedCollection second(dir);
+        ASSERT_FALSE(second.published);
+        ASSERT_EQ(3, second.samples.size());
+
+        //Saving makes it stale, so the next one publishes a new generation in its place
+        Sample* s = new Sample({5}, {}, {}, {}, {});
+        s->uuid = "shared3";
+        s->id = intern_uuid(s->uuid);
+        save(dir + "/", s);
+        SharedCollection third(dir);
+        ASSERT_TRUE(third.published);
+        ASSERT_EQ(4, third.samples.size());
+        ASSERT_EQ(s->id, third.samples.at(3).id);
+
+        //Older attachments are still readable
+        ASSERT_EQ(3, first.samples.size());
+        ASSERT_EQ(samples.at(2)->dist(samples.at(0), 10), samples.at(2)->dist(first.samples.at(0), 10));
+    }
+    //Removed once nothing is attached
+    ASSERT_FALSE(fs::exists(path));
+
+    shared_dir = old_shared_dir;
+    fs::remove_all(dir);
+    fs::remove_all("cases/dummy/shm");
+}
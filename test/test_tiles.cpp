@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include "../src/include/tiles.hpp"
+
+namespace fs = std::filesystem;
+
+/**
+* @brief Make a collection where sample i differs from the reference at i positions, so sample costs vary
+*/
+vector<Sample*> tile_samples(int count){
+    vector<Sample*> samples;
+    for(int i=0;i<count;i++){
+        vector<int> a;
+        for(int j=0;j<i;j++){
+            a.push_back(j);
+        }
+        Sample* s = new Sample(a, {}, {}, {}, {});
+        s->uuid = "tile" + to_string(i);
+        s->id = intern_uuid(s->uuid);
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+/**
+* @brief Test that tiles cover every pair once, and partitions cover every tile once
+*/
+TEST(tiles, make_and_partition){
+    int old_tile_size = tile_size;
+    tile_size = 3;
+    vector<Sample*> samples = tile_samples(10);
+
+    vector<Tile> tiles = make_tiles(samples, 1);
+    //4 blocks, less the last diagonal which only has 1 sample
+    ASSERT_EQ(9, tiles.size());
+    set<pair<uint32_t, uint32_t>> pairs;
+    for(const Tile &tile: tiles){
+        for(uint32_t i=tile.row_start;i<tile.row_end;i++){
+            for(uint32_t j=max(tile.col_start, i + 1);j<tile.col_end;j++){
+                ASSERT_TRUE(pairs.insert({i, j}).second);
+            }
+        }
+    }
+    ASSERT_EQ(45, pairs.size());
+
+    //Tiles shrink until there are enough
+    ASSERT_LE(40, make_tiles(samples, 40).size());
+
+    //Only pairs with a column from 7 on, so rows 0-6 against 7-9, then 7-9 against each other
+    vector<Tile> added = make_tiles(samples, 1, 7);
+    ASSERT_EQ(4, added.size());
+    uint64_t added_pairs = 0;
+    for(const Tile &tile: added){
+        ASSERT_LE(7, tile.col_start);
+        added_pairs += tile.pairs();
+    }
+    ASSERT_EQ(7 * 3 + 3, added_pairs);
+
+    vector<int> seen(tiles.size(), 0);
+    vector<uint64_t> loads;
+    uint64_t largest = 0;
+    for(const Tile &tile: tiles){
+        largest = max(largest, tile.cost);
+    }
+    for(int p=1;p<=3;p++){
+        uint64_t load = 0;
+        for(const Tile &tile: partition_tiles(tiles, 3, p)){
+            seen.at(tile.index)++;
+            load += tile.cost;
+        }
+        loads.push_back(load);
+    }
+    ASSERT_EQ(vector<int>(tiles.size(), 1), seen);
+    //Greedy balancing keeps partitions within a tile of each other
+    ASSERT_LE(*max_element(loads.begin(), loads.end()) - *min_element(loads.begin(), loads.end()), largest);
+    ASSERT_THROW(partition_tiles(tiles, 3, 4), invalid_argument);
+
+    tile_size = old_tile_size;
+}
+
+/**
+* @brief Test computing partitions separately then merging them gives the full matrix
+*/
+TEST(tiles, partition_and_merge){
+    string dir = "cases/dummy/partitions";
+    fs::remove_all(dir);
+    vector<Sample*> samples = tile_samples(12);
+
+    testing::internal::CaptureStdout();
+    compute_loaded(5, samples);
+    string expected = testing::internal::GetCapturedStdout();
+
+    compute_partition(5, samples, 1, 3, dir);
+    compute_partition(5, samples, 3, 3, dir);
+    //Not everything is there yet
+    ASSERT_THROW(merge_partitions(dir), invalid_argument);
+    compute_partition(5, samples, 2, 3, dir);
+
+    testing::internal::CaptureStdout();
+    uint64_t merged = merge_partitions(dir);
+    string actual = testing::internal::GetCapturedStdout();
+
+    auto lines = [](string text){
+        multiset<string> acc;
+        stringstream in(text);
+        string line;
+        while(getline(in, line)){
+            acc.insert(line);
+        }
+        return acc;
+    };
+    ASSERT_EQ(lines(expected), lines(actual));
+    ASSERT_EQ(lines(expected).size(), merged);
+
+    //Partitions of a different collection can't be mixed in
+    vector<Sample*> others = tile_samples(13);
+    compute_partition(5, others, 2, 3, dir + "/other");
+    fs::copy_file(dir + "/other/part-2-of-3.manifest", dir + "/part-2-of-3.manifest", fs::copy_options::overwrite_existing);
+    ASSERT_THROW(merge_partitions(dir), invalid_argument);
+
+    fs::remove_all(dir);
+}
@@ -0,0 +1,19 @@
+#include <gtest/gtest.h>
+#include "../src/include/watch.hpp"
+
+/**
+* @brief Test which files a spool dir watcher picks up
+*/
+TEST(watch, is_spool_file){
+    ASSERT_TRUE(is_spool_file("sample.fasta"));
+    ASSERT_TRUE(is_spool_file("sample.FASTA"));
+    ASSERT_TRUE(is_spool_file("sample.1.fa"));
+    ASSERT_TRUE(is_spool_file("sample.fas"));
+    ASSERT_TRUE(is_spool_file("sample.fna"));
+    ASSERT_TRUE(is_spool_file("uuid.fn5"));
+
+    ASSERT_FALSE(is_spool_file("metrics.tsv"));
+    ASSERT_FALSE(is_spool_file("sample.fasta.tmp"));
+    ASSERT_FALSE(is_spool_file(".fasta"));
+    ASSERT_FALSE(is_spool_file("fasta"));
+}